@@ -0,0 +1,223 @@
+/* acm_bench.c - search buffers for many patterns with util/acmatch.c
+ *
+ * Compiles random words into an automaton, checks the first matches in
+ * random text, half of it with a word planted, against a naive search,
+ * then prints the search throughput on 1 MB buffers: random text full
+ * of partial matches, and text with no byte that can start a pattern,
+ * with few distinct first bytes (the SSE2 prefilter where available) and
+ * with more (the scalar table).
+ *
+ * usage: acm_bench [patterns] [passes]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <ulogd/acmatch.h>
+
+#define BUF_LEN		(1 << 20)
+#define PATTERN_MAX	12
+#define NCHECK		64
+#define CHECK_LEN	1024
+
+struct pattern {
+	size_t len;
+	char data[PATTERN_MAX];
+};
+
+static struct pattern *patterns;
+static unsigned int num_patterns = 1000;
+static unsigned int passes = 20;
+static uint32_t seed = 0x2545f491;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void rnd_text(char *p, size_t len)
+{
+	while (len--)
+		*p++ = 'a' + rnd() % 26;
+}
+
+/* words of 5 to 12 letters, starting with one of `first' if given */
+static struct ulogd_acm *build(const char *first, int nocase)
+{
+	struct ulogd_acm *acm = ulogd_acm_alloc(nocase);
+	unsigned int i;
+
+	if (!acm)
+		return NULL;
+
+	for (i = 0; i < num_patterns; i++) {
+		struct pattern *p = &patterns[i];
+
+		p->len = 5 + rnd() % (PATTERN_MAX - 4);
+		rnd_text(p->data, p->len);
+		if (first)
+			p->data[0] = first[rnd() % strlen(first)];
+		if (ulogd_acm_add(acm, p->data, p->len, i) < 0) {
+			ulogd_acm_free(acm);
+			return NULL;
+		}
+	}
+	if (ulogd_acm_compile(acm) < 0) {
+		ulogd_acm_free(acm);
+		return NULL;
+	}
+	return acm;
+}
+
+/* the match ending first, the longest of those, the first added of
+ * duplicates */
+static int slow_search(const char *buf, size_t len, size_t *offset)
+{
+	size_t end;
+	unsigned int i;
+
+	for (end = 1; end <= len; end++) {
+		int best = -1;
+
+		for (i = 0; i < num_patterns; i++) {
+			const struct pattern *p = &patterns[i];
+
+			if (p->len > end ||
+			    strncasecmp(buf + end - p->len, p->data, p->len))
+				continue;
+			if (best < 0 || p->len > patterns[best].len)
+				best = i;
+		}
+		if (best >= 0) {
+			*offset = end - patterns[best].len;
+			return best;
+		}
+	}
+	return -1;
+}
+
+static int check(const struct ulogd_acm *acm, const char *buf)
+{
+	char p[CHECK_LEN];
+	unsigned int i;
+
+	for (i = 0; i < NCHECK; i++) {
+		size_t a_off = 0, b_off = 0;
+		int a, b;
+
+		memcpy(p, buf + rnd() % (BUF_LEN - CHECK_LEN), CHECK_LEN);
+		if (i % 2) {
+			const struct pattern *w = &patterns[rnd() %
+							    num_patterns];
+
+			memcpy(p + rnd() % (CHECK_LEN - w->len), w->data,
+			       w->len);
+		}
+
+		a = ulogd_acm_search(acm, p, CHECK_LEN, &a_off);
+		b = slow_search(p, CHECK_LEN, &b_off);
+		/* the same words may have been drawn twice */
+		if ((a < 0) != (b < 0) ||
+		    (a >= 0 && (a_off != b_off ||
+				patterns[a].len != patterns[b].len ||
+				strncasecmp(patterns[a].data, patterns[b].data,
+					    patterns[a].len)))) {
+			fprintf(stderr, "search %u: got %d at %zu, expected "
+				"%d at %zu\n", i, a, a_off, b, b_off);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* every match of the buffer, as PAYLOAD would see it in pieces */
+static void run(const char *name, const struct ulogd_acm *acm,
+		const char *buf)
+{
+	unsigned int i, found = 0;
+	uint64_t start, ns;
+
+	start = now_ns();
+	for (i = 0; i < passes; i++) {
+		size_t pos = 0, off;
+
+		while (pos < BUF_LEN &&
+		       ulogd_acm_search(acm, buf + pos, BUF_LEN - pos,
+					&off) >= 0) {
+			pos += off + 1;
+			found++;
+		}
+	}
+	ns = now_ns() - start;
+
+	printf("%-28s %6.2f GB/s, %u matches per MB\n", name,
+	       (double)BUF_LEN * passes / ns, found / passes);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ulogd_acm *acm;
+	char *text;
+	int ret = 0;
+
+	if (argc > 1)
+		num_patterns = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		passes = strtoul(argv[2], NULL, 10);
+	if (num_patterns == 0)
+		num_patterns = 1;
+	if (passes == 0)
+		passes = 1;
+
+	patterns = calloc(num_patterns, sizeof(*patterns));
+	text = malloc(BUF_LEN);
+	if (!patterns || !text)
+		return 1;
+	rnd_text(text, BUF_LEN);
+
+	printf("%u patterns of 5 to %u bytes, %u passes over 1 MB\n",
+	       num_patterns, PATTERN_MAX, passes);
+
+	acm = build(NULL, 1);
+	if (!acm)
+		return 1;
+	ret |= check(acm, text);
+	run("random text, nocase", acm, text);
+	ulogd_acm_free(acm);
+
+	/* no byte of the text starts a pattern */
+	acm = build("<{$%", 0);
+	if (!acm)
+		return 1;
+	run("no candidates, 4 first bytes", acm, text);
+	ulogd_acm_free(acm);
+
+	acm = build("<{$%&", 0);
+	if (!acm)
+		return 1;
+	run("no candidates, 5 first bytes", acm, text);
+	ulogd_acm_free(acm);
+
+	free(text);
+	free(patterns);
+	if (ret)
+		fprintf(stderr, "FAILED\n");
+	return ret;
+}
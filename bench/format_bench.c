@@ -0,0 +1,174 @@
+/* format_bench.c - compare util/format.c with sprintf() and inet_ntop()
+ *
+ * Formats the same pseudo random addresses with the previous code of
+ * IP2STR, IP2BIN, HWHDR and printpkt and with the ulogd_format_*()
+ * functions, checks that both give the same text and prints the time
+ * per call.
+ *
+ * usage: format_bench [iterations]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <ulogd/format.h>
+
+#define NADDR	1024
+
+static uint8_t addrs[NADDR][16];
+static char out[NADDR][64];
+static unsigned int iterations = 1000000;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* a mix of global, IPv4 mapped and mostly zero addresses */
+static void fill_addrs(void)
+{
+	uint32_t seed = 0x2545f491;
+	int i, j;
+
+	for (i = 0; i < NADDR; i++) {
+		for (j = 0; j < 16; j++) {
+			seed = seed * 1103515245 + 12345;
+			addrs[i][j] = seed >> 16;
+		}
+		switch (i % 4) {
+		case 1:
+			memset(addrs[i], 0, 10);
+			addrs[i][10] = addrs[i][11] = 0xff;
+			break;
+		case 2:
+			memset(addrs[i] + 4, 0, 8);
+			break;
+		}
+	}
+}
+
+static void old_ipv4(char *dst, const uint8_t *a)
+{
+	uint32_t ip;
+
+	memcpy(&ip, a + 12, sizeof(ip));
+	inet_ntop(AF_INET, &ip, dst, INET_ADDRSTRLEN);
+}
+
+static void new_ipv4(char *dst, const uint8_t *a)
+{
+	uint32_t ip;
+
+	memcpy(&ip, a + 12, sizeof(ip));
+	ulogd_format_ipv4(dst, ip);
+}
+
+static void old_ipv6(char *dst, const uint8_t *a)
+{
+	inet_ntop(AF_INET6, a, dst, INET6_ADDRSTRLEN);
+}
+
+static void new_ipv6(char *dst, const uint8_t *a)
+{
+	ulogd_format_ipv6(dst, a);
+}
+
+static void old_bin(char *dst, const uint8_t *a)
+{
+	int i;
+
+	*dst++ = '0';
+	*dst++ = 'x';
+	for (i = 0; i < 16; i += 4)
+		dst += sprintf(dst, "%02x%02x%02x%02x",
+			       a[i], a[i + 1], a[i + 2], a[i + 3]);
+}
+
+static void new_bin(char *dst, const uint8_t *a)
+{
+	*dst++ = '0';
+	*dst++ = 'x';
+	ulogd_format_hex(dst, a, 16);
+}
+
+static void old_mac(char *dst, const uint8_t *a)
+{
+	int i;
+
+	for (i = 0; i < 6; i++)
+		dst += sprintf(dst, "%02x%c", a[i], i == 5 ? 0 : ':');
+}
+
+static void new_mac(char *dst, const uint8_t *a)
+{
+	ulogd_format_mac(dst, a, 6, ':');
+}
+
+static double run(void (*fn)(char *, const uint8_t *))
+{
+	uint64_t start;
+	unsigned int i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		fn(out[i % NADDR], addrs[i % NADDR]);
+
+	return (double)(now_ns() - start) / iterations;
+}
+
+static int bench(const char *name, void (*old)(char *, const uint8_t *),
+		 void (*new)(char *, const uint8_t *))
+{
+	char ref[64];
+	double old_ns, new_ns;
+	int i;
+
+	for (i = 0; i < NADDR; i++) {
+		old(ref, addrs[i]);
+		new(out[i], addrs[i]);
+		if (strcmp(ref, out[i]) != 0) {
+			fprintf(stderr, "%s: got \"%s\", expected \"%s\"\n",
+				name, out[i], ref);
+			return 1;
+		}
+	}
+
+	old_ns = run(old);
+	new_ns = run(new);
+	printf("%-6s %10.1f %10.1f %8.1fx\n", name, old_ns, new_ns,
+	       old_ns / new_ns);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+	if (iterations == 0)
+		iterations = 1;
+
+	fill_addrs();
+
+	printf("%-6s %10s %10s %9s\n", "format", "old ns", "new ns",
+	       "speedup");
+	ret |= bench("ipv4", old_ipv4, new_ipv4);
+	ret |= bench("ipv6", old_ipv6, new_ipv6);
+	ret |= bench("bin", old_bin, new_bin);
+	ret |= bench("mac", old_mac, new_mac);
+
+	return ret;
+}
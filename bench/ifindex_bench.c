@@ -0,0 +1,346 @@
+/* ifindex_bench.c - rename interfaces under the lookups of IFINDEX
+ *
+ * Builds the IFINDEX plugin in, feeds its netlink parser with mock
+ * RTM_NEWLINK and RTM_DELLINK messages renaming and removing interfaces
+ * while the number of interfaces grows, and runs the timer freeing the
+ * replaced entries, all from the main thread as the ulogd loop would.
+ * Meanwhile other threads look names up. Freed memory is overwritten, so
+ * a reader that gets a name of another interface or garbage means an
+ * entry or the array was freed or changed under it. At the end, every
+ * name must be the last one given. Then a resync dump that leaves half
+ * of the interfaces out, as if they were removed while notifications
+ * were lost, must remove them.
+ *
+ * The clock seen by the plugin ticks every 100 ms, so that the grace
+ * period before freeing is 200 ms instead of 2 s and memory stays low.
+ * That is still many scheduler time slices for a preempted reader.
+ *
+ * usage: ifindex_bench [seconds] [readers] [interfaces]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/timer.h>
+#include <ulogd/clock.h>
+
+void bench_free(void *ptr)
+{
+	if (ptr)
+		memset(ptr, 'X', malloc_usable_size(ptr));
+	free(ptr);
+}
+
+#define free bench_free
+#include "../filter/ulogd_filter_IFINDEX.c"
+#undef free
+
+#define MAX_READERS	64
+#define BATCH		8	/* messages per read from the socket */
+
+static unsigned int duration = 2;
+static unsigned int num_readers = 4;
+static unsigned int num_ifaces = 4096;
+
+static unsigned int *generation;	/* 0 if removed */
+static unsigned int visible;		/* interfaces created so far */
+static int done;
+
+/* what the plugin needs from the core */
+
+static time_t due;
+
+void __ulogd_log(int level, char *file, int line, const char *message, ...)
+{
+	va_list ap;
+
+	if (level < ULOGD_ERROR)
+		return;
+	va_start(ap, message);
+	vfprintf(stderr, message, ap);
+	va_end(ap);
+}
+
+void ulogd_register_plugin(struct ulogd_plugin *me)
+{
+}
+
+int ulogd_register_fd(struct ulogd_fd *ufd)
+{
+	return 0;
+}
+
+void ulogd_unregister_fd(struct ulogd_fd *ufd)
+{
+}
+
+void ulogd_init_timer(struct ulogd_timer *t, void *data,
+		      void (*cb)(struct ulogd_timer *a, void *data))
+{
+	t->data = data;
+	t->cb = cb;
+}
+
+void ulogd_add_timer(struct ulogd_timer *alarm, unsigned long sc)
+{
+	due = ulogd_clock_sec() + sc;
+}
+
+void ulogd_del_timer(struct ulogd_timer *alarm)
+{
+	due = 0;
+}
+
+int ulogd_timer_pending(struct ulogd_timer *alarm)
+{
+	return due != 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+time_t ulogd_clock_sec(void)
+{
+	return now_ns() / 100000000;
+}
+
+static uint32_t rnd(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+/* the feeder side */
+
+static int mock_link(char *buf, int type, uint32_t ifindex,
+		     const char *name)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+
+	memset(nlh, 0, NLMSG_LENGTH(sizeof(*ifi)));
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = ifindex;
+
+	if (name) {
+		struct rtattr *rta;
+
+		rta = (struct rtattr *)(buf + NLMSG_ALIGN(nlh->nlmsg_len));
+		rta->rta_type = IFLA_IFNAME;
+		rta->rta_len = RTA_LENGTH(strlen(name) + 1);
+		strcpy(RTA_DATA(rta), name);
+		nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) +
+				 RTA_ALIGN(rta->rta_len);
+	}
+
+	return NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static unsigned int feed(uint32_t *seed)
+{
+	char buf[BATCH * 64] __attribute__((aligned(NLMSG_ALIGNTO)));
+	unsigned int i, len = 0;
+
+	/* the interfaces appear over time, growing the array */
+	if (visible < num_ifaces && rnd(seed) % 256 == 0)
+		visible++;
+
+	for (i = 0; i < BATCH; i++) {
+		uint32_t ifindex = 1 + rnd(seed) % visible;
+		char name[IFNAMSIZ];
+
+		if (rnd(seed) % 8 == 0) {
+			generation[ifindex] = 0;
+			len += mock_link(buf + len, RTM_DELLINK, ifindex, NULL);
+			continue;
+		}
+		generation[ifindex] = generation[ifindex] % 99999 + 1;
+		snprintf(name, sizeof(name), "e%u.%u", ifindex,
+			 generation[ifindex]);
+		len += mock_link(buf + len, RTM_NEWLINK, ifindex, name);
+	}
+	nl_parse(buf, len);
+
+	if (due && ulogd_clock_sec() >= due) {
+		due = 0;
+		ifindex_gc(&ifindex_gc_timer, NULL);
+	}
+
+	return BATCH;
+}
+
+/* the reader side */
+
+struct reader {
+	pthread_t thread;
+	uint32_t seed;
+	uint64_t lookups;
+	unsigned int errors;
+};
+
+static void *reader_main(void *data)
+{
+	struct reader *r = data;
+
+	while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+		uint32_t ifindex = rnd(&r->seed) % (2 * num_ifaces);
+		char name[IFNAMSIZ];
+		unsigned int idx, gen;
+
+		/* as long as an event would keep it */
+		strncpy(name, ifindex_lookup(ifindex), sizeof(name));
+		r->lookups++;
+		if (name[0] == '\0')
+			continue;
+		if (sscanf(name, "e%u.%u", &idx, &gen) != 2 ||
+		    idx != ifindex || gen == 0) {
+			if (r->errors++ < 10)
+				fprintf(stderr, "ifindex %u: bad name `%.16s'\n",
+					ifindex, name);
+		}
+	}
+
+	return NULL;
+}
+
+static unsigned int check_final(void)
+{
+	unsigned int i, errors = 0;
+
+	for (i = 0; i < 2 * num_ifaces; i++) {
+		const char *name = ifindex_lookup(i);
+		char expected[32] = "";
+
+		if (i <= num_ifaces && generation[i])
+			snprintf(expected, sizeof(expected), "e%u.%u", i,
+				 generation[i]);
+		if (strcmp(name, expected)) {
+			if (errors++ < 10)
+				fprintf(stderr, "ifindex %u: `%s' instead of "
+					"`%s'\n", i, name, expected);
+		}
+	}
+
+	return errors;
+}
+
+/* a dump after an overrun, with the even interfaces gone meanwhile */
+static void resync(void)
+{
+	char buf[BATCH * 64] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	unsigned int i, len = 0;
+
+	nl_dumping = 1;
+	nl_seq++;
+	nl_stale_mark();
+
+	for (i = 1; i <= visible; i++) {
+		char name[32];
+
+		if (i % 2 == 0)
+			generation[i] = 0;
+		if (generation[i] == 0)
+			continue;
+		snprintf(name, sizeof(name), "e%u.%u", i, generation[i]);
+		nlh = (struct nlmsghdr *)(buf + len);
+		len += mock_link(buf + len, RTM_NEWLINK, i, name);
+		nlh->nlmsg_seq = nl_seq;
+		if (len + 64 > sizeof(buf)) {
+			nl_parse(buf, len);
+			len = 0;
+		}
+	}
+
+	nlh = (struct nlmsghdr *)(buf + len);
+	memset(nlh, 0, NLMSG_LENGTH(sizeof(int)));
+	nlh->nlmsg_type = NLMSG_DONE;
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(int));
+	nlh->nlmsg_seq = nl_seq;
+	len += NLMSG_ALIGN(nlh->nlmsg_len);
+	nl_parse(buf, len);
+}
+
+int main(int argc, char *argv[])
+{
+	struct reader readers[MAX_READERS];
+	uint64_t start, end, updates = 0, lookups = 0;
+	unsigned int i, errors = 0, final, stale;
+	uint32_t seed = 0x2545f491;
+
+	if (argc > 1)
+		duration = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		num_readers = strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		num_ifaces = strtoul(argv[3], NULL, 10);
+	if (num_readers > MAX_READERS)
+		num_readers = MAX_READERS;
+	if (num_ifaces == 0 || num_ifaces >= IFINDEX_MAX)
+		num_ifaces = 4096;
+
+	generation = calloc(num_ifaces + 1, sizeof(*generation));
+	if (!generation) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	ulogd_init_timer(&ifindex_gc_timer, NULL, ifindex_gc);
+	visible = 1;
+
+	for (i = 0; i < num_readers; i++) {
+		memset(&readers[i], 0, sizeof(readers[i]));
+		readers[i].seed = seed + i + 1;
+		pthread_create(&readers[i].thread, NULL, reader_main,
+			       &readers[i]);
+	}
+
+	start = now_ns();
+	end = start + duration * 1000000000ULL;
+	while (now_ns() < end)
+		updates += feed(&seed);
+	end = now_ns();
+
+	__atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < num_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+		lookups += readers[i].lookups;
+		errors += readers[i].errors;
+	}
+	final = check_final();
+	resync();
+	stale = check_final();
+
+	printf("%u interfaces, table of %u, %u readers\n", visible,
+	       ifindex_table ? ifindex_table->size : 0, num_readers);
+	printf("updates  %10.0f/s\n", updates * 1e9 / (end - start));
+	printf("lookups  %10.0f/s, %u bad names, %u wrong at the end\n",
+	       lookups * 1e9 / (end - start), errors, final);
+	printf("resync   %u wrong\n", stale);
+
+	ifindex_clear();
+	free(generation);
+
+	if (errors || final || stale) {
+		fprintf(stderr, "FAILED\n");
+		return 1;
+	}
+	return 0;
+}
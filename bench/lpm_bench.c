@@ -0,0 +1,232 @@
+/* lpm_bench.c - build and query a large table with util/lpm.c
+ *
+ * Adds pseudo random IPv4 and IPv6 prefixes with a few thousand tags,
+ * checks lookups of random addresses against a linear search over the
+ * prefixes, then prints the time to compile, save and map the table
+ * and the time per lookup.
+ *
+ * usage: lpm_bench [prefixes] [lookups]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <ulogd/lpm.h>
+
+#define NADDR	4096
+#define NCHECK	256
+
+struct prefix {
+	int family;
+	uint8_t addr[16];
+	unsigned int bits;
+	char tag[16];
+};
+
+static struct prefix *prefixes;
+static unsigned int num_prefixes = 500000;
+static unsigned int iterations = 10000000;
+static uint8_t addrs[NADDR][16];
+static uint32_t seed = 0x2545f491;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void rnd_bytes(uint8_t *p, size_t len)
+{
+	while (len--)
+		*p++ = rnd();
+}
+
+/* mostly /16 to /24 as in a routing table, some shorter and longer;
+ * addresses come from a few /8 so that prefixes overlap */
+static void fill_prefixes(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_prefixes; i++) {
+		struct prefix *p = &prefixes[i];
+		uint32_t r = rnd();
+
+		rnd_bytes(p->addr, 16);
+		if (i % 8 == 7) {
+			p->family = AF_INET6;
+			p->addr[0] = 0x20;
+			p->addr[1] = 0x01 + (r & 3);
+			p->bits = 19 + r % 30;
+			if (r % 16 == 0)
+				p->bits = 64 + r % 65;
+		} else {
+			p->family = AF_INET;
+			p->addr[0] = 1 + (r & 15);
+			p->bits = 16 + r % 9;
+			if (r % 16 == 0)
+				p->bits = 8 + r % 25;
+		}
+		snprintf(p->tag, sizeof(p->tag), "AS%u", rnd() % 5000);
+	}
+
+	for (i = 0; i < NADDR; i++) {
+		const struct prefix *p = &prefixes[rnd() % num_prefixes];
+
+		/* half in a prefix, the others anywhere near */
+		rnd_bytes(addrs[i], 16);
+		memcpy(addrs[i], p->addr, i % 2 ? 2 : p->bits / 8);
+	}
+}
+
+static int match(const struct prefix *p, const uint8_t *addr)
+{
+	unsigned int n = p->bits / 8, r = p->bits % 8;
+
+	if (memcmp(p->addr, addr, n) != 0)
+		return 0;
+	return r == 0 || ((p->addr[n] ^ addr[n]) & (0xff00 >> r) & 0xff) == 0;
+}
+
+/* longest prefix, the last one added for duplicates */
+static const char *slow_lookup(int family, const uint8_t *addr)
+{
+	const struct prefix *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < num_prefixes; i++) {
+		const struct prefix *p = &prefixes[i];
+
+		if (p->family != family || !match(p, addr))
+			continue;
+		if (!best || p->bits >= best->bits)
+			best = p;
+	}
+	return best ? best->tag : NULL;
+}
+
+static int check(const struct ulogd_lpm *lpm)
+{
+	unsigned int i;
+
+	for (i = 0; i < NCHECK; i++) {
+		int family = i % 2 ? AF_INET6 : AF_INET;
+		const char *a = ulogd_lpm_lookup(lpm, family, addrs[i]);
+		const char *b = slow_lookup(family, addrs[i]);
+
+		if (a != b && (!a || !b || strcmp(a, b) != 0)) {
+			fprintf(stderr, "lookup %u: got %s, expected %s\n",
+				i, a ? a : "none", b ? b : "none");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static double run(const struct ulogd_lpm *lpm, int family)
+{
+	unsigned int i, found = 0;
+	uint64_t start;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		found += ulogd_lpm_lookup(lpm, family, addrs[i % NADDR]) != NULL;
+	if (found > iterations)
+		abort();
+
+	return (double)(now_ns() - start) / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint64_t source[2] = { 1, 2 };
+	char path[] = "/tmp/lpm_bench.XXXXXX";
+	struct ulogd_lpm_builder *b;
+	struct ulogd_lpm *lpm, *mapped;
+	uint64_t t0, t1, t2, t3;
+	unsigned int i;
+	size_t size;
+	void *image;
+	int fd, ret;
+
+	if (argc > 1)
+		num_prefixes = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		iterations = strtoul(argv[2], NULL, 10);
+	if (num_prefixes == 0)
+		num_prefixes = 1;
+	if (iterations == 0)
+		iterations = 1;
+
+	prefixes = calloc(num_prefixes, sizeof(*prefixes));
+	b = ulogd_lpm_builder_alloc();
+	if (!prefixes || !b)
+		return 1;
+	fill_prefixes();
+
+	t0 = now_ns();
+	for (i = 0; i < num_prefixes; i++) {
+		const struct prefix *p = &prefixes[i];
+
+		if (ulogd_lpm_add(b, p->family, p->addr, p->bits, p->tag) < 0)
+			return 1;
+	}
+	image = ulogd_lpm_compile(b, source, &size);
+	ulogd_lpm_builder_free(b);
+	if (!image)
+		return 1;
+	lpm = ulogd_lpm_load(image, size);
+	if (!lpm)
+		return 1;
+
+	t1 = now_ns();
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	close(fd);
+	if (ulogd_lpm_save(lpm, path) < 0) {
+		perror(path);
+		return 1;
+	}
+	t2 = now_ns();
+	mapped = ulogd_lpm_open(path, source);
+	t3 = now_ns();
+	unlink(path);
+	if (!mapped) {
+		perror(path);
+		return 1;
+	}
+
+	printf("%u prefixes, %zu bytes\n", num_prefixes, size);
+	printf("compile %8.1f ms\n", (t1 - t0) / 1e6);
+	printf("save    %8.1f ms\n", (t2 - t1) / 1e6);
+	printf("open    %8.1f ms\n", (t3 - t2) / 1e6);
+
+	ret = check(lpm) | check(mapped);
+	if (ret == 0) {
+		printf("ipv4    %8.1f ns\n", run(mapped, AF_INET));
+		printf("ipv6    %8.1f ns\n", run(mapped, AF_INET6));
+	}
+
+	ulogd_lpm_close(mapped);
+	ulogd_lpm_close(lpm);
+	free(prefixes);
+	return ret;
+}
@@ -0,0 +1,180 @@
+/* sketch_bench.c - feed a skewed stream to the sketches of util/sketch.c
+ *
+ * Draws keys from a zipf distribution, counts them exactly and with
+ * Space-Saving, Count-Min and HyperLogLog, then prints how the top keys
+ * and the number of distinct keys compare, and the time per update.
+ *
+ * usage: sketch_bench [events] [keys]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <ulogd/sketch.h>
+
+#define COUNTERS	1024
+#define WIDTH		8192
+#define BITS		12
+#define TOP		20
+
+static unsigned int num_events = 10000000;
+static unsigned int num_keys = 1000000;
+static uint32_t seed = 0x2545f491;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static uint64_t mix(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* key indexes with P(k) proportional to 1 / (k + 1) */
+static uint32_t *zipf_stream(void)
+{
+	uint32_t *stream = malloc(num_events * sizeof(uint32_t));
+	double *cdf = malloc(num_keys * sizeof(double));
+	double sum = 0;
+	unsigned int i;
+
+	if (!stream || !cdf)
+		exit(1);
+	for (i = 0; i < num_keys; i++)
+		cdf[i] = sum += 1.0 / (i + 1);
+	for (i = 0; i < num_events; i++) {
+		double r = (double)rnd() / (1 << 24) * sum;
+		unsigned int lo = 0, hi = num_keys - 1;
+
+		while (lo < hi) {
+			unsigned int mid = (lo + hi) / 2;
+
+			if (cdf[mid] < r)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		/* so that the most frequent keys aren't the lowest */
+		stream[i] = lo * 2654435761U;
+	}
+	free(cdf);
+
+	return stream;
+}
+
+static int cmp_desc(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ulogd_topk *tk;
+	struct ulogd_cms cms;
+	uint32_t *stream, *exact, *sorted, i;
+	uint8_t *hll;
+	uint64_t t0, t1, t2, t3, cms_err = 0;
+	unsigned int distinct = 0, rank, found = 0, ret = 0;
+	int fresh;
+
+	if (argc > 1)
+		num_events = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		num_keys = strtoul(argv[2], NULL, 10);
+	if (num_events == 0)
+		num_events = 1;
+	if (num_keys < TOP)
+		num_keys = TOP;
+
+	stream = zipf_stream();
+	exact = calloc(num_keys, sizeof(uint32_t));
+	sorted = malloc(num_keys * sizeof(uint32_t));
+	hll = calloc(1, 1U << BITS);
+	tk = ulogd_topk_alloc(COUNTERS, sizeof(uint32_t));
+	if (!exact || !sorted || !hll || !tk ||
+	    ulogd_cms_init(&cms, WIDTH) < 0)
+		return 1;
+
+	for (i = 0; i < num_events; i++) {
+		uint32_t k = stream[i] * 244002641U;	/* back to 0..n-1 */
+
+		if (exact[k]++ == 0)
+			distinct++;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < num_events; i++)
+		ulogd_topk_add(tk, &stream[i], mix(stream[i]), &fresh);
+	t1 = now_ns();
+	for (i = 0; i < num_events; i++)
+		ulogd_cms_add(&cms, mix(stream[i]));
+	t2 = now_ns();
+	for (i = 0; i < num_events; i++)
+		ulogd_hll_add(hll, BITS, mix(stream[i]));
+	t3 = now_ns();
+
+	memcpy(sorted, exact, num_keys * sizeof(uint32_t));
+	qsort(sorted, num_keys, sizeof(uint32_t), cmp_desc);
+
+	/* the counts are upper bounds, by at most their error */
+	for (i = ulogd_topk_first(tk), rank = 0; i != ULOGD_TOPK_NONE &&
+	     rank < TOP; i = ulogd_topk_next(tk, i), rank++) {
+		uint32_t key, k, est;
+		uint64_t count = ulogd_topk_count(tk, i);
+
+		memcpy(&key, ulogd_topk_key(tk, i), sizeof(key));
+		k = key * 244002641U;
+		est = ulogd_cms_estimate(&cms, mix(key));
+		if (count < exact[k] ||
+		    count - ulogd_topk_error(tk, i) > exact[k] ||
+		    est < exact[k]) {
+			fprintf(stderr, "key %u: count %" PRIu64 " error %"
+				PRIu64 " cms %u, exact %u\n", k, count,
+				ulogd_topk_error(tk, i), est, exact[k]);
+			ret = 1;
+		}
+		found += exact[k] >= sorted[TOP - 1];
+		cms_err += est - exact[k];
+	}
+
+	printf("%u events, %u distinct keys\n", num_events, distinct);
+	printf("top %u found  %u\n", TOP, found);
+	printf("cms error    %8.1f avg\n", (double)cms_err / TOP);
+	printf("hll          %u (%+.1f%%)\n",
+	       (unsigned int)ulogd_hll_count(hll, BITS),
+	       100.0 * ((double)ulogd_hll_count(hll, BITS) - distinct) /
+	       distinct);
+	printf("space-saving %8.1f ns\n", (double)(t1 - t0) / num_events);
+	printf("count-min    %8.1f ns\n", (double)(t2 - t1) / num_events);
+	printf("hyperloglog  %8.1f ns\n", (double)(t3 - t2) / num_events);
+
+	ulogd_topk_free(tk);
+	ulogd_cms_free(&cms);
+	free(hll);
+	free(sorted);
+	free(exact);
+	free(stream);
+	return ret;
+}
@@ -0,0 +1,342 @@
+/* transport_test.c - send records with util/transport.c to local listeners
+ *
+ * For each mode, listens on a local socket, queues numbered records of
+ * various sizes, runs a minimal event loop in place of the ulogd one
+ * until the queue is flushed, and checks that the records arrived whole
+ * and in order. The unixgram peer is also given a send buffer smaller
+ * than some records: those are dropped and counted, the others still go
+ * through on the same connection.
+ *
+ * usage: transport_test [records]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/timer.h>
+#include <ulogd/transport.h>
+
+#define RECORD_MAX	32768
+
+static unsigned int num_records = 100000;
+
+/* what the transport needs from the core */
+
+static struct ulogd_fd *registered;
+static struct ulogd_timer *timer;
+static unsigned int connections;
+
+void __ulogd_log(int level, char *file, int line, const char *message, ...)
+{
+	va_list ap;
+
+	if (level < ULOGD_ERROR)
+		return;
+	va_start(ap, message);
+	vfprintf(stderr, message, ap);
+	va_end(ap);
+}
+
+int ulogd_register_fd(struct ulogd_fd *ufd)
+{
+	registered = ufd;
+	connections++;
+	return 0;
+}
+
+void ulogd_unregister_fd(struct ulogd_fd *ufd)
+{
+	registered = NULL;
+}
+
+void ulogd_update_fd(struct ulogd_fd *ufd, unsigned int when)
+{
+	ufd->when = when;
+}
+
+void ulogd_init_timer(struct ulogd_timer *t, void *data,
+		      void (*cb)(struct ulogd_timer *a, void *data))
+{
+	t->data = data;
+	t->cb = cb;
+}
+
+void ulogd_add_timer(struct ulogd_timer *alarm, unsigned long sc)
+{
+	timer = alarm;
+}
+
+void ulogd_del_timer(struct ulogd_timer *alarm)
+{
+	timer = NULL;
+}
+
+int ulogd_timer_pending(struct ulogd_timer *alarm)
+{
+	return timer == alarm;
+}
+
+/* the listener side */
+
+struct peer {
+	int type;
+	int lfd;		/* listening stream socket */
+	int fd;
+	char buf[2 * RECORD_MAX];
+	unsigned int len;
+	unsigned int received;
+	int next;		/* lowest sequence number expected */
+	int errors;
+};
+
+static void check_record(struct peer *p, const char *rec, unsigned int len)
+{
+	unsigned int seq, size;
+
+	if (sscanf(rec, "%u %u ", &seq, &size) != 2 || size != len ||
+	    (int)seq < p->next) {
+		fprintf(stderr, "bad record `%.40s' of %u bytes\n", rec, len);
+		p->errors++;
+		return;
+	}
+	p->next = seq + 1;
+	p->received++;
+}
+
+static void peer_read(struct peer *p)
+{
+	char *nl, *rec;
+	ssize_t ret;
+
+	if (p->fd < 0) {
+		p->fd = accept(p->lfd, NULL, NULL);
+		return;
+	}
+
+	while ((ret = recv(p->fd, p->buf + p->len, sizeof(p->buf) - p->len,
+			   MSG_DONTWAIT)) > 0) {
+		p->len += ret;
+
+		/* a datagram only holds whole records */
+		if (p->type == SOCK_DGRAM && p->buf[p->len - 1] != '\n') {
+			fprintf(stderr, "datagram with a partial record\n");
+			p->errors++;
+		}
+		for (rec = p->buf;
+		     (nl = memchr(rec, '\n', p->buf + p->len - rec));
+		     rec = nl + 1)
+			check_record(p, rec, nl - rec + 1);
+		p->len = p->buf + p->len - rec;
+		memmove(p->buf, rec, p->len);
+		if (p->type == SOCK_DGRAM)
+			p->len = 0;
+	}
+}
+
+static int peer_listen(struct peer *p, const char *mode, char *port,
+		       const char *path)
+{
+	struct sockaddr_storage ss;
+	socklen_t sslen;
+	int inet = !strcmp(mode, "tcp") || !strcmp(mode, "udp");
+
+	memset(p, 0, sizeof(*p));
+	memset(&ss, 0, sizeof(ss));
+	p->type = !strcmp(mode, "tcp") || !strcmp(mode, "unix") ?
+		  SOCK_STREAM : SOCK_DGRAM;
+	p->fd = p->lfd = -1;
+
+	if (inet) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sslen = sizeof(*sin);
+	} else {
+		struct sockaddr_un *sun = (struct sockaddr_un *)&ss;
+
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, path);
+		unlink(path);
+		sslen = sizeof(*sun);
+	}
+
+	p->lfd = socket(ss.ss_family, p->type, 0);
+	if (p->lfd < 0 || bind(p->lfd, (struct sockaddr *)&ss, sslen) < 0 ||
+	    getsockname(p->lfd, (struct sockaddr *)&ss, &sslen) < 0)
+		return -1;
+	if (inet)
+		sprintf(port, "%u",
+			ntohs(((struct sockaddr_in *)&ss)->sin_port));
+
+	if (p->type == SOCK_DGRAM) {
+		int size = 4 * 1024 * 1024;
+
+		setsockopt(p->lfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		p->fd = p->lfd;
+		p->lfd = -1;
+	} else if (listen(p->lfd, 1) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void peer_close(struct peer *p)
+{
+	if (p->fd >= 0)
+		close(p->fd);
+	if (p->lfd >= 0)
+		close(p->lfd);
+}
+
+/* one iteration of the loop, as the ulogd select loop would do it */
+static void run_loop(struct ulogd_transport *t, struct peer *p)
+{
+	struct pollfd pfd[2];
+	unsigned int n = 0, what = 0;
+
+	if (timer && !registered) {
+		struct ulogd_timer *a = timer;
+
+		timer = NULL;
+		a->cb(a, a->data);
+	}
+
+	pfd[n].fd = p->fd >= 0 ? p->fd : p->lfd;
+	pfd[n++].events = POLLIN;
+	if (registered) {
+		pfd[n].fd = registered->fd;
+		pfd[n].events = (registered->when & ULOGD_FD_READ ? POLLIN : 0) |
+				(registered->when & ULOGD_FD_WRITE ? POLLOUT : 0);
+		n++;
+	}
+	if (poll(pfd, n, 10) <= 0)
+		return;
+
+	if (pfd[0].revents)
+		peer_read(p);
+	if (n > 1 && registered) {
+		if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))
+			what |= ULOGD_FD_READ;
+		if (pfd[1].revents & POLLOUT)
+			what |= ULOGD_FD_WRITE;
+		if (what)
+			registered->cb(registered->fd, what, registered->data);
+	}
+}
+
+static unsigned int record_size(unsigned int i, int oversize)
+{
+	if (oversize && i % 1000 == 999)
+		return RECORD_MAX;
+	/* mostly small, sometimes a few kilobytes */
+	return i % 97 == 0 ? 7000 + i % 1000 : 40 + i % 200;
+}
+
+static int run_mode(const char *mode, int oversize)
+{
+	char path[64], port[8] = "", *rec;
+	struct ulogd_transport t;
+	struct peer p;
+	unsigned int i, expected = 0, idle = 0;
+	int ret = 0;
+
+	connections = 0;
+	snprintf(path, sizeof(path), "/tmp/transport_test.%u", getpid());
+	if (peer_listen(&p, mode, port, path) < 0) {
+		perror(mode);
+		return 1;
+	}
+	if (ulogd_transport_start(&t, mode, mode, "127.0.0.1", port, path,
+				  0) < 0)
+		return 1;
+
+	/* records larger than the socket buffer can't be sent at all */
+	if (oversize && registered) {
+		int size = 4096;	/* doubled by the kernel */
+
+		setsockopt(registered->fd, SOL_SOCKET, SO_SNDBUF, &size,
+			   sizeof(size));
+	}
+
+	rec = malloc(RECORD_MAX);
+	for (i = 0; i < num_records; i++) {
+		unsigned int len = record_size(i, oversize);
+		int hdr = sprintf(rec, "%u %u ", i, len);
+
+		memset(rec + hdr, 'x', len - hdr - 1);
+		rec[len - 1] = '\n';
+		while (t.tail - t.head + len > t.size)
+			run_loop(&t, &p);
+		ulogd_transport_write(&t, rec, len);
+		if (len < RECORD_MAX)
+			expected++;
+		if (i % 64 == 0)
+			run_loop(&t, &p);
+	}
+	free(rec);
+
+	/* until everything is sent and nothing comes for a while */
+	while (idle < 20) {
+		unsigned int before = p.received;
+
+		run_loop(&t, &p);
+		if (t.head == t.tail && p.received == before)
+			idle++;
+		else
+			idle = 0;
+	}
+
+	printf("%-9s %u records, %u received, %" PRIu64 " dropped, "
+	       "datagrams up to %u bytes\n", mode, num_records, p.received,
+	       t.dropped + t.dropped_total, t.dgram_max);
+
+	/* no record may cost the connection */
+	if (p.errors || t.state != TRANSPORT_CONNECTED || connections != 1)
+		ret = 1;
+	/* udp may lose datagrams when our receive buffer is full */
+	if (!strcmp(mode, "udp") ? p.received == 0 || p.received > expected :
+	    p.received != expected ||
+	    t.dropped + t.dropped_total != num_records - expected)
+		ret = 1;
+
+	ulogd_transport_stop(&t);
+	peer_close(&p);
+	if (strcmp(mode, "tcp") && strcmp(mode, "udp"))
+		unlink(path);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+
+	if (argc > 1)
+		num_records = strtoul(argv[1], NULL, 10);
+
+	ret |= run_mode("tcp", 0);
+	ret |= run_mode("udp", 0);
+	ret |= run_mode("unix", 0);
+	ret |= run_mode("unixgram", 0);
+	ret |= run_mode("unixgram", 1);
+
+	if (ret)
+		fprintf(stderr, "FAILED\n");
+	return ret;
+}
@@ -0,0 +1,209 @@
+#!/bin/sh
+#
+# ulogd-bench.sh - run the reference stacks against GENERATOR
+#
+# usage: ulogd-bench.sh <top_builddir> [events]
+#
+# Each stack is fed <events> synthetic events as fast as possible and
+# ulogd exits once they went through. For each stack, the throughput,
+# the time spent per event in the stack and the heap allocations per
+# event are printed.
+
+top=${1:?usage: $0 <top_builddir> [events]}
+events=${2:-1000000}
+
+ulogd=$top/src/ulogd
+alloc=$top/bench/.libs/alloc_count.so
+
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/ulogd-bench.XXXXXX") || exit 1
+trap 'kill $sink 2>/dev/null; rm -rf "$tmp"' EXIT
+sink=
+
+plugin() {
+	echo "plugin=\"$top/$1/.libs/$2.so\""
+}
+
+# run <name> <stack> <extra config>
+run() {
+	name=$1
+	conf=$tmp/$name.conf
+	log=$tmp/$name.log
+
+	cat > "$conf" <<EOF
+[global]
+logfile="$log"
+loglevel=5
+$(plugin input/generator ulogd_inpgen_GENERATOR)
+$(plugin filter/raw2packet ulogd_raw2packet_BASE)
+$(plugin filter ulogd_filter_IP2STR)
+$(plugin filter ulogd_filter_FILTER)
+$(plugin filter ulogd_filter_PAYLOAD)
+$(plugin filter ulogd_filter_PWSNIFF)
+$(plugin filter ulogd_filter_CIDRTAG)
+$(plugin filter ulogd_filter_DEDUP)
+$(plugin filter ulogd_filter_SKETCH)
+$(plugin filter ulogd_filter_RATELIMIT)
+$(plugin output ulogd_output_JSON)
+$(plugin output ulogd_output_NACCT)
+$(plugin output ulogd_output_GRAPHITE)
+$(plugin output ulogd_output_NULL)
+stack=$2
+
+$3
+EOF
+	LD_PRELOAD=$alloc "$ulogd" -c "$conf" > /dev/null 2>&1
+	result=$(sed -n 's/.*GENERATOR: //p' "$log")
+	if [ -z "$result" ]; then
+		printf '%-28s failed, see below\n' "$name"
+		cat "$log"
+		return 1
+	fi
+	printf '%-28s %s\n' "$name" "$result"
+}
+
+gen() {
+	printf '[gen]\nmode=%s\ncount=%s\nexit_at_end=1\n' "$1" "$events"
+}
+
+status=0
+
+run "packet->BASE->NULL" "gen:GENERATOR,base:BASE,null:NULL" \
+	"$(gen packet)
+[null]" || status=1
+
+run "packet->BASE->IP2STR->JSON" \
+	"gen:GENERATOR,base:BASE,ip2str:IP2STR,json:JSON" \
+	"$(gen packet)
+[json]
+file=\"$tmp/packet.json\"" || status=1
+
+# sets of 1000 members, hashed: 500 hosts and 500 /24 networks, so two
+# probes per event, and 1000 ports
+awk 'BEGIN {
+	printf "ip.saddr in {"
+	for (i = 0; i < 500; i++)
+		printf "%s10.%d.%d.%d", i ? "," : "", i % 256, i * 7 % 256, i % 200
+	for (i = 0; i < 500; i++)
+		printf ",10.%d.%d.0/24", i * 3 % 256, i % 256
+	print "}"
+}' > "$tmp/filter-addr.rule"
+awk 'BEGIN {
+	printf "tcp.dport in {"
+	for (i = 0; i < 1000; i++)
+		printf "%s%d", i ? "," : "", 1024 + i * 61 % 64000
+	print "} || udp.dport in { 53, 123 }"
+}' > "$tmp/filter-port.rule"
+
+run "packet->BASE->FILTER(addr)" "gen:GENERATOR,base:BASE,f:FILTER,null:NULL" \
+	"$(gen packet)
+[f]
+rule_file=\"$tmp/filter-addr.rule\"
+[null]" || status=1
+
+run "packet->BASE->FILTER(port)" "gen:GENERATOR,base:BASE,f:FILTER,null:NULL" \
+	"$(gen packet)
+[f]
+rule_file=\"$tmp/filter-port.rule\"
+[null]" || status=1
+
+# 1000 words of 5 to 12 letters, none in the 1460 bytes of payload
+awk 'BEGIN {
+	srand(1)
+	for (i = 0; i < 1000; i++) {
+		len = 5 + int(rand() * 8)
+		w = ""
+		for (j = 0; j < len; j++)
+			w = w substr("bcdfgjkqvwxz", 1 + int(rand() * 12), 1)
+		print w
+	}
+}' > "$tmp/patterns"
+
+run "packet->PAYLOAD" "gen:GENERATOR,p:PAYLOAD,null:NULL" \
+	"$(gen packet)
+pktlen=1500
+payload=\"GET /index.html HTTP/1.1 Host: www.example.com Accept: */* \"
+[p]
+patterns_file=\"$tmp/patterns\"
+pass_unmatched=1
+[null]" || status=1
+
+# FTP logins, the user and password are copied into the event arena
+run "packet->PWSNIFF" "gen:GENERATOR,pw:PWSNIFF,null:NULL" \
+	"$(gen packet)
+dport=21
+payload=\"USER alice PASS secret \"
+[null]" || status=1
+
+# 100000 prefixes from /12 to /28 in the source and destination networks
+awk 'BEGIN {
+	srand(1)
+	for (i = 0; i < 100000; i++) {
+		len = 12 + int(rand() * 17)
+		a = int(rand() * 2 ^ 24)
+		a -= a % 2 ^ (32 - len)
+		net = 10
+		if (i % 2 && len >= 16) {
+			net = 192
+			a = 168 * 65536 + a % 65536
+		}
+		printf "%d.%d.%d.%d/%d AS%d\n", net, int(a / 65536),
+			int(a / 256) % 256, a % 256, len, i % 5000
+	}
+}' > "$tmp/prefixes"
+
+run "packet->BASE->CIDRTAG" "gen:GENERATOR,base:BASE,t:CIDRTAG,null:NULL" \
+	"$(gen packet)
+[t]
+table=\"$tmp/prefixes\"
+[null]" || status=1
+
+# the events of the few generated flows are nearly all repeats
+run "packet->BASE->DEDUP" "gen:GENERATOR,base:BASE,d:DEDUP,null:NULL" \
+	"$(gen packet)
+[d]
+[null]" || status=1
+
+run "packet->BASE->SKETCH" "gen:GENERATOR,base:BASE,sk:SKETCH,null:NULL" \
+	"$(gen packet)
+[sk]
+keys=\"ip.saddr,ip.daddr\"
+distinct=\"tcp.dport,udp.dport\"
+[null]" || status=1
+
+# most events are over the limit and dropped
+run "packet->BASE->RATELIMIT" "gen:GENERATOR,base:BASE,r:RATELIMIT,null:NULL" \
+	"$(gen packet)
+[r]
+keys=\"ip.saddr,ip.daddr\"
+[null]" || status=1
+
+run "flow->IP2STR->NACCT" "gen:GENERATOR,ip2str:IP2STR,nacct:NACCT" \
+	"$(gen flow)
+[nacct]
+file=\"$tmp/flow.nacct\"" || status=1
+
+# GRAPHITE needs someone to talk to
+port=${BENCH_GRAPHITE_PORT:-22003}
+if command -v python3 > /dev/null; then
+	python3 -c '
+import socket, sys
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(("127.0.0.1", int(sys.argv[1])))
+s.listen(1)
+c, _ = s.accept()
+while c.recv(65536):
+	pass
+' "$port" &
+	sink=$!
+	sleep 1
+	run "sum->GRAPHITE" "gen:GENERATOR,graphite:GRAPHITE" \
+		"$(gen sum)
+[graphite]
+host=\"127.0.0.1\"
+port=\"$port\"" || status=1
+else
+	echo "sum->GRAPHITE                skipped, python3 is needed"
+fi
+
+exit $status
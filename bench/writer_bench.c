@@ -0,0 +1,225 @@
+/* writer_bench.c - write records to a throttled sink with util/writer.c
+ *
+ * The sink is a FIFO drained by a thread at a fixed rate, standing for
+ * a slow disk. Records are produced in bursts, a bit slower than the sink
+ * on average, and written to it with one write() per record, as the
+ * outputs did before the writer, then through the writer with
+ * overflow=block and overflow=drop. For each, the time spent by the
+ * producer in writes, its longest stall and the records lost are printed,
+ * and the records read from the sink are checked to be whole.
+ *
+ * usage: writer_bench [records] [sink MB/s] [producer MB/s]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/writer.h>
+#include <ulogd/clock.h>
+
+#define RECORD_LEN	200
+#define BURST		2000	/* records, 400 kB */
+
+static unsigned int num_records = 100000;
+static unsigned int sink_rate = 20;	/* MB/s */
+static unsigned int producer_rate = 15;
+
+void __ulogd_log(int level, char *file, int line, const char *message, ...)
+{
+	va_list ap;
+
+	if (level < ULOGD_ERROR)
+		return;
+	va_start(ap, message);
+	vfprintf(stderr, message, ap);
+	va_end(ap);
+}
+
+/* the core samples it once per main loop iteration */
+time_t ulogd_clock_sec(void)
+{
+	return time(NULL);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct sink {
+	const char *path;
+	pthread_t thread;
+	uint64_t bytes;
+	unsigned int records;
+	unsigned int errors;
+};
+
+/* read at sink_rate, checking that records are whole */
+static void *sink_thread(void *data)
+{
+	struct sink *s = data;
+	char buf[65536 + RECORD_LEN];
+	unsigned int len = 0;
+	uint64_t start;
+	ssize_t ret;
+	int fd;
+
+	fd = open(s->path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	start = now_ns();
+
+	while ((ret = read(fd, buf + len, 65536)) > 0) {
+		uint64_t due;
+		char *p, *nl;
+
+		s->bytes += ret;
+		len += ret;
+		for (p = buf; (nl = memchr(p, '\n', buf + len - p)); p = nl + 1) {
+			if (nl - p + 1 != RECORD_LEN || *p != '#')
+				s->errors++;
+			s->records++;
+		}
+		len = buf + len - p;
+		memmove(buf, p, len);
+
+		due = start + s->bytes * 1000 / sink_rate;
+		while (now_ns() < due)
+			usleep((due - now_ns()) / 1000 + 1);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void make_record(char *rec, unsigned int i)
+{
+	int len = snprintf(rec, RECORD_LEN, "#%u ", i);
+
+	memset(rec + len, 'x', RECORD_LEN - len - 1);
+	rec[RECORD_LEN - 1] = '\n';
+}
+
+struct result {
+	uint64_t total;
+	uint64_t max;
+	unsigned int lost;
+};
+
+static int run(const char *name, const char *path, const char *overflow)
+{
+	struct config_entry ces[WRITER_CE_NUM] = { WRITER_CES };
+	struct ulogd_writer w;
+	struct sink s = { .path = path };
+	struct result r = { 0, 0, 0 };
+	char rec[RECORD_LEN];
+	unsigned int i;
+	uint64_t t0;
+	int fd = -1, ret = 0;
+
+	pthread_create(&s.thread, NULL, sink_thread, &s);
+
+	if (overflow) {
+		strcpy(writer_overflow_ce(ces).u.string, overflow);
+		if (ulogd_writer_open(&w, name, path, 0, ces) < 0)
+			return 1;
+	} else {
+		fd = open(path, O_WRONLY);
+		if (fd < 0)
+			return 1;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < num_records; i++) {
+		uint64_t t, spent;
+
+		if (i % BURST == 0) {
+			uint64_t due = t0 + (uint64_t)i * RECORD_LEN * 1000 /
+					    producer_rate;
+
+			while (now_ns() < due)
+				usleep((due - now_ns()) / 1000 + 1);
+		}
+		make_record(rec, i);
+		t = now_ns();
+		if (overflow)
+			r.lost += ulogd_writer_write(&w, rec, RECORD_LEN) < 0;
+		else if (write(fd, rec, RECORD_LEN) != RECORD_LEN)
+			r.lost++;
+		spent = now_ns() - t;
+		r.total += spent;
+		if (spent > r.max)
+			r.max = spent;
+	}
+
+	/* what is left in the buffers goes out at the sink's pace */
+	t0 = now_ns();
+	if (overflow)
+		ulogd_writer_close(&w);
+	else
+		close(fd);
+	pthread_join(s.thread, NULL);
+
+	printf("%-16s %8.1f ns/record, longest stall %8.3f ms, %u lost, "
+	       "drained in %.2f s\n", name, (double)r.total / num_records,
+	       r.max / 1e6, r.lost, (now_ns() - t0) / 1e9);
+
+	if (s.errors || s.records != num_records - r.lost) {
+		fprintf(stderr, "%s: %u records read, %u broken\n", name,
+			s.records, s.errors);
+		ret = 1;
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char path[64];
+	int ret = 0;
+
+	if (argc > 1)
+		num_records = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		sink_rate = strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		producer_rate = strtoul(argv[3], NULL, 10);
+	if (sink_rate == 0)
+		sink_rate = 1;
+	if (producer_rate == 0)
+		producer_rate = 1;
+
+	snprintf(path, sizeof(path), "/tmp/writer_bench.%u", getpid());
+	if (mkfifo(path, 0600) < 0) {
+		perror(path);
+		return 1;
+	}
+
+	printf("%u records of %u bytes in bursts of %u at %u MB/s, sink "
+	       "drained at %u MB/s\n", num_records, RECORD_LEN, BURST,
+	       producer_rate, sink_rate);
+	ret |= run("write()", path, NULL);
+	ret |= run("overflow=block", path, "block");
+	ret |= run("overflow=drop", path, "drop");
+
+	unlink(path);
+	if (ret)
+		fprintf(stderr, "FAILED\n");
+	return ret;
+}
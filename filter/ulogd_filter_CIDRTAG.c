@@ -0,0 +1,537 @@
+/* ulogd_filter_CIDRTAG.c
+ *
+ * ulogd interpreter plugin tagging addresses with the longest matching
+ * prefix of a table, e.g. to add the site, customer or AS of a host
+ *
+ * The table is a text file, one "address/bits tag" per line, where the
+ * tag is the rest of the line. It is compiled by util/lpm.c into an
+ * image saved in the cache file, which is mapped instead of parsing the
+ * table again as long as the table doesn't change.
+ *
+ * On SIGHUP the table is loaded again by a separate thread, the events
+ * keep being tagged from the previous one meanwhile. The new table is
+ * swapped in from the main loop, between two events, and the previous
+ * one dropped: tags must not be kept longer than an event.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <netinet/if_ether.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/addr.h>
+#include <ulogd/lpm.h>
+
+enum cidrtag_conf {
+	CIDRTAG_CONF_TABLE,
+	CIDRTAG_CONF_CACHE,
+	CIDRTAG_CONF_MAX,
+};
+
+static struct config_keyset cidrtag_kset = {
+	.num_ces = CIDRTAG_CONF_MAX,
+	.ces = {
+		[CIDRTAG_CONF_TABLE] = {
+			.key	 = "table",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_MANDATORY,
+		},
+		/* compiled table, "<table>.lpm" if not set, "none" for
+		 * no cache */
+		[CIDRTAG_CONF_CACHE] = {
+			.key	 = "cache",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+	},
+};
+#define table_ce(x)	(x->ces[CIDRTAG_CONF_TABLE])
+#define cache_ce(x)	(x->ces[CIDRTAG_CONF_CACHE])
+
+enum input_keys {
+	KEY_OOB_FAMILY,
+	KEY_OOB_PROTOCOL,
+	KEY_IP_SADDR,
+	START_KEY = KEY_IP_SADDR,
+	KEY_IP_DADDR,
+	KEY_ORIG_IP_SADDR,
+	KEY_ORIG_IP_DADDR,
+	MAX_KEY = KEY_ORIG_IP_DADDR,
+};
+
+static struct ulogd_key cidrtag_inp[] = {
+	[KEY_OOB_FAMILY] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "oob.family",
+	},
+	[KEY_OOB_PROTOCOL] = {
+		.type	= ULOGD_RET_UINT16,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "oob.protocol",
+	},
+	[KEY_IP_SADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "ip.saddr",
+	},
+	[KEY_IP_DADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "ip.daddr",
+	},
+	[KEY_ORIG_IP_SADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.ip.saddr",
+	},
+	[KEY_ORIG_IP_DADDR] = {
+		.type	= ULOGD_RET_IPADDR,
+		.flags	= ULOGD_RETF_NONE|ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.ip.daddr",
+	},
+};
+
+/* not set for addresses outside of all prefixes */
+static struct ulogd_key cidrtag_outp[] = {
+	{
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "ip.saddr.tag",
+	},
+	{
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "ip.daddr.tag",
+	},
+	{
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "orig.ip.saddr.tag",
+	},
+	{
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "orig.ip.daddr.tag",
+	},
+};
+
+struct cidrtag_priv {
+	/* used by interp, only changed from the main loop */
+	struct ulogd_lpm *lpm;
+	char cache[PATH_MAX];
+
+	/* the loader thread writes to the pipe once done */
+	int pipe[2];
+	struct ulogd_fd fd;
+	pthread_t loader;
+	int loading;
+	int pending;
+	struct ulogd_lpm *loaded;
+};
+
+/* identifies the version of the table the cache was built from */
+static int table_source(const char *file, uint64_t source[2])
+{
+	struct stat st;
+
+	if (stat(file, &st) < 0)
+		return -1;
+	source[0] = st.st_size;
+	source[1] = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+	return 0;
+}
+
+static int parse_line(struct ulogd_lpm_builder *b, char *line,
+		      const char *file, unsigned int lineno)
+{
+	struct ulogd_addr addr;
+	char *tag, *end;
+	int family;
+
+	line += strspn(line, " \t");
+	end = line + strcspn(line, "\r\n");
+	*end = '\0';
+	if (*line == '\0' || *line == '#')
+		return 0;
+
+	tag = line + strcspn(line, " \t");
+	family = ulogd_parse_addr(line, tag - line, &addr);
+	if (family < 0) {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: %s:%u: invalid prefix\n",
+			  file, lineno);
+		return -1;
+	}
+
+	tag += strspn(tag, " \t");
+	while (end > tag && (end[-1] == ' ' || end[-1] == '\t'))
+		*--end = '\0';
+	if (*tag == '\0') {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: %s:%u: missing tag\n",
+			  file, lineno);
+		return -1;
+	}
+
+	if (ulogd_lpm_add(b, family, family == AF_INET6 ?
+			  (void *)addr.in.ipv6 : (void *)&addr.in.ipv4,
+			  addr.netmask, tag) < 0) {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: out of memory\n");
+		return -1;
+	}
+	return 1;
+}
+
+static struct ulogd_lpm *build_table(const char *file,
+				     const uint64_t source[2])
+{
+	struct ulogd_lpm_builder *b;
+	struct ulogd_lpm *lpm = NULL;
+	unsigned int lineno = 0, count = 0;
+	char *line = NULL;
+	size_t len = 0;
+	void *image;
+	int ret = 0;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (f == NULL) {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: can't open %s: %s\n",
+			  file, strerror(errno));
+		return NULL;
+	}
+
+	b = ulogd_lpm_builder_alloc();
+	if (b == NULL) {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: out of memory\n");
+		fclose(f);
+		return NULL;
+	}
+
+	while (getline(&line, &len, f) >= 0) {
+		ret = parse_line(b, line, file, ++lineno);
+		if (ret < 0)
+			break;
+		count += ret;
+	}
+	free(line);
+	fclose(f);
+
+	if (ret >= 0) {
+		image = ulogd_lpm_compile(b, source, &len);
+		if (image)
+			lpm = ulogd_lpm_load(image, len);
+		if (lpm == NULL) {
+			ulogd_log(ULOGD_ERROR, "CIDRTAG: can't compile %u "
+				  "prefixes\n", count);
+			free(image);
+		}
+	}
+	ulogd_lpm_builder_free(b);
+
+	return lpm;
+}
+
+/* map the cache if it is up to date, else compile the table and save
+ * it. Called at start and from the loader thread. */
+static struct ulogd_lpm *load_table(struct ulogd_pluginstance *upi)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+	const char *file = table_ce(upi->config_kset).u.string;
+	struct ulogd_lpm *lpm;
+	uint64_t source[2];
+
+	if (table_source(file, source) < 0) {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: can't open %s: %s\n",
+			  file, strerror(errno));
+		return NULL;
+	}
+
+	if (priv->cache[0]) {
+		lpm = ulogd_lpm_open(priv->cache, source);
+		if (lpm) {
+			ulogd_log(ULOGD_INFO, "CIDRTAG: %u prefixes from %s\n",
+				  ulogd_lpm_count(lpm), priv->cache);
+			return lpm;
+		}
+	}
+
+	lpm = build_table(file, source);
+	if (lpm == NULL)
+		return NULL;
+	ulogd_log(ULOGD_INFO, "CIDRTAG: %u prefixes from %s\n",
+		  ulogd_lpm_count(lpm), file);
+
+	if (priv->cache[0] && ulogd_lpm_save(lpm, priv->cache) < 0)
+		ulogd_log(ULOGD_NOTICE, "CIDRTAG: can't write %s: %s\n",
+			  priv->cache, strerror(errno));
+
+	return lpm;
+}
+
+static void *loader_main(void *arg)
+{
+	struct ulogd_pluginstance *upi = arg;
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+
+	priv->loaded = load_table(upi);
+	if (write(priv->pipe[1], "d", 1) < 0) {
+		/* the pipe is full, the main loop is awake already */
+	}
+	return NULL;
+}
+
+static void start_loader(struct ulogd_pluginstance *upi)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+	sigset_t all, old;
+	int ret;
+
+	if (priv->loading) {
+		priv->pending = 1;
+		return;
+	}
+
+	priv->pending = 0;
+	priv->loaded = NULL;
+
+	/* signals have to be handled by the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	ret = pthread_create(&priv->loader, NULL, loader_main, upi);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: can't start loader thread\n");
+		return;
+	}
+	priv->loading = 1;
+}
+
+static void finish_loader(struct ulogd_pluginstance *upi)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+
+	pthread_join(priv->loader, NULL);
+	priv->loading = 0;
+
+	if (priv->loaded) {
+		ulogd_lpm_close(priv->lpm);
+		priv->lpm = priv->loaded;
+		priv->loaded = NULL;
+	} else
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: reload failed, keeping "
+			  "the previous table\n");
+}
+
+static int pipe_cb(int fd, unsigned int what, void *param)
+{
+	struct ulogd_pluginstance *upi = param;
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+	char buf[64];
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	if (priv->loading)
+		finish_loader(upi);
+	/* SIGHUP during the load */
+	if (priv->pending)
+		start_loader(upi);
+
+	return 0;
+}
+
+static void tag_addr(struct ulogd_key *inp, int index, int family,
+		     const struct ulogd_lpm *lpm, struct ulogd_key *ret)
+{
+	const char *tag;
+
+	switch (family) {
+	uint32_t ip;
+	case AF_INET6:
+		tag = ulogd_lpm_lookup(lpm, AF_INET6,
+				       ikey_get_u128(&inp[index]));
+		break;
+	case AF_INET:
+		ip = ikey_get_u32(&inp[index]);
+		tag = ulogd_lpm_lookup(lpm, AF_INET, &ip);
+		break;
+	default:
+		return;
+	}
+
+	if (tag)
+		okey_set_ptr(ret, (char *)tag);
+}
+
+static int interp_cidrtag(struct ulogd_pluginstance *pi)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)pi->private;
+	struct ulogd_key *inp = pi->input.keys;
+	struct ulogd_key *ret = pi->output.keys;
+	int family = ikey_get_u8(&inp[KEY_OOB_FAMILY]);
+	int i;
+
+	if (family == AF_BRIDGE) {
+		if (!pp_is_valid(inp, KEY_OOB_PROTOCOL))
+			return ULOGD_IRET_OK;
+		switch (ikey_get_u16(&inp[KEY_OOB_PROTOCOL])) {
+		case ETH_P_IPV6:
+			family = AF_INET6;
+			break;
+		case ETH_P_IP:
+			family = AF_INET;
+			break;
+		default:
+			return ULOGD_IRET_OK;
+		}
+	}
+
+	for (i = START_KEY; i <= MAX_KEY; i++) {
+		if (pp_is_valid(inp, i))
+			tag_addr(inp, i, family, priv->lpm,
+				 &ret[i - START_KEY]);
+	}
+
+	return ULOGD_IRET_OK;
+}
+
+static void signal_cidrtag(struct ulogd_pluginstance *upi, int signal)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+
+	/* called from the main loop, not started yet if there is no pipe */
+	if (signal != SIGHUP || priv->pipe[1] < 0)
+		return;
+
+	start_loader(upi);
+}
+
+static int configure_cidrtag(struct ulogd_pluginstance *upi,
+			     struct ulogd_pluginstance_stack *stack)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+	const char *table, *cache;
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	table = table_ce(upi->config_kset).u.string;
+	cache = cache_ce(upi->config_kset).u.string;
+	if (strcmp(cache, "none") == 0)
+		priv->cache[0] = '\0';
+	else if ((size_t)snprintf(priv->cache, sizeof(priv->cache),
+				  cache[0] ? "%s" : "%s.lpm",
+				  cache[0] ? cache : table) >=
+		 sizeof(priv->cache)) {
+		ulogd_log(ULOGD_FATAL, "CIDRTAG: cache path too long\n");
+		return -1;
+	}
+	priv->pipe[0] = priv->pipe[1] = -1;
+
+	return 0;
+}
+
+static int start_cidrtag(struct ulogd_pluginstance *upi)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+
+	priv->lpm = load_table(upi);
+	if (priv->lpm == NULL)
+		return -1;
+
+	if (pipe(priv->pipe) < 0) {
+		ulogd_log(ULOGD_ERROR, "CIDRTAG: can't create pipe: %s\n",
+			  strerror(errno));
+		goto err;
+	}
+	fcntl(priv->pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(priv->pipe[1], F_SETFL, O_NONBLOCK);
+	fcntl(priv->pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(priv->pipe[1], F_SETFD, FD_CLOEXEC);
+
+	priv->fd.fd = priv->pipe[0];
+	priv->fd.when = ULOGD_FD_READ;
+	priv->fd.cb = &pipe_cb;
+	priv->fd.data = upi;
+	if (ulogd_register_fd(&priv->fd) < 0) {
+		close(priv->pipe[0]);
+		close(priv->pipe[1]);
+		priv->pipe[0] = priv->pipe[1] = -1;
+		goto err;
+	}
+
+	return 0;
+
+err:
+	ulogd_lpm_close(priv->lpm);
+	priv->lpm = NULL;
+	return -1;
+}
+
+static int stop_cidrtag(struct ulogd_pluginstance *upi)
+{
+	struct cidrtag_priv *priv = (struct cidrtag_priv *)upi->private;
+
+	if (priv->loading) {
+		pthread_join(priv->loader, NULL);
+		priv->loading = 0;
+		ulogd_lpm_close(priv->loaded);
+		priv->loaded = NULL;
+	}
+	if (priv->pipe[0] >= 0) {
+		ulogd_unregister_fd(&priv->fd);
+		close(priv->pipe[0]);
+		close(priv->pipe[1]);
+		priv->pipe[0] = priv->pipe[1] = -1;
+	}
+	ulogd_lpm_close(priv->lpm);
+	priv->lpm = NULL;
+
+	return 0;
+}
+
+static struct ulogd_plugin cidrtag_plugin = {
+	.name = "CIDRTAG",
+	.input = {
+		.keys = cidrtag_inp,
+		.num_keys = ARRAY_SIZE(cidrtag_inp),
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+	},
+	.output = {
+		.keys = cidrtag_outp,
+		.num_keys = ARRAY_SIZE(cidrtag_outp),
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+	},
+	.config_kset	= &cidrtag_kset,
+	.interp		= &interp_cidrtag,
+	.configure	= &configure_cidrtag,
+	.start		= &start_cidrtag,
+	.stop		= &stop_cidrtag,
+	.signal		= &signal_cidrtag,
+	.priv_size	= sizeof(struct cidrtag_priv),
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&cidrtag_plugin);
+}
@@ -0,0 +1,422 @@
+/* ulogd_filter_DEDUP.c
+ *
+ * ulogd interpreter plugin suppressing repeated events
+ *
+ * The first event of a tuple of keys (by default the prefix, addresses,
+ * protocol and destination port) goes through and opens a window of
+ * the configured number of seconds. The following events of the same
+ * tuple are dropped until the window closes. Then, if some were, one
+ * event is emitted with dedup.tuple, the tuple as text, dedup.repeats,
+ * the number of dropped events, and the wall clock time of the first
+ * and last events of the window.
+ *
+ * The table has a fixed number of entries, allocated at start. Events
+ * of new tuples while it is full go through. Windows are closed by a
+ * timer wheel with one slot per second, turned once per second while
+ * the table isn't empty.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/clock.h>
+#include <ulogd/timer.h>
+#include <ulogd/tuple.h>
+
+#define NSEC_PER_SEC		1000000000ULL
+
+enum dedup_conf {
+	DEDUP_CONF_KEYS,
+	DEDUP_CONF_WINDOW,
+	DEDUP_CONF_ENTRIES,
+	DEDUP_CONF_MAX,
+};
+
+static struct config_keyset dedup_kset = {
+	.num_ces = DEDUP_CONF_MAX,
+	.ces = {
+		[DEDUP_CONF_KEYS] = {
+			.key	 = "keys",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "oob.prefix,ip.saddr,ip.daddr,ip.protocol,"
+				    "tcp.dport,udp.dport",
+		},
+		/* in seconds */
+		[DEDUP_CONF_WINDOW] = {
+			.key	 = "window",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 10,
+		},
+		[DEDUP_CONF_ENTRIES] = {
+			.key	 = "entries",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 65536,
+		},
+	},
+};
+#define keys_ce(x)	(x->ces[DEDUP_CONF_KEYS])
+#define window_ce(x)	(x->ces[DEDUP_CONF_WINDOW])
+#define entries_ce(x)	(x->ces[DEDUP_CONF_ENTRIES])
+
+enum dedup_output_keys {
+	DEDUP_TUPLE,
+	DEDUP_REPEATS,
+	DEDUP_FIRST,
+	DEDUP_LAST,
+};
+
+static struct ulogd_key dedup_outp[] = {
+	[DEDUP_TUPLE] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "dedup.tuple",
+	},
+	[DEDUP_REPEATS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "dedup.repeats",
+	},
+	[DEDUP_FIRST] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "dedup.first.sec",
+	},
+	[DEDUP_LAST] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "dedup.last.sec",
+	},
+};
+
+#define DEDUP_NONE		UINT32_MAX
+#define DEDUP_MAX_ENTRIES	(1 << 24)
+#define DEDUP_MAX_WINDOW	86400
+#define DEDUP_STRLEN		512
+
+struct dedup_entry {
+	uint32_t hnext;		/* in the bucket */
+	uint32_t wnext;		/* in the wheel slot, or free */
+	uint32_t hash;
+	uint32_t valid;
+	uint32_t expires;	/* monotonic second */
+	uint32_t first;
+	uint32_t last;
+	uint32_t pad;
+	uint64_t repeats;
+	uint32_t tuple[];
+};
+
+struct dedup_priv {
+	struct ulogd_tuple tuple;
+	uint32_t seed;
+	uint32_t window;
+	size_t stride;
+	unsigned int num_entries;
+	unsigned int used;
+	uint32_t free;
+	uint8_t *entries;
+	uint32_t *buckets;
+	uint32_t bucket_mask;
+	uint32_t *wheel;
+	uint32_t wheel_mask;
+	uint32_t wheel_pos;	/* last second turned */
+	uint64_t overflow;	/* events let through, table full */
+	uint32_t *scratch;
+	struct ulogd_timer timer;
+	char str[DEDUP_STRLEN];
+};
+
+static inline struct dedup_entry *dedup_entry(struct dedup_priv *priv,
+					      uint32_t i)
+{
+	return (struct dedup_entry *)(priv->entries + i * priv->stride);
+}
+
+static inline uint32_t dedup_now(void)
+{
+	return ulogd_clock_monotonic() / NSEC_PER_SEC;
+}
+
+static uint32_t dedup_pow2(uint32_t n)
+{
+	uint32_t p = 1;
+
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+static int interp_dedup(struct ulogd_pluginstance *upi)
+{
+	struct dedup_priv *priv = (struct dedup_priv *)upi->private;
+	size_t len = priv->tuple.len;
+	struct dedup_entry *e;
+	uint32_t valid, hash, i;
+
+	valid = ulogd_tuple_pack(&priv->tuple, upi->input.keys,
+				 priv->scratch);
+	hash = ulogd_tuple_hash(&priv->tuple, priv->scratch, valid,
+				priv->seed);
+
+	for (i = priv->buckets[hash & priv->bucket_mask]; i != DEDUP_NONE;
+	     i = e->hnext) {
+		e = dedup_entry(priv, i);
+		if (e->hash == hash && e->valid == valid &&
+		    memcmp(e->tuple, priv->scratch, len) == 0) {
+			e->repeats++;
+			e->last = ulogd_clock_sec();
+			return ULOGD_IRET_STOP;
+		}
+	}
+
+	if (priv->free == DEDUP_NONE) {
+		priv->overflow++;
+		return ULOGD_IRET_OK;
+	}
+
+	i = priv->free;
+	e = dedup_entry(priv, i);
+	priv->free = e->wnext;
+	priv->used++;
+
+	e->hash = hash;
+	e->valid = valid;
+	e->expires = dedup_now() + priv->window;
+	e->first = e->last = ulogd_clock_sec();
+	e->repeats = 0;
+	memcpy(e->tuple, priv->scratch, len);
+
+	e->hnext = priv->buckets[hash & priv->bucket_mask];
+	priv->buckets[hash & priv->bucket_mask] = i;
+	e->wnext = priv->wheel[e->expires & priv->wheel_mask];
+	priv->wheel[e->expires & priv->wheel_mask] = i;
+
+	if (!ulogd_timer_pending(&priv->timer))
+		ulogd_add_timer(&priv->timer, 1);
+
+	return ULOGD_IRET_OK;
+}
+
+/* from the timer, the other keys of the stack have no value */
+static void dedup_close(struct ulogd_pluginstance *upi, uint32_t i)
+{
+	struct dedup_priv *priv = (struct dedup_priv *)upi->private;
+	struct dedup_entry *e = dedup_entry(priv, i);
+	struct ulogd_key *ret = upi->output.keys;
+	uint32_t *p;
+
+	if (e->repeats) {
+		ulogd_tuple_format(&priv->tuple, e->tuple, e->valid,
+				   priv->str, sizeof(priv->str));
+		okey_set_ptr(&ret[DEDUP_TUPLE], priv->str);
+		okey_set_u64(&ret[DEDUP_REPEATS], e->repeats);
+		okey_set_u32(&ret[DEDUP_FIRST], e->first);
+		okey_set_u32(&ret[DEDUP_LAST], e->last);
+		ulogd_propagate_results(upi);
+	}
+
+	for (p = &priv->buckets[e->hash & priv->bucket_mask]; *p != i;
+	     p = &dedup_entry(priv, *p)->hnext)
+		;
+	*p = e->hnext;
+
+	e->wnext = priv->free;
+	priv->free = i;
+	priv->used--;
+}
+
+static void dedup_timer_cb(struct ulogd_timer *t, void *data)
+{
+	struct ulogd_pluginstance *upi = data;
+	struct dedup_priv *priv = (struct dedup_priv *)upi->private;
+	uint32_t now = dedup_now();
+	uint32_t n = now - priv->wheel_pos;
+
+	/* after a long stall, one turn of the wheel closes everything due */
+	if (n > priv->wheel_mask + 1)
+		n = priv->wheel_mask + 1;
+
+	while (n--) {
+		uint32_t *slot, i;
+
+		priv->wheel_pos++;
+		slot = &priv->wheel[priv->wheel_pos & priv->wheel_mask];
+		i = *slot;
+		*slot = DEDUP_NONE;
+		while (i != DEDUP_NONE) {
+			struct dedup_entry *e = dedup_entry(priv, i);
+			uint32_t next = e->wnext;
+
+			if ((int32_t)(e->expires - now) > 0) {
+				e->wnext = *slot;
+				*slot = i;
+			} else
+				dedup_close(upi, i);
+			i = next;
+		}
+	}
+	priv->wheel_pos = now;
+
+	if (priv->overflow) {
+		ulogd_log(ULOGD_NOTICE, "%s: table full, %" PRIu64 " events "
+			  "not deduplicated\n", upi->id, priv->overflow);
+		priv->overflow = 0;
+	}
+
+	if (priv->used)
+		ulogd_add_timer(&priv->timer, 1);
+}
+
+static int configure_dedup(struct ulogd_pluginstance *upi,
+			   struct ulogd_pluginstance_stack *stack)
+{
+	struct dedup_priv *priv = (struct dedup_priv *)upi->private;
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (window_ce(upi->config_kset).u.value <= 0 ||
+	    window_ce(upi->config_kset).u.value > DEDUP_MAX_WINDOW) {
+		ulogd_log(ULOGD_FATAL, "DEDUP: window must be 1 to %d "
+			  "seconds\n", DEDUP_MAX_WINDOW);
+		return -1;
+	}
+	if (entries_ce(upi->config_kset).u.value <= 0 ||
+	    entries_ce(upi->config_kset).u.value > DEDUP_MAX_ENTRIES) {
+		ulogd_log(ULOGD_FATAL, "DEDUP: entries must be 1 to %d\n",
+			  DEDUP_MAX_ENTRIES);
+		return -1;
+	}
+
+	if (ulogd_tuple_parse(&priv->tuple, keys_ce(upi->config_kset).u.string,
+			      0, "DEDUP") < 0)
+		return -1;
+
+	/* one input key per key of the tuple, wherever they come from */
+	free(upi->input.keys);
+	upi->input.keys = calloc(priv->tuple.num_keys,
+				 sizeof(struct ulogd_key));
+	if (!upi->input.keys) {
+		upi->input.num_keys = 0;
+		return -ENOMEM;
+	}
+	upi->input.num_keys = priv->tuple.num_keys;
+	ulogd_tuple_init_keys(&priv->tuple, upi->input.keys);
+
+	return 0;
+}
+
+static void dedup_free(struct dedup_priv *priv)
+{
+	free(priv->entries);
+	free(priv->buckets);
+	free(priv->wheel);
+	free(priv->scratch);
+	priv->entries = NULL;
+	priv->buckets = NULL;
+	priv->wheel = NULL;
+	priv->scratch = NULL;
+}
+
+static int start_dedup(struct ulogd_pluginstance *upi)
+{
+	struct dedup_priv *priv = (struct dedup_priv *)upi->private;
+	struct ulogd_key *inp = upi->input.keys;
+	uint32_t num_buckets, wheel_size, i;
+
+	for (i = 0; i < priv->tuple.num_keys; i++)
+		if (!inp[i].u.source && !priv->tuple.field[i].hidden)
+			ulogd_log(ULOGD_NOTICE, "DEDUP: key `%s' not in "
+				  "stack, ignored\n", inp[i].name);
+
+	if (ulogd_tuple_start(&priv->tuple, inp, "DEDUP") < 0)
+		return -1;
+
+	priv->window = window_ce(upi->config_kset).u.value;
+	priv->num_entries = entries_ce(upi->config_kset).u.value;
+	priv->stride = (sizeof(struct dedup_entry) + priv->tuple.len + 7) &
+		       ~(size_t)7;
+	num_buckets = dedup_pow2(priv->num_entries);
+	/* an entry is never put in the slot being turned */
+	wheel_size = dedup_pow2(priv->window + 2);
+
+	priv->entries = malloc(priv->num_entries * priv->stride);
+	priv->buckets = malloc(num_buckets * sizeof(uint32_t));
+	priv->wheel = malloc(wheel_size * sizeof(uint32_t));
+	priv->scratch = malloc(priv->tuple.len);
+	if (!priv->entries || !priv->buckets || !priv->wheel ||
+	    !priv->scratch) {
+		ulogd_log(ULOGD_FATAL, "DEDUP: out of memory\n");
+		dedup_free(priv);
+		return -1;
+	}
+
+	memset(priv->buckets, 0xff, num_buckets * sizeof(uint32_t));
+	memset(priv->wheel, 0xff, wheel_size * sizeof(uint32_t));
+	for (i = 0; i < priv->num_entries; i++)
+		dedup_entry(priv, i)->wnext = i + 1 < priv->num_entries ?
+					      i + 1 : DEDUP_NONE;
+	priv->free = 0;
+	priv->used = 0;
+	priv->overflow = 0;
+	priv->bucket_mask = num_buckets - 1;
+	priv->wheel_mask = wheel_size - 1;
+	priv->wheel_pos = dedup_now();
+	priv->seed = ulogd_clock_realtime();
+
+	ulogd_init_timer(&priv->timer, upi, dedup_timer_cb);
+
+	return 0;
+}
+
+/* windows still open are dropped without a summary */
+static int stop_dedup(struct ulogd_pluginstance *upi)
+{
+	struct dedup_priv *priv = (struct dedup_priv *)upi->private;
+
+	if (priv->entries && ulogd_timer_pending(&priv->timer))
+		ulogd_del_timer(&priv->timer);
+	dedup_free(priv);
+	free(upi->input.keys);
+	upi->input.keys = NULL;
+	upi->input.num_keys = 0;
+	return 0;
+}
+
+static struct ulogd_plugin dedup_plugin = {
+	.name = "DEDUP",
+	.input = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+	},
+	.output = {
+		.keys = dedup_outp,
+		.num_keys = ARRAY_SIZE(dedup_outp),
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+	},
+	.config_kset	= &dedup_kset,
+	.interp		= &interp_dedup,
+	.configure	= &configure_dedup,
+	.start		= &start_dedup,
+	.stop		= &stop_dedup,
+	.priv_size	= sizeof(struct dedup_priv),
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&dedup_plugin);
+}
@@ -0,0 +1,1456 @@
+/* ulogd_filter_FILTER.c
+ *
+ * ulogd interpreter plugin letting through the events matching a rule
+ *
+ * The rule is a boolean expression over the keys of the stack, e.g.
+ *
+ *   oob.mark & 0xff00 == 0x100 && (ip.saddr in { 10.0.0.0/8, fd00::/8 }
+ *	|| tcp.dport in { 22, 8000..8080 }) && !(oob.prefix ^= 'ACCEPT')
+ *
+ * It is compiled at configure time into a flat program. Each
+ * instruction does one test on one input key and says which
+ * instruction comes next depending on the result, or whether the event
+ * is accepted or dropped: && and || short-circuit by jumping, ! by
+ * swapping the targets, and the program only ever jumps forward. Sets
+ * with more than a few members are looked up in a hash table; address
+ * sets with one probe per prefix length in use.
+ *
+ * A test on a key which is not in the stack, or which has no value for
+ * this event, is false. Strings are quoted with ' or ", the former being
+ * the only choice in the rule option of the configuration file. Numbers
+ * are decimal, or hexadecimal with 0x, and may be negative for signed
+ * keys, as may ranges, e.g. -5..-1.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/hash.h>
+#include <ulogd/jhash.h>
+
+enum filter_conf {
+	FILTER_CONF_RULE,
+	FILTER_CONF_FILE,
+	FILTER_CONF_MAX,
+};
+
+static struct config_keyset filter_kset = {
+	.num_ces = FILTER_CONF_MAX,
+	.ces = {
+		[FILTER_CONF_RULE] = {
+			.key	 = "rule",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+		/* for rules which don't fit in the rule option */
+		[FILTER_CONF_FILE] = {
+			.key	 = "rule_file",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+	},
+};
+#define rule_ce(x)	(x->ces[FILTER_CONF_RULE])
+#define file_ce(x)	(x->ces[FILTER_CONF_FILE])
+
+/* the input keys are those used by the rule, after this one */
+#define FILTER_KEY_FAMILY	0
+
+/* jump targets beyond the last instruction */
+#define FILTER_ACCEPT		0xfffe
+#define FILTER_DROP		0xffff
+#define FILTER_MAX_INSNS	FILTER_ACCEPT
+
+/* sets up to that size are scanned rather than hashed */
+#define FILTER_SET_LINEAR	8
+
+enum filter_op {
+	FILTER_OP_TRUE,		/* has a value, non zero for numbers */
+	FILTER_OP_NUM,		/* number compared with u.num.lo */
+	FILTER_OP_RANGE,	/* number in u.num.lo..u.num.hi */
+	FILTER_OP_NUMSET,
+	FILTER_OP_ADDR,		/* address in u.addr network */
+	FILTER_OP_ADDRSET,
+	FILTER_OP_STR,		/* string equal to u.str */
+	FILTER_OP_PREFIX,	/* string starting with u.str */
+	FILTER_OP_STRSET,
+};
+
+enum filter_cmp {
+	FILTER_CMP_EQ,
+	FILTER_CMP_LT,
+	FILTER_CMP_LE,
+	FILTER_CMP_GT,
+	FILTER_CMP_GE,
+};
+
+enum filter_kind {
+	FILTER_KIND_NUM,
+	FILTER_KIND_ADDR,
+	FILTER_KIND_STR,
+};
+
+struct filter_elem {
+	struct hashtable_node node;
+	uint8_t kind;
+	uint8_t family;
+	/* prefix length of addresses, length of strings */
+	unsigned int len;
+	union {
+		uint64_t num;
+		uint32_t addr[4];
+		char *str;
+	} v;
+	/* of addresses, for sets scanned linearly */
+	uint32_t mask[4];
+};
+
+struct filter_prefix {
+	unsigned int len;
+	uint32_t mask[4];
+};
+
+struct filter_range {
+	uint64_t lo, hi;
+};
+
+struct filter_set {
+	struct filter_elem *elems;
+	unsigned int num_elems;
+	struct filter_range *ranges;
+	unsigned int num_ranges;
+	/* NULL for sets scanned linearly */
+	struct hashtable *table;
+	/* prefix lengths in the set, longest first, for IPv4 and IPv6 */
+	struct filter_prefix *prefixes[2];
+	unsigned int num_prefixes[2];
+};
+
+struct filter_insn {
+	uint8_t op;
+	uint8_t cmp;
+	/* the source key holds signed numbers */
+	uint8_t is_signed;
+	uint16_t key;
+	uint16_t jt, jf;
+	uint64_t mask;
+	union {
+		struct {
+			uint64_t lo, hi;
+		} num;
+		struct {
+			uint8_t family;
+			uint32_t addr[4];
+			uint32_t mask[4];
+		} addr;
+		struct {
+			char *s;
+			size_t len;
+		} str;
+		struct filter_set *set;
+	} u;
+};
+
+struct filter_priv {
+	struct filter_insn *insns;
+	unsigned int num_insns;
+	char (*names)[ULOGD_MAX_KEYLEN + 1];
+	unsigned int num_names;
+};
+
+/***********************************************************************
+ * sets
+ ***********************************************************************/
+
+static void filter_mask(uint32_t *mask, unsigned int plen)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++, plen = plen > 32 ? plen - 32 : 0)
+		mask[i] = plen >= 32 ? 0xffffffff :
+			  plen ? htonl(~(0xffffffffU >> plen)) : 0;
+}
+
+static uint32_t filter_elem_hash(const void *data,
+				 const struct hashtable *table)
+{
+	const struct filter_elem *e = data;
+	uint32_t h = 0;
+
+	switch (e->kind) {
+	case FILTER_KIND_NUM:
+		h = jhash_2words(e->v.num, e->v.num >> 32, 0);
+		break;
+	case FILTER_KIND_ADDR:
+		if (e->family == AF_INET)
+			h = jhash_2words(e->v.addr[0], e->len, 0);
+		else
+			h = jhash2((uint32_t *)e->v.addr, 4, e->len);
+		break;
+	case FILTER_KIND_STR:
+		h = jhash(e->v.str, e->len, 0);
+		break;
+	}
+	return ((uint64_t)h * table->hashsize) >> 32;
+}
+
+static int filter_elem_compare(const void *data1, const void *data2)
+{
+	const struct filter_elem *a = data1, *b = data2;
+
+	switch (a->kind) {
+	case FILTER_KIND_NUM:
+		return a->v.num == b->v.num;
+	case FILTER_KIND_ADDR:
+		return a->family == b->family && a->len == b->len &&
+		       !memcmp(a->v.addr, b->v.addr, sizeof(a->v.addr));
+	case FILTER_KIND_STR:
+		return a->len == b->len && !memcmp(a->v.str, b->v.str, a->len);
+	}
+	return 0;
+}
+
+static void filter_set_free(struct filter_set *set)
+{
+	unsigned int i;
+
+	if (!set)
+		return;
+
+	for (i = 0; i < set->num_elems; i++)
+		if (set->elems[i].kind == FILTER_KIND_STR)
+			free(set->elems[i].v.str);
+	if (set->table)
+		hashtable_destroy(set->table);
+	free(set->prefixes[0]);
+	free(set->prefixes[1]);
+	free(set->elems);
+	free(set->ranges);
+	free(set);
+}
+
+static int filter_set_hash(struct filter_set *set)
+{
+	unsigned int i, f;
+
+	if (set->num_elems > FILTER_SET_LINEAR) {
+		set->table = hashtable_create(set->num_elems, set->num_elems,
+					      filter_elem_hash,
+					      filter_elem_compare);
+		if (!set->table)
+			return -1;
+		for (i = 0; i < set->num_elems; i++) {
+			struct filter_elem *e = &set->elems[i];
+
+			/* duplicates are harmless, don't waste a slot */
+			if (hashtable_find(set->table, e,
+					   hashtable_hash(set->table, e)))
+				continue;
+			hashtable_add(set->table, &e->node,
+				      hashtable_hash(set->table, e));
+		}
+	}
+
+	/* addresses are probed once per prefix length, longest first */
+	for (f = 0; f < 2; f++) {
+		uint8_t seen[129] = { 0 };
+		int plen;
+
+		for (i = 0; i < set->num_elems; i++) {
+			struct filter_elem *e = &set->elems[i];
+
+			if (e->kind == FILTER_KIND_ADDR &&
+			    (e->family == AF_INET6) == f)
+				seen[e->len] = 1;
+		}
+		for (plen = 128; plen >= 0; plen--) {
+			struct filter_prefix *pf;
+
+			if (!seen[plen])
+				continue;
+			pf = realloc(set->prefixes[f],
+				     (set->num_prefixes[f] + 1) * sizeof(*pf));
+			if (!pf)
+				return -1;
+			set->prefixes[f] = pf;
+			pf = &pf[set->num_prefixes[f]++];
+			pf->len = plen;
+			filter_mask(pf->mask, plen);
+		}
+	}
+	return 0;
+}
+
+static int filter_range_cmp_u(const void *a, const void *b)
+{
+	const struct filter_range *x = a, *y = b;
+
+	return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+static int filter_range_cmp_s(const void *a, const void *b)
+{
+	const struct filter_range *x = a, *y = b;
+
+	return (int64_t)x->lo < (int64_t)y->lo ? -1 :
+	       (int64_t)x->lo > (int64_t)y->lo;
+}
+
+/* sort the ranges and merge the overlapping ones, so that a binary
+ * search on the lower bound finds the only candidate */
+static void filter_set_ranges(struct filter_set *set, int is_signed)
+{
+	unsigned int i, n = 0;
+
+	if (set->num_ranges == 0)
+		return;
+
+	qsort(set->ranges, set->num_ranges, sizeof(*set->ranges),
+	      is_signed ? filter_range_cmp_s : filter_range_cmp_u);
+	for (i = 1; i < set->num_ranges; i++) {
+		struct filter_range *r = &set->ranges[i];
+		struct filter_range *last = &set->ranges[n];
+
+		if (is_signed ? (int64_t)r->lo <= (int64_t)last->hi :
+				r->lo <= last->hi) {
+			if (is_signed ? (int64_t)r->hi > (int64_t)last->hi :
+					r->hi > last->hi)
+				last->hi = r->hi;
+		} else
+			set->ranges[++n] = *r;
+	}
+	set->num_ranges = n + 1;
+}
+
+static int filter_set_has_num(const struct filter_set *set, uint64_t v,
+			      int is_signed)
+{
+	unsigned int lo = 0, hi = set->num_ranges;
+
+	if (set->table) {
+		struct filter_elem e = { .kind = FILTER_KIND_NUM, .v.num = v };
+
+		if (hashtable_find(set->table, &e,
+				   hashtable_hash(set->table, &e)))
+			return 1;
+	} else {
+		unsigned int i;
+
+		for (i = 0; i < set->num_elems; i++)
+			if (set->elems[i].v.num == v)
+				return 1;
+	}
+
+	/* last range starting at or before v */
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (is_signed ? (int64_t)set->ranges[mid].lo <= (int64_t)v :
+				set->ranges[mid].lo <= v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return 0;
+	return is_signed ? (int64_t)v <= (int64_t)set->ranges[lo - 1].hi :
+			   v <= set->ranges[lo - 1].hi;
+}
+
+static int filter_set_has_addr(const struct filter_set *set,
+			       const uint32_t *addr, uint8_t family)
+{
+	int f = family == AF_INET6;
+	struct filter_elem e;
+	unsigned int i, j;
+
+	if (!set->table) {
+		for (i = 0; i < set->num_elems; i++) {
+			const struct filter_elem *m = &set->elems[i];
+
+			if (m->family != family)
+				continue;
+			/* the other words of IPv4 addresses are 0 */
+			if (family == AF_INET) {
+				if ((addr[0] & m->mask[0]) == m->v.addr[0])
+					return 1;
+				continue;
+			}
+			for (j = 0; j < 4; j++)
+				if ((addr[j] & m->mask[j]) != m->v.addr[j])
+					break;
+			if (j == 4)
+				return 1;
+		}
+		return 0;
+	}
+
+	e.kind = FILTER_KIND_ADDR;
+	e.family = family;
+	for (i = 0; i < set->num_prefixes[f]; i++) {
+		const struct filter_prefix *pf = &set->prefixes[f][i];
+
+		e.len = pf->len;
+		for (j = 0; j < 4; j++)
+			e.v.addr[j] = addr[j] & pf->mask[j];
+		if (hashtable_find(set->table, &e,
+				   hashtable_hash(set->table, &e)))
+			return 1;
+	}
+	return 0;
+}
+
+static int filter_set_has_str(const struct filter_set *set, const char *s)
+{
+	struct filter_elem e = {
+		.kind = FILTER_KIND_STR,
+		.len = strlen(s),
+		.v.str = (char *)s,
+	};
+	unsigned int i;
+
+	if (set->table)
+		return hashtable_find(set->table, &e,
+				      hashtable_hash(set->table, &e)) != NULL;
+
+	for (i = 0; i < set->num_elems; i++)
+		if (filter_elem_compare(&set->elems[i], &e))
+			return 1;
+	return 0;
+}
+
+/***********************************************************************
+ * evaluation
+ ***********************************************************************/
+
+static uint64_t filter_get_num(const struct ulogd_key *src)
+{
+	switch (src->type) {
+	case ULOGD_RET_INT8:
+		return src->u.value.i8;
+	case ULOGD_RET_INT16:
+		return src->u.value.i16;
+	case ULOGD_RET_INT32:
+		return src->u.value.i32;
+	case ULOGD_RET_INT64:
+		return src->u.value.i64;
+	case ULOGD_RET_UINT8:
+	case ULOGD_RET_BOOL:
+		return src->u.value.ui8;
+	case ULOGD_RET_UINT16:
+		return src->u.value.ui16;
+	case ULOGD_RET_UINT32:
+		return src->u.value.ui32;
+	case ULOGD_RET_UINT64:
+		return src->u.value.ui64;
+	}
+	return 0;
+}
+
+static int filter_is_num(uint16_t type)
+{
+	return (type >= ULOGD_RET_INT8 && type <= ULOGD_RET_INT64) ||
+	       (type >= ULOGD_RET_UINT8 && type <= ULOGD_RET_UINT64) ||
+	       type == ULOGD_RET_BOOL;
+}
+
+static int filter_cmp(const struct filter_insn *insn, uint64_t v)
+{
+	uint64_t x = insn->u.num.lo;
+
+	if (insn->is_signed) {
+		switch (insn->cmp) {
+		case FILTER_CMP_LT:
+			return (int64_t)v < (int64_t)x;
+		case FILTER_CMP_LE:
+			return (int64_t)v <= (int64_t)x;
+		case FILTER_CMP_GT:
+			return (int64_t)v > (int64_t)x;
+		case FILTER_CMP_GE:
+			return (int64_t)v >= (int64_t)x;
+		}
+	} else {
+		switch (insn->cmp) {
+		case FILTER_CMP_LT:
+			return v < x;
+		case FILTER_CMP_LE:
+			return v <= x;
+		case FILTER_CMP_GT:
+			return v > x;
+		case FILTER_CMP_GE:
+			return v >= x;
+		}
+	}
+	return v == x;
+}
+
+static int filter_test(const struct filter_insn *insn,
+		       const struct ulogd_key *src, uint8_t family)
+{
+	const uint32_t *addr;
+	uint32_t addr4[4];
+	uint64_t v;
+	unsigned int i;
+
+	switch (insn->op) {
+	case FILTER_OP_TRUE:
+		if (!filter_is_num(src->type))
+			return 1;
+		return (filter_get_num(src) & insn->mask) != 0;
+	case FILTER_OP_NUM:
+		return filter_cmp(insn, filter_get_num(src) & insn->mask);
+	case FILTER_OP_RANGE:
+		v = filter_get_num(src) & insn->mask;
+		if (insn->is_signed)
+			return (int64_t)v >= (int64_t)insn->u.num.lo &&
+			       (int64_t)v <= (int64_t)insn->u.num.hi;
+		return v >= insn->u.num.lo && v <= insn->u.num.hi;
+	case FILTER_OP_NUMSET:
+		return filter_set_has_num(insn->u.set,
+					  filter_get_num(src) & insn->mask,
+					  insn->is_signed);
+	case FILTER_OP_STR:
+		return !strcmp(src->u.value.ptr, insn->u.str.s);
+	case FILTER_OP_PREFIX:
+		return !strncmp(src->u.value.ptr, insn->u.str.s,
+				insn->u.str.len);
+	case FILTER_OP_STRSET:
+		return filter_set_has_str(insn->u.set, src->u.value.ptr);
+	}
+
+	/* IPv4 addresses are stored in the first word of IPADDR keys */
+	if (src->type == ULOGD_RET_IP6ADDR || family == AF_INET6) {
+		family = AF_INET6;
+		addr = src->u.value.ui128;
+	} else {
+		family = AF_INET;
+		addr4[0] = src->u.value.ui32;
+		addr4[1] = addr4[2] = addr4[3] = 0;
+		addr = addr4;
+	}
+
+	if (insn->op == FILTER_OP_ADDRSET)
+		return filter_set_has_addr(insn->u.set, addr, family);
+
+	if (family != insn->u.addr.family)
+		return 0;
+	for (i = 0; i < 4; i++)
+		if ((addr[i] & insn->u.addr.mask[i]) != insn->u.addr.addr[i])
+			return 0;
+	return 1;
+}
+
+static int interp_filter(struct ulogd_pluginstance *pi)
+{
+	struct filter_priv *priv = (struct filter_priv *)pi->private;
+	struct ulogd_key *inp = pi->input.keys;
+	unsigned int pc = 0;
+	uint8_t family = 0;
+
+	if (pp_is_valid(inp, FILTER_KEY_FAMILY))
+		family = ikey_get_u8(&inp[FILTER_KEY_FAMILY]);
+
+	while (pc < priv->num_insns) {
+		const struct filter_insn *insn = &priv->insns[pc];
+		int res = 0;
+
+		if (pp_is_valid(inp, insn->key))
+			res = filter_test(insn, inp[insn->key].u.source,
+					  family);
+		pc = res ? insn->jt : insn->jf;
+	}
+
+	return pc == FILTER_ACCEPT ? ULOGD_IRET_OK : ULOGD_IRET_STOP;
+}
+
+/***********************************************************************
+ * parsing
+ ***********************************************************************/
+
+enum filter_node_type {
+	FILTER_NODE_TEST,
+	FILTER_NODE_NOT,
+	FILTER_NODE_AND,
+	FILTER_NODE_OR,
+};
+
+struct filter_node {
+	enum filter_node_type type;
+	struct filter_node *l, *r;
+	struct filter_insn insn;
+};
+
+struct filter_parser {
+	struct filter_priv *priv;
+	const char *p;
+	unsigned int num_tests;
+	int error;
+};
+
+/* a literal value of the rule */
+struct filter_value {
+	enum filter_kind kind;
+	int is_range;
+	uint64_t lo, hi;
+	uint8_t family;
+	unsigned int plen;
+	uint32_t addr[4];
+	char *str;
+};
+
+static void filter_insn_free(struct filter_insn *insn)
+{
+	switch (insn->op) {
+	case FILTER_OP_STR:
+	case FILTER_OP_PREFIX:
+		free(insn->u.str.s);
+		break;
+	case FILTER_OP_NUMSET:
+	case FILTER_OP_ADDRSET:
+	case FILTER_OP_STRSET:
+		filter_set_free(insn->u.set);
+		break;
+	}
+}
+
+/* with insns, the resources of the tests are released as well */
+static void filter_node_free(struct filter_node *n, int insns)
+{
+	if (!n)
+		return;
+	filter_node_free(n->l, insns);
+	filter_node_free(n->r, insns);
+	if (n->type == FILTER_NODE_TEST && insns)
+		filter_insn_free(&n->insn);
+	free(n);
+}
+
+static void *filter_error(struct filter_parser *ps, const char *msg)
+{
+	if (!ps->error)
+		ulogd_log(ULOGD_ERROR, "FILTER: %s at `%.20s'\n", msg, ps->p);
+	ps->error = 1;
+	return NULL;
+}
+
+static void filter_skip(struct filter_parser *ps)
+{
+	for (;;) {
+		while (isspace(*ps->p))
+			ps->p++;
+		if (*ps->p != '#')
+			return;
+		while (*ps->p && *ps->p != '\n')
+			ps->p++;
+	}
+}
+
+static int filter_is_word(char c)
+{
+	return isalnum(c) || c == '_' || c == '.' || c == ':' || c == '/';
+}
+
+/* read a key name, number or address */
+static int filter_word(struct filter_parser *ps, char *buf, size_t size)
+{
+	const char *start = ps->p;
+
+	if (*ps->p == '-')
+		ps->p++;
+	/* the upper bound of a range can be negative too */
+	while (filter_is_word(*ps->p) ||
+	       (*ps->p == '-' && ps->p - start >= 2 && ps->p[-1] == '.' &&
+		ps->p[-2] == '.'))
+		ps->p++;
+	if (ps->p == start || (size_t)(ps->p - start) >= size) {
+		ps->p = start;
+		return -1;
+	}
+	memcpy(buf, start, ps->p - start);
+	buf[ps->p - start] = '\0';
+	return 0;
+}
+
+/* the operators and keywords, keywords only if a whole word */
+static int filter_accept(struct filter_parser *ps, const char *tok)
+{
+	size_t len = strlen(tok);
+
+	filter_skip(ps);
+	if (strncmp(ps->p, tok, len))
+		return 0;
+	if (isalpha(tok[0]) && filter_is_word(ps->p[len]))
+		return 0;
+	ps->p += len;
+	return 1;
+}
+
+/* decimal, or hexadecimal with 0x: a leading 0 doesn't mean octal */
+static int filter_number(const char *s, uint64_t *v)
+{
+	const char *digits = *s == '-' ? s + 1 : s;
+	int base = 10;
+	char *end;
+
+	if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X'))
+		base = 16;
+	/* strtoull() would skip blanks and take a sign */
+	if (base == 16 ? !isxdigit(digits[2]) : !isdigit(digits[0]))
+		return -1;
+
+	errno = 0;
+	if (*s == '-')
+		*v = strtoll(s, &end, base);
+	else
+		*v = strtoull(s, &end, base);
+	return (errno || *end) ? -1 : 0;
+}
+
+static int filter_address(const char *s, struct filter_value *val)
+{
+	char buf[INET6_ADDRSTRLEN + 4];
+	const char *slash = strchr(s, '/');
+	unsigned int max, i;
+	uint32_t mask[4];
+	size_t len = slash ? (size_t)(slash - s) : strlen(s);
+
+	if (len >= INET6_ADDRSTRLEN)
+		return -1;
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+
+	memset(val->addr, 0, sizeof(val->addr));
+	if (inet_pton(AF_INET6, buf, val->addr) == 1) {
+		val->family = AF_INET6;
+		max = 128;
+	} else if (inet_pton(AF_INET, buf, val->addr) == 1) {
+		val->family = AF_INET;
+		max = 32;
+	} else
+		return -1;
+
+	val->plen = max;
+	if (slash) {
+		char *end;
+
+		val->plen = strtoul(slash + 1, &end, 10);
+		if (end == slash + 1 || *end || val->plen > max)
+			return -1;
+	}
+
+	/* keep the network only, to compare and hash it directly */
+	filter_mask(mask, val->plen);
+	for (i = 0; i < 4; i++)
+		val->addr[i] &= mask[i];
+	val->kind = FILTER_KIND_ADDR;
+	return 0;
+}
+
+static int filter_value(struct filter_parser *ps, struct filter_value *val)
+{
+	char buf[128];
+	char *dots;
+	const char *start;
+
+	memset(val, 0, sizeof(*val));
+	filter_skip(ps);
+	start = ps->p;
+
+	if (*ps->p == '"' || *ps->p == '\'') {
+		char quote = *ps->p++;
+		size_t len = 0;
+
+		val->str = malloc(strlen(ps->p) + 1);
+		if (!val->str) {
+			filter_error(ps, "out of memory");
+			return -1;
+		}
+		while (*ps->p && *ps->p != quote) {
+			if (*ps->p == '\\' && ps->p[1])
+				ps->p++;
+			val->str[len++] = *ps->p++;
+		}
+		if (*ps->p != quote) {
+			free(val->str);
+			val->str = NULL;
+			filter_error(ps, "unterminated string");
+			return -1;
+		}
+		ps->p++;
+		val->str[len] = '\0';
+		val->kind = FILTER_KIND_STR;
+		return 0;
+	}
+
+	if (filter_word(ps, buf, sizeof(buf)) < 0) {
+		filter_error(ps, "value expected");
+		return -1;
+	}
+
+	val->kind = FILTER_KIND_NUM;
+	dots = strstr(buf, "..");
+	if (dots) {
+		*dots = '\0';
+		val->is_range = 1;
+		/* ordered for a signed key if a bound is negative, whether
+		 * the key is signed is only checked at start */
+		if (filter_number(buf, &val->lo) == 0 &&
+		    filter_number(dots + 2, &val->hi) == 0 &&
+		    (buf[0] == '-' || dots[2] == '-' ?
+		     (int64_t)val->lo <= (int64_t)val->hi :
+		     val->lo <= val->hi))
+			return 0;
+	} else if (filter_number(buf, &val->lo) == 0) {
+		return 0;
+	} else if (filter_address(buf, val) == 0)
+		return 0;
+
+	ps->p = start;
+	filter_error(ps, "invalid value");
+	return -1;
+}
+
+static int filter_key(struct filter_priv *priv, const char *name)
+{
+	unsigned int i;
+	void *names;
+
+	for (i = 0; i < priv->num_names; i++)
+		if (!strcmp(priv->names[i], name))
+			return i;
+
+	if (priv->num_names >= FILTER_MAX_INSNS ||
+	    strlen(name) > ULOGD_MAX_KEYLEN)
+		return -1;
+
+	names = realloc(priv->names, (priv->num_names + 1) *
+				     sizeof(*priv->names));
+	if (!names)
+		return -1;
+	priv->names = names;
+	strcpy(priv->names[priv->num_names], name);
+
+	return priv->num_names++;
+}
+
+static struct filter_node *filter_new(struct filter_parser *ps,
+				      enum filter_node_type type,
+				      struct filter_node *l,
+				      struct filter_node *r)
+{
+	struct filter_node *n = calloc(1, sizeof(*n));
+
+	if (!n) {
+		filter_node_free(l, 1);
+		filter_node_free(r, 1);
+		return filter_error(ps, "out of memory");
+	}
+	n->type = type;
+	n->l = l;
+	n->r = r;
+	return n;
+}
+
+static int filter_set_add(struct filter_parser *ps, struct filter_set *set,
+			  struct filter_value *val)
+{
+	if (val->is_range) {
+		struct filter_range *r;
+
+		r = realloc(set->ranges,
+			    (set->num_ranges + 1) * sizeof(*r));
+		if (!r)
+			goto oom;
+		set->ranges = r;
+		set->ranges[set->num_ranges].lo = val->lo;
+		set->ranges[set->num_ranges].hi = val->hi;
+		set->num_ranges++;
+	} else {
+		struct filter_elem *e;
+
+		e = realloc(set->elems, (set->num_elems + 1) * sizeof(*e));
+		if (!e)
+			goto oom;
+		set->elems = e;
+		e = &set->elems[set->num_elems++];
+		memset(e, 0, sizeof(*e));
+		e->kind = val->kind;
+		switch (val->kind) {
+		case FILTER_KIND_NUM:
+			e->v.num = val->lo;
+			break;
+		case FILTER_KIND_ADDR:
+			e->family = val->family;
+			e->len = val->plen;
+			memcpy(e->v.addr, val->addr, sizeof(e->v.addr));
+			filter_mask(e->mask, val->plen);
+			break;
+		case FILTER_KIND_STR:
+			e->len = strlen(val->str);
+			e->v.str = val->str;
+			val->str = NULL;
+			break;
+		}
+	}
+	return 0;
+
+oom:
+	filter_error(ps, "out of memory");
+	return -1;
+}
+
+/* "{" value { "," value } "}" */
+static int filter_set(struct filter_parser *ps, struct filter_insn *insn)
+{
+	struct filter_set *set = calloc(1, sizeof(*set));
+	int kind = -1;
+
+	if (!set) {
+		filter_error(ps, "out of memory");
+		return -1;
+	}
+
+	for (;;) {
+		struct filter_value val;
+
+		if (filter_value(ps, &val) < 0)
+			goto err;
+		if (kind >= 0 && (int)val.kind != kind) {
+			free(val.str);
+			filter_error(ps, "mixed types in set");
+			goto err;
+		}
+		kind = val.kind;
+		if (filter_set_add(ps, set, &val) < 0) {
+			free(val.str);
+			goto err;
+		}
+		if (filter_accept(ps, "}"))
+			break;
+		if (!filter_accept(ps, ",")) {
+			filter_error(ps, "`}' expected");
+			goto err;
+		}
+	}
+
+	switch (kind) {
+	case FILTER_KIND_NUM:
+		insn->op = FILTER_OP_NUMSET;
+		break;
+	case FILTER_KIND_ADDR:
+		insn->op = FILTER_OP_ADDRSET;
+		break;
+	case FILTER_KIND_STR:
+		insn->op = FILTER_OP_STRSET;
+		break;
+	}
+	insn->u.set = set;
+	if (filter_set_hash(set) < 0) {
+		filter_error(ps, "out of memory");
+		return -1;
+	}
+	return 0;
+
+err:
+	filter_set_free(set);
+	return -1;
+}
+
+/* test on a single value, negated for != */
+static int filter_single(struct filter_parser *ps, struct filter_insn *insn,
+			 int cmp, struct filter_value *val)
+{
+	switch (val->kind) {
+	case FILTER_KIND_NUM:
+		insn->op = val->is_range ? FILTER_OP_RANGE : FILTER_OP_NUM;
+		insn->cmp = cmp;
+		insn->u.num.lo = val->lo;
+		insn->u.num.hi = val->hi;
+		if (val->is_range && cmp != FILTER_CMP_EQ)
+			goto err;
+		break;
+	case FILTER_KIND_ADDR:
+		if (cmp != FILTER_CMP_EQ)
+			goto err;
+		insn->op = FILTER_OP_ADDR;
+		insn->u.addr.family = val->family;
+		memcpy(insn->u.addr.addr, val->addr, sizeof(val->addr));
+		filter_mask(insn->u.addr.mask, val->plen);
+		break;
+	case FILTER_KIND_STR:
+		if (cmp != FILTER_CMP_EQ)
+			goto err;
+		insn->op = FILTER_OP_STR;
+		insn->u.str.s = val->str;
+		insn->u.str.len = strlen(val->str);
+		break;
+	}
+	return 0;
+
+err:
+	free(val->str);
+	filter_error(ps, "invalid comparison");
+	return -1;
+}
+
+/* key [ "&" number ] [ op value | "in" ( value | set ) | "^=" string ] */
+static struct filter_node *filter_parse_test(struct filter_parser *ps)
+{
+	static const struct {
+		const char *tok;
+		int cmp;
+	} cmps[] = {
+		{ "==", FILTER_CMP_EQ },
+		{ "!=", FILTER_CMP_EQ },
+		{ "<=", FILTER_CMP_LE },
+		{ ">=", FILTER_CMP_GE },
+		{ "<", FILTER_CMP_LT },
+		{ ">", FILTER_CMP_GT },
+	};
+	struct filter_node *n;
+	struct filter_value val;
+	char name[ULOGD_MAX_KEYLEN + 2];
+	unsigned int i;
+	int key, negate = 0;
+
+	filter_skip(ps);
+	if (!isalpha(*ps->p) || filter_word(ps, name, sizeof(name)) < 0)
+		return filter_error(ps, "key expected");
+	key = filter_key(ps->priv, name);
+	if (key < 0)
+		return filter_error(ps, "invalid key");
+
+	n = filter_new(ps, FILTER_NODE_TEST, NULL, NULL);
+	if (!n)
+		return NULL;
+	n->insn.key = key;
+	n->insn.mask = ~(uint64_t)0;
+	n->insn.op = FILTER_OP_TRUE;
+	ps->num_tests++;
+
+	filter_skip(ps);
+	if (ps->p[0] == '&' && ps->p[1] != '&') {
+		ps->p++;
+		if (filter_value(ps, &val) < 0 ||
+		    val.kind != FILTER_KIND_NUM || val.is_range) {
+			free(val.str);
+			filter_node_free(n, 1);
+			return filter_error(ps, "invalid mask");
+		}
+		n->insn.mask = val.lo;
+	}
+
+	if (filter_accept(ps, "in")) {
+		int ret;
+
+		if (filter_accept(ps, "{")) {
+			ret = filter_set(ps, &n->insn);
+		} else {
+			ret = filter_value(ps, &val);
+			if (ret == 0)
+				ret = filter_single(ps, &n->insn,
+						    FILTER_CMP_EQ, &val);
+		}
+		if (ret < 0) {
+			filter_node_free(n, 1);
+			return NULL;
+		}
+		return n;
+	}
+
+	if (filter_accept(ps, "^=")) {
+		if (filter_value(ps, &val) < 0 ||
+		    val.kind != FILTER_KIND_STR) {
+			free(val.str);
+			filter_node_free(n, 1);
+			return filter_error(ps, "string expected");
+		}
+		n->insn.op = FILTER_OP_PREFIX;
+		n->insn.u.str.s = val.str;
+		n->insn.u.str.len = strlen(val.str);
+		return n;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cmps); i++) {
+		if (!filter_accept(ps, cmps[i].tok))
+			continue;
+		negate = i == 1;
+		if (filter_value(ps, &val) < 0 ||
+		    filter_single(ps, &n->insn, cmps[i].cmp, &val) < 0) {
+			filter_node_free(n, 1);
+			return NULL;
+		}
+		break;
+	}
+
+	if (negate)
+		return filter_new(ps, FILTER_NODE_NOT, n, NULL);
+	return n;
+}
+
+static struct filter_node *filter_parse_or(struct filter_parser *ps);
+
+static struct filter_node *filter_parse_not(struct filter_parser *ps)
+{
+	struct filter_node *n;
+
+	filter_skip(ps);
+	if ((ps->p[0] == '!' && ps->p[1] != '=' && filter_accept(ps, "!")) ||
+	    filter_accept(ps, "not")) {
+		n = filter_parse_not(ps);
+		if (!n)
+			return NULL;
+		return filter_new(ps, FILTER_NODE_NOT, n, NULL);
+	}
+	if (filter_accept(ps, "(")) {
+		n = filter_parse_or(ps);
+		if (!n)
+			return NULL;
+		if (!filter_accept(ps, ")")) {
+			filter_node_free(n, 1);
+			return filter_error(ps, "`)' expected");
+		}
+		return n;
+	}
+	return filter_parse_test(ps);
+}
+
+static struct filter_node *filter_parse_and(struct filter_parser *ps)
+{
+	struct filter_node *n = filter_parse_not(ps);
+
+	while (n && (filter_accept(ps, "&&") || filter_accept(ps, "and"))) {
+		struct filter_node *r = filter_parse_not(ps);
+
+		if (!r) {
+			filter_node_free(n, 1);
+			return NULL;
+		}
+		n = filter_new(ps, FILTER_NODE_AND, n, r);
+	}
+	return n;
+}
+
+static struct filter_node *filter_parse_or(struct filter_parser *ps)
+{
+	struct filter_node *n = filter_parse_and(ps);
+
+	while (n && (filter_accept(ps, "||") || filter_accept(ps, "or"))) {
+		struct filter_node *r = filter_parse_and(ps);
+
+		if (!r) {
+			filter_node_free(n, 1);
+			return NULL;
+		}
+		n = filter_new(ps, FILTER_NODE_OR, n, r);
+	}
+	return n;
+}
+
+/* the program is laid out from the end, so that the targets of each
+ * test are known when it is emitted. Returns the index of the first
+ * instruction of n. */
+static unsigned int filter_emit(struct filter_priv *priv, unsigned int *pos,
+				struct filter_node *n, unsigned int t,
+				unsigned int f)
+{
+	unsigned int r;
+
+	switch (n->type) {
+	case FILTER_NODE_TEST:
+		priv->insns[--*pos] = n->insn;
+		priv->insns[*pos].jt = t;
+		priv->insns[*pos].jf = f;
+		return *pos;
+	case FILTER_NODE_NOT:
+		return filter_emit(priv, pos, n->l, f, t);
+	case FILTER_NODE_AND:
+		r = filter_emit(priv, pos, n->r, t, f);
+		return filter_emit(priv, pos, n->l, r, f);
+	case FILTER_NODE_OR:
+		r = filter_emit(priv, pos, n->r, t, f);
+		return filter_emit(priv, pos, n->l, t, r);
+	}
+	return f;
+}
+
+static int filter_compile(struct filter_priv *priv, const char *rule)
+{
+	struct filter_parser ps = {
+		.priv = priv,
+		.p = rule,
+	};
+	struct filter_node *n;
+	unsigned int pos;
+
+	n = filter_parse_or(&ps);
+	if (!n)
+		return -1;
+	filter_skip(&ps);
+	if (*ps.p) {
+		filter_node_free(n, 1);
+		filter_error(&ps, "unexpected input");
+		return -1;
+	}
+	if (ps.num_tests > FILTER_MAX_INSNS) {
+		filter_node_free(n, 1);
+		ulogd_log(ULOGD_ERROR, "FILTER: rule too large\n");
+		return -1;
+	}
+
+	priv->insns = calloc(ps.num_tests, sizeof(*priv->insns));
+	if (!priv->insns) {
+		filter_node_free(n, 1);
+		ulogd_log(ULOGD_ERROR, "FILTER: out of memory\n");
+		return -1;
+	}
+	priv->num_insns = pos = ps.num_tests;
+	filter_emit(priv, &pos, n, FILTER_ACCEPT, FILTER_DROP);
+	/* the tests belong to the program now */
+	filter_node_free(n, 0);
+
+	return 0;
+}
+
+/***********************************************************************
+ * plugin
+ ***********************************************************************/
+
+static void filter_free(struct filter_priv *priv)
+{
+	unsigned int i;
+
+	for (i = 0; i < priv->num_insns; i++)
+		filter_insn_free(&priv->insns[i]);
+	free(priv->insns);
+	priv->insns = NULL;
+	priv->num_insns = 0;
+	free(priv->names);
+	priv->names = NULL;
+	priv->num_names = 0;
+}
+
+static char *filter_read_file(const char *file)
+{
+	char *buf = NULL;
+	size_t len = 0, size = 0;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (f == NULL) {
+		ulogd_log(ULOGD_ERROR, "FILTER: can't open %s: %s\n",
+			  file, strerror(errno));
+		return NULL;
+	}
+
+	do {
+		if (len + 1 >= size) {
+			char *tmp;
+
+			size = size ? size * 2 : 4096;
+			tmp = realloc(buf, size);
+			if (!tmp) {
+				ulogd_log(ULOGD_ERROR, "FILTER: out of memory\n");
+				free(buf);
+				fclose(f);
+				return NULL;
+			}
+			buf = tmp;
+		}
+		len += fread(buf + len, 1, size - len - 1, f);
+	} while (!feof(f) && !ferror(f));
+
+	if (ferror(f)) {
+		ulogd_log(ULOGD_ERROR, "FILTER: can't read %s\n", file);
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	buf[len] = '\0';
+
+	return buf;
+}
+
+static int configure_filter(struct ulogd_pluginstance *upi,
+			    struct ulogd_pluginstance_stack *stack)
+{
+	struct filter_priv *priv = (struct filter_priv *)upi->private;
+	const char *file;
+	char *rule;
+	unsigned int i;
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	file = file_ce(upi->config_kset).u.string;
+	if (file[0] && rule_ce(upi->config_kset).u.string[0]) {
+		ulogd_log(ULOGD_FATAL, "FILTER: set either rule or "
+			  "rule_file\n");
+		return -1;
+	}
+	if (file[0])
+		rule = filter_read_file(file);
+	else
+		rule = strdup(rule_ce(upi->config_kset).u.string);
+	if (!rule)
+		return -1;
+
+	filter_free(priv);
+	if (filter_key(priv, "oob.family") < 0 ||
+	    filter_compile(priv, rule) < 0) {
+		free(rule);
+		filter_free(priv);
+		return -1;
+	}
+	free(rule);
+
+	if (priv->num_insns == 0) {
+		ulogd_log(ULOGD_FATAL, "FILTER: no rule configured\n");
+		filter_free(priv);
+		return -1;
+	}
+
+	/* one input key per key in the rule, wherever they come from */
+	free(upi->input.keys);
+	upi->input.keys = calloc(priv->num_names, sizeof(struct ulogd_key));
+	if (!upi->input.keys) {
+		upi->input.num_keys = 0;
+		filter_free(priv);
+		return -ENOMEM;
+	}
+	upi->input.num_keys = priv->num_names;
+	for (i = 0; i < priv->num_names; i++) {
+		strcpy(upi->input.keys[i].name, priv->names[i]);
+		upi->input.keys[i].flags = ULOGD_KEYF_OPTIONAL;
+	}
+
+	return 0;
+}
+
+static int filter_check_type(const struct filter_insn *insn, uint16_t type)
+{
+	switch (insn->op) {
+	case FILTER_OP_TRUE:
+		return 1;
+	case FILTER_OP_NUM:
+	case FILTER_OP_RANGE:
+	case FILTER_OP_NUMSET:
+		return filter_is_num(type);
+	case FILTER_OP_ADDR:
+	case FILTER_OP_ADDRSET:
+		return type == ULOGD_RET_IPADDR || type == ULOGD_RET_IP6ADDR;
+	case FILTER_OP_STR:
+	case FILTER_OP_PREFIX:
+	case FILTER_OP_STRSET:
+		return type == ULOGD_RET_STRING;
+	}
+	return 0;
+}
+
+/* ranges going from a negative to a positive bound are only ordered for
+ * signed keys */
+static int filter_check_ranges(const struct filter_insn *insn)
+{
+	unsigned int i;
+
+	if (insn->is_signed)
+		return 1;
+
+	switch (insn->op) {
+	case FILTER_OP_RANGE:
+		return insn->u.num.lo <= insn->u.num.hi;
+	case FILTER_OP_NUMSET:
+		for (i = 0; i < insn->u.set->num_ranges; i++)
+			if (insn->u.set->ranges[i].lo >
+			    insn->u.set->ranges[i].hi)
+				return 0;
+		break;
+	}
+	return 1;
+}
+
+/* the types of the keys are only known once the stack is resolved */
+static int start_filter(struct ulogd_pluginstance *upi)
+{
+	struct filter_priv *priv = (struct filter_priv *)upi->private;
+	struct ulogd_key *inp = upi->input.keys;
+	unsigned int i;
+
+	for (i = 1; i < upi->input.num_keys; i++)
+		if (!inp[i].u.source)
+			ulogd_log(ULOGD_NOTICE, "FILTER: key `%s' not in "
+				  "stack, tests on it are false\n",
+				  inp[i].name);
+
+	for (i = 0; i < priv->num_insns; i++) {
+		struct filter_insn *insn = &priv->insns[i];
+		struct ulogd_key *src = inp[insn->key].u.source;
+
+		if (!src)
+			continue;
+		if (!filter_check_type(insn, src->type)) {
+			ulogd_log(ULOGD_ERROR, "FILTER: invalid test on "
+				  "key `%s'\n", inp[insn->key].name);
+			return -1;
+		}
+		insn->is_signed = src->type >= ULOGD_RET_INT8 &&
+				  src->type <= ULOGD_RET_INT64;
+		if (!filter_check_ranges(insn)) {
+			ulogd_log(ULOGD_ERROR, "FILTER: range across 0 on "
+				  "unsigned key `%s'\n",
+				  inp[insn->key].name);
+			return -1;
+		}
+		if (insn->op == FILTER_OP_NUMSET)
+			filter_set_ranges(insn->u.set, insn->is_signed);
+	}
+
+	return 0;
+}
+
+static int stop_filter(struct ulogd_pluginstance *upi)
+{
+	filter_free((struct filter_priv *)upi->private);
+	free(upi->input.keys);
+	upi->input.keys = NULL;
+	upi->input.num_keys = 0;
+	return 0;
+}
+
+static struct ulogd_plugin filter_plugin = {
+	.name = "FILTER",
+	.input = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW |
+			ULOGD_DTYPE_SUM,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW |
+			ULOGD_DTYPE_SUM,
+	},
+	.config_kset	= &filter_kset,
+	.interp		= &interp_filter,
+	.configure	= &configure_filter,
+	.start		= &start_filter,
+	.stop		= &stop_filter,
+	.priv_size	= sizeof(struct filter_priv),
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&filter_plugin);
+}
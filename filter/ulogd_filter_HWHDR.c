@@ -29,6 +29,7 @@
 #include <linux/if_arp.h>
 #include <linux/if_ether.h>
 #include <ulogd/ulogd.h>
+#include <ulogd/format.h>
 
 #define HWADDR_LENGTH 128
 
@@ -109,26 +110,22 @@ static struct ulogd_key mac2str_keys[] = {
 	},
 };
 
-static char hwmac_str[MAX_KEY - START_KEY][HWADDR_LENGTH];
+struct mac2str_priv {
+	char hwmac_str[MAX_KEY - START_KEY + 1][HWADDR_LENGTH];
+};
 
-static int parse_mac2str(struct ulogd_key *ret, unsigned char *mac,
+static int parse_mac2str(struct ulogd_pluginstance *pi, unsigned char *mac,
 			 int okey, int len)
 {
-	char *buf_cur;
-	int i;
+	struct mac2str_priv *priv = (struct mac2str_priv *)pi->private;
+	char *buf = priv->hwmac_str[okey - START_KEY];
 
 	if (len * 3 + 1 > HWADDR_LENGTH)
 		return ULOGD_IRET_ERR;
 
-	if (len == 0)
-		hwmac_str[okey - START_KEY][0] = 0;
-
-	buf_cur = hwmac_str[okey - START_KEY];
-	for (i = 0; i < len; i++)
-		buf_cur += sprintf(buf_cur, "%02x%c", mac[i],
-				i == len - 1 ? 0 : ':');
+	ulogd_format_mac(buf, mac, len, ':');
 
-	okey_set_ptr(&ret[okey], hwmac_str[okey - START_KEY]);
+	okey_set_ptr(&pi->output.keys[okey], buf);
 
 	return ULOGD_IRET_OK;
 }
@@ -148,16 +145,18 @@ static u_int16_t hwhdr_get_len(struct ulogd_key *inp)
 	void *len = ikey_get_ptr(&inp[KEY_RAW_MAC]) + 2 * ETH_ALEN;
 	return ntohs(*(u_int16_t *) len);
 }
-static int parse_ethernet(struct ulogd_key *ret, struct ulogd_key *inp)
+static int parse_ethernet(struct ulogd_pluginstance *pi)
 {
+	struct ulogd_key *ret = pi->output.keys;
+	struct ulogd_key *inp = pi->input.keys;
 	int fret;
 	if (!pp_is_valid(inp, KEY_RAW_MAC_SADDR)) {
-		fret = parse_mac2str(ret, hwhdr_get_saddr(inp),
+		fret = parse_mac2str(pi, hwhdr_get_saddr(inp),
 				     KEY_MAC_SADDR, ETH_ALEN);
 		if (fret != ULOGD_IRET_OK)
 			return fret;
 	}
-	fret = parse_mac2str(ret, hwhdr_get_daddr(inp),
+	fret = parse_mac2str(pi, hwhdr_get_daddr(inp),
 			     KEY_MAC_DADDR, ETH_ALEN);
 	if (fret != ULOGD_IRET_OK)
 		return fret;
@@ -181,7 +180,7 @@ static int interp_mac2str(struct ulogd_pluginstance *pi)
 		int fret;
 		if (! pp_is_valid(inp, KEY_RAW_MAC_ADDRLEN))
 			return ULOGD_IRET_ERR;
-		fret = parse_mac2str(ret,
+		fret = parse_mac2str(pi,
 				     ikey_get_ptr(&inp[KEY_RAW_MAC_SADDR]),
 				     KEY_MAC_SADDR,
 				     ikey_get_u16(&inp[KEY_RAW_MAC_ADDRLEN]));
@@ -209,12 +208,12 @@ static int interp_mac2str(struct ulogd_pluginstance *pi)
 
 	switch (type) {
 		case ARPHRD_ETHER:
-			parse_ethernet(ret, inp);
+			parse_ethernet(pi);
 		default:
 			if (!pp_is_valid(inp, KEY_RAW_MAC))
 				return ULOGD_IRET_OK;
 			/* convert raw header to string */
-			return parse_mac2str(ret,
+			return parse_mac2str(pi,
 					    ikey_get_ptr(&inp[KEY_RAW_MAC]),
 					    KEY_MAC_ADDR,
 					    ikey_get_u16(&inp[KEY_RAW_MACLEN]));
@@ -237,6 +236,7 @@ static struct ulogd_plugin mac2str_pluging = {
 		.type = ULOGD_DTYPE_PACKET,
 		},
 	.interp = &interp_mac2str,
+	.priv_size = sizeof(struct mac2str_priv),
 	.version = VERSION,
 };
 
@@ -22,8 +22,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <ulogd/ulogd.h>
-#include <libnfnetlink/libnfnetlink.h>
+#include <ulogd/timer.h>
+#include <ulogd/clock.h>
 
 static struct ulogd_key ifindex_keys[] = {
 	{ 
@@ -51,80 +60,431 @@ static struct ulogd_key ifindex_inp[] = {
 	},
 };
 
-/* we only need one global static cache of ifindex to ifname mappings, 
- * so all state is global (as opposed to per-instance local state in almost
- * all other plugins */
-static struct ulogd_fd nlif_u_fd = { .fd = -1 };
-static int nlif_users;
-static struct nlif_handle *nlif_inst;
+/* we only need one global cache of ifindex to ifname mappings, so all
+ * state is global (as opposed to per-instance local state in almost all
+ * other plugins).
+ *
+ * The names are kept in an array indexed by ifindex, filled from an
+ * rtnetlink dump and kept up to date from the RTM_NEWLINK and
+ * RTM_DELLINK notifications. Entries and the array itself are never
+ * modified once published: a change allocates a new one and swaps the
+ * pointer, so a lookup is two loads without any lock. Replaced entries
+ * are freed IFINDEX_GRACE seconds later, a reader must not keep a name
+ * longer than the processing of one event. */
+
+#define IFINDEX_GRACE	2
+#define IFINDEX_MIN	64
+#define IFINDEX_MAX	(1 << 20)
+
+struct ifindex_name {
+	char name[IFNAMSIZ];
+};
+
+struct ifindex_table {
+	unsigned int size;
+	struct ifindex_name *names[];
+};
+
+struct ifindex_retired {
+	struct llist_head list;
+	time_t since;
+	void *ptr;
+};
+
+static struct ifindex_table *ifindex_table;
+static LLIST_HEAD(retired_list);
+static struct ulogd_timer ifindex_gc_timer;
+
+static struct ulogd_fd nl_fd = { .fd = -1 };
+static int nl_users;
+static unsigned int nl_seq;
+static int nl_dumping;
+static int nl_resync;
+
+/* one bit per entry present when a dump starts, cleared once the dump or
+ * a notification mentions it. Those left when the dump is done were
+ * removed while notifications were lost. Only used from the main loop. */
+static uint8_t *nl_stale;
+static unsigned int nl_stale_size;
+
+static const char *ifindex_lookup(uint32_t ifindex)
+{
+	struct ifindex_table *t;
+	struct ifindex_name *n;
+
+	t = __atomic_load_n(&ifindex_table, __ATOMIC_ACQUIRE);
+	if (t == NULL || ifindex >= t->size)
+		return "";
+
+	n = __atomic_load_n(&t->names[ifindex], __ATOMIC_ACQUIRE);
+	return n ? n->name : "";
+}
 
 static int interp_ifindex(struct ulogd_pluginstance *pi)
 {
 	struct ulogd_key *ret = pi->output.keys;
 	struct ulogd_key *inp = pi->input.keys;
-	static char indev[IFNAMSIZ];
-	static char outdev[IFNAMSIZ];
 
-	nlif_index2name(nlif_inst, ikey_get_u32(&inp[0]), indev);
-	if (indev[0] == '*')
-		indev[0] = 0;
-	okey_set_ptr(&ret[0], indev);
-
-	nlif_index2name(nlif_inst, ikey_get_u32(&inp[1]), outdev);
-	if (outdev[0] == '*')
-		outdev[0] = 0;
-	okey_set_ptr(&ret[1], outdev);
+	okey_set_ptr(&ret[0], (char *)ifindex_lookup(ikey_get_u32(&inp[0])));
+	okey_set_ptr(&ret[1], (char *)ifindex_lookup(ikey_get_u32(&inp[1])));
 
 	return ULOGD_IRET_OK;
 }
 
-static int nlif_read_cb(int fd, unsigned int what, void *param)
+static void ifindex_retire(void *ptr)
+{
+	struct ifindex_retired *r;
+
+	if (ptr == NULL)
+		return;
+
+	r = malloc(sizeof(*r));
+	if (r == NULL) {
+		/* better leak it than free it under a reader */
+		ulogd_log(ULOGD_ERROR, "IFINDEX: out of memory\n");
+		return;
+	}
+	r->since = ulogd_clock_sec();
+	r->ptr = ptr;
+	llist_add_tail(&r->list, &retired_list);
+
+	if (!ulogd_timer_pending(&ifindex_gc_timer))
+		ulogd_add_timer(&ifindex_gc_timer, IFINDEX_GRACE);
+}
+
+static void ifindex_gc(struct ulogd_timer *t, void *data)
+{
+	struct ifindex_retired *r, *tmp;
+	time_t now = ulogd_clock_sec();
+
+	llist_for_each_entry_safe(r, tmp, &retired_list, list) {
+		if (now - r->since < IFINDEX_GRACE)
+			break;
+		llist_del(&r->list);
+		free(r->ptr);
+		free(r);
+	}
+
+	if (!llist_empty(&retired_list))
+		ulogd_add_timer(&ifindex_gc_timer, 1);
+}
+
+/* make room for ifindex, by publishing a larger copy of the array */
+static struct ifindex_table *ifindex_grow(uint32_t ifindex)
+{
+	struct ifindex_table *old = ifindex_table, *t;
+	unsigned int size = old ? old->size : IFINDEX_MIN;
+
+	while (size <= ifindex)
+		size *= 2;
+
+	t = calloc(1, sizeof(*t) + size * sizeof(t->names[0]));
+	if (t == NULL)
+		return NULL;
+	t->size = size;
+	if (old)
+		memcpy(t->names, old->names,
+		       old->size * sizeof(old->names[0]));
+
+	__atomic_store_n(&ifindex_table, t, __ATOMIC_RELEASE);
+	ifindex_retire(old);
+
+	return t;
+}
+
+/* name is not necessarily NUL terminated, NULL removes the entry */
+static void ifindex_set(uint32_t ifindex, const char *name, size_t len)
 {
+	struct ifindex_table *t = ifindex_table;
+	struct ifindex_name *old, *n = NULL;
+
+	if (ifindex >= IFINDEX_MAX)
+		return;
+
+	if (t == NULL || ifindex >= t->size) {
+		if (name == NULL)
+			return;
+		t = ifindex_grow(ifindex);
+		if (t == NULL) {
+			ulogd_log(ULOGD_ERROR, "IFINDEX: out of memory\n");
+			return;
+		}
+	}
+
+	old = t->names[ifindex];
+	if (name) {
+		len = strnlen(name, len < IFNAMSIZ ? len : IFNAMSIZ - 1);
+		if (old && strncmp(old->name, name, len) == 0 &&
+		    old->name[len] == '\0')
+			return;
+		n = malloc(sizeof(*n));
+		if (n == NULL) {
+			ulogd_log(ULOGD_ERROR, "IFINDEX: out of memory\n");
+			return;
+		}
+		memcpy(n->name, name, len);
+		n->name[len] = '\0';
+	}
+
+	__atomic_store_n(&t->names[ifindex], n, __ATOMIC_RELEASE);
+	ifindex_retire(old);
+}
+
+static void nl_stale_free(void)
+{
+	free(nl_stale);
+	nl_stale = NULL;
+	nl_stale_size = 0;
+}
+
+static void nl_stale_mark(void)
+{
+	struct ifindex_table *t = ifindex_table;
+	unsigned int i;
+
+	nl_stale_free();
+	if (t == NULL)
+		return;
+
+	nl_stale = calloc(1, t->size / 8);
+	if (nl_stale == NULL) {
+		/* removed interfaces will be kept until the next dump */
+		ulogd_log(ULOGD_ERROR, "IFINDEX: out of memory\n");
+		return;
+	}
+	nl_stale_size = t->size;
+	for (i = 0; i < t->size; i++) {
+		if (t->names[i])
+			nl_stale[i / 8] |= 1 << (i % 8);
+	}
+}
+
+static void nl_stale_clear(uint32_t ifindex)
+{
+	if (ifindex < nl_stale_size)
+		nl_stale[ifindex / 8] &= ~(1 << (ifindex % 8));
+}
+
+static void nl_stale_sweep(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nl_stale_size; i++) {
+		if (nl_stale[i / 8] & (1 << (i % 8)))
+			ifindex_set(i, NULL, 0);
+	}
+	nl_stale_free();
+}
+
+static void ifindex_clear(void)
+{
+	struct ifindex_retired *r, *tmp;
+	unsigned int i;
+
+	nl_stale_free();
+
+	if (ifindex_table) {
+		for (i = 0; i < ifindex_table->size; i++)
+			free(ifindex_table->names[i]);
+		free(ifindex_table);
+		ifindex_table = NULL;
+	}
+
+	llist_for_each_entry_safe(r, tmp, &retired_list, list) {
+		llist_del(&r->list);
+		free(r->ptr);
+		free(r);
+	}
+}
+
+static void nl_parse_link(struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	struct rtattr *rta;
+
+	if (len < 0 || ifi->ifi_index <= 0)
+		return;
+
+	nl_stale_clear(ifi->ifi_index);
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		ifindex_set(ifi->ifi_index, NULL, 0);
+		return;
+	}
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME) {
+			ifindex_set(ifi->ifi_index, RTA_DATA(rta),
+				    RTA_PAYLOAD(rta));
+			break;
+		}
+	}
+}
+
+/* ask for all links, notifications that arrive meanwhile are applied in
+ * order with the dump, so they are not lost */
+static int nl_request_dump(int fd)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+
+	if (nl_dumping) {
+		nl_resync = 1;
+		return 0;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++nl_seq;
+	req.ifi.ifi_family = AF_UNSPEC;
+
+	if (sendto(fd, &req, sizeof(req), 0, (struct sockaddr *)&addr,
+		   sizeof(addr)) < 0)
+		return -1;
+
+	nl_dumping = 1;
+	nl_resync = 0;
+	nl_stale_mark();
+	return 0;
+}
+
+static void nl_parse(void *buf, int len)
+{
+	struct nlmsghdr *nlh;
+
+	for (nlh = buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		switch (nlh->nlmsg_type) {
+		case RTM_NEWLINK:
+		case RTM_DELLINK:
+			nl_parse_link(nlh);
+			break;
+		case NLMSG_DONE:
+		case NLMSG_ERROR:
+			if (nlh->nlmsg_seq != nl_seq || !nl_dumping)
+				break;
+			nl_dumping = 0;
+			/* an aborted dump tells nothing about the others */
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				nl_stale_sweep();
+			else
+				nl_stale_free();
+			break;
+		}
+	}
+}
+
+static int nl_read_cb(int fd, unsigned int what, void *param)
+{
+	char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct sockaddr_nl addr;
+	socklen_t addrlen;
+	int len;
+
 	if (!(what & ULOGD_FD_READ))
 		return 0;
 
-	return nlif_catch(nlif_inst);
+	for (;;) {
+		addrlen = sizeof(addr);
+		len = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT,
+			       (struct sockaddr *)&addr, &addrlen);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				/* notifications were lost, start over */
+				ulogd_log(ULOGD_NOTICE, "IFINDEX: netlink "
+					  "overrun, resynchronizing\n");
+				nl_dumping = 0;
+				nl_request_dump(fd);
+				continue;
+			}
+			break;
+		}
+		if (len == 0)
+			break;
+		/* only trust the kernel */
+		if (addr.nl_pid != 0)
+			continue;
+		nl_parse(buf, len);
+	}
+
+	if (nl_resync && !nl_dumping)
+		nl_request_dump(fd);
+
+	return 0;
 }
 
 static int ifindex_start(struct ulogd_pluginstance *upi)
 {
-	int rc;
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK,
+	};
+	int fd, rc;
 
 	/* if we're already initialized, inc usage count and exit */
-	if (nlif_u_fd.fd >= 0) {
-		nlif_users++;
+	if (nl_fd.fd >= 0) {
+		nl_users++;
 		return 0;
 	}
 
 	/* if we reach here, we need to initialize */
-	nlif_inst = nlif_open();
-	if (nlif_inst == NULL) {
-		return nlif_u_fd.fd;
-	}
-	nlif_query(nlif_inst);
-	
-	nlif_u_fd.fd = nlif_fd(nlif_inst);
-	nlif_u_fd.when = ULOGD_FD_READ;
-	nlif_u_fd.cb = &nlif_read_cb;
-	rc = ulogd_register_fd(&nlif_u_fd);
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "IFINDEX: can't open rtnetlink "
+			  "socket: %s\n", strerror(errno));
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    nl_request_dump(fd) < 0) {
+		ulogd_log(ULOGD_ERROR, "IFINDEX: can't query links: %s\n",
+			  strerror(errno));
+		rc = -1;
+		goto out_close;
+	}
+
+	ulogd_init_timer(&ifindex_gc_timer, NULL, ifindex_gc);
+
+	nl_fd.fd = fd;
+	nl_fd.when = ULOGD_FD_READ;
+	nl_fd.cb = &nl_read_cb;
+	rc = ulogd_register_fd(&nl_fd);
 	if (rc < 0)
-		goto out_nlif;
+		goto out_close;
+
+	/* have the interfaces known before the first event */
+	while (nl_dumping) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+		if (poll(&pfd, 1, 1000) <= 0)
+			break;
+		nl_read_cb(fd, ULOGD_FD_READ, NULL);
+	}
 
-	nlif_users++;
+	nl_users++;
 	return 0;
 
-out_nlif:
-	nlif_close(nlif_inst);
-	nlif_u_fd.fd = -1;
+out_close:
+	close(fd);
+	nl_fd.fd = -1;
+	nl_dumping = 0;
 	return rc;
 }
 
 static int ifindex_fini(struct ulogd_pluginstance *upi)
 {
-	if (--nlif_users == 0) {
-		ulogd_unregister_fd(&nlif_u_fd);
-		nlif_close(nlif_inst);
-		nlif_u_fd.fd = -1;
+	if (--nl_users == 0) {
+		ulogd_unregister_fd(&nl_fd);
+		close(nl_fd.fd);
+		nl_fd.fd = -1;
+		nl_dumping = 0;
+		ulogd_del_timer(&ifindex_gc_timer);
+		ifindex_clear();
 	}
 
 	return 0;
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <ulogd/ulogd.h>
+#include <ulogd/format.h>
 #include <netinet/if_ether.h>
 
 #define IPADDR_LENGTH 128
@@ -114,7 +115,9 @@ static struct ulogd_key ip2bin_keys[] = {
 
 };
 
-static char ipbin_array[MAX_KEY-START_KEY][IPADDR_LENGTH];
+struct ip2bin_priv {
+	char ipbin_array[MAX_KEY - START_KEY + 1][IPADDR_LENGTH];
+};
 
 /**
  * Convert IPv4 address (as 32-bit unsigned integer) to IPv6 address:
@@ -128,15 +131,12 @@ inline void uint32_to_ipv6(const uint32_t ipv4, struct in6_addr *ipv6)
 	ipv6->s6_addr32[3] = ipv4;
 }
 
-static int ip2bin(struct ulogd_key* inp, int index, int oindex)
+static int ip2bin(struct ulogd_key* inp, int index, char *buffer)
 {
 	char family = ikey_get_u8(&inp[KEY_OOB_FAMILY]);
 	char convfamily = family;
-	unsigned char *addr8;
 	struct in6_addr *addr;
 	struct in6_addr ip4_addr;
-	char *buffer;
-	int i, written;
 
 	if (family == AF_BRIDGE) {
 		if (!pp_is_valid(inp, KEY_OOB_PROTOCOL)) {
@@ -176,23 +176,10 @@ static int ip2bin(struct ulogd_key* inp, int index, int oindex)
 			return ULOGD_IRET_ERR;
 	}
 
-	buffer = ipbin_array[oindex];
 	/* format IPv6 to BINARY(16) as "0x..." */
 	buffer[0] = '0';
 	buffer[1] = 'x';
-	buffer += 2;
-	addr8 = &addr->s6_addr[0];
-	for (i = 0; i < 4; i++) {
-		written = sprintf(buffer, "%02x%02x%02x%02x",
-				addr8[0], addr8[1], addr8[2], addr8[3]);
-		if (written != 2 * 4) {
-			buffer[0] = 0;
-			return ULOGD_IRET_ERR;
-		}
-		buffer += written;
-		addr8 += 4;
-	}
-	buffer[0] = 0;
+	ulogd_format_hex(buffer + 2, addr->s6_addr, sizeof(addr->s6_addr));
 
 	return ULOGD_IRET_OK;
 }
@@ -201,17 +188,19 @@ static int interp_ip2bin(struct ulogd_pluginstance *pi)
 {
 	struct ulogd_key *ret = pi->output.keys;
 	struct ulogd_key *inp = pi->input.keys;
+	struct ip2bin_priv *priv = (struct ip2bin_priv *)pi->private;
 	int i;
 	int fret;
 
 	/* Iter on all addr fields */
-	for(i = START_KEY; i < MAX_KEY; i++) {
+	for(i = START_KEY; i <= MAX_KEY; i++) {
 		if (pp_is_valid(inp, i)) {
-			fret = ip2bin(inp, i, i-START_KEY);
+			char *buf = priv->ipbin_array[i-START_KEY];
+
+			fret = ip2bin(inp, i, buf);
 			if (fret != ULOGD_IRET_OK)
 				return fret;
-			okey_set_ptr(&ret[i-START_KEY],
-				     ipbin_array[i-START_KEY]);
+			okey_set_ptr(&ret[i-START_KEY], buf);
 		}
 	}
 
@@ -231,6 +220,7 @@ static struct ulogd_plugin ip2bin_pluging = {
 		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
 		},
 	.interp = &interp_ip2bin,
+	.priv_size = sizeof(struct ip2bin_priv),
 	.version = VERSION,
 };
 
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <ulogd/ulogd.h>
+#include <ulogd/format.h>
 #include <netinet/if_ether.h>
 
 #define IPADDR_LENGTH 128
@@ -137,9 +138,11 @@ static struct ulogd_key ip2str_keys[] = {
 	},
 };
 
-static char ipstr_array[MAX_KEY-START_KEY][IPADDR_LENGTH];
+struct ip2str_priv {
+	char ipstr_array[MAX_KEY - START_KEY + 1][IPADDR_LENGTH];
+};
 
-static int ip2str(struct ulogd_key *inp, int index, int oindex)
+static int ip2str(struct ulogd_key *inp, int index, char *buf)
 {
 	char family = ikey_get_u8(&inp[KEY_OOB_FAMILY]);
 	char convfamily = family;
@@ -170,14 +173,11 @@ static int ip2str(struct ulogd_key *inp, int index, int oindex)
 	switch (convfamily) {
 		u_int32_t ip;
 	case AF_INET6:
-		inet_ntop(AF_INET6,
-			  ikey_get_u128(&inp[index]),
-			  ipstr_array[oindex], sizeof(ipstr_array[oindex]));
+		ulogd_format_ipv6(buf, ikey_get_u128(&inp[index]));
 		break;
 	case AF_INET:
 		ip = ikey_get_u32(&inp[index]);
-		inet_ntop(AF_INET, &ip,
-			  ipstr_array[oindex], sizeof(ipstr_array[oindex]));
+		ulogd_format_ipv4(buf, ip);
 		break;
 	default:
 		/* TODO error handling */
@@ -191,17 +191,19 @@ static int interp_ip2str(struct ulogd_pluginstance *pi)
 {
 	struct ulogd_key *ret = pi->output.keys;
 	struct ulogd_key *inp = pi->input.keys;
+	struct ip2str_priv *priv = (struct ip2str_priv *)pi->private;
 	int i;
 	int fret;
 
 	/* Iter on all addr fields */
 	for (i = START_KEY; i <= MAX_KEY; i++) {
 		if (pp_is_valid(inp, i)) {
-			fret = ip2str(inp, i, i-START_KEY);
+			char *buf = priv->ipstr_array[i-START_KEY];
+
+			fret = ip2str(inp, i, buf);
 			if (fret != ULOGD_IRET_OK)
 				return fret;
-			okey_set_ptr(&ret[i-START_KEY],
-				     ipstr_array[i-START_KEY]);
+			okey_set_ptr(&ret[i-START_KEY], buf);
 		}
 	}
 
@@ -221,6 +223,7 @@ static struct ulogd_plugin ip2str_pluging = {
 		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
 		},
 	.interp = &interp_ip2str,
+	.priv_size = sizeof(struct ip2str_priv),
 	.version = VERSION,
 };
 
@@ -0,0 +1,519 @@
+/* ulogd_filter_PAYLOAD.c
+ *
+ * ulogd interpreter plugin looking for patterns in TCP and UDP payloads
+ *
+ * All patterns are searched at once with an Aho-Corasick automaton, so
+ * the cost per payload byte doesn't depend on their number. Packets
+ * where none is found stop the stack, unless pass_unmatched is set. The
+ * first match is exported with its pattern, index and offset.
+ *
+ * Patterns are given in the patterns option, separated by commas, and
+ * in patterns_file, one per line. "\xHH", "\\" and "\," stand for
+ * any byte, a backslash and a comma.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/acmatch.h>
+
+enum payload_conf {
+	PAYLOAD_CONF_PATTERNS,
+	PAYLOAD_CONF_FILE,
+	PAYLOAD_CONF_NOCASE,
+	PAYLOAD_CONF_PORTS,
+	PAYLOAD_CONF_UNMATCHED,
+	PAYLOAD_CONF_MAX,
+};
+
+static struct config_keyset payload_kset = {
+	.num_ces = PAYLOAD_CONF_MAX,
+	.ces = {
+		[PAYLOAD_CONF_PATTERNS] = {
+			.key	 = "patterns",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+		[PAYLOAD_CONF_FILE] = {
+			.key	 = "patterns_file",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+		[PAYLOAD_CONF_NOCASE] = {
+			.key	 = "nocase",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		/* e.g. "21,110,8000-8080", source or destination */
+		[PAYLOAD_CONF_PORTS] = {
+			.key	 = "ports",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+		[PAYLOAD_CONF_UNMATCHED] = {
+			.key	 = "pass_unmatched",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	},
+};
+#define patterns_ce(x)	(x->ces[PAYLOAD_CONF_PATTERNS])
+#define file_ce(x)	(x->ces[PAYLOAD_CONF_FILE])
+#define nocase_ce(x)	(x->ces[PAYLOAD_CONF_NOCASE])
+#define ports_ce(x)	(x->ces[PAYLOAD_CONF_PORTS])
+#define unmatched_ce(x)	(x->ces[PAYLOAD_CONF_UNMATCHED])
+
+enum input_keys {
+	KEY_RAW_PKT,
+	KEY_RAW_PKTLEN,
+	KEY_OOB_FAMILY,
+};
+
+static struct ulogd_key payload_inp[] = {
+	[KEY_RAW_PKT] = {
+		.type	= ULOGD_RET_RAW,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "raw.pkt",
+	},
+	[KEY_RAW_PKTLEN] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "raw.pktlen",
+	},
+	[KEY_OOB_FAMILY] = {
+		.type	= ULOGD_RET_UINT8,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "oob.family",
+	},
+};
+
+enum output_keys {
+	KEY_PAYLOAD_MATCH,
+	KEY_PAYLOAD_MATCH_ID,
+	KEY_PAYLOAD_OFFSET,
+};
+
+static struct ulogd_key payload_outp[] = {
+	/* the pattern as written in the configuration */
+	[KEY_PAYLOAD_MATCH] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "payload.match",
+	},
+	/* from 0, patterns first, then patterns_file */
+	[KEY_PAYLOAD_MATCH_ID] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "payload.match.id",
+	},
+	/* of the first byte of the match in the TCP or UDP payload */
+	[KEY_PAYLOAD_OFFSET] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "payload.offset",
+	},
+};
+
+struct payload_priv {
+	struct ulogd_acm *acm;
+	char **names;
+	unsigned int num_names;
+	int all_ports;
+	uint8_t ports[65536 / 8];
+};
+
+static inline int port_is_set(const struct payload_priv *priv, uint16_t port)
+{
+	return priv->ports[port >> 3] & (1 << (port & 7));
+}
+
+static int parse_ports(struct payload_priv *priv, const char *str)
+{
+	const char *p = str;
+
+	memset(priv->ports, 0, sizeof(priv->ports));
+	priv->all_ports = (*str == '\0');
+
+	while (*p) {
+		unsigned long from, to;
+		char *end;
+
+		from = strtoul(p, &end, 10);
+		if (end == p)
+			return -1;
+		to = from;
+		p = end;
+		if (*p == '-') {
+			p++;
+			to = strtoul(p, &end, 10);
+			if (end == p)
+				return -1;
+			p = end;
+		}
+		if (from > to || to > 65535)
+			return -1;
+		for (; from <= to; from++)
+			priv->ports[from >> 3] |= 1 << (from & 7);
+
+		while (isspace(*p))
+			p++;
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -1;
+		while (isspace(*p))
+			p++;
+	}
+	return 0;
+}
+
+/* unescape the pattern in str up to one of the stop characters, into
+ * buf of at least the same length, returns the end in str or NULL */
+static const char *parse_pattern(const char *str, const char *stop,
+				 uint8_t *buf, size_t *len)
+{
+	const char *p = str;
+
+	*len = 0;
+	while (*p && !strchr(stop, *p)) {
+		if (*p != '\\') {
+			buf[(*len)++] = *p++;
+			continue;
+		}
+		p++;
+		if (*p == 'x' && isxdigit(p[1]) && isxdigit(p[2])) {
+			char hex[3] = { p[1], p[2], 0 };
+
+			buf[(*len)++] = strtoul(hex, NULL, 16);
+			p += 3;
+		} else if (*p == '\\' || *p == ',') {
+			buf[(*len)++] = *p++;
+		} else
+			return NULL;
+	}
+	return p;
+}
+
+static int add_pattern(struct payload_priv *priv, const char *text,
+		       size_t text_len)
+{
+	uint8_t *buf;
+	size_t len;
+	char **names;
+	char *name;
+
+	buf = malloc(text_len + 1);
+	name = strndup(text, text_len);
+	names = realloc(priv->names, (priv->num_names + 1) * sizeof(*names));
+	if (!buf || !name || !names) {
+		free(buf);
+		free(name);
+		if (names)
+			priv->names = names;
+		ulogd_log(ULOGD_ERROR, "PAYLOAD: out of memory\n");
+		return -1;
+	}
+	priv->names = names;
+
+	if (parse_pattern(name, "", buf, &len) == NULL || len == 0) {
+		ulogd_log(ULOGD_ERROR, "PAYLOAD: invalid pattern `%s'\n",
+			  name);
+		free(buf);
+		free(name);
+		return -1;
+	}
+	if (ulogd_acm_add(priv->acm, buf, len, priv->num_names) < 0) {
+		ulogd_log(ULOGD_ERROR, "PAYLOAD: out of memory\n");
+		free(buf);
+		free(name);
+		return -1;
+	}
+	free(buf);
+	priv->names[priv->num_names++] = name;
+
+	return 0;
+}
+
+static int add_patterns_list(struct payload_priv *priv, const char *str)
+{
+	const char *p = str;
+
+	while (*p) {
+		const char *start = p;
+		uint8_t buf[CONFIG_VAL_STRING_LEN];
+		size_t len;
+
+		/* find the end of this pattern, honouring "\," */
+		p = parse_pattern(start, ",", buf, &len);
+		if (p == NULL) {
+			ulogd_log(ULOGD_ERROR, "PAYLOAD: invalid pattern in "
+				  "`%s'\n", str);
+			return -1;
+		}
+		if (p > start && add_pattern(priv, start, p - start) < 0)
+			return -1;
+		if (*p == ',')
+			p++;
+	}
+	return 0;
+}
+
+static int add_patterns_file(struct payload_priv *priv, const char *file)
+{
+	char line[LINE_LEN + 1];
+	int ret = 0;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (f == NULL) {
+		ulogd_log(ULOGD_ERROR, "PAYLOAD: can't open %s: %s\n",
+			  file, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		size_t len = strcspn(line, "\r\n");
+
+		if (len == 0 || line[0] == '#')
+			continue;
+		ret = add_pattern(priv, line, len);
+		if (ret < 0)
+			break;
+	}
+	fclose(f);
+
+	return ret;
+}
+
+static void payload_free(struct payload_priv *priv)
+{
+	unsigned int i;
+
+	ulogd_acm_free(priv->acm);
+	priv->acm = NULL;
+	for (i = 0; i < priv->num_names; i++)
+		free(priv->names[i]);
+	free(priv->names);
+	priv->names = NULL;
+	priv->num_names = 0;
+}
+
+/* the TCP or UDP payload of an IPv4 or IPv6 packet, NULL otherwise */
+static const uint8_t *get_payload(const uint8_t *pkt, size_t len,
+				  uint8_t family, size_t *plen,
+				  uint16_t *sport, uint16_t *dport)
+{
+	const uint8_t *end = pkt + len, *l4;
+	uint8_t proto;
+
+	switch (family) {
+	case AF_INET: {
+		const struct iphdr *iph = (const struct iphdr *)pkt;
+
+		if (len < sizeof(*iph) || iph->ihl < 5 ||
+		    iph->ihl * 4 > len)
+			return NULL;
+		/* only the first fragment has the transport header */
+		if (ntohs(iph->frag_off) & IP_OFFMASK)
+			return NULL;
+		if (ntohs(iph->tot_len) >= iph->ihl * 4 &&
+		    ntohs(iph->tot_len) < len)
+			end = pkt + ntohs(iph->tot_len);
+		proto = iph->protocol;
+		l4 = pkt + iph->ihl * 4;
+		break;
+	}
+	case AF_INET6: {
+		const struct ip6_hdr *ip6h = (const struct ip6_hdr *)pkt;
+
+		if (len < sizeof(*ip6h))
+			return NULL;
+		proto = ip6h->ip6_nxt;
+		l4 = pkt + sizeof(*ip6h);
+		/* skip the extension headers which can precede TCP/UDP */
+		while (proto == IPPROTO_HOPOPTS || proto == IPPROTO_ROUTING ||
+		       proto == IPPROTO_DSTOPTS) {
+			if (end - l4 < 8 || end - l4 < (l4[1] + 1) * 8)
+				return NULL;
+			proto = l4[0];
+			l4 += (l4[1] + 1) * 8;
+		}
+		break;
+	}
+	default:
+		return NULL;
+	}
+
+	switch (proto) {
+	case IPPROTO_TCP: {
+		const struct tcphdr *tcph = (const struct tcphdr *)l4;
+
+		if (end - l4 < (ptrdiff_t)sizeof(*tcph) ||
+		    end - l4 < tcph->doff * 4)
+			return NULL;
+		*sport = ntohs(tcph->source);
+		*dport = ntohs(tcph->dest);
+		l4 += tcph->doff * 4;
+		break;
+	}
+	case IPPROTO_UDP: {
+		const struct udphdr *udph = (const struct udphdr *)l4;
+
+		if (end - l4 < (ptrdiff_t)sizeof(*udph))
+			return NULL;
+		*sport = ntohs(udph->source);
+		*dport = ntohs(udph->dest);
+		l4 += sizeof(*udph);
+		break;
+	}
+	default:
+		return NULL;
+	}
+
+	*plen = end - l4;
+	return l4;
+}
+
+static int interp_payload(struct ulogd_pluginstance *pi)
+{
+	struct payload_priv *priv = (struct payload_priv *)pi->private;
+	struct ulogd_key *inp = pi->input.keys;
+	struct ulogd_key *ret = pi->output.keys;
+	const uint8_t *payload;
+	size_t len, offset;
+	uint16_t sport, dport;
+	int id = -1;
+
+	if (!pp_is_valid(inp, KEY_RAW_PKT))
+		goto nomatch;
+
+	payload = get_payload(ikey_get_ptr(&inp[KEY_RAW_PKT]),
+			      ikey_get_u32(&inp[KEY_RAW_PKTLEN]),
+			      ikey_get_u8(&inp[KEY_OOB_FAMILY]),
+			      &len, &sport, &dport);
+	if (payload == NULL || len == 0)
+		goto nomatch;
+	if (!priv->all_ports && !port_is_set(priv, sport) &&
+	    !port_is_set(priv, dport))
+		goto nomatch;
+
+	id = ulogd_acm_search(priv->acm, payload, len, &offset);
+	if (id < 0)
+		goto nomatch;
+
+	okey_set_ptr(&ret[KEY_PAYLOAD_MATCH], priv->names[id]);
+	okey_set_u32(&ret[KEY_PAYLOAD_MATCH_ID], id);
+	okey_set_u32(&ret[KEY_PAYLOAD_OFFSET], offset);
+
+	return ULOGD_IRET_OK;
+
+nomatch:
+	if (unmatched_ce(pi->config_kset).u.value)
+		return ULOGD_IRET_OK;
+	return ULOGD_IRET_STOP;
+}
+
+static int configure_payload(struct ulogd_pluginstance *upi,
+			     struct ulogd_pluginstance_stack *stack)
+{
+	struct payload_priv *priv = (struct payload_priv *)upi->private;
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (parse_ports(priv, ports_ce(upi->config_kset).u.string) < 0) {
+		ulogd_log(ULOGD_FATAL, "PAYLOAD: invalid ports `%s'\n",
+			  ports_ce(upi->config_kset).u.string);
+		return -1;
+	}
+	if (patterns_ce(upi->config_kset).u.string[0] == '\0' &&
+	    file_ce(upi->config_kset).u.string[0] == '\0') {
+		ulogd_log(ULOGD_FATAL, "PAYLOAD: no patterns configured\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int start_payload(struct ulogd_pluginstance *upi)
+{
+	struct payload_priv *priv = (struct payload_priv *)upi->private;
+	const char *file = file_ce(upi->config_kset).u.string;
+
+	priv->acm = ulogd_acm_alloc(nocase_ce(upi->config_kset).u.value);
+	if (priv->acm == NULL) {
+		ulogd_log(ULOGD_ERROR, "PAYLOAD: out of memory\n");
+		return -1;
+	}
+
+	if (add_patterns_list(priv, patterns_ce(upi->config_kset).u.string) < 0 ||
+	    (file[0] && add_patterns_file(priv, file) < 0))
+		goto err;
+
+	if (priv->num_names == 0) {
+		ulogd_log(ULOGD_ERROR, "PAYLOAD: no patterns found\n");
+		goto err;
+	}
+	if (ulogd_acm_compile(priv->acm) < 0) {
+		ulogd_log(ULOGD_ERROR, "PAYLOAD: can't compile %u patterns\n",
+			  priv->num_names);
+		goto err;
+	}
+	ulogd_log(ULOGD_INFO, "PAYLOAD: %u patterns\n", priv->num_names);
+
+	return 0;
+
+err:
+	payload_free(priv);
+	return -1;
+}
+
+static int stop_payload(struct ulogd_pluginstance *upi)
+{
+	payload_free((struct payload_priv *)upi->private);
+	return 0;
+}
+
+static struct ulogd_plugin payload_plugin = {
+	.name = "PAYLOAD",
+	.input = {
+		.keys = payload_inp,
+		.num_keys = ARRAY_SIZE(payload_inp),
+		.type = ULOGD_DTYPE_PACKET,
+	},
+	.output = {
+		.keys = payload_outp,
+		.num_keys = ARRAY_SIZE(payload_outp),
+		.type = ULOGD_DTYPE_PACKET,
+	},
+	.config_kset	= &payload_kset,
+	.interp		= &interp_payload,
+	.configure	= &configure_payload,
+	.start		= &start_payload,
+	.stop		= &stop_payload,
+	.priv_size	= sizeof(struct payload_priv),
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&payload_plugin);
+}
@@ -30,14 +30,18 @@ static struct ulogd_key printflow_outp[] = {
 	},
 };
 
+struct printflow_priv {
+	char buf[4096];
+};
+
 static int printflow_interp(struct ulogd_pluginstance *upi)
 {
 	struct ulogd_key *inp = upi->input.keys;
 	struct ulogd_key *ret = upi->output.keys;
-	static char buf[4096];
+	struct printflow_priv *priv = (struct printflow_priv *)upi->private;
 
-	printflow_print(inp, buf);
-	okey_set_ptr(&ret[0], buf);
+	printflow_print(inp, priv->buf);
+	okey_set_ptr(&ret[0], priv->buf);
 	return ULOGD_IRET_OK;
 }
 
@@ -54,6 +58,7 @@ static struct ulogd_plugin printflow_plugin = {
 		.type = ULOGD_DTYPE_FLOW,
 	},
 	.interp = &printflow_interp,
+	.priv_size = sizeof(struct printflow_priv),
 	.version = VERSION,
 };
 
@@ -30,14 +30,18 @@ static struct ulogd_key printpkt_outp[] = {
 	},
 };
 
+struct printpkt_priv {
+	char buf[4096];
+};
+
 static int printpkt_interp(struct ulogd_pluginstance *upi)
 {
 	struct ulogd_key *inp = upi->input.keys;
 	struct ulogd_key *ret = upi->output.keys;
-	static char buf[4096];
+	struct printpkt_priv *priv = (struct printpkt_priv *)upi->private;
 
-	printpkt_print(inp, buf);
-	okey_set_ptr(&ret[0], buf);
+	printpkt_print(inp, priv->buf);
+	okey_set_ptr(&ret[0], priv->buf);
 	return ULOGD_IRET_OK;
 }
 
@@ -54,6 +58,7 @@ static struct ulogd_plugin printpkt_plugin = {
 		.type = ULOGD_DTYPE_PACKET,
 	},
 	.interp = &printpkt_interp,
+	.priv_size = sizeof(struct printpkt_priv),
 	.version = VERSION,
 };
 
@@ -67,10 +67,10 @@ static int interp_pwsniff(struct ulogd_pluginstance *pi)
 	int len, pw_len, cont = 0;
 	unsigned int i;
 
-	if (!IS_VALID(pi->input.keys[0]))
+	if (!pp_is_valid(pi->input.keys, 0))
 		return ULOGD_IRET_STOP;
 	
-	iph = (struct iphdr *) pi->input.keys[0].u.value.ptr;
+	iph = (struct iphdr *) ikey_get_ptr(&pi->input.keys[0]);
 	protoh = (u_int32_t *)iph + iph->ihl;
 	tcph = protoh;
 	tcplen = ntohs(iph->tot_len) - iph->ihl * 4;
@@ -113,24 +113,12 @@ static int interp_pwsniff(struct ulogd_pluginstance *pi)
 		}
 	}
 
-	if (len) {
-		char *ptr;
-		ptr = (char *) malloc(len+1);
-		if (!ptr)
-			return ULOGD_IRET_ERR;
-		strncpy(ptr, (char *)begp, len);
-		ptr[len] = '\0';
-		okey_set_ptr(&ret[0], ptr);
-	}
-	if (pw_len) {
-		char *ptr;
-		ptr = (char *) malloc(pw_len+1);
-		if (!ptr)
-			return ULOGD_IRET_ERR;
-		strncpy(ptr, (char *)pw_begp, pw_len);
-		ptr[pw_len] = '\0';
-		okey_set_ptr(&ret[1], ptr);
-	}
+	if (len && okey_set_str_arena(pi, &ret[0], (char *)begp,
+				      strnlen((char *)begp, len)) < 0)
+		return ULOGD_IRET_ERR;
+	if (pw_len && okey_set_str_arena(pi, &ret[1], (char *)pw_begp,
+					 strnlen((char *)pw_begp, pw_len)) < 0)
+		return ULOGD_IRET_ERR;
 	return ULOGD_IRET_OK;
 }
 
@@ -144,12 +132,12 @@ static struct ulogd_key pwsniff_outp[] = {
 	{
 		.name	= "pwsniff.user",
 		.type	= ULOGD_RET_STRING,
-		.flags	= ULOGD_RETF_FREE,
+		.flags	= ULOGD_RETF_NONE,
 	},
 	{
 		.name 	= "pwsniff.pass",
 		.type	= ULOGD_RET_STRING,
-		.flags	= ULOGD_RETF_FREE,
+		.flags	= ULOGD_RETF_NONE,
 	},
 };
 
@@ -0,0 +1,419 @@
+/* ulogd_filter_RATELIMIT.c
+ *
+ * ulogd interpreter plugin limiting the rate of events per tuple
+ *
+ * Each tuple of keys (by default the source address) has a token
+ * bucket of burst events, refilled at rate events per second. Events
+ * finding it empty are dropped. Every interval seconds, one event is
+ * emitted for each tuple which had events dropped, with ratelimit.tuple,
+ * the tuple as text, and ratelimit.drops, their number.
+ *
+ * The bucket is kept as the time at which it will be full again (the
+ * generic cell rate algorithm), so an event costs a hash lookup and an
+ * addition on the clock sampled by the core. The table has a fixed
+ * number of entries, allocated at start. When it is full, the least
+ * recently seen tuple is forgotten, and its drops are only logged.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/clock.h>
+#include <ulogd/timer.h>
+#include <ulogd/tuple.h>
+
+#define NSEC_PER_SEC		1000000000ULL
+
+enum ratelimit_conf {
+	RATELIMIT_CONF_KEYS,
+	RATELIMIT_CONF_RATE,
+	RATELIMIT_CONF_BURST,
+	RATELIMIT_CONF_ENTRIES,
+	RATELIMIT_CONF_INTERVAL,
+	RATELIMIT_CONF_MAX,
+};
+
+static struct config_keyset ratelimit_kset = {
+	.num_ces = RATELIMIT_CONF_MAX,
+	.ces = {
+		[RATELIMIT_CONF_KEYS] = {
+			.key	 = "keys",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "ip.saddr",
+		},
+		/* in events per second */
+		[RATELIMIT_CONF_RATE] = {
+			.key	 = "rate",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 100,
+		},
+		[RATELIMIT_CONF_BURST] = {
+			.key	 = "burst",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 200,
+		},
+		[RATELIMIT_CONF_ENTRIES] = {
+			.key	 = "entries",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 65536,
+		},
+		/* in seconds */
+		[RATELIMIT_CONF_INTERVAL] = {
+			.key	 = "interval",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 60,
+		},
+	},
+};
+#define keys_ce(x)	(x->ces[RATELIMIT_CONF_KEYS])
+#define rate_ce(x)	(x->ces[RATELIMIT_CONF_RATE])
+#define burst_ce(x)	(x->ces[RATELIMIT_CONF_BURST])
+#define entries_ce(x)	(x->ces[RATELIMIT_CONF_ENTRIES])
+#define interval_ce(x)	(x->ces[RATELIMIT_CONF_INTERVAL])
+
+enum ratelimit_output_keys {
+	RATELIMIT_TUPLE,
+	RATELIMIT_DROPS,
+};
+
+static struct ulogd_key ratelimit_outp[] = {
+	[RATELIMIT_TUPLE] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "ratelimit.tuple",
+	},
+	[RATELIMIT_DROPS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "ratelimit.drops",
+	},
+};
+
+#define RATELIMIT_NONE		UINT32_MAX
+#define RATELIMIT_MAX_ENTRIES	(1 << 24)
+#define RATELIMIT_MAX_INTERVAL	86400
+#define RATELIMIT_STRLEN	512
+
+struct ratelimit_entry {
+	uint32_t hnext;		/* in the bucket */
+	uint32_t prev;		/* more recently seen */
+	uint32_t next;		/* less recently seen */
+	uint32_t hash;
+	uint32_t valid;
+	uint32_t pad;
+	uint64_t full;		/* monotonic ns at which the bucket is full */
+	uint64_t drops;
+	uint32_t tuple[];
+};
+
+struct ratelimit_priv {
+	struct ulogd_tuple tuple;
+	uint32_t seed;
+	uint64_t period;	/* ns per token */
+	uint64_t depth;		/* ns for burst tokens */
+	size_t stride;
+	unsigned int num_entries;
+	unsigned int used;
+	uint8_t *entries;
+	uint32_t *buckets;
+	uint32_t bucket_mask;
+	uint32_t head;		/* most recently seen */
+	uint32_t tail;
+	uint64_t evicted;	/* drops of forgotten tuples */
+	uint32_t *scratch;
+	unsigned int interval;
+	struct ulogd_timer timer;
+	char str[RATELIMIT_STRLEN];
+};
+
+static inline struct ratelimit_entry *
+ratelimit_entry(struct ratelimit_priv *priv, uint32_t i)
+{
+	return (struct ratelimit_entry *)(priv->entries + i * priv->stride);
+}
+
+static void lru_unlink(struct ratelimit_priv *priv, uint32_t i)
+{
+	struct ratelimit_entry *e = ratelimit_entry(priv, i);
+
+	if (e->prev == RATELIMIT_NONE)
+		priv->head = e->next;
+	else
+		ratelimit_entry(priv, e->prev)->next = e->next;
+	if (e->next == RATELIMIT_NONE)
+		priv->tail = e->prev;
+	else
+		ratelimit_entry(priv, e->next)->prev = e->prev;
+}
+
+static void lru_push(struct ratelimit_priv *priv, uint32_t i)
+{
+	struct ratelimit_entry *e = ratelimit_entry(priv, i);
+
+	e->prev = RATELIMIT_NONE;
+	e->next = priv->head;
+	if (priv->head == RATELIMIT_NONE)
+		priv->tail = i;
+	else
+		ratelimit_entry(priv, priv->head)->prev = i;
+	priv->head = i;
+}
+
+/* take the least recently seen entry out of the table */
+static uint32_t ratelimit_evict(struct ratelimit_priv *priv)
+{
+	uint32_t i = priv->tail;
+	struct ratelimit_entry *e = ratelimit_entry(priv, i);
+	uint32_t *p;
+
+	for (p = &priv->buckets[e->hash & priv->bucket_mask]; *p != i;
+	     p = &ratelimit_entry(priv, *p)->hnext)
+		;
+	*p = e->hnext;
+	lru_unlink(priv, i);
+	priv->evicted += e->drops;
+
+	return i;
+}
+
+static int interp_ratelimit(struct ulogd_pluginstance *upi)
+{
+	struct ratelimit_priv *priv = (struct ratelimit_priv *)upi->private;
+	uint64_t now = ulogd_clock_monotonic();
+	size_t len = priv->tuple.len;
+	struct ratelimit_entry *e;
+	uint32_t valid, hash, i;
+
+	valid = ulogd_tuple_pack(&priv->tuple, upi->input.keys,
+				 priv->scratch);
+	hash = ulogd_tuple_hash(&priv->tuple, priv->scratch, valid,
+				priv->seed);
+
+	for (i = priv->buckets[hash & priv->bucket_mask]; i != RATELIMIT_NONE;
+	     i = e->hnext) {
+		e = ratelimit_entry(priv, i);
+		if (e->hash == hash && e->valid == valid &&
+		    memcmp(e->tuple, priv->scratch, len) == 0)
+			break;
+	}
+
+	if (i == RATELIMIT_NONE) {
+		if (priv->used < priv->num_entries)
+			i = priv->used++;
+		else
+			i = ratelimit_evict(priv);
+		e = ratelimit_entry(priv, i);
+		e->hash = hash;
+		e->valid = valid;
+		e->full = now;
+		e->drops = 0;
+		memcpy(e->tuple, priv->scratch, len);
+		e->hnext = priv->buckets[hash & priv->bucket_mask];
+		priv->buckets[hash & priv->bucket_mask] = i;
+	} else if (i != priv->head) {
+		lru_unlink(priv, i);
+	}
+	if (i != priv->head)
+		lru_push(priv, i);
+
+	/* one token is period ns until the bucket is full again */
+	if (e->full < now)
+		e->full = now;
+	if (e->full - now >= priv->depth) {
+		e->drops++;
+		return ULOGD_IRET_STOP;
+	}
+	e->full += priv->period;
+
+	return ULOGD_IRET_OK;
+}
+
+/* from the timer, the other keys of the stack have no value */
+static void ratelimit_timer_cb(struct ulogd_timer *t, void *data)
+{
+	struct ulogd_pluginstance *upi = data;
+	struct ratelimit_priv *priv = (struct ratelimit_priv *)upi->private;
+	struct ulogd_key *ret = upi->output.keys;
+	unsigned int i;
+
+	for (i = 0; i < priv->used; i++) {
+		struct ratelimit_entry *e = ratelimit_entry(priv, i);
+
+		if (!e->drops)
+			continue;
+		ulogd_tuple_format(&priv->tuple, e->tuple, e->valid,
+				   priv->str, sizeof(priv->str));
+		okey_set_ptr(&ret[RATELIMIT_TUPLE], priv->str);
+		okey_set_u64(&ret[RATELIMIT_DROPS], e->drops);
+		ulogd_propagate_results(upi);
+		e->drops = 0;
+	}
+
+	if (priv->evicted) {
+		ulogd_log(ULOGD_NOTICE, "%s: table full, %" PRIu64 " events "
+			  "dropped for forgotten tuples\n", upi->id,
+			  priv->evicted);
+		priv->evicted = 0;
+	}
+
+	ulogd_add_timer(&priv->timer, priv->interval);
+}
+
+static int configure_ratelimit(struct ulogd_pluginstance *upi,
+			       struct ulogd_pluginstance_stack *stack)
+{
+	struct ratelimit_priv *priv = (struct ratelimit_priv *)upi->private;
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (rate_ce(upi->config_kset).u.value <= 0 ||
+	    rate_ce(upi->config_kset).u.value > 1000000) {
+		ulogd_log(ULOGD_FATAL, "RATELIMIT: rate must be 1 to 1000000 "
+			  "events per second\n");
+		return -1;
+	}
+	if (burst_ce(upi->config_kset).u.value <= 0) {
+		ulogd_log(ULOGD_FATAL, "RATELIMIT: burst must be at least "
+			  "1\n");
+		return -1;
+	}
+	if (entries_ce(upi->config_kset).u.value <= 0 ||
+	    entries_ce(upi->config_kset).u.value > RATELIMIT_MAX_ENTRIES) {
+		ulogd_log(ULOGD_FATAL, "RATELIMIT: entries must be 1 to %d\n",
+			  RATELIMIT_MAX_ENTRIES);
+		return -1;
+	}
+	if (interval_ce(upi->config_kset).u.value <= 0 ||
+	    interval_ce(upi->config_kset).u.value > RATELIMIT_MAX_INTERVAL) {
+		ulogd_log(ULOGD_FATAL, "RATELIMIT: interval must be 1 to %d "
+			  "seconds\n", RATELIMIT_MAX_INTERVAL);
+		return -1;
+	}
+
+	if (ulogd_tuple_parse(&priv->tuple, keys_ce(upi->config_kset).u.string,
+			      0, "RATELIMIT") < 0)
+		return -1;
+
+	/* one input key per key of the tuple, wherever they come from */
+	free(upi->input.keys);
+	upi->input.keys = calloc(priv->tuple.num_keys,
+				 sizeof(struct ulogd_key));
+	if (!upi->input.keys) {
+		upi->input.num_keys = 0;
+		return -ENOMEM;
+	}
+	upi->input.num_keys = priv->tuple.num_keys;
+	ulogd_tuple_init_keys(&priv->tuple, upi->input.keys);
+
+	return 0;
+}
+
+static void ratelimit_free(struct ratelimit_priv *priv)
+{
+	free(priv->entries);
+	free(priv->buckets);
+	free(priv->scratch);
+	priv->entries = NULL;
+	priv->buckets = NULL;
+	priv->scratch = NULL;
+}
+
+static int start_ratelimit(struct ulogd_pluginstance *upi)
+{
+	struct ratelimit_priv *priv = (struct ratelimit_priv *)upi->private;
+	struct ulogd_key *inp = upi->input.keys;
+	uint32_t num_buckets = 1, i;
+
+	for (i = 0; i < priv->tuple.num_keys; i++)
+		if (!inp[i].u.source && !priv->tuple.field[i].hidden)
+			ulogd_log(ULOGD_NOTICE, "RATELIMIT: key `%s' not in "
+				  "stack, ignored\n", inp[i].name);
+
+	if (ulogd_tuple_start(&priv->tuple, inp, "RATELIMIT") < 0)
+		return -1;
+
+	priv->period = NSEC_PER_SEC / rate_ce(upi->config_kset).u.value;
+	priv->depth = priv->period * burst_ce(upi->config_kset).u.value;
+	priv->interval = interval_ce(upi->config_kset).u.value;
+	priv->num_entries = entries_ce(upi->config_kset).u.value;
+	priv->stride = (sizeof(struct ratelimit_entry) + priv->tuple.len +
+			7) & ~(size_t)7;
+	while (num_buckets < priv->num_entries)
+		num_buckets <<= 1;
+
+	priv->entries = malloc(priv->num_entries * priv->stride);
+	priv->buckets = malloc(num_buckets * sizeof(uint32_t));
+	priv->scratch = malloc(priv->tuple.len);
+	if (!priv->entries || !priv->buckets || !priv->scratch) {
+		ulogd_log(ULOGD_FATAL, "RATELIMIT: out of memory\n");
+		ratelimit_free(priv);
+		return -1;
+	}
+
+	memset(priv->buckets, 0xff, num_buckets * sizeof(uint32_t));
+	priv->bucket_mask = num_buckets - 1;
+	priv->head = priv->tail = RATELIMIT_NONE;
+	priv->used = 0;
+	priv->evicted = 0;
+	priv->seed = ulogd_clock_realtime();
+
+	ulogd_init_timer(&priv->timer, upi, ratelimit_timer_cb);
+	ulogd_add_timer(&priv->timer, priv->interval);
+
+	return 0;
+}
+
+/* drops since the last report aren't reported */
+static int stop_ratelimit(struct ulogd_pluginstance *upi)
+{
+	struct ratelimit_priv *priv = (struct ratelimit_priv *)upi->private;
+
+	if (priv->entries && ulogd_timer_pending(&priv->timer))
+		ulogd_del_timer(&priv->timer);
+	ratelimit_free(priv);
+	free(upi->input.keys);
+	upi->input.keys = NULL;
+	upi->input.num_keys = 0;
+	return 0;
+}
+
+static struct ulogd_plugin ratelimit_plugin = {
+	.name = "RATELIMIT",
+	.input = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+	},
+	.output = {
+		.keys = ratelimit_outp,
+		.num_keys = ARRAY_SIZE(ratelimit_outp),
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+	},
+	.config_kset	= &ratelimit_kset,
+	.interp		= &interp_ratelimit,
+	.configure	= &configure_ratelimit,
+	.start		= &start_ratelimit,
+	.stop		= &stop_ratelimit,
+	.priv_size	= sizeof(struct ratelimit_priv),
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&ratelimit_plugin);
+}
@@ -0,0 +1,535 @@
+/* ulogd_filter_SKETCH.c
+ *
+ * ulogd interpreter plugin turning packets or flows into periodic
+ * summaries: the most frequent values of a tuple of keys, and
+ * optionally how many distinct values of another tuple were seen, in
+ * total and with each of the most frequent ones. For example, with
+ * keys=tcp.dport and distinct=ip.saddr, the busiest ports and their
+ * number of distinct sources.
+ *
+ * The most frequent tuples are tracked by Space-Saving with a fixed
+ * number of counters, their counts bounded by a Count-Min sketch and
+ * the distinct values counted by HyperLogLog. Events stop here; every
+ * interval, one sum event is emitted with the totals and one for each
+ * of the top tuples, with the names of the keys of STATS and NFACCT so
+ * that the outputs for sums can be used. Then counting starts again.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ulogd/ulogd.h>
+#include <ulogd/clock.h>
+#include <ulogd/timer.h>
+#include <ulogd/tuple.h>
+#include <ulogd/sketch.h>
+
+enum sketch_conf {
+	SKETCH_CONF_KEYS,
+	SKETCH_CONF_DISTINCT,
+	SKETCH_CONF_INTERVAL,
+	SKETCH_CONF_TOP,
+	SKETCH_CONF_COUNTERS,
+	SKETCH_CONF_WIDTH,
+	SKETCH_CONF_PRECISION,
+	SKETCH_CONF_MAX,
+};
+
+static struct config_keyset sketch_kset = {
+	.num_ces = SKETCH_CONF_MAX,
+	.ces = {
+		[SKETCH_CONF_KEYS] = {
+			.key	 = "keys",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "ip.saddr",
+		},
+		[SKETCH_CONF_DISTINCT] = {
+			.key	 = "distinct",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+		/* in seconds */
+		[SKETCH_CONF_INTERVAL] = {
+			.key	 = "interval",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 60,
+		},
+		[SKETCH_CONF_TOP] = {
+			.key	 = "top",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 10,
+		},
+		/* of Space-Saving */
+		[SKETCH_CONF_COUNTERS] = {
+			.key	 = "counters",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1024,
+		},
+		/* of the rows of Count-Min */
+		[SKETCH_CONF_WIDTH] = {
+			.key	 = "width",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 8192,
+		},
+		/* of HyperLogLog, 2^precision registers */
+		[SKETCH_CONF_PRECISION] = {
+			.key	 = "precision",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 10,
+		},
+	},
+};
+#define keys_ce(x)	(x->ces[SKETCH_CONF_KEYS])
+#define distinct_ce(x)	(x->ces[SKETCH_CONF_DISTINCT])
+#define interval_ce(x)	(x->ces[SKETCH_CONF_INTERVAL])
+#define top_ce(x)	(x->ces[SKETCH_CONF_TOP])
+#define counters_ce(x)	(x->ces[SKETCH_CONF_COUNTERS])
+#define width_ce(x)	(x->ces[SKETCH_CONF_WIDTH])
+#define precision_ce(x)	(x->ces[SKETCH_CONF_PRECISION])
+
+enum sketch_output_keys {
+	SKETCH_SUM_NAME,
+	SKETCH_SUM_PKTS,
+	SKETCH_SUM_BYTES,
+	SKETCH_TIME_SEC,
+	SKETCH_TIME_USEC,
+	SKETCH_RANK,
+	SKETCH_TUPLE,
+	SKETCH_ERROR,
+	SKETCH_DISTINCT,
+};
+
+static struct ulogd_key sketch_outp[] = {
+	/* the instance id for the totals, followed by .<rank> for the top
+	 * tuples */
+	[SKETCH_SUM_NAME] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.name",
+	},
+	/* number of events, an upper bound for the top tuples */
+	[SKETCH_SUM_PKTS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.pkts",
+	},
+	/* not counted, for the outputs which need it */
+	[SKETCH_SUM_BYTES] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.bytes",
+	},
+	[SKETCH_TIME_SEC] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "oob.time.sec",
+	},
+	[SKETCH_TIME_USEC] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "oob.time.usec",
+	},
+	/* 0 for the totals */
+	[SKETCH_RANK] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sketch.rank",
+	},
+	[SKETCH_TUPLE] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sketch.tuple",
+	},
+	/* sum.pkts minus this is a lower bound */
+	[SKETCH_ERROR] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sketch.error",
+	},
+	/* for the top tuples, since they are tracked */
+	[SKETCH_DISTINCT] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sketch.distinct",
+	},
+};
+
+#define SKETCH_MAX_COUNTERS	(1 << 20)
+#define SKETCH_MAX_WIDTH	(1 << 24)
+#define SKETCH_STRLEN		512
+
+/* the registers a counter's tuple brought up, while they are few. A
+ * counter taken by a new tuple only has to empty this list, its 2^bits
+ * registers are cleared when the list overflows into them. */
+#define SKETCH_SPARSE		16
+
+struct sketch_sparse {
+	unsigned int used;		/* SKETCH_SPARSE + 1 once in hll */
+	uint32_t reg[SKETCH_SPARSE];	/* register << 8 | rank */
+};
+
+struct sketch_priv {
+	struct ulogd_tuple keys;
+	struct ulogd_tuple distinct;
+	int has_distinct;
+	unsigned int bits;		/* HyperLogLog precision */
+	uint32_t seed;
+	uint64_t events;
+	struct ulogd_topk *topk;
+	struct ulogd_cms cms;
+	uint8_t *hll;			/* total, then one per counter */
+	struct sketch_sparse *sparse;	/* one per counter */
+	uint8_t *hll_tmp;		/* to count from a sparse list */
+	uint32_t *scratch;		/* valid bitmap and packed keys */
+	uint32_t *scratch_distinct;
+	struct ulogd_timer timer;
+	char name[ULOGD_MAX_KEYLEN + 16];
+	char str[SKETCH_STRLEN];
+};
+
+/* 64 bits out of the 32 of the tuple hash, for Count-Min and
+ * HyperLogLog (the finalizer of splitmix64) */
+static inline uint64_t sketch_mix(uint32_t h)
+{
+	uint64_t z = h + 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint8_t *sketch_hll(struct sketch_priv *priv, uint32_t i)
+{
+	return priv->hll + ((size_t)(i + 1) << priv->bits);
+}
+
+static void sketch_expand(struct sketch_priv *priv,
+			  const struct sketch_sparse *s, uint8_t *hll)
+{
+	unsigned int j;
+
+	memset(hll, 0, 1U << priv->bits);
+	for (j = 0; j < s->used; j++)
+		hll[s->reg[j] >> 8] = s->reg[j] & 0xff;
+}
+
+static void sketch_distinct_add(struct sketch_priv *priv, uint32_t i,
+				uint64_t h)
+{
+	struct sketch_sparse *s = &priv->sparse[i];
+	uint32_t reg;
+	uint8_t rank;
+	unsigned int j;
+
+	if (s->used > SKETCH_SPARSE) {
+		ulogd_hll_add(sketch_hll(priv, i), priv->bits, h);
+		return;
+	}
+
+	reg = ulogd_hll_index(h, priv->bits, &rank);
+	for (j = 0; j < s->used; j++) {
+		if (s->reg[j] >> 8 == reg) {
+			if ((s->reg[j] & 0xff) < rank)
+				s->reg[j] = reg << 8 | rank;
+			return;
+		}
+	}
+	if (s->used < SKETCH_SPARSE) {
+		s->reg[s->used++] = reg << 8 | rank;
+		return;
+	}
+
+	sketch_expand(priv, s, sketch_hll(priv, i));
+	s->used = SKETCH_SPARSE + 1;
+	ulogd_hll_add(sketch_hll(priv, i), priv->bits, h);
+}
+
+static uint64_t sketch_distinct_count(struct sketch_priv *priv, uint32_t i)
+{
+	const struct sketch_sparse *s = &priv->sparse[i];
+
+	if (s->used > SKETCH_SPARSE)
+		return ulogd_hll_count(sketch_hll(priv, i), priv->bits);
+	sketch_expand(priv, s, priv->hll_tmp);
+	return ulogd_hll_count(priv->hll_tmp, priv->bits);
+}
+
+static int interp_sketch(struct ulogd_pluginstance *upi)
+{
+	struct sketch_priv *priv = (struct sketch_priv *)upi->private;
+	struct ulogd_key *inp = upi->input.keys;
+	uint32_t hash, i;
+	int fresh;
+
+	priv->scratch[0] = ulogd_tuple_pack(&priv->keys, inp,
+					    priv->scratch + 1);
+	hash = ulogd_tuple_hash(&priv->keys, priv->scratch + 1,
+				priv->scratch[0], priv->seed);
+	i = ulogd_topk_add(priv->topk, priv->scratch, hash, &fresh);
+	ulogd_cms_add(&priv->cms, sketch_mix(hash));
+	priv->events++;
+
+	if (priv->has_distinct) {
+		uint32_t *d = priv->scratch_distinct;
+		uint64_t h;
+
+		h = sketch_mix(ulogd_tuple_hash(&priv->distinct, d,
+				ulogd_tuple_pack(&priv->distinct, inp, d),
+				priv->seed));
+		if (fresh)
+			priv->sparse[i].used = 0;
+		ulogd_hll_add(priv->hll, priv->bits, h);
+		sketch_distinct_add(priv, i, h);
+	}
+
+	return ULOGD_IRET_STOP;
+}
+
+static void sketch_emit(struct ulogd_pluginstance *upi, unsigned int rank,
+			uint32_t i, const struct timeval *tv)
+{
+	struct sketch_priv *priv = (struct sketch_priv *)upi->private;
+	struct ulogd_key *ret = upi->output.keys;
+
+	okey_set_u32(&ret[SKETCH_TIME_SEC], tv->tv_sec);
+	okey_set_u32(&ret[SKETCH_TIME_USEC], tv->tv_usec);
+	okey_set_u32(&ret[SKETCH_RANK], rank);
+
+	if (rank == 0) {
+		okey_set_ptr(&ret[SKETCH_SUM_NAME], upi->id);
+		okey_set_u64(&ret[SKETCH_SUM_PKTS], priv->events);
+		if (priv->has_distinct)
+			okey_set_u64(&ret[SKETCH_DISTINCT],
+				     ulogd_hll_count(priv->hll, priv->bits));
+	} else {
+		const uint32_t *key = ulogd_topk_key(priv->topk, i);
+		uint64_t count = ulogd_topk_count(priv->topk, i);
+		uint64_t lower = count - ulogd_topk_error(priv->topk, i);
+		uint64_t cms;
+
+		/* both are upper bounds */
+		cms = ulogd_cms_estimate(&priv->cms,
+				sketch_mix(ulogd_topk_hash(priv->topk, i)));
+		if (cms < count)
+			count = cms;
+
+		snprintf(priv->name, sizeof(priv->name), "%s.%u", upi->id,
+			 rank);
+		ulogd_tuple_format(&priv->keys, key + 1, key[0], priv->str,
+				   sizeof(priv->str));
+		okey_set_ptr(&ret[SKETCH_SUM_NAME], priv->name);
+		okey_set_u64(&ret[SKETCH_SUM_PKTS], count);
+		okey_set_ptr(&ret[SKETCH_TUPLE], priv->str);
+		okey_set_u64(&ret[SKETCH_ERROR], count - lower);
+		if (priv->has_distinct)
+			okey_set_u64(&ret[SKETCH_DISTINCT],
+				     sketch_distinct_count(priv, i));
+	}
+
+	ulogd_propagate_results(upi);
+}
+
+static void sketch_timer_cb(struct ulogd_timer *t, void *data)
+{
+	struct ulogd_pluginstance *upi = data;
+	struct sketch_priv *priv = (struct sketch_priv *)upi->private;
+	unsigned int rank, top = top_ce(upi->config_kset).u.value;
+	struct timeval tv;
+	uint32_t i;
+
+	ulogd_clock_timeval(&tv);
+	sketch_emit(upi, 0, ULOGD_TOPK_NONE, &tv);
+	for (i = ulogd_topk_first(priv->topk), rank = 1;
+	     i != ULOGD_TOPK_NONE && rank <= top;
+	     i = ulogd_topk_next(priv->topk, i), rank++)
+		sketch_emit(upi, rank, i, &tv);
+
+	/* the counters of the tuples are cleared as they are taken again */
+	ulogd_topk_reset(priv->topk);
+	ulogd_cms_reset(&priv->cms);
+	if (priv->has_distinct)
+		memset(priv->hll, 0, 1U << priv->bits);
+	priv->events = 0;
+
+	ulogd_add_timer(&priv->timer, interval_ce(upi->config_kset).u.value);
+}
+
+static int configure_sketch(struct ulogd_pluginstance *upi,
+			    struct ulogd_pluginstance_stack *stack)
+{
+	struct sketch_priv *priv = (struct sketch_priv *)upi->private;
+	struct config_keyset *kset = upi->config_kset;
+	unsigned int num_keys;
+	int ret;
+
+	ret = config_parse_file(upi->id, kset);
+	if (ret < 0)
+		return ret;
+
+	if (interval_ce(kset).u.value <= 0 || top_ce(kset).u.value <= 0) {
+		ulogd_log(ULOGD_FATAL, "SKETCH: interval and top must be "
+			  "positive\n");
+		return -1;
+	}
+	if (counters_ce(kset).u.value < top_ce(kset).u.value ||
+	    counters_ce(kset).u.value > SKETCH_MAX_COUNTERS) {
+		ulogd_log(ULOGD_FATAL, "SKETCH: counters must be top to %d\n",
+			  SKETCH_MAX_COUNTERS);
+		return -1;
+	}
+	if (width_ce(kset).u.value <= 0 ||
+	    width_ce(kset).u.value > SKETCH_MAX_WIDTH) {
+		ulogd_log(ULOGD_FATAL, "SKETCH: width must be 1 to %d\n",
+			  SKETCH_MAX_WIDTH);
+		return -1;
+	}
+	if (precision_ce(kset).u.value < ULOGD_HLL_MIN_BITS ||
+	    precision_ce(kset).u.value > ULOGD_HLL_MAX_BITS) {
+		ulogd_log(ULOGD_FATAL, "SKETCH: precision must be %d to %d\n",
+			  ULOGD_HLL_MIN_BITS, ULOGD_HLL_MAX_BITS);
+		return -1;
+	}
+
+	if (ulogd_tuple_parse(&priv->keys, keys_ce(kset).u.string, 0,
+			      "SKETCH") < 0)
+		return -1;
+	num_keys = priv->keys.num_keys;
+	priv->has_distinct = distinct_ce(kset).u.string[0] != '\0';
+	if (priv->has_distinct) {
+		if (ulogd_tuple_parse(&priv->distinct,
+				      distinct_ce(kset).u.string, num_keys,
+				      "SKETCH") < 0)
+			return -1;
+		num_keys += priv->distinct.num_keys;
+	}
+
+	/* one input key per key of the tuples, wherever they come from */
+	free(upi->input.keys);
+	upi->input.keys = calloc(num_keys, sizeof(struct ulogd_key));
+	if (!upi->input.keys) {
+		upi->input.num_keys = 0;
+		return -ENOMEM;
+	}
+	upi->input.num_keys = num_keys;
+	ulogd_tuple_init_keys(&priv->keys, upi->input.keys);
+	if (priv->has_distinct)
+		ulogd_tuple_init_keys(&priv->distinct, upi->input.keys);
+
+	return 0;
+}
+
+static void sketch_free(struct sketch_priv *priv)
+{
+	ulogd_topk_free(priv->topk);
+	ulogd_cms_free(&priv->cms);
+	free(priv->hll);
+	free(priv->sparse);
+	free(priv->hll_tmp);
+	free(priv->scratch);
+	free(priv->scratch_distinct);
+	priv->topk = NULL;
+	priv->hll = NULL;
+	priv->sparse = NULL;
+	priv->hll_tmp = NULL;
+	priv->scratch = NULL;
+	priv->scratch_distinct = NULL;
+}
+
+static int start_sketch(struct ulogd_pluginstance *upi)
+{
+	struct sketch_priv *priv = (struct sketch_priv *)upi->private;
+	struct config_keyset *kset = upi->config_kset;
+	struct ulogd_key *inp = upi->input.keys;
+	unsigned int counters = counters_ce(kset).u.value;
+	unsigned int i;
+
+	for (i = 0; i < upi->input.num_keys; i++)
+		if (!inp[i].u.source && strcmp(inp[i].name, "oob.family"))
+			ulogd_log(ULOGD_NOTICE, "SKETCH: key `%s' not in "
+				  "stack, ignored\n", inp[i].name);
+
+	if (ulogd_tuple_start(&priv->keys, inp, "SKETCH") < 0 ||
+	    (priv->has_distinct &&
+	     ulogd_tuple_start(&priv->distinct, inp, "SKETCH") < 0))
+		return -1;
+
+	priv->bits = precision_ce(kset).u.value;
+	priv->seed = ulogd_clock_realtime();
+	priv->events = 0;
+	/* the valid bitmap is part of the key */
+	priv->topk = ulogd_topk_alloc(counters, 4 + priv->keys.len);
+	priv->scratch = malloc(4 + priv->keys.len);
+	if (ulogd_cms_init(&priv->cms, width_ce(kset).u.value) < 0)
+		priv->cms.rows = NULL;
+	if (priv->has_distinct) {
+		/* pages of counters never overflowing stay untouched */
+		priv->hll = calloc(counters + 1, 1U << priv->bits);
+		priv->sparse = calloc(counters, sizeof(*priv->sparse));
+		priv->hll_tmp = malloc(1U << priv->bits);
+		priv->scratch_distinct = malloc(priv->distinct.len);
+	}
+	if (!priv->topk || !priv->scratch || !priv->cms.rows ||
+	    (priv->has_distinct && (!priv->hll || !priv->sparse ||
+				    !priv->hll_tmp ||
+				    !priv->scratch_distinct))) {
+		ulogd_log(ULOGD_FATAL, "SKETCH: out of memory\n");
+		sketch_free(priv);
+		return -1;
+	}
+
+	ulogd_init_timer(&priv->timer, upi, sketch_timer_cb);
+	ulogd_add_timer(&priv->timer, interval_ce(kset).u.value);
+
+	return 0;
+}
+
+/* the counts of the interval in progress are dropped */
+static int stop_sketch(struct ulogd_pluginstance *upi)
+{
+	struct sketch_priv *priv = (struct sketch_priv *)upi->private;
+
+	if (priv->topk)
+		ulogd_del_timer(&priv->timer);
+	sketch_free(priv);
+	free(upi->input.keys);
+	upi->input.keys = NULL;
+	upi->input.num_keys = 0;
+	return 0;
+}
+
+static struct ulogd_plugin sketch_plugin = {
+	.name = "SKETCH",
+	.input = {
+		.type = ULOGD_DTYPE_PACKET | ULOGD_DTYPE_FLOW,
+	},
+	.output = {
+		.keys = sketch_outp,
+		.num_keys = ARRAY_SIZE(sketch_outp),
+		.type = ULOGD_DTYPE_SUM,
+	},
+	.config_kset	= &sketch_kset,
+	.interp		= &interp_sketch,
+	.configure	= &configure_sketch,
+	.start		= &start_sketch,
+	.stop		= &stop_sketch,
+	.priv_size	= sizeof(struct sketch_priv),
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&sketch_plugin);
+}
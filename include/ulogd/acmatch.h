@@ -0,0 +1,31 @@
+/* Multi-pattern matching with an Aho-Corasick automaton
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_ACMATCH_H
+#define _ULOGD_ACMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ulogd_acm;
+
+/* with nocase, ASCII letters match regardless of their case */
+struct ulogd_acm *ulogd_acm_alloc(int nocase);
+void ulogd_acm_free(struct ulogd_acm *acm);
+
+/* patterns are binary, id is returned by ulogd_acm_search(), the first
+ * one is kept for duplicates. Returns -1 if out of memory or empty. */
+int ulogd_acm_add(struct ulogd_acm *acm, const void *pattern, size_t len,
+		  unsigned int id);
+
+/* build the automaton once all patterns are added, none can be added
+ * afterwards. Returns -1 if out of memory or too large. */
+int ulogd_acm_compile(struct ulogd_acm *acm);
+
+/* the id of the match that ends first in buf, the longest pattern if
+ * several end there, and its start in *offset. -1 if none matches. */
+int ulogd_acm_search(const struct ulogd_acm *acm, const void *buf,
+		     size_t len, size_t *offset);
+
+#endif
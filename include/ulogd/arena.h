@@ -0,0 +1,53 @@
+/* Bump pointer allocator for the values of one event
+ *
+ * Each stack owns an arena. Plugins allocate the strings and buffers
+ * they attach to output keys from it, and the core releases all of them
+ * at once after the event went through the stack, by resetting the
+ * pointer. Once the arena grew to the size needed by the largest
+ * events, no more calls to malloc() are made.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_ARENA_H
+#define _ULOGD_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ULOGD_ARENA_ALIGN	16
+#define ULOGD_ARENA_MIN_SIZE	4096
+
+struct ulogd_arena_chunk;
+
+struct ulogd_arena {
+	char *cur;
+	char *end;
+	/* the chunk in use first, older ones after it */
+	struct ulogd_arena_chunk *chunks;
+};
+
+void ulogd_arena_init(struct ulogd_arena *a);
+/* release everything allocated since the last reset */
+void ulogd_arena_reset(struct ulogd_arena *a);
+void ulogd_arena_fini(struct ulogd_arena *a);
+
+void *__ulogd_arena_alloc(struct ulogd_arena *a, size_t size);
+
+/* the memory is aligned on ULOGD_ARENA_ALIGN, NULL if out of memory */
+static inline void *ulogd_arena_alloc(struct ulogd_arena *a, size_t size)
+{
+	size_t len = (size + ULOGD_ARENA_ALIGN - 1) &
+		     ~(size_t)(ULOGD_ARENA_ALIGN - 1);
+	char *p = a->cur;
+
+	if (len < size || len > (size_t)(a->end - p))
+		return __ulogd_arena_alloc(a, size);
+
+	a->cur = p + len;
+	return p;
+}
+
+/* NUL terminated copy of the first len bytes of s */
+char *ulogd_arena_strndup(struct ulogd_arena *a, const char *s, size_t len);
+
+#endif
@@ -0,0 +1,40 @@
+/* Clock sampled once per main loop iteration
+ *
+ * Reading the time for each event is a significant part of the cost of
+ * simple stacks, and a per-event precision is rarely needed when the
+ * kernel doesn't provide a timestamp. The core samples the clock after
+ * each wake up of the main loop and plugins read the cached values.
+ * Timers refresh it when set and before select, so that a long
+ * callback doesn't delay them.
+ * These functions are only meant to be used from the main loop thread.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_CLOCK_H
+#define _ULOGD_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* called by the core, and by sources which process a long batch */
+void ulogd_clock_update(void);
+
+time_t ulogd_clock_sec(void);
+void ulogd_clock_timeval(struct timeval *tv);
+/* wall clock and CLOCK_MONOTONIC, in nanoseconds */
+uint64_t ulogd_clock_realtime(void);
+uint64_t ulogd_clock_monotonic(void);
+
+/* a strftime() result in local time, only formatted again when the
+ * second changes */
+struct ulogd_timefmt {
+	time_t sec;
+	unsigned int len;		/* 0 until formatted once */
+	char str[64];
+};
+
+const char *ulogd_timefmt(struct ulogd_timefmt *tf, time_t sec,
+			  const char *fmt);
+
+#endif
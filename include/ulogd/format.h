@@ -0,0 +1,34 @@
+/* Formatting of addresses and binary data as text
+ *
+ * Replacements for the sprintf() and inet_ntop() calls of the filters
+ * and printers, producing the same text. All functions write a
+ * terminating NUL and return a pointer to it, so that calls can be
+ * chained. They may write scratch bytes after the NUL, but never past
+ * the documented buffer sizes.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_FORMAT_H
+#define _ULOGD_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* buffer sizes, the same as INET_ADDRSTRLEN and INET6_ADDRSTRLEN */
+#define ULOGD_IP4STR_LEN	16
+#define ULOGD_IP6STR_LEN	46
+
+/* lower case hex digits of len bytes, dst must hold 2 * len + 1 bytes */
+char *ulogd_format_hex(char *dst, const void *src, size_t len);
+
+/* dotted quad of an IPv4 address in network byte order */
+char *ulogd_format_ipv4(char *dst, uint32_t addr);
+
+/* RFC 5952 text of an IPv6 address, as printed by inet_ntop() */
+char *ulogd_format_ipv6(char *dst, const void *addr);
+
+/* "xx:xx:..." with sep between the bytes, dst must hold 3 * len + 1
+ * bytes (1 if len is 0) */
+char *ulogd_format_mac(char *dst, const void *mac, size_t len, char sep);
+
+#endif
@@ -0,0 +1,73 @@
+/* Log-linear latency histograms and the cycle counter feeding them
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_HISTOGRAM_H
+#define _ULOGD_HISTOGRAM_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* values below ULOGD_HIST_SUB are counted exactly, above that each
+ * power of two is split in ULOGD_HIST_SUB buckets, which bounds the
+ * relative error to 1 / ULOGD_HIST_SUB */
+#define ULOGD_HIST_SUB_BITS	3
+#define ULOGD_HIST_SUB		(1 << ULOGD_HIST_SUB_BITS)
+#define ULOGD_HIST_BUCKETS	((64 - ULOGD_HIST_SUB_BITS + 1) * ULOGD_HIST_SUB)
+
+/* only updated from the main loop, so no locking is needed; readers
+ * like signal handlers may see a slightly inconsistent snapshot */
+struct ulogd_histogram {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[ULOGD_HIST_BUCKETS];
+};
+
+static inline unsigned int ulogd_hist_index(uint64_t v)
+{
+	unsigned int exp;
+
+	if (v < ULOGD_HIST_SUB)
+		return v;
+
+	exp = 63 - __builtin_clzll(v);
+	return ((exp - ULOGD_HIST_SUB_BITS + 1) << ULOGD_HIST_SUB_BITS) +
+	       ((v >> (exp - ULOGD_HIST_SUB_BITS)) & (ULOGD_HIST_SUB - 1));
+}
+
+static inline void ulogd_hist_add(struct ulogd_histogram *h, uint64_t v)
+{
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+	h->buckets[ulogd_hist_index(v)]++;
+}
+
+/* highest value of the bucket holding the given percentile (0 to 100) */
+uint64_t ulogd_hist_percentile(const struct ulogd_histogram *h, double p);
+
+/* a cheap, monotonic counter: the time stamp counter where there is one,
+ * CLOCK_MONOTONIC in nanoseconds elsewhere */
+static inline uint64_t ulogd_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t v;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (v));
+	return v;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* start measuring the rate of ulogd_cycles(), it is only known
+ * accurately after a few milliseconds */
+void ulogd_cycles_calibrate(void);
+uint64_t ulogd_cycles_to_ns(uint64_t cycles);
+
+#endif
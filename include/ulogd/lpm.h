@@ -0,0 +1,53 @@
+/* Longest prefix match of IPv4 and IPv6 addresses
+ *
+ * Prefixes carrying a text tag are compiled into a single read-only
+ * image, which can be written to a file and mapped back later without
+ * rebuilding it.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_LPM_H
+#define _ULOGD_LPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ulogd_lpm_builder;
+struct ulogd_lpm;
+
+struct ulogd_lpm_builder *ulogd_lpm_builder_alloc(void);
+void ulogd_lpm_builder_free(struct ulogd_lpm_builder *b);
+
+/* addr is in network byte order, 4 or 16 bytes depending on family.
+ * Host bits are ignored, the last tag added wins for duplicates.
+ * Returns -1 if out of memory or if the arguments are invalid. */
+int ulogd_lpm_add(struct ulogd_lpm_builder *b, int family, const void *addr,
+		  unsigned int bits, const char *tag);
+
+/* the image of all added prefixes, to be freed by the caller. source
+ * is stored in it to recognize what it was built from, see
+ * ulogd_lpm_open(). Returns NULL if out of memory or too large. */
+void *ulogd_lpm_compile(struct ulogd_lpm_builder *b, const uint64_t source[2],
+			size_t *size);
+
+/* use an image built by ulogd_lpm_compile(), which then belongs to the
+ * returned table */
+struct ulogd_lpm *ulogd_lpm_load(void *image, size_t size);
+
+/* map an image from a file, NULL with errno set if it can't be read,
+ * is invalid or, if source isn't NULL, was built from something else */
+struct ulogd_lpm *ulogd_lpm_open(const char *path, const uint64_t source[2]);
+
+void ulogd_lpm_close(struct ulogd_lpm *lpm);
+
+/* write the image of lpm to path, atomically replacing it */
+int ulogd_lpm_save(const struct ulogd_lpm *lpm, const char *path);
+
+unsigned int ulogd_lpm_count(const struct ulogd_lpm *lpm);
+
+/* tag of the longest prefix containing addr, NULL if none. The string
+ * stays valid until ulogd_lpm_close(). */
+const char *ulogd_lpm_lookup(const struct ulogd_lpm *lpm, int family,
+			     const void *addr);
+
+#endif
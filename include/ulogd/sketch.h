@@ -0,0 +1,86 @@
+/* Streaming summaries in fixed memory
+ *
+ * Space-Saving keeps the most frequent keys of a stream with a bounded
+ * number of counters, Count-Min estimates the count of any key and
+ * HyperLogLog the number of distinct keys. Updates are O(1) and never
+ * allocate. Keys are given with their hash, computed by the caller.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_SKETCH_H
+#define _ULOGD_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ULOGD_TOPK_NONE		UINT32_MAX
+
+struct ulogd_topk;
+
+struct ulogd_topk *ulogd_topk_alloc(unsigned int counters, size_t key_len);
+void ulogd_topk_free(struct ulogd_topk *tk);
+void ulogd_topk_reset(struct ulogd_topk *tk);
+
+/* count one occurrence of key and return the index of its counter.
+ * *fresh is set if the counter was taken by key with this event, from
+ * another key or unused. */
+uint32_t ulogd_topk_add(struct ulogd_topk *tk, const void *key,
+			uint32_t hash, int *fresh);
+
+/* counters by decreasing count: the first, then the next of i, until
+ * ULOGD_TOPK_NONE */
+uint32_t ulogd_topk_first(const struct ulogd_topk *tk);
+uint32_t ulogd_topk_next(const struct ulogd_topk *tk, uint32_t i);
+
+/* count is at least the number of occurrences of the key, at most
+ * error more */
+uint64_t ulogd_topk_count(const struct ulogd_topk *tk, uint32_t i);
+uint64_t ulogd_topk_error(const struct ulogd_topk *tk, uint32_t i);
+const void *ulogd_topk_key(const struct ulogd_topk *tk, uint32_t i);
+uint32_t ulogd_topk_hash(const struct ulogd_topk *tk, uint32_t i);
+
+#define ULOGD_CMS_DEPTH		4
+
+struct ulogd_cms {
+	uint32_t mask;
+	uint32_t *rows;
+};
+
+/* width is rounded up to a power of two */
+int ulogd_cms_init(struct ulogd_cms *cms, unsigned int width);
+void ulogd_cms_free(struct ulogd_cms *cms);
+void ulogd_cms_reset(struct ulogd_cms *cms);
+
+/* with conservative update, returns the estimate after the update */
+uint32_t ulogd_cms_add(struct ulogd_cms *cms, uint64_t hash);
+uint32_t ulogd_cms_estimate(const struct ulogd_cms *cms, uint64_t hash);
+
+/* HyperLogLog with 2^bits one byte registers */
+#define ULOGD_HLL_MIN_BITS	4
+#define ULOGD_HLL_MAX_BITS	16
+
+/* the register hash goes to, and the rank it brings there */
+static inline uint32_t ulogd_hll_index(uint64_t hash, unsigned int bits,
+				       uint8_t *rank)
+{
+	uint64_t rest = hash << bits;
+
+	*rank = 64 - bits + 1;
+	if (rest)
+		*rank = __builtin_clzll(rest) + 1;
+	return hash >> (64 - bits);
+}
+
+static inline void ulogd_hll_add(uint8_t *reg, unsigned int bits,
+				 uint64_t hash)
+{
+	uint8_t rank;
+	uint32_t i = ulogd_hll_index(hash, bits, &rank);
+
+	if (reg[i] < rank)
+		reg[i] = rank;
+}
+
+uint64_t ulogd_hll_count(const uint8_t *reg, unsigned int bits);
+
+#endif
@@ -0,0 +1,56 @@
+/* Nonblocking stream / datagram transport for line based output plugins
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_TRANSPORT_H
+#define _ULOGD_TRANSPORT_H
+
+#include <sys/socket.h>
+#include <ulogd/ulogd.h>
+
+enum {
+	TRANSPORT_DISCONNECTED,
+	TRANSPORT_CONNECTING,
+	TRANSPORT_CONNECTED,
+};
+
+struct ulogd_transport {
+	const char *name;		/* used as prefix of log messages */
+	int socktype;			/* SOCK_STREAM or SOCK_DGRAM */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int state;
+	struct ulogd_fd ufd;
+	struct ulogd_timer timer;	/* reconnect timer */
+	unsigned int backoff;		/* next reconnect delay in seconds */
+	/* bounded queue of newline terminated records */
+	char *queue;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+	int partial;			/* head is in the middle of a record */
+	unsigned int dgram_max;		/* lowered if the socket refuses */
+	/* records dropped since the last report and overall */
+	uint64_t dropped;
+	uint64_t dropped_total;
+	/* optional, drops and queued bytes are accounted there */
+	struct ulogd_pluginstance_stats *stats;
+};
+
+#define TRANSPORT_QUEUE_DEFAULT		(1024 * 1024)
+#define TRANSPORT_BACKOFF_MAX		64
+/* maximum size of one datagram, records are never split */
+#define TRANSPORT_DGRAM_MAX		8192
+
+/* `mode' is one of tcp, udp, unix (stream) or unixgram, `path' is only
+ * used by the unix modes and `host'/`port' by the inet ones. */
+int ulogd_transport_start(struct ulogd_transport *t, const char *name,
+			  const char *mode, const char *host,
+			  const char *port, const char *path,
+			  unsigned int queue_size);
+void ulogd_transport_stop(struct ulogd_transport *t);
+/* queue one or more newline terminated records */
+int ulogd_transport_write(struct ulogd_transport *t,
+			  const char *buf, unsigned int len);
+
+#endif
@@ -0,0 +1,65 @@
+/* Tuples of key values, for plugins keeping state per flow, host, etc.
+ *
+ * A tuple is a list of input keys given in the configuration. Their
+ * values are packed into a fixed size buffer which can be hashed,
+ * compared with memcmp() and stored, and later formatted as text.
+ * oob.family is always part of the tuple, to know how to print the
+ * addresses, but it is only printed when listed.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_TUPLE_H
+#define _ULOGD_TUPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ulogd/ulogd.h>
+
+#define ULOGD_TUPLE_MAX_KEYS	32
+/* strings are truncated to this size, NUL included */
+#define ULOGD_TUPLE_STRLEN	64
+
+struct ulogd_tuple_field {
+	char name[ULOGD_MAX_KEYLEN + 1];
+	uint16_t type;
+	uint16_t offset;
+	uint16_t size;
+	uint8_t hidden;
+};
+
+struct ulogd_tuple {
+	unsigned int base;		/* index of the first input key */
+	unsigned int num_keys;
+	unsigned int family;		/* field of oob.family */
+	unsigned int len;		/* packed size, a multiple of 4 */
+	struct ulogd_tuple_field field[ULOGD_TUPLE_MAX_KEYS];
+};
+
+/* set up t from a list of key names separated by commas, for input
+ * keys starting at base. Returns -1, logged with the name of the
+ * plugin, if a name is too long or there are too many. */
+int ulogd_tuple_parse(struct ulogd_tuple *t, const char *list,
+		      unsigned int base, const char *plugin);
+
+/* name the t->num_keys input keys from t->base, all optional */
+void ulogd_tuple_init_keys(const struct ulogd_tuple *t, struct ulogd_key *inp);
+
+/* compute the layout once the types of the input keys are known.
+ * Returns -1, logged, if a key can't be part of a tuple. */
+int ulogd_tuple_start(struct ulogd_tuple *t, struct ulogd_key *inp,
+		      const char *plugin);
+
+/* write the values of the valid keys to buf, t->len bytes aligned on 4,
+ * and return the bitmap of the valid keys */
+uint32_t ulogd_tuple_pack(const struct ulogd_tuple *t, struct ulogd_key *inp,
+			  void *buf);
+
+uint32_t ulogd_tuple_hash(const struct ulogd_tuple *t, const void *buf,
+			  uint32_t valid, uint32_t seed);
+
+/* "name=value name=value" of the valid keys, truncated to size.
+ * Returns the end of the string. */
+char *ulogd_tuple_format(const struct ulogd_tuple *t, const void *buf,
+			 uint32_t valid, char *dst, size_t size);
+
+#endif
@@ -14,6 +14,7 @@
 #include <ulogd/linuxlist.h>
 #include <ulogd/conffile.h>
 #include <ulogd/ipfix_protocol.h>
+#include <ulogd/arena.h>
 #include <stdio.h>
 #include <signal.h>	/* need this because of extension-sighandler */
 #include <sys/types.h>
@@ -252,6 +253,22 @@ struct ulogd_plugin {
 #define ULOGD_IRET_STOP		-2
 #define ULOGD_IRET_OK		0
 
+struct ulogd_histogram;
+
+/* counters of a plugin instance, exported by the STATS plugin */
+struct ulogd_pluginstance_stats {
+	/* maintained by ulogd_propagate_results() */
+	uint64_t events;		/* produced by sources, seen by others */
+	uint64_t errors;		/* interp() returned ULOGD_IRET_ERR */
+	/* only with ulogd_stats_timing(), in ulogd_cycles() units */
+	uint64_t interp_cycles;
+	struct ulogd_histogram *latency;	/* of each interp() call */
+	/* maintained by the plugins */
+	uint64_t drops;			/* events known to be lost */
+	uint64_t overruns;		/* netlink ENOBUFS, events lost */
+	uint64_t backlog;		/* bytes queued for output */
+};
+
 /* an instance of a plugin, element in a stack */
 struct ulogd_pluginstance {
 	/* local list of plugins in this stack */
@@ -270,6 +287,7 @@ struct ulogd_pluginstance {
 	struct ulogd_keyset output;
 	/* per-instance config parameters (array) */
 	struct config_keyset *config_kset;
+	struct ulogd_pluginstance_stats stats;
 	/* private data */
 	char private[0];
 };
@@ -280,14 +298,47 @@ struct ulogd_pluginstance_stack {
 	/* list of plugins in this stack */
 	struct llist_head list;
 	char *name;
+	/* values of the event going through the stack */
+	struct ulogd_arena arena;
 };
 
+/* memory released by the core once the current event went through the
+ * stack, replaces malloc() and ULOGD_RETF_FREE for per-event values */
+static inline void *ulogd_event_alloc(struct ulogd_pluginstance *pi,
+				      size_t size)
+{
+	return ulogd_arena_alloc(&pi->stack->arena, size);
+}
+
+/* set key to a copy of the first len bytes of s, allocated from the
+ * arena of the stack, returns -1 if out of memory */
+static inline int okey_set_str_arena(struct ulogd_pluginstance *pi,
+				     struct ulogd_key *key,
+				     const char *s, size_t len)
+{
+	char *p = ulogd_arena_strndup(&pi->stack->arena, s, len);
+
+	if (!p)
+		return -1;
+	okey_set_ptr(key, p);
+	return 0;
+}
+
 /***********************************************************************
  * PUBLIC INTERFACE 
  ***********************************************************************/
 
 void ulogd_propagate_results(struct ulogd_pluginstance *pi);
 
+/* measure the time spent in interp() into stats.interp_cycles and the
+ * stats.latency histograms, which costs two cycle counter reads per
+ * plugin and event, so only done once somebody asked for it */
+void ulogd_stats_timing(void);
+/* call `cb' on every plugin instance of every stack, in configuration
+ * order, stops on non-zero */
+int ulogd_pluginstance_iterate(int (*cb)(struct ulogd_pluginstance *pi,
+					 void *data), void *data);
+
 /* register a new interpreter plugin */
 void ulogd_register_plugin(struct ulogd_plugin *me);
 
@@ -332,6 +383,7 @@ struct ulogd_fd {
 
 int ulogd_register_fd(struct ulogd_fd *ufd);
 void ulogd_unregister_fd(struct ulogd_fd *ufd);
+void ulogd_update_fd(struct ulogd_fd *ufd, unsigned int when);
 int ulogd_select_main(struct timeval *tv);
 
 /***********************************************************************
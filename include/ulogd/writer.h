@@ -0,0 +1,191 @@
+/* Asynchronous buffered file writer for text and capture outputs
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#ifndef _ULOGD_WRITER_H
+#define _ULOGD_WRITER_H
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <ulogd/ulogd.h>
+
+/* number of buffers, the flush thread writes all filled ones at once */
+#define WRITER_BUFFERS		4
+
+struct writer_buf {
+	char *data;
+	unsigned int len;
+	int fd;			/* file the buffer belongs to, once filled */
+	int filled;
+};
+
+enum {
+	WRITER_OVERFLOW_BLOCK,
+	WRITER_OVERFLOW_DROP,
+};
+
+enum {
+	WRITER_COMPRESS_NONE,
+	WRITER_COMPRESS_GZIP,
+	WRITER_COMPRESS_ZSTD,
+};
+
+struct ulogd_writer {
+	const char *name;		/* used as prefix of log messages */
+	char *path;			/* NULL for stdout */
+	int flags;			/* open(2) flags */
+	int fd;
+	int retired_fd;			/* old fd to close after a reopen */
+	unsigned int size;		/* size of one buffer */
+	unsigned int flush_interval;	/* in milliseconds */
+	int overflow;
+	struct writer_buf bufs[WRITER_BUFFERS];
+	unsigned int active;		/* buffer being filled */
+	unsigned int next_flush;	/* oldest filled buffer */
+	int flush_requested;
+	int stop;
+	uint64_t dropped;
+	/* optional, drops and queued bytes are accounted there */
+	struct ulogd_pluginstance_stats *stats;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;		/* wakes up the flush thread */
+	pthread_cond_t space;		/* a buffer has been written out */
+	/* written at the start and at the end of each file */
+	char *header;
+	unsigned int header_len;
+	char *footer;
+	unsigned int footer_len;
+	/* rotation, the file names are only changed by the flush thread */
+	uint64_t written;		/* bytes queued for the current file */
+	unsigned int rotate_size;
+	unsigned int rotate_interval;	/* in seconds */
+	unsigned int rotate_count;
+	int rotate_compress;
+	time_t rotate_at;
+	int next_fd;			/* pre-opened file used after rotation */
+	char *next_path;
+	char *rotated_path;		/* file renamed once written out */
+	char *rotated_next;		/* its successor, renamed to it */
+	int busy;			/* thread is renaming or opening files */
+	int next_failed;
+	pthread_t compressor;
+	int compressing;
+	unsigned int generation;	/* bumped on each change of file */
+	int rotation_checked;		/* by ulogd_writer_begin() */
+	/* streaming compression, only used by the flush thread */
+	int compress;
+	int compress_level;
+	void *stream;			/* z_stream or ZSTD_CCtx */
+	int stream_fd;			/* file the stream has been started on */
+	char *zbuf;
+};
+
+#define WRITER_BUFFER_SIZE_DEFAULT	(256 * 1024)
+#define WRITER_FLUSH_INTERVAL_DEFAULT	1000
+#define WRITER_ROTATE_COUNT_DEFAULT	5
+
+#define WRITER_CES						\
+		{						\
+			.key = "buffer_size",			\
+			.type = CONFIG_TYPE_INT,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.value = WRITER_BUFFER_SIZE_DEFAULT,	\
+		},						\
+		{						\
+			.key = "flush_interval",		\
+			.type = CONFIG_TYPE_INT,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.value = WRITER_FLUSH_INTERVAL_DEFAULT, \
+		},						\
+		{						\
+			.key = "overflow",			\
+			.type = CONFIG_TYPE_STRING,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.string = "block",			\
+		},						\
+		{						\
+			.key = "rotate_size",			\
+			.type = CONFIG_TYPE_INT,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.value = 0,				\
+		},						\
+		{						\
+			.key = "rotate_interval",		\
+			.type = CONFIG_TYPE_INT,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.value = 0,				\
+		},						\
+		{						\
+			.key = "rotate_count",			\
+			.type = CONFIG_TYPE_INT,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.value = WRITER_ROTATE_COUNT_DEFAULT,	\
+		},						\
+		{						\
+			.key = "rotate_compress",		\
+			.type = CONFIG_TYPE_INT,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.value = 0,				\
+		},						\
+		{						\
+			.key = "compress",			\
+			.type = CONFIG_TYPE_STRING,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.string = "none",			\
+		},						\
+		{						\
+			.key = "compress_level",		\
+			.type = CONFIG_TYPE_INT,		\
+			.options = CONFIG_OPT_NONE,		\
+			.u.value = 0,				\
+		}
+
+#define WRITER_CE_NUM		9
+#define writer_bufsize_ce(ces)	((ces)[0])
+#define writer_interval_ce(ces)	((ces)[1])
+#define writer_overflow_ce(ces)	((ces)[2])
+#define writer_rsize_ce(ces)	((ces)[3])
+#define writer_rinterval_ce(ces) ((ces)[4])
+#define writer_rcount_ce(ces)	((ces)[5])
+#define writer_rcompress_ce(ces) ((ces)[6])
+#define writer_compress_ce(ces)	((ces)[7])
+#define writer_clevel_ce(ces)	((ces)[8])
+
+/* `ces' points to the WRITER_CES entries of the plugin configuration,
+ * a NULL `path' writes to stdout. */
+int ulogd_writer_open(struct ulogd_writer *w, const char *name,
+		      const char *path, int flags, struct config_entry *ces);
+/* data written at the start of each new file and before closing it,
+ * to be called right after ulogd_writer_open() */
+int ulogd_writer_set_frame(struct ulogd_writer *w,
+			   const void *header, unsigned int header_len,
+			   const void *footer, unsigned int footer_len);
+/* The writer functions take its mutex, they must be called from the main
+ * loop (signal callbacks are), never from a signal handler. */
+
+/* reopen the file, after it has been moved away by logrotate. Unlike
+ * records and rotations, this opens the file from the main loop and
+ * waits for the buffers of the old one, even with overflow=drop. */
+int ulogd_writer_reopen(struct ulogd_writer *w);
+/* continue with another file, the old one is closed once written out.
+ * Waits like ulogd_writer_reopen(). */
+int ulogd_writer_switch(struct ulogd_writer *w, const char *path);
+void ulogd_writer_close(struct ulogd_writer *w);
+int ulogd_writer_write(struct ulogd_writer *w, const void *buf,
+		       unsigned int len);
+/* the iovecs are queued as one record, never split by overflow=drop */
+int ulogd_writer_writev(struct ulogd_writer *w, const struct iovec *iov,
+			int iovcnt);
+int ulogd_writer_printf(struct ulogd_writer *w, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+/* to be called before building a record that depends on what has already
+ * been written to the file (e.g. pcapng interface blocks). Returns the
+ * generation of the current file, which changes after a rotation or a
+ * reopen. The next write is guaranteed to go to that file. */
+unsigned int ulogd_writer_begin(struct ulogd_writer *w);
+/* ask the flush thread to write what we have got so far */
+void ulogd_writer_flush(struct ulogd_writer *w);
+
+#endif
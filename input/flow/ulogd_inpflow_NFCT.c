@@ -43,6 +43,7 @@
 
 #include <ulogd/ulogd.h>
 #include <ulogd/timer.h>
+#include <ulogd/clock.h>
 #include <ulogd/ipfix_protocol.h>
 #include <ulogd/addr.h>
 
@@ -645,7 +646,7 @@ static void set_timestamp_from_ct(struct ct_timestamp *ts,
 				   struct nf_conntrack *ct, int name)
 {
 	if (!set_timestamp_from_ct_try(ts, ct, name))
-		gettimeofday(&ts->time[name], NULL);
+		ulogd_clock_timeval(&ts->time[name]);
 }
 
 static int
@@ -831,6 +832,7 @@ static int read_cb_nfct(int fd, unsigned int what, void *param)
 
 	if (nfct_catch(cpi->cth) == -1) {
 		if (errno == ENOBUFS) {
+			upi->stats.overruns++;
 			if (nlsockbufmaxsize_ce(upi->config_kset).u.value) {
 				int s = cpi->nlbufsiz * 2;
 				if (setnlbufsiz(upi, s)) {
@@ -940,6 +942,7 @@ static int read_cb_ovh(int fd, unsigned int what, void *param)
 	if (nfct_catch(cpi->ovh) == -1) {
 		/* enobufs in the overrun buffer? very rare */
 		if (errno == ENOBUFS) {
+			upi->stats.overruns++;
 			if (!ulogd_timer_pending(&cpi->ov_timer)) {
 				ulogd_add_timer(&cpi->ov_timer,
 						nlresynctimeout_ce(upi->config_kset).u.value);
@@ -0,0 +1,915 @@
+/* ulogd_inpgen_GENERATOR.c - synthetic events for benchmarking stacks
+ *
+ * Produces packet (NFLOG-like), flow (NFCT-like) or sum (NFACCT-like)
+ * events from a pool of flows, picked uniformly, round-robin or with a
+ * zipf distribution, at a given rate or as fast as possible. Once done,
+ * the number of events, the throughput and the time spent per event in
+ * the stack are logged. When ulogd runs with bench/alloc_count.so
+ * preloaded, the number of allocations per event is reported as well.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+
+#include <ulogd/ulogd.h>
+
+/* events handed to the stack per main loop iteration */
+#define GEN_BATCH		256
+
+#define NSEC_PER_SEC		1000000000ULL
+
+/* provided by bench/alloc_count.so when preloaded */
+extern uint64_t ulogd_bench_allocs(void) __attribute__((weak));
+
+enum {
+	GEN_MODE_PACKET,
+	GEN_MODE_FLOW,
+	GEN_MODE_SUM,
+};
+
+enum {
+	GEN_DIST_UNIFORM,
+	GEN_DIST_ROUNDROBIN,
+	GEN_DIST_ZIPF,
+};
+
+struct gen_instance {
+	int mode;
+	int dist;
+	unsigned int flows;
+	unsigned int rate;
+	uint64_t count;
+	uint32_t src_net, src_mask;	/* host byte order */
+	uint32_t dst_net, dst_mask;
+	uint64_t rnd;
+	double *cdf;			/* zipf */
+	unsigned int next_flow;		/* round-robin */
+	unsigned char *pkt;
+	unsigned int pktlen;
+	uint16_t dport;			/* 0 for the mix of gen_dport() */
+	uint64_t *sums;			/* packets and bytes per counter */
+	char name[32];
+	struct ulogd_fd timer_fd;
+	uint64_t start;
+	uint64_t emitted;
+	uint64_t busy;			/* ns spent in the stack */
+	uint64_t allocs;
+};
+
+static struct config_keyset gen_kset = {
+	.num_ces = 13,
+	.ces = {
+		{
+			.key	 = "mode",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "packet",
+		},
+		{
+			.key	 = "count",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "rate",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "flows",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1024,
+		},
+		{
+			.key	 = "distribution",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "uniform",
+		},
+		{
+			.key	 = "src_net",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "10.0.0.0/8",
+		},
+		{
+			.key	 = "dst_net",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "192.168.0.0/16",
+		},
+		{
+			.key	 = "pktlen",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 64,
+		},
+		{
+			.key	 = "prefix",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "",
+		},
+		{
+			.key	 = "seed",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		{
+			.key	 = "exit_at_end",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "payload",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "",
+		},
+		{
+			.key	 = "dport",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	}
+};
+
+#define mode_ce(x)	(x->ces[0])
+#define count_ce(x)	(x->ces[1])
+#define rate_ce(x)	(x->ces[2])
+#define flows_ce(x)	(x->ces[3])
+#define dist_ce(x)	(x->ces[4])
+#define src_ce(x)	(x->ces[5])
+#define dst_ce(x)	(x->ces[6])
+#define pktlen_ce(x)	(x->ces[7])
+#define prefix_ce(x)	(x->ces[8])
+#define seed_ce(x)	(x->ces[9])
+#define exit_ce(x)	(x->ces[10])
+#define payload_ce(x)	(x->ces[11])
+#define dport_ce(x)	(x->ces[12])
+
+/* the keys of all modes, typed like those of the plugins they mimic.
+ * oob.protocol is 16 bits as with NFLOG, NFCT has it 8 bits but the
+ * consumers of flows only look at its value */
+enum gen_keys {
+	GEN_KEY_RAW_PCKT,
+	GEN_KEY_RAW_PCKTLEN,
+	GEN_KEY_RAW_PCKTCOUNT,
+	GEN_KEY_OOB_PREFIX,
+	GEN_KEY_OOB_TIME_SEC,
+	GEN_KEY_OOB_TIME_USEC,
+	GEN_KEY_OOB_MARK,
+	GEN_KEY_OOB_IFINDEX_IN,
+	GEN_KEY_OOB_FAMILY,
+	GEN_KEY_OOB_PROTOCOL,
+	GEN_KEY_ORIG_IP_SADDR,
+	GEN_KEY_ORIG_IP_DADDR,
+	GEN_KEY_ORIG_IP_PROTOCOL,
+	GEN_KEY_ORIG_L4_SPORT,
+	GEN_KEY_ORIG_L4_DPORT,
+	GEN_KEY_ORIG_RAW_PKTLEN,
+	GEN_KEY_ORIG_RAW_PKTCOUNT,
+	GEN_KEY_REPLY_IP_SADDR,
+	GEN_KEY_REPLY_IP_DADDR,
+	GEN_KEY_REPLY_IP_PROTOCOL,
+	GEN_KEY_REPLY_L4_SPORT,
+	GEN_KEY_REPLY_L4_DPORT,
+	GEN_KEY_REPLY_RAW_PKTLEN,
+	GEN_KEY_REPLY_RAW_PKTCOUNT,
+	GEN_KEY_ICMP_CODE,
+	GEN_KEY_ICMP_TYPE,
+	GEN_KEY_CT_MARK,
+	GEN_KEY_CT_ID,
+	GEN_KEY_CT_EVENT,
+	GEN_KEY_FLOW_START_SEC,
+	GEN_KEY_FLOW_START_USEC,
+	GEN_KEY_FLOW_END_SEC,
+	GEN_KEY_FLOW_END_USEC,
+	GEN_KEY_SUM_NAME,
+	GEN_KEY_SUM_PKTS,
+	GEN_KEY_SUM_BYTES,
+	GEN_KEY_BENCH_TIME,
+};
+
+static struct ulogd_key gen_keys[] = {
+	[GEN_KEY_RAW_PCKT] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pkt",
+	},
+	[GEN_KEY_RAW_PCKTLEN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktlen",
+	},
+	[GEN_KEY_RAW_PCKTCOUNT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktcount",
+	},
+	[GEN_KEY_OOB_PREFIX] = {
+		.type = ULOGD_RET_STRING,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.prefix",
+	},
+	[GEN_KEY_OOB_TIME_SEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.sec",
+	},
+	[GEN_KEY_OOB_TIME_USEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.usec",
+	},
+	[GEN_KEY_OOB_MARK] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.mark",
+	},
+	[GEN_KEY_OOB_IFINDEX_IN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.ifindex_in",
+	},
+	[GEN_KEY_OOB_FAMILY] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.family",
+	},
+	[GEN_KEY_OOB_PROTOCOL] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.protocol",
+	},
+	[GEN_KEY_ORIG_IP_SADDR] = {
+		.type = ULOGD_RET_IPADDR,
+		.flags = ULOGD_RETF_NONE,
+		.name = "orig.ip.saddr",
+	},
+	[GEN_KEY_ORIG_IP_DADDR] = {
+		.type = ULOGD_RET_IPADDR,
+		.flags = ULOGD_RETF_NONE,
+		.name = "orig.ip.daddr",
+	},
+	[GEN_KEY_ORIG_IP_PROTOCOL] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "orig.ip.protocol",
+	},
+	[GEN_KEY_ORIG_L4_SPORT] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "orig.l4.sport",
+	},
+	[GEN_KEY_ORIG_L4_DPORT] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "orig.l4.dport",
+	},
+	[GEN_KEY_ORIG_RAW_PKTLEN] = {
+		.type = ULOGD_RET_UINT64,
+		.flags = ULOGD_RETF_NONE,
+		.name = "orig.raw.pktlen",
+	},
+	[GEN_KEY_ORIG_RAW_PKTCOUNT] = {
+		.type = ULOGD_RET_UINT64,
+		.flags = ULOGD_RETF_NONE,
+		.name = "orig.raw.pktcount",
+	},
+	[GEN_KEY_REPLY_IP_SADDR] = {
+		.type = ULOGD_RET_IPADDR,
+		.flags = ULOGD_RETF_NONE,
+		.name = "reply.ip.saddr",
+	},
+	[GEN_KEY_REPLY_IP_DADDR] = {
+		.type = ULOGD_RET_IPADDR,
+		.flags = ULOGD_RETF_NONE,
+		.name = "reply.ip.daddr",
+	},
+	[GEN_KEY_REPLY_IP_PROTOCOL] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "reply.ip.protocol",
+	},
+	[GEN_KEY_REPLY_L4_SPORT] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "reply.l4.sport",
+	},
+	[GEN_KEY_REPLY_L4_DPORT] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "reply.l4.dport",
+	},
+	[GEN_KEY_REPLY_RAW_PKTLEN] = {
+		.type = ULOGD_RET_UINT64,
+		.flags = ULOGD_RETF_NONE,
+		.name = "reply.raw.pktlen",
+	},
+	[GEN_KEY_REPLY_RAW_PKTCOUNT] = {
+		.type = ULOGD_RET_UINT64,
+		.flags = ULOGD_RETF_NONE,
+		.name = "reply.raw.pktcount",
+	},
+	[GEN_KEY_ICMP_CODE] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "icmp.code",
+	},
+	[GEN_KEY_ICMP_TYPE] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "icmp.type",
+	},
+	[GEN_KEY_CT_MARK] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "ct.mark",
+	},
+	[GEN_KEY_CT_ID] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "ct.id",
+	},
+	[GEN_KEY_CT_EVENT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "ct.event",
+	},
+	[GEN_KEY_FLOW_START_SEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "flow.start.sec",
+	},
+	[GEN_KEY_FLOW_START_USEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "flow.start.usec",
+	},
+	[GEN_KEY_FLOW_END_SEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "flow.end.sec",
+	},
+	[GEN_KEY_FLOW_END_USEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "flow.end.usec",
+	},
+	[GEN_KEY_SUM_NAME] = {
+		.type = ULOGD_RET_STRING,
+		.flags = ULOGD_RETF_NONE,
+		.name = "sum.name",
+	},
+	[GEN_KEY_SUM_PKTS] = {
+		.type = ULOGD_RET_UINT64,
+		.flags = ULOGD_RETF_NONE,
+		.name = "sum.pkts",
+	},
+	[GEN_KEY_SUM_BYTES] = {
+		.type = ULOGD_RET_UINT64,
+		.flags = ULOGD_RETF_NONE,
+		.name = "sum.bytes",
+	},
+	[GEN_KEY_BENCH_TIME] = {
+		.type = ULOGD_RET_UINT64,
+		.flags = ULOGD_RETF_NONE,
+		.name = "bench.time",
+	},
+};
+
+static uint64_t gen_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* xorshift64* */
+static uint64_t gen_random(struct gen_instance *gi)
+{
+	gi->rnd ^= gi->rnd >> 12;
+	gi->rnd ^= gi->rnd << 25;
+	gi->rnd ^= gi->rnd >> 27;
+	return gi->rnd * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned int gen_flow(struct gen_instance *gi)
+{
+	unsigned int lo, hi;
+	double u;
+
+	switch (gi->dist) {
+	case GEN_DIST_ROUNDROBIN:
+		if (gi->next_flow == gi->flows)
+			gi->next_flow = 0;
+		return gi->next_flow++;
+	case GEN_DIST_ZIPF:
+		u = (gen_random(gi) >> 11) * (1.0 / (1ULL << 53));
+		lo = 0;
+		hi = gi->flows - 1;
+		while (lo < hi) {
+			unsigned int mid = lo + (hi - lo) / 2;
+
+			if (gi->cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	default:
+		return gen_random(gi) % gi->flows;
+	}
+}
+
+/* spread the flows over the networks, the same flow always gets the same
+ * addresses and ports */
+static uint32_t gen_mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static uint32_t gen_saddr(struct gen_instance *gi, unsigned int flow)
+{
+	return htonl(gi->src_net | (gen_mix(flow) & ~gi->src_mask));
+}
+
+static uint32_t gen_daddr(struct gen_instance *gi, unsigned int flow)
+{
+	return htonl(gi->dst_net | (gen_mix(~flow) & ~gi->dst_mask));
+}
+
+static uint8_t gen_proto(unsigned int flow)
+{
+	return flow % 4 ? IPPROTO_TCP : IPPROTO_UDP;
+}
+
+static uint16_t gen_sport(unsigned int flow)
+{
+	return 1024 + gen_mix(flow * 2 + 1) % 64512;
+}
+
+static uint16_t gen_dport(struct gen_instance *gi, unsigned int flow)
+{
+	static const uint16_t ports[] = { 443, 80, 53, 22, 123, 8080, 25 };
+
+	if (gi->dport)
+		return gi->dport;
+	return ports[flow % (sizeof(ports) / sizeof(ports[0]))];
+}
+
+static void gen_packet(struct ulogd_pluginstance *upi, unsigned int flow,
+		       struct timespec *now)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	struct ulogd_key *ret = upi->output.keys;
+	struct iphdr *iph = (struct iphdr *)gi->pkt;
+	uint8_t proto = gen_proto(flow);
+
+	iph->saddr = gen_saddr(gi, flow);
+	iph->daddr = gen_daddr(gi, flow);
+	iph->protocol = proto;
+	if (proto == IPPROTO_TCP) {
+		struct tcphdr *tcph = (struct tcphdr *)(iph + 1);
+
+		tcph->source = htons(gen_sport(flow));
+		tcph->dest = htons(gen_dport(gi, flow));
+		tcph->seq = htonl(gi->emitted);
+	} else {
+		struct udphdr *udph = (struct udphdr *)(iph + 1);
+
+		udph->source = htons(gen_sport(flow));
+		udph->dest = htons(gen_dport(gi, flow));
+		udph->len = htons(gi->pktlen - sizeof(*iph));
+	}
+
+	okey_set_ptr(&ret[GEN_KEY_RAW_PCKT], gi->pkt);
+	okey_set_u32(&ret[GEN_KEY_RAW_PCKTLEN], gi->pktlen);
+	okey_set_u32(&ret[GEN_KEY_RAW_PCKTCOUNT], 1);
+	if (prefix_ce(upi->config_kset).u.string[0])
+		okey_set_ptr(&ret[GEN_KEY_OOB_PREFIX],
+			     prefix_ce(upi->config_kset).u.string);
+	okey_set_u32(&ret[GEN_KEY_OOB_TIME_SEC], now->tv_sec);
+	okey_set_u32(&ret[GEN_KEY_OOB_TIME_USEC], now->tv_nsec / 1000);
+	okey_set_u32(&ret[GEN_KEY_OOB_MARK], flow);
+	okey_set_u32(&ret[GEN_KEY_OOB_IFINDEX_IN], 1);
+	okey_set_u8(&ret[GEN_KEY_OOB_FAMILY], AF_INET);
+	okey_set_u16(&ret[GEN_KEY_OOB_PROTOCOL], ETH_P_IP);
+}
+
+static void gen_flow_event(struct ulogd_pluginstance *upi, unsigned int flow,
+			   struct timespec *now)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	struct ulogd_key *ret = upi->output.keys;
+	uint64_t pkts = 1 + gen_random(gi) % 64;
+	uint8_t proto = gen_proto(flow);
+
+	okey_set_u32(&ret[GEN_KEY_ORIG_IP_SADDR], gen_saddr(gi, flow));
+	okey_set_u32(&ret[GEN_KEY_ORIG_IP_DADDR], gen_daddr(gi, flow));
+	okey_set_u8(&ret[GEN_KEY_ORIG_IP_PROTOCOL], proto);
+	okey_set_u16(&ret[GEN_KEY_ORIG_L4_SPORT], gen_sport(flow));
+	okey_set_u16(&ret[GEN_KEY_ORIG_L4_DPORT], gen_dport(gi, flow));
+	okey_set_u64(&ret[GEN_KEY_ORIG_RAW_PKTLEN], pkts * gi->pktlen);
+	okey_set_u64(&ret[GEN_KEY_ORIG_RAW_PKTCOUNT], pkts);
+	okey_set_u32(&ret[GEN_KEY_REPLY_IP_SADDR], gen_daddr(gi, flow));
+	okey_set_u32(&ret[GEN_KEY_REPLY_IP_DADDR], gen_saddr(gi, flow));
+	okey_set_u8(&ret[GEN_KEY_REPLY_IP_PROTOCOL], proto);
+	okey_set_u16(&ret[GEN_KEY_REPLY_L4_SPORT], gen_dport(gi, flow));
+	okey_set_u16(&ret[GEN_KEY_REPLY_L4_DPORT], gen_sport(flow));
+	okey_set_u64(&ret[GEN_KEY_REPLY_RAW_PKTLEN], pkts * gi->pktlen);
+	okey_set_u64(&ret[GEN_KEY_REPLY_RAW_PKTCOUNT], pkts);
+	okey_set_u32(&ret[GEN_KEY_CT_MARK], 0);
+	okey_set_u32(&ret[GEN_KEY_CT_ID], gi->emitted);
+	okey_set_u32(&ret[GEN_KEY_CT_EVENT], 4);	/* destroy */
+	okey_set_u32(&ret[GEN_KEY_FLOW_START_SEC], now->tv_sec - pkts);
+	okey_set_u32(&ret[GEN_KEY_FLOW_START_USEC], now->tv_nsec / 1000);
+	okey_set_u32(&ret[GEN_KEY_FLOW_END_SEC], now->tv_sec);
+	okey_set_u32(&ret[GEN_KEY_FLOW_END_USEC], now->tv_nsec / 1000);
+	okey_set_u8(&ret[GEN_KEY_OOB_FAMILY], AF_INET);
+	okey_set_u16(&ret[GEN_KEY_OOB_PROTOCOL], 0);
+}
+
+static void gen_sum(struct ulogd_pluginstance *upi, unsigned int flow,
+		    struct timespec *now)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	struct ulogd_key *ret = upi->output.keys;
+	uint64_t pkts = 1 + gen_random(gi) % 64;
+
+	gi->sums[2 * flow] += pkts;
+	gi->sums[2 * flow + 1] += pkts * gi->pktlen;
+	snprintf(gi->name, sizeof(gi->name), "counter%u", flow);
+
+	okey_set_ptr(&ret[GEN_KEY_SUM_NAME], gi->name);
+	okey_set_u64(&ret[GEN_KEY_SUM_PKTS], gi->sums[2 * flow]);
+	okey_set_u64(&ret[GEN_KEY_SUM_BYTES], gi->sums[2 * flow + 1]);
+	okey_set_u32(&ret[GEN_KEY_OOB_TIME_SEC], now->tv_sec);
+	okey_set_u32(&ret[GEN_KEY_OOB_TIME_USEC], now->tv_nsec / 1000);
+}
+
+static void gen_event(struct ulogd_pluginstance *upi, struct timespec *now)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	unsigned int flow = gen_flow(gi);
+	uint64_t t;
+
+	switch (gi->mode) {
+	case GEN_MODE_PACKET:
+		gen_packet(upi, flow, now);
+		break;
+	case GEN_MODE_FLOW:
+		gen_flow_event(upi, flow, now);
+		break;
+	case GEN_MODE_SUM:
+		gen_sum(upi, flow, now);
+		break;
+	}
+
+	t = gen_now();
+	okey_set_u64(&upi->output.keys[GEN_KEY_BENCH_TIME], t);
+	ulogd_propagate_results(upi);
+	gi->busy += gen_now() - t;
+	gi->emitted++;
+}
+
+static void gen_report(struct ulogd_pluginstance *upi)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	uint64_t elapsed = gen_now() - gi->start;
+	char allocs[64] = "";
+
+	if (!gi->emitted || !elapsed)
+		return;
+
+	if (ulogd_bench_allocs)
+		snprintf(allocs, sizeof(allocs), ", %.2f allocs/event",
+			 (double)(ulogd_bench_allocs() - gi->allocs) /
+			 gi->emitted);
+
+	ulogd_log(ULOGD_NOTICE, "GENERATOR: %" PRIu64 " events, %.0f "
+		  "events/s, %.0f ns/event%s\n", gi->emitted,
+		  gi->emitted * (double)NSEC_PER_SEC / elapsed,
+		  (double)gi->busy / gi->emitted, allocs);
+}
+
+static int gen_arm(struct gen_instance *gi, uint64_t when)
+{
+	struct itimerspec its = {
+		.it_value = {
+			.tv_sec = when / NSEC_PER_SEC,
+			.tv_nsec = when % NSEC_PER_SEC,
+		},
+	};
+
+	return timerfd_settime(gi->timer_fd.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int gen_timer_cb(int fd, unsigned int what, void *param)
+{
+	struct ulogd_pluginstance *upi = param;
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	uint64_t expirations, now, n = GEN_BATCH;
+	struct timespec realtime;
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		return -1;
+
+	now = gen_now();
+	if (gi->rate) {
+		uint64_t due = (now - gi->start) * gi->rate / NSEC_PER_SEC;
+
+		n = due > gi->emitted ? due - gi->emitted : 0;
+		if (n > GEN_BATCH)
+			n = GEN_BATCH;
+	}
+	if (gi->count && gi->emitted + n > gi->count)
+		n = gi->count - gi->emitted;
+
+	/* once all plugins are started, their setup isn't counted */
+	if (!gi->emitted && ulogd_bench_allocs)
+		gi->allocs = ulogd_bench_allocs();
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	while (n--)
+		gen_event(upi, &realtime);
+
+	if (gi->count && gi->emitted == gi->count) {
+		/* the timer is left disarmed once done */
+		gen_report(upi);
+		if (exit_ce(upi->config_kset).u.value)
+			kill(getpid(), SIGTERM);
+		return 0;
+	}
+
+	if (gi->rate)
+		return gen_arm(gi, gi->start +
+			       (gi->emitted + 1) * NSEC_PER_SEC / gi->rate);
+	/* let the other file descriptors in before the next batch */
+	return gen_arm(gi, now);
+}
+
+static int gen_parse_net(const char *str, uint32_t *net, uint32_t *mask)
+{
+	char buf[INET_ADDRSTRLEN + 4], *slash;
+	struct in_addr addr;
+	int len = 32;
+
+	snprintf(buf, sizeof(buf), "%s", str);
+	slash = strchr(buf, '/');
+	if (slash) {
+		*slash++ = '\0';
+		len = atoi(slash);
+		if (len < 0 || len > 32)
+			return -1;
+	}
+	if (inet_pton(AF_INET, buf, &addr) != 1)
+		return -1;
+
+	*mask = len ? ~0U << (32 - len) : 0;
+	*net = ntohl(addr.s_addr) & *mask;
+	return 0;
+}
+
+static int configure(struct ulogd_pluginstance *upi,
+		     struct ulogd_pluginstance_stack *stack)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	struct config_keyset *kset = upi->config_kset;
+	const char *mode, *dist;
+	int ret;
+
+	ret = config_parse_file(upi->id, kset);
+	if (ret < 0)
+		return ret;
+
+	mode = mode_ce(kset).u.string;
+	if (!strcmp(mode, "packet")) {
+		gi->mode = GEN_MODE_PACKET;
+	} else if (!strcmp(mode, "flow")) {
+		gi->mode = GEN_MODE_FLOW;
+	} else if (!strcmp(mode, "sum")) {
+		gi->mode = GEN_MODE_SUM;
+	} else {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: unknown mode `%s'\n", mode);
+		return -EINVAL;
+	}
+
+	dist = dist_ce(kset).u.string;
+	if (!strcmp(dist, "uniform"))
+		gi->dist = GEN_DIST_UNIFORM;
+	else if (!strcmp(dist, "roundrobin"))
+		gi->dist = GEN_DIST_ROUNDROBIN;
+	else if (!strcmp(dist, "zipf"))
+		gi->dist = GEN_DIST_ZIPF;
+	else {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: unknown distribution "
+			  "`%s'\n", dist);
+		return -EINVAL;
+	}
+
+	if (gen_parse_net(src_ce(kset).u.string, &gi->src_net,
+			  &gi->src_mask) < 0 ||
+	    gen_parse_net(dst_ce(kset).u.string, &gi->dst_net,
+			  &gi->dst_mask) < 0) {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: invalid src_net or "
+			  "dst_net\n");
+		return -EINVAL;
+	}
+
+	if (flows_ce(kset).u.value <= 0 || count_ce(kset).u.value < 0 ||
+	    rate_ce(kset).u.value < 0) {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: flows must be positive, "
+			  "count and rate can't be negative\n");
+		return -EINVAL;
+	}
+	gi->flows = flows_ce(kset).u.value;
+	gi->count = count_ce(kset).u.value;
+	gi->rate = rate_ce(kset).u.value;
+
+	gi->pktlen = pktlen_ce(kset).u.value;
+	if (gi->pktlen < sizeof(struct iphdr) + sizeof(struct tcphdr))
+		gi->pktlen = sizeof(struct iphdr) + sizeof(struct tcphdr);
+	if (gi->pktlen > 65535)
+		gi->pktlen = 65535;
+
+	if (dport_ce(kset).u.value < 0 || dport_ce(kset).u.value > 65535) {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: invalid dport %d\n",
+			  dport_ce(kset).u.value);
+		return -EINVAL;
+	}
+	gi->dport = dport_ce(kset).u.value;
+
+	return 0;
+}
+
+static int gen_init_pool(struct gen_instance *gi, const char *payload)
+{
+	size_t hlen = sizeof(struct iphdr) + sizeof(struct tcphdr);
+	size_t plen = strlen(payload);
+	struct iphdr *iph;
+	unsigned int i;
+
+	if (gi->dist == GEN_DIST_ZIPF) {
+		double sum = 0;
+
+		gi->cdf = malloc(gi->flows * sizeof(double));
+		if (!gi->cdf)
+			return -1;
+		for (i = 0; i < gi->flows; i++) {
+			sum += 1.0 / (i + 1);
+			gi->cdf[i] = sum;
+		}
+		for (i = 0; i < gi->flows; i++)
+			gi->cdf[i] /= sum;
+	}
+
+	switch (gi->mode) {
+	case GEN_MODE_PACKET:
+		gi->pkt = calloc(1, gi->pktlen);
+		if (!gi->pkt)
+			return -1;
+		iph = (struct iphdr *)gi->pkt;
+		iph->version = 4;
+		iph->ihl = 5;
+		iph->ttl = 64;
+		iph->tot_len = htons(gi->pktlen);
+		((struct tcphdr *)(iph + 1))->doff = 5;
+		/* the payload text repeated up to the packet length, after
+		 * a TCP header, UDP packets have a few zeros in front */
+		for (i = 0; plen && hlen + i < gi->pktlen; i++)
+			gi->pkt[hlen + i] = payload[i % plen];
+		break;
+	case GEN_MODE_SUM:
+		gi->sums = calloc(gi->flows, 2 * sizeof(uint64_t));
+		if (!gi->sums)
+			return -1;
+		break;
+	}
+
+	return 0;
+}
+
+static void gen_free_pool(struct gen_instance *gi)
+{
+	free(gi->cdf);
+	gi->cdf = NULL;
+	free(gi->pkt);
+	gi->pkt = NULL;
+	free(gi->sums);
+	gi->sums = NULL;
+}
+
+static int start(struct ulogd_pluginstance *upi)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+	int fd;
+
+	if (gen_init_pool(gi, payload_ce(upi->config_kset).u.string) < 0) {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: out of memory\n");
+		goto err;
+	}
+	/* 0 would get stuck in xorshift */
+	gi->rnd = seed_ce(upi->config_kset).u.value | 1ULL << 32;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: can't create timer: %s\n",
+			  strerror(errno));
+		goto err;
+	}
+	gi->timer_fd.fd = fd;
+	gi->timer_fd.cb = &gen_timer_cb;
+	gi->timer_fd.data = upi;
+	gi->timer_fd.when = ULOGD_FD_READ;
+
+	gi->start = gen_now();
+	gi->emitted = 0;
+	gi->busy = 0;
+	if (ulogd_register_fd(&gi->timer_fd) < 0 ||
+	    gen_arm(gi, gi->start) < 0) {
+		ulogd_log(ULOGD_ERROR, "GENERATOR: can't set up timer\n");
+		close(fd);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	gen_free_pool(gi);
+	return -1;
+}
+
+static int stop(struct ulogd_pluginstance *upi)
+{
+	struct gen_instance *gi = (struct gen_instance *)upi->private;
+
+	/* interrupted before count was reached */
+	if (!gi->count || gi->emitted < gi->count)
+		gen_report(upi);
+
+	ulogd_unregister_fd(&gi->timer_fd);
+	close(gi->timer_fd.fd);
+	gen_free_pool(gi);
+
+	return 0;
+}
+
+static struct ulogd_plugin gen_plugin = {
+	.name = "GENERATOR",
+	.input = {
+		.type = ULOGD_DTYPE_SOURCE,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_RAW | ULOGD_DTYPE_PACKET |
+			ULOGD_DTYPE_FLOW | ULOGD_DTYPE_SUM,
+		.keys = gen_keys,
+		.num_keys = ARRAY_SIZE(gen_keys),
+	},
+	.priv_size	= sizeof(struct gen_instance),
+	.configure	= &configure,
+	.start		= &start,
+	.stop		= &stop,
+	.config_kset	= &gen_kset,
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&gen_plugin);
+}
@@ -10,6 +10,7 @@
 #include <stdbool.h>
 
 #include <ulogd/ulogd.h>
+#include <ulogd/clock.h>
 #include <libnfnetlink/libnfnetlink.h>
 #include <libnetfilter_log/libnetfilter_log.h>
 
@@ -373,7 +374,7 @@ interp_packet(struct ulogd_pluginstance *upi, u_int8_t pf_family,
 	/* god knows why timestamp_usec contains crap if timestamp_sec
 	 * == 0 if (pkt->timestamp_sec || pkt->timestamp_usec) { */
 	if (! (nflog_get_timestamp(ldata, &ts) == 0 && ts.tv_sec))
-		gettimeofday(&ts, NULL);
+		ulogd_clock_timeval(&ts);
 
 	okey_set_u32(&ret[NFLOG_KEY_OOB_TIME_SEC], ts.tv_sec & 0xffffffff);
 	okey_set_u32(&ret[NFLOG_KEY_OOB_TIME_USEC], ts.tv_usec & 0xffffffff);
@@ -433,6 +434,8 @@ static int nful_read_cb(int fd, unsigned int what, void *param)
 	 * sockets that have pending work */
 	len = recv(fd, ui->nfulog_buf, bufsiz_ce(upi->config_kset).u.value, 0);
 	if (len < 0) {
+		if (errno == ENOBUFS)
+			upi->stats.overruns++;
 		if (errno == ENOBUFS && !ui->nful_overrun_warned) {
 			if (nlsockbufmaxsize_ce(upi->config_kset).u.value) {
 				int s = ui->nlbufsiz * 2;
@@ -0,0 +1,1132 @@
+/* ulogd_inppkt_REPLAY.c - replay pcap and pcapng capture files
+ *
+ * Packets are read from a memory mapped capture file and handed to the
+ * stack with the same keys as NFLOG, either as fast as possible or
+ * following the time stamps of the capture, optionally accelerated.
+ * Pacing uses a timerfd in the main loop, at most REPLAY_BATCH packets
+ * are processed before other file descriptors get their turn.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <net/if_arp.h>
+#include <linux/if_ether.h>
+
+#include <ulogd/ulogd.h>
+
+/* packets handed to the stack per main loop iteration */
+#define REPLAY_BATCH		256
+
+#define REPLAY_PREFIX_MAX	128
+
+/* classic pcap */
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_HDR_LEN		24
+#define PCAP_REC_LEN		16
+
+/* pcapng */
+#define PCAPNG_SHB		0x0A0D0D0A
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_SPB		0x00000003
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+
+#define PCAPNG_OPT_COMMENT	1
+#define PCAPNG_IF_TSRESOL	9
+#define PCAPNG_IF_TSOFFSET	14
+
+/* link types we know how to take apart */
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_IPV6		229
+#define LINKTYPE_NFLOG		239
+
+/* NFLOG attributes in LINKTYPE_NFLOG captures */
+#define NFLOG_TLV_PACKET_HDR	1
+#define NFLOG_TLV_MARK		2
+#define NFLOG_TLV_INDEV		4
+#define NFLOG_TLV_OUTDEV	5
+#define NFLOG_TLV_PAYLOAD	9
+#define NFLOG_TLV_PREFIX	10
+#define NFLOG_TLV_UID		11
+#define NFLOG_TLV_GID		14
+#define NFLOG_TLV_HWTYPE	15
+#define NFLOG_TLV_HWHEADER	16
+#define NFLOG_TLV_HWLEN		17
+
+#define NSEC_PER_SEC		1000000000ULL
+
+struct replay_iface {
+	uint16_t linktype;
+	uint8_t tsresol;		/* if_tsresol, default 10^-6 */
+	int64_t tsoffset;		/* seconds */
+};
+
+struct replay_pkt {
+	const unsigned char *data;
+	uint32_t caplen;
+	uint32_t origlen;
+	uint64_t ts;			/* nanoseconds */
+	uint16_t linktype;
+	const unsigned char *comment[2];
+	uint16_t comment_len[2];
+};
+
+struct replay_input {
+	unsigned char *map;
+	size_t size;
+	size_t start;			/* first record or block */
+	size_t off;			/* next one */
+	int pcapng;
+	int swapped;
+	/* classic pcap */
+	int nsec;
+	uint16_t linktype;
+	/* pcapng, interfaces of the current section */
+	struct replay_iface *ifaces;
+	unsigned int num_ifaces;
+	unsigned int max_ifaces;
+
+	struct ulogd_fd timer_fd;
+	struct replay_pkt pkt;
+	int have_pkt;
+	int pass_started;
+	uint64_t pass_ts;		/* time stamp of the first packet */
+	uint64_t pass_start;		/* CLOCK_MONOTONIC at that packet */
+	uint64_t last_ts;
+	unsigned int passes;
+	uint64_t packets;
+	uint64_t skipped;
+	int warned;
+	char prefix[REPLAY_PREFIX_MAX + 1];
+};
+
+static struct config_keyset replay_kset = {
+	.num_ces = 5,
+	.ces = {
+		{
+			.key	 = "file",
+			.type	 = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_MANDATORY,
+		},
+		{
+			.key	 = "speed",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		{
+			.key	 = "loop",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1,
+		},
+		{
+			.key	 = "exit_at_end",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+		{
+			.key	 = "numeric_label",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	}
+};
+
+#define file_ce(x)	(x->ces[0])
+#define speed_ce(x)	(x->ces[1])
+#define loop_ce(x)	(x->ces[2])
+#define exit_ce(x)	(x->ces[3])
+#define label_ce(x)	(x->ces[4])
+
+enum replay_keys {
+	REPLAY_KEY_RAW_MAC = 0,
+	REPLAY_KEY_RAW_PCKT,
+	REPLAY_KEY_RAW_PCKTLEN,
+	REPLAY_KEY_RAW_PCKTCOUNT,
+	REPLAY_KEY_OOB_PREFIX,
+	REPLAY_KEY_OOB_TIME_SEC,
+	REPLAY_KEY_OOB_TIME_USEC,
+	REPLAY_KEY_OOB_MARK,
+	REPLAY_KEY_OOB_IFINDEX_IN,
+	REPLAY_KEY_OOB_IFINDEX_OUT,
+	REPLAY_KEY_OOB_HOOK,
+	REPLAY_KEY_RAW_MAC_LEN,
+	REPLAY_KEY_OOB_FAMILY,
+	REPLAY_KEY_OOB_PROTOCOL,
+	REPLAY_KEY_OOB_UID,
+	REPLAY_KEY_OOB_GID,
+	REPLAY_KEY_RAW_LABEL,
+	REPLAY_KEY_RAW_TYPE,
+	REPLAY_KEY_RAW_MAC_SADDR,
+	REPLAY_KEY_RAW_MAC_ADDRLEN,
+};
+
+static struct ulogd_key output_keys[] = {
+	[REPLAY_KEY_RAW_MAC] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac",
+	},
+	[REPLAY_KEY_RAW_MAC_SADDR] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac.saddr",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_sourceMacAddress,
+		},
+	},
+	[REPLAY_KEY_RAW_PCKT] = {
+		.type = ULOGD_RET_RAW,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pkt",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_rawpacket,
+		},
+	},
+	[REPLAY_KEY_RAW_PCKTLEN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktlen",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_rawpacket_length,
+		},
+	},
+	[REPLAY_KEY_RAW_PCKTCOUNT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.pktcount",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_packetDeltaCount,
+		},
+	},
+	[REPLAY_KEY_OOB_PREFIX] = {
+		.type = ULOGD_RET_STRING,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.prefix",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_prefix,
+		},
+	},
+	[REPLAY_KEY_OOB_TIME_SEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.sec",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_flowStartSeconds,
+		},
+	},
+	[REPLAY_KEY_OOB_TIME_USEC] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.time.usec",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_flowStartMicroSeconds,
+		},
+	},
+	[REPLAY_KEY_OOB_MARK] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.mark",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_mark,
+		},
+	},
+	[REPLAY_KEY_OOB_IFINDEX_IN] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.ifindex_in",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_ingressInterface,
+		},
+	},
+	[REPLAY_KEY_OOB_IFINDEX_OUT] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.ifindex_out",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_IETF,
+			.field_id = IPFIX_egressInterface,
+		},
+	},
+	[REPLAY_KEY_OOB_HOOK] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.hook",
+		.ipfix = {
+			.vendor = IPFIX_VENDOR_NETFILTER,
+			.field_id = IPFIX_NF_hook,
+		},
+	},
+	[REPLAY_KEY_RAW_MAC_LEN] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac_len",
+	},
+	[REPLAY_KEY_RAW_MAC_ADDRLEN] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.mac.addrlen",
+	},
+	[REPLAY_KEY_OOB_FAMILY] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.family",
+	},
+	[REPLAY_KEY_OOB_PROTOCOL] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.protocol",
+	},
+	[REPLAY_KEY_OOB_UID] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.uid",
+	},
+	[REPLAY_KEY_OOB_GID] = {
+		.type = ULOGD_RET_UINT32,
+		.flags = ULOGD_RETF_NONE,
+		.name = "oob.gid",
+	},
+	[REPLAY_KEY_RAW_LABEL] = {
+		.type = ULOGD_RET_UINT8,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.label",
+	},
+	[REPLAY_KEY_RAW_TYPE] = {
+		.type = ULOGD_RET_UINT16,
+		.flags = ULOGD_RETF_NONE,
+		.name = "raw.type",
+	},
+};
+
+/***********************************************************************
+ * capture file parsing
+ ***********************************************************************/
+
+static uint16_t replay_u16(struct replay_input *ri, const unsigned char *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ri->swapped ? bswap_16(v) : v;
+}
+
+static uint32_t replay_u32(struct replay_input *ri, const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ri->swapped ? bswap_32(v) : v;
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static int replay_open_pcap(struct replay_input *ri)
+{
+	uint32_t magic;
+
+	if (ri->size < PCAP_HDR_LEN)
+		return -1;
+
+	memcpy(&magic, ri->map, sizeof(magic));
+	if (magic == bswap_32(PCAP_MAGIC) ||
+	    magic == bswap_32(PCAP_MAGIC_NSEC)) {
+		ri->swapped = 1;
+		magic = bswap_32(magic);
+	}
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+		return -1;
+
+	ri->nsec = magic == PCAP_MAGIC_NSEC;
+	/* upper bits carry FCS information */
+	ri->linktype = replay_u32(ri, ri->map + 20) & 0xffff;
+	ri->start = PCAP_HDR_LEN;
+	return 0;
+}
+
+static int replay_next_pcap(struct replay_input *ri, struct replay_pkt *pkt)
+{
+	const unsigned char *rec = ri->map + ri->off;
+	uint32_t sec, frac;
+
+	if (ri->off + PCAP_REC_LEN > ri->size)
+		return 0;
+
+	sec = replay_u32(ri, rec);
+	frac = replay_u32(ri, rec + 4);
+	pkt->caplen = replay_u32(ri, rec + 8);
+	pkt->origlen = replay_u32(ri, rec + 12);
+	if (pkt->caplen > ri->size - ri->off - PCAP_REC_LEN)
+		return -1;
+
+	pkt->data = rec + PCAP_REC_LEN;
+	pkt->ts = sec * NSEC_PER_SEC + (ri->nsec ? frac : frac * 1000ULL);
+	pkt->linktype = ri->linktype;
+	pkt->comment[0] = pkt->comment[1] = NULL;
+	ri->off += PCAP_REC_LEN + pkt->caplen;
+
+	return 1;
+}
+
+/* the resolutions whose unit fits in 64 bits */
+static int replay_tsresol_valid(uint8_t tsresol)
+{
+	if (tsresol & 0x80)
+		return (tsresol & 0x7f) <= 63;
+	return tsresol <= 19;
+}
+
+/* convert to nanoseconds, returns -1 if they don't fit in 64 bits */
+static int replay_ts(struct replay_iface *iface, uint64_t ts, uint64_t *ns)
+{
+	unsigned int exp = iface->tsresol & 0x7f;
+	int64_t off = iface->tsoffset;
+	uint64_t sec, frac, unit = 1;
+
+	if (iface->tsresol & 0x80) {
+		/* negative power of two */
+		sec = ts >> exp;
+		frac = ts & ((1ULL << exp) - 1);
+		/* finer than 2^-32 s doesn't matter, and can't overflow */
+		if (exp > 32) {
+			frac >>= exp - 32;
+			exp = 32;
+		}
+		frac = (frac * NSEC_PER_SEC) >> exp;
+	} else {
+		for (; exp > 0; exp--)
+			unit *= 10;
+		sec = ts / unit;
+		frac = ts % unit;
+		if (unit <= NSEC_PER_SEC)
+			frac *= NSEC_PER_SEC / unit;
+		else
+			frac /= unit / NSEC_PER_SEC;
+	}
+
+	if (off < 0) {
+		if (sec < 0 - (uint64_t)off)
+			return -1;
+		sec -= 0 - (uint64_t)off;
+	} else {
+		if (sec > UINT64_MAX - off)
+			return -1;
+		sec += off;
+	}
+	if (sec > (UINT64_MAX - frac) / NSEC_PER_SEC)
+		return -1;
+
+	*ns = sec * NSEC_PER_SEC + frac;
+	return 0;
+}
+
+/* walk the options at `p', calling back for each of them */
+static void replay_options(struct replay_input *ri, const unsigned char *p,
+			   const unsigned char *end,
+			   void (*cb)(struct replay_input *ri, uint16_t code,
+				      const unsigned char *val, uint16_t len,
+				      void *data),
+			   void *data)
+{
+	while (p + 4 <= end) {
+		uint16_t code = replay_u16(ri, p);
+		uint16_t len = replay_u16(ri, p + 2);
+
+		if (code == 0 || p + 4 + len > end)
+			break;
+		cb(ri, code, p + 4, len, data);
+		p += 4 + ((len + 3) & ~3);
+	}
+}
+
+static void replay_idb_option(struct replay_input *ri, uint16_t code,
+			      const unsigned char *val, uint16_t len,
+			      void *data)
+{
+	struct replay_iface *iface = data;
+
+	if (code == PCAPNG_IF_TSRESOL && len == 1)
+		iface->tsresol = val[0];
+	else if (code == PCAPNG_IF_TSOFFSET && len == 8) {
+		uint64_t off;
+
+		memcpy(&off, val, sizeof(off));
+		iface->tsoffset = ri->swapped ? bswap_64(off) : off;
+	}
+}
+
+static void replay_epb_option(struct replay_input *ri, uint16_t code,
+			      const unsigned char *val, uint16_t len,
+			      void *data)
+{
+	struct replay_pkt *pkt = data;
+	int i = pkt->comment[0] ? 1 : 0;
+
+	if (code != PCAPNG_OPT_COMMENT || pkt->comment[1])
+		return;
+	pkt->comment[i] = val;
+	pkt->comment_len[i] = len;
+}
+
+static int replay_add_iface(struct replay_input *ri, const unsigned char *body,
+			    const unsigned char *end)
+{
+	struct replay_iface *iface;
+
+	if (end - body < 8)
+		return -1;
+
+	if (ri->num_ifaces == ri->max_ifaces) {
+		unsigned int max = ri->max_ifaces ? 2 * ri->max_ifaces : 8;
+
+		iface = realloc(ri->ifaces, max * sizeof(*iface));
+		if (!iface)
+			return -1;
+		ri->ifaces = iface;
+		ri->max_ifaces = max;
+	}
+
+	iface = &ri->ifaces[ri->num_ifaces++];
+	iface->linktype = replay_u16(ri, body);
+	iface->tsresol = 6;
+	iface->tsoffset = 0;
+	replay_options(ri, body + 8, end, replay_idb_option, iface);
+	if (!replay_tsresol_valid(iface->tsresol))
+		return -1;
+
+	return 0;
+}
+
+static int replay_open_pcapng(struct replay_input *ri)
+{
+	uint32_t type;
+
+	if (ri->size < 12)
+		return -1;
+	memcpy(&type, ri->map, sizeof(type));
+	if (type != PCAPNG_SHB)
+		return -1;
+
+	ri->pcapng = 1;
+	ri->start = 0;
+	return 0;
+}
+
+static int replay_next_pcapng(struct replay_input *ri, struct replay_pkt *pkt)
+{
+	while (ri->off + 12 <= ri->size) {
+		const unsigned char *blk = ri->map + ri->off;
+		const unsigned char *body = blk + 8, *end;
+		uint32_t type, len, magic;
+		struct replay_iface *iface;
+
+		memcpy(&type, blk, sizeof(type));
+		if (type == PCAPNG_SHB) {
+			/* each section has its own byte order */
+			memcpy(&magic, blk + 8, sizeof(magic));
+			if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+				ri->swapped = 0;
+			else if (magic == bswap_32(PCAPNG_BYTE_ORDER_MAGIC))
+				ri->swapped = 1;
+			else
+				return -1;
+			ri->num_ifaces = 0;
+		} else
+			type = replay_u32(ri, blk);
+
+		len = replay_u32(ri, blk + 4);
+		if (len < 12 || len % 4 || len > ri->size - ri->off)
+			return -1;
+		end = blk + len - 4;
+		ri->off += len;
+
+		switch (type) {
+		case PCAPNG_IDB:
+			if (replay_add_iface(ri, body, end) < 0)
+				return -1;
+			break;
+		case PCAPNG_EPB: {
+			uint32_t id;
+
+			if (end - body < 20)
+				return -1;
+			id = replay_u32(ri, body);
+			if (id >= ri->num_ifaces)
+				return -1;
+			iface = &ri->ifaces[id];
+			pkt->caplen = replay_u32(ri, body + 12);
+			pkt->origlen = replay_u32(ri, body + 16);
+			if (pkt->caplen > (size_t)(end - body - 20))
+				return -1;
+			pkt->data = body + 20;
+			if (replay_ts(iface,
+				      (uint64_t)replay_u32(ri, body + 4) << 32 |
+				      replay_u32(ri, body + 8), &pkt->ts) < 0)
+				return -1;
+			pkt->linktype = iface->linktype;
+			pkt->comment[0] = pkt->comment[1] = NULL;
+			replay_options(ri, pkt->data + ((pkt->caplen + 3) & ~3),
+				       end, replay_epb_option, pkt);
+			return 1;
+		}
+		case PCAPNG_SPB:
+			if (end - body < 4 || ri->num_ifaces == 0)
+				return -1;
+			pkt->origlen = replay_u32(ri, body);
+			pkt->caplen = end - body - 4;
+			if (pkt->caplen > pkt->origlen)
+				pkt->caplen = pkt->origlen;
+			pkt->data = body + 4;
+			/* no time stamp, keep the pace of the previous one */
+			pkt->ts = ri->last_ts;
+			pkt->linktype = ri->ifaces[0].linktype;
+			pkt->comment[0] = pkt->comment[1] = NULL;
+			return 1;
+		default:
+			/* statistics, name resolution and so on */
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int replay_next(struct replay_input *ri, struct replay_pkt *pkt)
+{
+	if (ri->pcapng)
+		return replay_next_pcapng(ri, pkt);
+	return replay_next_pcap(ri, pkt);
+}
+
+/***********************************************************************
+ * handing packets to the stack
+ ***********************************************************************/
+
+static void set_family(struct ulogd_key *ret, uint16_t proto)
+{
+	switch (proto) {
+	case ETH_P_IP:
+		okey_set_u8(&ret[REPLAY_KEY_OOB_FAMILY], AF_INET);
+		break;
+	case ETH_P_IPV6:
+		okey_set_u8(&ret[REPLAY_KEY_OOB_FAMILY], AF_INET6);
+		break;
+	default:
+		okey_set_u8(&ret[REPLAY_KEY_OOB_FAMILY], AF_BRIDGE);
+		break;
+	}
+	okey_set_u16(&ret[REPLAY_KEY_OOB_PROTOCOL], proto);
+}
+
+static void set_payload(struct ulogd_key *ret, const unsigned char *data,
+			uint32_t len)
+{
+	okey_set_ptr(&ret[REPLAY_KEY_RAW_PCKT], (void *)data);
+	okey_set_u32(&ret[REPLAY_KEY_RAW_PCKTLEN], len);
+}
+
+static void set_prefix(struct replay_input *ri, struct ulogd_key *ret,
+		       const unsigned char *p, unsigned int len)
+{
+	if (len > REPLAY_PREFIX_MAX)
+		len = REPLAY_PREFIX_MAX;
+	memcpy(ri->prefix, p, len);
+	ri->prefix[len] = '\0';
+	/* NFLOG prefixes are NUL terminated already */
+	if (ri->prefix[0])
+		okey_set_ptr(&ret[REPLAY_KEY_OOB_PREFIX], ri->prefix);
+}
+
+static int decode_raw(struct ulogd_key *ret, const unsigned char *p,
+		      uint32_t len)
+{
+	if (len < 1)
+		return -1;
+
+	switch (p[0] >> 4) {
+	case 4:
+		set_family(ret, ETH_P_IP);
+		break;
+	case 6:
+		set_family(ret, ETH_P_IPV6);
+		break;
+	default:
+		return -1;
+	}
+	set_payload(ret, p, len);
+	return 0;
+}
+
+static int decode_ethernet(struct ulogd_key *ret, const unsigned char *p,
+			   uint32_t len)
+{
+	unsigned int hlen = ETH_HLEN;
+	uint16_t proto;
+
+	if (len < ETH_HLEN)
+		return -1;
+
+	proto = p[12] << 8 | p[13];
+	/* skip VLAN tags */
+	while ((proto == ETH_P_8021Q || proto == ETH_P_8021AD) &&
+	       len >= hlen + 4) {
+		proto = p[hlen + 2] << 8 | p[hlen + 3];
+		hlen += 4;
+	}
+
+	okey_set_ptr(&ret[REPLAY_KEY_RAW_MAC], (void *)p);
+	okey_set_u16(&ret[REPLAY_KEY_RAW_MAC_LEN], hlen);
+	okey_set_u16(&ret[REPLAY_KEY_RAW_TYPE], ARPHRD_ETHER);
+	okey_set_ptr(&ret[REPLAY_KEY_RAW_MAC_SADDR], (void *)(p + ETH_ALEN));
+	okey_set_u16(&ret[REPLAY_KEY_RAW_MAC_ADDRLEN], ETH_ALEN);
+	set_family(ret, proto);
+	set_payload(ret, p + hlen, len - hlen);
+	return 0;
+}
+
+static int decode_sll(struct ulogd_key *ret, const unsigned char *p,
+		      uint32_t len)
+{
+	uint16_t addrlen;
+
+	if (len < 16)
+		return -1;
+
+	addrlen = p[4] << 8 | p[5];
+	if (addrlen > 8)
+		addrlen = 8;
+	okey_set_u16(&ret[REPLAY_KEY_RAW_TYPE], p[2] << 8 | p[3]);
+	okey_set_ptr(&ret[REPLAY_KEY_RAW_MAC_SADDR], (void *)(p + 6));
+	okey_set_u16(&ret[REPLAY_KEY_RAW_MAC_ADDRLEN], addrlen);
+	set_family(ret, p[14] << 8 | p[15]);
+	set_payload(ret, p + 16, len - 16);
+	return 0;
+}
+
+/* captures of the nflog pseudo interface, attributes are in the byte
+ * order of the capturing host except for their values */
+static int decode_nflog(struct replay_input *ri, struct ulogd_key *ret,
+			const unsigned char *p, uint32_t len)
+{
+	const unsigned char *end = p + len, *hwhdr = NULL;
+	unsigned int hwhdr_len = 0;
+	int have_payload = 0, hwlen = -1;
+
+	if (len < 4)
+		return -1;
+
+	okey_set_u8(&ret[REPLAY_KEY_OOB_FAMILY], p[0]);
+	for (p += 4; p + 4 <= end; ) {
+		uint16_t tlv_len = replay_u16(ri, p);
+		uint16_t type = replay_u16(ri, p + 2) & 0x7fff;
+		const unsigned char *val = p + 4;
+		unsigned int val_len;
+
+		if (tlv_len < 4 || p + tlv_len > end)
+			break;
+		val_len = tlv_len - 4;
+
+		switch (type) {
+		case NFLOG_TLV_PACKET_HDR:
+			if (val_len >= 3) {
+				okey_set_u16(&ret[REPLAY_KEY_OOB_PROTOCOL],
+					     val[0] << 8 | val[1]);
+				okey_set_u8(&ret[REPLAY_KEY_OOB_HOOK], val[2]);
+			}
+			break;
+		case NFLOG_TLV_MARK:
+			if (val_len >= 4)
+				okey_set_u32(&ret[REPLAY_KEY_OOB_MARK],
+					     get_be32(val));
+			break;
+		case NFLOG_TLV_INDEV:
+			if (val_len >= 4 && get_be32(val))
+				okey_set_u32(&ret[REPLAY_KEY_OOB_IFINDEX_IN],
+					     get_be32(val));
+			break;
+		case NFLOG_TLV_OUTDEV:
+			if (val_len >= 4 && get_be32(val))
+				okey_set_u32(&ret[REPLAY_KEY_OOB_IFINDEX_OUT],
+					     get_be32(val));
+			break;
+		case NFLOG_TLV_PAYLOAD:
+			set_payload(ret, val, val_len);
+			have_payload = 1;
+			break;
+		case NFLOG_TLV_PREFIX:
+			set_prefix(ri, ret, val, val_len);
+			break;
+		case NFLOG_TLV_UID:
+			if (val_len >= 4)
+				okey_set_u32(&ret[REPLAY_KEY_OOB_UID],
+					     get_be32(val));
+			break;
+		case NFLOG_TLV_GID:
+			if (val_len >= 4)
+				okey_set_u32(&ret[REPLAY_KEY_OOB_GID],
+					     get_be32(val));
+			break;
+		case NFLOG_TLV_HWTYPE:
+			if (val_len >= 2)
+				okey_set_u16(&ret[REPLAY_KEY_RAW_TYPE],
+					     val[0] << 8 | val[1]);
+			break;
+		case NFLOG_TLV_HWHEADER:
+			hwhdr = val;
+			hwhdr_len = val_len;
+			break;
+		case NFLOG_TLV_HWLEN:
+			if (val_len >= 2)
+				hwlen = val[0] << 8 | val[1];
+			break;
+		}
+		p += (tlv_len + 3) & ~3;
+	}
+
+	/* the length is trusted by whoever reads the header */
+	if (hwhdr && hwlen >= 0 && (unsigned int)hwlen <= hwhdr_len) {
+		okey_set_ptr(&ret[REPLAY_KEY_RAW_MAC], (void *)hwhdr);
+		okey_set_u16(&ret[REPLAY_KEY_RAW_MAC_LEN], hwlen);
+	}
+
+	return have_payload ? 0 : -1;
+}
+
+static void replay_comments(struct replay_input *ri, struct ulogd_key *ret,
+			    struct replay_pkt *pkt)
+{
+	int i;
+
+	/* as written by the pcapng mode of the PCAP output */
+	for (i = 0; i < 2 && pkt->comment[i]; i++) {
+		const unsigned char *c = pkt->comment[i];
+		uint16_t len = pkt->comment_len[i];
+
+		if (len > 5 && len < 16 && !memcmp(c, "mark=", 5)) {
+			char mark[16];
+
+			memcpy(mark, c + 5, len - 5);
+			mark[len - 5] = '\0';
+			okey_set_u32(&ret[REPLAY_KEY_OOB_MARK],
+				     strtoul(mark, NULL, 0));
+		} else
+			set_prefix(ri, ret, c, len);
+	}
+}
+
+static void replay_packet(struct ulogd_pluginstance *upi,
+			  struct replay_pkt *pkt)
+{
+	struct replay_input *ri = (struct replay_input *)upi->private;
+	struct ulogd_key *ret = upi->output.keys;
+	int err;
+
+	switch (pkt->linktype) {
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		err = decode_raw(ret, pkt->data, pkt->caplen);
+		break;
+	case LINKTYPE_ETHERNET:
+		err = decode_ethernet(ret, pkt->data, pkt->caplen);
+		break;
+	case LINKTYPE_LINUX_SLL:
+		err = decode_sll(ret, pkt->data, pkt->caplen);
+		break;
+	case LINKTYPE_NFLOG:
+		err = decode_nflog(ri, ret, pkt->data, pkt->caplen);
+		break;
+	default:
+		if (!ri->warned) {
+			ulogd_log(ULOGD_NOTICE, "REPLAY: skipping packets of "
+				  "unsupported link type %u\n",
+				  pkt->linktype);
+			ri->warned = 1;
+		}
+		err = -1;
+		break;
+	}
+	if (err < 0) {
+		unsigned int i;
+
+		ri->skipped++;
+		for (i = 0; i < upi->output.num_keys; i++)
+			ret[i].flags &= ~ULOGD_RETF_VALID;
+		return;
+	}
+
+	replay_comments(ri, ret, pkt);
+	okey_set_u32(&ret[REPLAY_KEY_RAW_PCKTCOUNT], 1);
+	okey_set_u8(&ret[REPLAY_KEY_RAW_LABEL],
+		    label_ce(upi->config_kset).u.value);
+	okey_set_u32(&ret[REPLAY_KEY_OOB_TIME_SEC],
+		     (pkt->ts / NSEC_PER_SEC) & 0xffffffff);
+	okey_set_u32(&ret[REPLAY_KEY_OOB_TIME_USEC],
+		     (pkt->ts % NSEC_PER_SEC) / 1000);
+
+	ri->packets++;
+	ulogd_propagate_results(upi);
+}
+
+static uint64_t replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int replay_arm(struct replay_input *ri, uint64_t when)
+{
+	struct itimerspec its = {
+		.it_value = {
+			.tv_sec = when / NSEC_PER_SEC,
+			.tv_nsec = when % NSEC_PER_SEC,
+		},
+	};
+
+	return timerfd_settime(ri->timer_fd.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* the end of the file has been reached, start over if we loop */
+static int replay_rewind(struct ulogd_pluginstance *upi)
+{
+	struct replay_input *ri = (struct replay_input *)upi->private;
+	int loops = loop_ce(upi->config_kset).u.value;
+
+	ri->passes++;
+	if (loops > 0 && ri->passes >= (unsigned int)loops) {
+		ulogd_log(ULOGD_NOTICE, "REPLAY: done, %" PRIu64 " packets, "
+			  "%" PRIu64 " skipped\n", ri->packets, ri->skipped);
+		if (exit_ce(upi->config_kset).u.value)
+			kill(getpid(), SIGTERM);
+		return -1;
+	}
+
+	ri->off = ri->start;
+	ri->num_ifaces = 0;
+	ri->pass_started = 0;
+	return 0;
+}
+
+static int replay_timer_cb(int fd, unsigned int what, void *param)
+{
+	struct ulogd_pluginstance *upi = param;
+	struct replay_input *ri = (struct replay_input *)upi->private;
+	unsigned int speed = speed_ce(upi->config_kset).u.value;
+	uint64_t expirations, now = 0;
+	int i, ret;
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		return -1;
+
+	for (i = 0; i < REPLAY_BATCH; i++) {
+		if (!ri->have_pkt) {
+			ret = replay_next(ri, &ri->pkt);
+			if (ret < 0) {
+				ulogd_log(ULOGD_ERROR, "REPLAY: `%s' is "
+					  "truncated or corrupt\n",
+					  file_ce(upi->config_kset).u.string);
+				ret = 0;
+			}
+			if (ret == 0) {
+				/* the timer is left disarmed once done */
+				if (replay_rewind(upi) < 0)
+					return 0;
+				continue;
+			}
+			ri->have_pkt = 1;
+		}
+
+		if (speed) {
+			uint64_t due;
+
+			if (!now)
+				now = replay_now();
+			if (!ri->pass_started) {
+				ri->pass_ts = ri->pkt.ts;
+				ri->pass_start = now;
+				ri->pass_started = 1;
+			}
+			due = ri->pass_start;
+			if (ri->pkt.ts > ri->pass_ts)
+				due += (ri->pkt.ts - ri->pass_ts) / speed;
+			if (due > now)
+				return replay_arm(ri, due);
+		}
+
+		ri->last_ts = ri->pkt.ts;
+		ri->have_pkt = 0;
+		replay_packet(upi, &ri->pkt);
+	}
+
+	/* let the other file descriptors in before the next batch */
+	return replay_arm(ri, replay_now());
+}
+
+static int configure(struct ulogd_pluginstance *upi,
+		     struct ulogd_pluginstance_stack *stack)
+{
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (speed_ce(upi->config_kset).u.value < 0 ||
+	    loop_ce(upi->config_kset).u.value < 0) {
+		ulogd_log(ULOGD_ERROR, "REPLAY: speed and loop can't be "
+			  "negative\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int start(struct ulogd_pluginstance *upi)
+{
+	struct replay_input *ri = (struct replay_input *)upi->private;
+	char *file = file_ce(upi->config_kset).u.string;
+	struct stat st;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "REPLAY: can't open `%s': %s\n",
+			  file, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		ulogd_log(ULOGD_ERROR, "REPLAY: `%s' is empty\n", file);
+		close(fd);
+		return -1;
+	}
+
+	ri->size = st.st_size;
+	ri->map = mmap(NULL, ri->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ri->map == MAP_FAILED) {
+		ulogd_log(ULOGD_ERROR, "REPLAY: can't map `%s': %s\n",
+			  file, strerror(errno));
+		ri->map = NULL;
+		return -1;
+	}
+	madvise(ri->map, ri->size, MADV_SEQUENTIAL);
+
+	if (replay_open_pcap(ri) < 0 && replay_open_pcapng(ri) < 0) {
+		ulogd_log(ULOGD_ERROR, "REPLAY: `%s' is neither a pcap nor "
+			  "a pcapng file\n", file);
+		goto err_map;
+	}
+	ri->off = ri->start;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "REPLAY: can't create timer: %s\n",
+			  strerror(errno));
+		goto err_map;
+	}
+	ri->timer_fd.fd = fd;
+	ri->timer_fd.cb = &replay_timer_cb;
+	ri->timer_fd.data = upi;
+	ri->timer_fd.when = ULOGD_FD_READ;
+
+	if (ulogd_register_fd(&ri->timer_fd) < 0 ||
+	    replay_arm(ri, replay_now()) < 0) {
+		ulogd_log(ULOGD_ERROR, "REPLAY: can't set up timer\n");
+		close(fd);
+		goto err_map;
+	}
+
+	return 0;
+
+err_map:
+	munmap(ri->map, ri->size);
+	ri->map = NULL;
+	return -1;
+}
+
+static int stop(struct ulogd_pluginstance *upi)
+{
+	struct replay_input *ri = (struct replay_input *)upi->private;
+
+	if (!ri->map)
+		return 0;
+
+	ulogd_unregister_fd(&ri->timer_fd);
+	close(ri->timer_fd.fd);
+	munmap(ri->map, ri->size);
+	ri->map = NULL;
+	free(ri->ifaces);
+	ri->ifaces = NULL;
+	ri->num_ifaces = ri->max_ifaces = 0;
+
+	return 0;
+}
+
+static struct ulogd_plugin replay_plugin = {
+	.name = "REPLAY",
+	.input = {
+		.type = ULOGD_DTYPE_SOURCE,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_RAW,
+		.keys = output_keys,
+		.num_keys = ARRAY_SIZE(output_keys),
+	},
+	.priv_size	= sizeof(struct replay_input),
+	.configure	= &configure,
+	.start		= &start,
+	.stop		= &stop,
+	.config_kset	= &replay_kset,
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&replay_plugin);
+}
@@ -20,10 +20,24 @@
 
 #include <ulogd/ulogd.h>
 #include <ulogd/timer.h>
+#include <ulogd/clock.h>
+#include <ulogd/linuxlist.h>
+#include <ulogd/jhash.h>
+#include <ulogd/hash.h>
 
 #include <libmnl/libmnl.h>
 #include <libnetfilter_acct/libnetfilter_acct.h>
 
+/* state kept across polls for each accounting object */
+struct nfacct_obj {
+	struct hashtable_node	hashnode;	/* must be first */
+	struct nfacct		*nfacct;	/* last received */
+	uint64_t		pkts;
+	uint64_t		bytes;
+	uint64_t		poll_time;	/* of pkts/bytes, in ns */
+	unsigned int		poll;		/* last poll seen in */
+};
+
 struct nfacct_pluginstance {
 	struct mnl_socket	*nl;
 	uint32_t		portid;
@@ -31,6 +45,11 @@ struct nfacct_pluginstance {
 	struct ulogd_fd		ufd;
 	struct ulogd_timer	timer;
 	struct timeval tv;
+	/* objects by name, and the next one to parse messages into */
+	struct hashtable	*objs;
+	struct nfacct		*spare;
+	unsigned int		poll;
+	uint64_t		poll_time;	/* CLOCK_MONOTONIC, in ns */
 };
 
 static struct config_keyset nfacct_kset = {
@@ -52,13 +71,27 @@ static struct config_keyset nfacct_kset = {
 			.type	 = CONFIG_TYPE_INT,
 			.options = CONFIG_OPT_NONE,
 			.u.value = 0,
-		}
+		},
+		{
+			.key	 = "buckets",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 1024,
+		},
+		{
+			.key	 = "maxentries",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 65536,
+		},
 	},
-	.num_ces = 3,
+	.num_ces = 5,
 };
 #define pollint_ce(x)	(x->ces[0])
 #define zerocounter_ce(x) (x->ces[1])
 #define timestamp_ce(x) (x->ces[2])
+#define buckets_ce(x)	(x->ces[3])
+#define maxentries_ce(x) (x->ces[4])
 
 enum ulogd_nfacct_keys {
 	ULOGD_NFACCT_NAME,
@@ -67,6 +100,10 @@ enum ulogd_nfacct_keys {
 	ULOGD_NFACCT_RAW,
 	ULOGD_NFACCT_TIME_SEC,
 	ULOGD_NFACCT_TIME_USEC,
+	ULOGD_NFACCT_PKTS_DELTA,
+	ULOGD_NFACCT_BYTES_DELTA,
+	ULOGD_NFACCT_PKTS_RATE,
+	ULOGD_NFACCT_BYTES_RATE,
 };
 
 static struct ulogd_key nfacct_okeys[] = {
@@ -100,13 +137,149 @@ static struct ulogd_key nfacct_okeys[] = {
 		.flags = ULOGD_RETF_NONE,
 		.name = "oob.time.usec",
 	},
+	/* since the previous poll, not set the first time an object is seen */
+	[ULOGD_NFACCT_PKTS_DELTA] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.pkts.delta",
+	},
+	[ULOGD_NFACCT_BYTES_DELTA] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.bytes.delta",
+	},
+	/* per second */
+	[ULOGD_NFACCT_PKTS_RATE] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.pkts.rate",
+	},
+	[ULOGD_NFACCT_BYTES_RATE] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.bytes.rate",
+	},
+};
+
+struct nfacct_sample {
+	struct nfacct *nfacct;
+	int has_delta;
+	uint64_t pkts_delta;
+	uint64_t bytes_delta;
+	uint64_t pkts_rate;
+	uint64_t bytes_rate;
 };
 
+static uint32_t nfacct_hash(const void *data, const struct hashtable *table)
+{
+	const char *name = data;
+
+	return ((uint64_t)jhash(name, strlen(name), 0) * table->hashsize) >> 32;
+}
+
+static int nfacct_compare(const void *data1, const void *data2)
+{
+	const struct nfacct_obj *obj = data1;
+
+	return !strcmp(nfacct_attr_get_str(obj->nfacct, NFACCT_ATTR_NAME),
+		       data2);
+}
+
+static uint64_t nfacct_delta(uint64_t prev, uint64_t cur, int zeroed)
+{
+	/* counters read with zerocounter start again from 0 every time,
+	 * and a counter going backwards was reset or recreated meanwhile */
+	if (zeroed || cur < prev)
+		return cur;
+	return cur - prev;
+}
+
+/* remember the counters of the freshly parsed `cpi->spare' and compute
+ * what changed since the previous poll. The object takes the place of
+ * the previous one of the same name, which becomes the next spare. */
+static void nfacct_track(struct ulogd_pluginstance *upi,
+			 struct nfacct_sample *sample)
+{
+	struct nfacct_pluginstance *cpi =
+		(struct nfacct_pluginstance *)upi->private;
+	struct nfacct *nfacct = cpi->spare;
+	const char *name = nfacct_attr_get_str(nfacct, NFACCT_ATTR_NAME);
+	uint64_t pkts = nfacct_attr_get_u64(nfacct, NFACCT_ATTR_PKTS);
+	uint64_t bytes = nfacct_attr_get_u64(nfacct, NFACCT_ATTR_BYTES);
+	int zeroed = zerocounter_ce(upi->config_kset).u.value != 0;
+	struct nfacct_obj *obj;
+	int id;
+
+	sample->nfacct = nfacct;
+	sample->has_delta = 0;
+
+	id = hashtable_hash(cpi->objs, name);
+	obj = (struct nfacct_obj *) hashtable_find(cpi->objs, name, id);
+	if (obj) {
+		uint64_t elapsed = cpi->poll_time - obj->poll_time;
+
+		sample->has_delta = 1;
+		sample->pkts_delta = nfacct_delta(obj->pkts, pkts, zeroed);
+		sample->bytes_delta = nfacct_delta(obj->bytes, bytes, zeroed);
+		if (elapsed) {
+			sample->pkts_rate = sample->pkts_delta * 1e9 / elapsed;
+			sample->bytes_rate = sample->bytes_delta * 1e9 /
+					     elapsed;
+		} else
+			sample->pkts_rate = sample->bytes_rate = 0;
+
+		cpi->spare = obj->nfacct;
+	} else {
+		obj = calloc(1, sizeof(*obj));
+		if (!obj)
+			goto untracked;
+		if (hashtable_add(cpi->objs, &obj->hashnode, id) < 0) {
+			free(obj);
+			goto untracked;
+		}
+		cpi->spare = NULL;
+	}
+
+	obj->nfacct = nfacct;
+	obj->pkts = pkts;
+	obj->bytes = bytes;
+	obj->poll_time = cpi->poll_time;
+	obj->poll = cpi->poll;
+	return;
+
+untracked:
+	/* too many objects, still pass the counters on */
+	cpi->spare = nfacct;
+}
+
+static int nfacct_expire(void *data, void *n)
+{
+	struct nfacct_pluginstance *cpi = data;
+	struct nfacct_obj *obj = n;
+
+	if (obj->poll != cpi->poll) {
+		hashtable_del(cpi->objs, &obj->hashnode);
+		nfacct_free(obj->nfacct);
+		free(obj);
+	}
+	return 0;
+}
+
+static int nfacct_free_obj(void *data, void *n)
+{
+	struct nfacct_obj *obj = n;
+
+	nfacct_free(obj->nfacct);
+	free(obj);
+	return 0;
+}
+
 static void
-propagate_nfacct(struct ulogd_pluginstance *upi, struct nfacct *nfacct)
+propagate_nfacct(struct ulogd_pluginstance *upi, struct nfacct_sample *sample)
 {
 	struct ulogd_key *ret = upi->output.keys;
 	struct nfacct_pluginstance *cpi = (struct nfacct_pluginstance *) upi->private;
+	struct nfacct *nfacct = sample->nfacct;
 
 	okey_set_ptr(&ret[ULOGD_NFACCT_NAME],
 			(void *)nfacct_attr_get_str(nfacct, NFACCT_ATTR_NAME));
@@ -121,39 +294,54 @@ propagate_nfacct(struct ulogd_pluginstance *upi, struct nfacct *nfacct)
 		okey_set_u32(&ret[ULOGD_NFACCT_TIME_USEC], cpi->tv.tv_usec);
 	}
 
+	if (sample->has_delta) {
+		okey_set_u64(&ret[ULOGD_NFACCT_PKTS_DELTA], sample->pkts_delta);
+		okey_set_u64(&ret[ULOGD_NFACCT_BYTES_DELTA],
+			     sample->bytes_delta);
+		okey_set_u64(&ret[ULOGD_NFACCT_PKTS_RATE], sample->pkts_rate);
+		okey_set_u64(&ret[ULOGD_NFACCT_BYTES_RATE],
+			     sample->bytes_rate);
+	}
+
 	ulogd_propagate_results(upi);
 }
 
 static void
-do_propagate_nfacct(struct ulogd_pluginstance *upi, struct nfacct *nfacct)
+do_propagate_nfacct(struct ulogd_pluginstance *upi,
+		    struct nfacct_sample *sample)
 {
 	struct ulogd_pluginstance *npi = NULL;
 
 	llist_for_each_entry(npi, &upi->plist, plist)
-		propagate_nfacct(npi, nfacct);
-
-	propagate_nfacct(upi, nfacct);
+		propagate_nfacct(npi, sample);
 
-	nfacct_free(nfacct);
+	propagate_nfacct(upi, sample);
 }
 
 static int nfacct_cb(const struct nlmsghdr *nlh, void *data)
 {
-	struct nfacct *nfacct;
 	struct ulogd_pluginstance *upi = data;
-
-	nfacct = nfacct_alloc();
-	if (nfacct == NULL) {
-		ulogd_log(ULOGD_ERROR, "OOM");
-		goto err;
+	struct nfacct_pluginstance *cpi =
+		(struct nfacct_pluginstance *)upi->private;
+	struct nfacct_sample sample;
+
+	/* objects are only allocated for accounting objects not seen yet,
+	 * the others are parsed into the object of the previous poll */
+	if (cpi->spare == NULL) {
+		cpi->spare = nfacct_alloc();
+		if (cpi->spare == NULL) {
+			ulogd_log(ULOGD_ERROR, "OOM");
+			goto err;
+		}
 	}
 
-	if (nfacct_nlmsg_parse_payload(nlh, nfacct) < 0) {
+	if (nfacct_nlmsg_parse_payload(nlh, cpi->spare) < 0) {
 		ulogd_log(ULOGD_ERROR, "Error parsing nfacct message");
 		goto err;
 	}
 
-	do_propagate_nfacct(upi, nfacct);
+	nfacct_track(upi, &sample);
+	do_propagate_nfacct(upi, &sample);
 
 err:
 	return MNL_CB_OK;
@@ -174,6 +362,9 @@ static int nfacct_read_cb(int fd, unsigned int what, void *param)
 	if (ret > 0) {
 		ret = mnl_cb_run(buf, ret, cpi->seq,
 				 cpi->portid, nfacct_cb, upi);
+		/* end of the dump, forget the objects which are gone */
+		if (ret == MNL_CB_STOP)
+			hashtable_iterate(cpi->objs, cpi, nfacct_expire);
 	}
 	return ret;
 }
@@ -192,6 +383,8 @@ static int nfacct_send_request(struct ulogd_pluginstance *upi)
 		flushctr = NFNL_MSG_ACCT_GET;
 
 	cpi->seq = time(NULL);
+	cpi->poll++;
+	cpi->poll_time = ulogd_clock_monotonic();
 	nlh = nfacct_nlmsg_build_hdr(buf, flushctr, NLM_F_DUMP, cpi->seq);
 
 	if (mnl_socket_sendto(cpi->nl, nlh, nlh->nlmsg_len) < 0) {
@@ -200,7 +393,7 @@ static int nfacct_send_request(struct ulogd_pluginstance *upi)
 	}
 	if (timestamp_ce(upi->config_kset).u.value != 0) {
 		/* Compute time of query */
-		gettimeofday(&cpi->tv, NULL);
+		ulogd_clock_timeval(&cpi->tv);
 	}
 	return 0;
 }
@@ -229,6 +422,12 @@ static int configure_nfacct(struct ulogd_pluginstance *upi,
 		ulogd_log(ULOGD_FATAL, "You have to set pollint\n");
 		return -1;
 	}
+	if (buckets_ce(upi->config_kset).u.value <= 0 ||
+	    maxentries_ce(upi->config_kset).u.value <= 0) {
+		ulogd_log(ULOGD_FATAL, "buckets and maxentries must be "
+			  "positive\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -240,15 +439,25 @@ static int constructor_nfacct(struct ulogd_pluginstance *upi)
 	if (pollint_ce(upi->config_kset).u.value == 0)
 		return -1;
 
+	cpi->objs = hashtable_create(buckets_ce(upi->config_kset).u.value,
+				     maxentries_ce(upi->config_kset).u.value,
+				     nfacct_hash, nfacct_compare);
+	if (cpi->objs == NULL) {
+		ulogd_log(ULOGD_FATAL, "error allocating hash\n");
+		return -1;
+	}
+	cpi->spare = NULL;
+
 	cpi->nl = mnl_socket_open(NETLINK_NETFILTER);
 	if (cpi->nl == NULL) {
 		ulogd_log(ULOGD_FATAL, "cannot open netlink socket\n");
-		return -1;
+		goto err_hashtable;
 	}
 
 	if (mnl_socket_bind(cpi->nl, 0, MNL_SOCKET_AUTOPID) < 0) {
 		ulogd_log(ULOGD_FATAL, "cannot bind netlink socket\n");
-		return -1;
+		mnl_socket_close(cpi->nl);
+		goto err_hashtable;
 	}
 	cpi->portid = mnl_socket_get_portid(cpi->nl);
 
@@ -263,6 +472,11 @@ static int constructor_nfacct(struct ulogd_pluginstance *upi)
 			 pollint_ce(upi->config_kset).u.value);
 
 	return 0;
+
+err_hashtable:
+	hashtable_destroy(cpi->objs);
+	cpi->objs = NULL;
+	return -1;
 }
 
 static int destructor_nfacct(struct ulogd_pluginstance *upi)
@@ -273,6 +487,14 @@ static int destructor_nfacct(struct ulogd_pluginstance *upi)
 	ulogd_unregister_fd(&cpi->ufd);
 	mnl_socket_close(cpi->nl);
 
+	hashtable_iterate(cpi->objs, NULL, nfacct_free_obj);
+	hashtable_destroy(cpi->objs);
+	cpi->objs = NULL;
+	if (cpi->spare) {
+		nfacct_free(cpi->spare);
+		cpi->spare = NULL;
+	}
+
 	return 0;
 }
 
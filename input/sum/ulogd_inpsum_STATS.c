@@ -0,0 +1,318 @@
+/* ulogd_inpsum_STATS.c
+ *
+ * ulogd input plugin reporting the counters of ulogd itself
+ *
+ * Every pollinterval seconds, one event is emitted for each plugin
+ * instance of each stack, with the counters kept by the core (events,
+ * errors, time spent in interp and its distribution) and by the plugins
+ * (drops, netlink overruns, bytes waiting to be written).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/timer.h>
+#include <ulogd/clock.h>
+#include <ulogd/histogram.h>
+#include <ulogd/linuxlist.h>
+
+struct stats_pluginstance {
+	struct ulogd_timer	timer;
+	struct timeval		tv;
+};
+
+static struct config_keyset stats_kset = {
+	.ces = {
+		{
+			.key	 = "pollinterval",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 10,
+		},
+		{
+			/* costs two cycle counter reads per plugin and event */
+			.key	 = "timing",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	},
+	.num_ces = 2,
+};
+#define pollint_ce(x)	(x->ces[0])
+#define timing_ce(x)	(x->ces[1])
+
+enum ulogd_stats_keys {
+	ULOGD_STATS_NAME,
+	ULOGD_STATS_PKTS,
+	ULOGD_STATS_BYTES,
+	ULOGD_STATS_TIME_SEC,
+	ULOGD_STATS_TIME_USEC,
+	ULOGD_STATS_PLUGIN,
+	ULOGD_STATS_STACK,
+	ULOGD_STATS_EVENTS,
+	ULOGD_STATS_ERRORS,
+	ULOGD_STATS_INTERP_NS,
+	ULOGD_STATS_DROPS,
+	ULOGD_STATS_OVERRUNS,
+	ULOGD_STATS_BACKLOG,
+	ULOGD_STATS_LATENCY_P50,
+	ULOGD_STATS_LATENCY_P99,
+	ULOGD_STATS_LATENCY_MAX,
+};
+
+static struct ulogd_key stats_okeys[] = {
+	/* the instance id, events and backlog are also exported with the
+	 * names of NFACCT so that the outputs for sums can be used */
+	[ULOGD_STATS_NAME] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.name",
+	},
+	[ULOGD_STATS_PKTS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.pkts",
+	},
+	[ULOGD_STATS_BYTES] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "sum.bytes",
+	},
+	[ULOGD_STATS_TIME_SEC] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "oob.time.sec",
+	},
+	[ULOGD_STATS_TIME_USEC] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "oob.time.usec",
+	},
+	[ULOGD_STATS_PLUGIN] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.plugin",
+	},
+	/* position of the stack in the configuration file, from 0 */
+	[ULOGD_STATS_STACK] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.stack",
+	},
+	[ULOGD_STATS_EVENTS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.events",
+	},
+	[ULOGD_STATS_ERRORS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.errors",
+	},
+	/* only set with timing=1 */
+	[ULOGD_STATS_INTERP_NS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.interp_ns",
+	},
+	[ULOGD_STATS_DROPS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.drops",
+	},
+	[ULOGD_STATS_OVERRUNS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.overruns",
+	},
+	[ULOGD_STATS_BACKLOG] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.backlog",
+	},
+	/* of one interp() call in ns, only set with timing=1 */
+	[ULOGD_STATS_LATENCY_P50] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.latency.p50",
+	},
+	[ULOGD_STATS_LATENCY_P99] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.latency.p99",
+	},
+	[ULOGD_STATS_LATENCY_MAX] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_RETF_NONE,
+		.name	= "stats.latency.max",
+	},
+};
+
+static void propagate_stats(struct ulogd_pluginstance *upi,
+			    struct ulogd_pluginstance *pi, unsigned int stack)
+{
+	struct stats_pluginstance *spi =
+		(struct stats_pluginstance *)upi->private;
+	struct ulogd_key *ret = upi->output.keys;
+	struct ulogd_pluginstance_stats *st = &pi->stats;
+
+	okey_set_ptr(&ret[ULOGD_STATS_NAME], pi->id);
+	okey_set_u64(&ret[ULOGD_STATS_PKTS], st->events);
+	okey_set_u64(&ret[ULOGD_STATS_BYTES], st->backlog);
+	okey_set_u32(&ret[ULOGD_STATS_TIME_SEC], spi->tv.tv_sec);
+	okey_set_u32(&ret[ULOGD_STATS_TIME_USEC], spi->tv.tv_usec);
+	okey_set_ptr(&ret[ULOGD_STATS_PLUGIN], pi->plugin->name);
+	okey_set_u32(&ret[ULOGD_STATS_STACK], stack);
+	okey_set_u64(&ret[ULOGD_STATS_EVENTS], st->events);
+	okey_set_u64(&ret[ULOGD_STATS_ERRORS], st->errors);
+	if (timing_ce(upi->config_kset).u.value != 0)
+		okey_set_u64(&ret[ULOGD_STATS_INTERP_NS],
+			     ulogd_cycles_to_ns(st->interp_cycles));
+	okey_set_u64(&ret[ULOGD_STATS_DROPS], st->drops);
+	okey_set_u64(&ret[ULOGD_STATS_OVERRUNS], st->overruns);
+	okey_set_u64(&ret[ULOGD_STATS_BACKLOG], st->backlog);
+	if (st->latency && st->latency->count) {
+		okey_set_u64(&ret[ULOGD_STATS_LATENCY_P50], ulogd_cycles_to_ns(
+			     ulogd_hist_percentile(st->latency, 50)));
+		okey_set_u64(&ret[ULOGD_STATS_LATENCY_P99], ulogd_cycles_to_ns(
+			     ulogd_hist_percentile(st->latency, 99)));
+		okey_set_u64(&ret[ULOGD_STATS_LATENCY_MAX],
+			     ulogd_cycles_to_ns(st->latency->max));
+	}
+
+	ulogd_propagate_results(upi);
+}
+
+struct stats_walk {
+	struct ulogd_pluginstance *upi;
+	struct ulogd_pluginstance_stack *stack;
+	unsigned int num;
+};
+
+static int stats_report_one(struct ulogd_pluginstance *pi, void *data)
+{
+	struct stats_walk *walk = data;
+	struct ulogd_pluginstance *npi;
+
+	if (pi->stack != walk->stack) {
+		if (walk->stack)
+			walk->num++;
+		walk->stack = pi->stack;
+	}
+
+	/* the counters are taken before they are changed by this event */
+	llist_for_each_entry(npi, &walk->upi->plist, plist)
+		propagate_stats(npi, pi, walk->num);
+	propagate_stats(walk->upi, pi, walk->num);
+
+	return 0;
+}
+
+static void polling_timer_cb(struct ulogd_timer *t, void *data)
+{
+	struct ulogd_pluginstance *upi = data;
+	struct stats_pluginstance *spi =
+		(struct stats_pluginstance *)upi->private;
+	struct ulogd_pluginstance *npi;
+	struct stats_walk walk = {
+		.upi = upi,
+	};
+
+	ulogd_clock_timeval(&spi->tv);
+	llist_for_each_entry(npi, &upi->plist, plist) {
+		struct stats_pluginstance *nspi =
+			(struct stats_pluginstance *)npi->private;
+
+		nspi->tv = spi->tv;
+	}
+	ulogd_pluginstance_iterate(stats_report_one, &walk);
+
+	ulogd_add_timer(&spi->timer, pollint_ce(upi->config_kset).u.value);
+}
+
+static int configure_stats(struct ulogd_pluginstance *upi,
+			   struct ulogd_pluginstance_stack *stack)
+{
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (pollint_ce(upi->config_kset).u.value <= 0) {
+		ulogd_log(ULOGD_FATAL, "pollinterval must be positive\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int start_stats(struct ulogd_pluginstance *upi)
+{
+	struct stats_pluginstance *spi =
+		(struct stats_pluginstance *)upi->private;
+
+	if (timing_ce(upi->config_kset).u.value != 0)
+		ulogd_stats_timing();
+
+	ulogd_init_timer(&spi->timer, upi, polling_timer_cb);
+	ulogd_add_timer(&spi->timer, pollint_ce(upi->config_kset).u.value);
+
+	return 0;
+}
+
+static int stop_stats(struct ulogd_pluginstance *upi)
+{
+	struct stats_pluginstance *spi =
+		(struct stats_pluginstance *)upi->private;
+
+	ulogd_del_timer(&spi->timer);
+
+	return 0;
+}
+
+static void signal_stats(struct ulogd_pluginstance *upi, int signal)
+{
+	struct stats_pluginstance *spi =
+		(struct stats_pluginstance *)upi->private;
+
+	switch (signal) {
+	case SIGUSR2:
+		/* report now, the next report comes a full interval later */
+		ulogd_del_timer(&spi->timer);
+		polling_timer_cb(&spi->timer, upi);
+		break;
+	}
+}
+
+static struct ulogd_plugin stats_plugin = {
+	.name = "STATS",
+	.input = {
+		.type = ULOGD_DTYPE_SOURCE,
+	},
+	.output = {
+		.keys = stats_okeys,
+		.num_keys = ARRAY_SIZE(stats_okeys),
+		.type = ULOGD_DTYPE_SUM,
+	},
+	.config_kset	= &stats_kset,
+	.interp		= NULL,
+	.configure	= &configure_stats,
+	.start		= &start_stats,
+	.stop		= &stop_stats,
+	.signal		= &signal_stats,
+	.priv_size	= sizeof(struct stats_pluginstance),
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&stats_plugin);
+}
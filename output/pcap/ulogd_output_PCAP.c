@@ -29,8 +29,12 @@
 #include <sys/stat.h>
 #include <pcap.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
+#include <ulogd/clock.h>
+#include <ulogd/writer.h>
 
 /* This is a timeval as stored on disk in a dumpfile.
  * It has to use the same types everywhere, independent of the actual
@@ -74,6 +78,53 @@ struct pcap_sf_pkthdr {
 	uint32_t len;			/* length this packet (off wire) */
 };
 
+/* pcapng blocks, see draft-ietf-opsawg-pcapng. All fields are in host
+ * byte order, readers detect it with the byte-order magic. */
+#define PCAPNG_SHB		0x0A0D0D0A
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+
+#define PCAPNG_OPT_ENDOFOPT	0
+#define PCAPNG_OPT_COMMENT	1
+#define PCAPNG_IF_NAME		2
+#define PCAPNG_IF_TSRESOL	9
+
+#define PCAPNG_PAD(len)		(((len) + 3) & ~3)
+
+struct pcapng_shb {
+	uint32_t type;
+	uint32_t len;
+	uint32_t magic;
+	uint16_t major;
+	uint16_t minor;
+	uint32_t section_len[2];	/* -1, not known in advance */
+	uint32_t len2;
+};
+
+struct pcapng_idb {
+	uint32_t type;
+	uint32_t len;
+	uint16_t linktype;
+	uint16_t reserved;
+	uint32_t snaplen;
+	/* options and len */
+};
+
+struct pcapng_epb {
+	uint32_t type;
+	uint32_t len;
+	uint32_t interface;
+	uint32_t ts_high;
+	uint32_t ts_low;
+	uint32_t caplen;
+	uint32_t origlen;
+	/* packet, options and len */
+};
+
+/* longest comment we put into an EPB */
+#define PCAPNG_COMMENT_MAX	128
+
 #ifndef ULOGD_PCAP_DEFAULT
 #define ULOGD_PCAP_DEFAULT	"/var/log/ulogd.pcap"
 #endif
@@ -89,7 +140,7 @@ struct pcap_sf_pkthdr {
         ((unsigned char *)&addr)[3]
 
 static struct config_keyset pcap_kset = {
-	.num_ces = 2,
+	.num_ces = 3 + WRITER_CE_NUM,
 	.ces = {
 		{ 
 			.key = "file", 
@@ -103,11 +154,31 @@ static struct config_keyset pcap_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u = { .value = ULOGD_PCAP_SYNC_DEFAULT },
 		},
+		{
+			.key = "format",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u = { .string = "pcap" },
+		},
+		WRITER_CES,
 	},
 };
 
+#define file_ce(x)	(x->ces[0])
+#define sync_ce(x)	(x->ces[1])
+#define format_ce(x)	(x->ces[2])
+#define writer_ces(x)	(&x->ces[3])
+
 struct pcap_instance {
-	FILE *of;
+	struct ulogd_writer w;
+	int pcapng;
+	/* pcapng: interfaces described in the current section, the
+	 * interface id of a packet is the position of its ifindex */
+	unsigned int generation;
+	uint32_t *ifindex;
+	unsigned int num_ifaces;
+	unsigned int max_ifaces;
+	unsigned int last_iface;
 };
 
 struct intr_id {
@@ -115,8 +186,21 @@ struct intr_id {
 	unsigned int id;		
 };
 
-#define INTR_IDS 	7
-static struct ulogd_key pcap_keys[INTR_IDS] = {
+enum pcap_keys {
+	PCAP_KEY_RAW_PKT,
+	PCAP_KEY_RAW_PKTLEN,
+	PCAP_KEY_IP_TOTLEN,
+	PCAP_KEY_OOB_TIME_SEC,
+	PCAP_KEY_OOB_TIME_USEC,
+	PCAP_KEY_OOB_FAMILY,
+	PCAP_KEY_IP6_PAYLOADLEN,
+	PCAP_KEY_OOB_IFINDEX_IN,
+	PCAP_KEY_OOB_IFINDEX_OUT,
+	PCAP_KEY_OOB_PREFIX,
+	PCAP_KEY_OOB_MARK,
+};
+
+static struct ulogd_key pcap_keys[] = {
 	{ .type = ULOGD_RET_UINT32,
 	  .flags = ULOGD_RETF_NONE,
 	  .name = "raw.pkt" },
@@ -138,30 +222,43 @@ static struct ulogd_key pcap_keys[INTR_IDS] = {
 	{ .type = ULOGD_RET_UINT16,
 	  .flags = ULOGD_RETF_NONE,
 	  .name = "ip6.payloadlen" },
+	/* only used by pcapng */
+	{ .type = ULOGD_RET_UINT32,
+	  .flags = ULOGD_KEYF_OPTIONAL,
+	  .name = "oob.ifindex_in" },
+	{ .type = ULOGD_RET_UINT32,
+	  .flags = ULOGD_KEYF_OPTIONAL,
+	  .name = "oob.ifindex_out" },
+	{ .type = ULOGD_RET_STRING,
+	  .flags = ULOGD_KEYF_OPTIONAL,
+	  .name = "oob.prefix" },
+	{ .type = ULOGD_RET_UINT32,
+	  .flags = ULOGD_KEYF_OPTIONAL,
+	  .name = "oob.mark" },
 };
 
-#define GET_FLAGS(res, x)	(res[x].u.source->flags)
+/* Try to set the len field correctly, if we know the protocol. */
+static uint32_t pcap_origlen(struct ulogd_key *res, uint32_t caplen)
+{
+	switch (ikey_get_u8(&res[PCAP_KEY_OOB_FAMILY])) {
+	case 2: /* INET */
+		return ikey_get_u16(&res[PCAP_KEY_IP_TOTLEN]);
+	case 10: /* INET6 -- payload length + header length */
+		return ikey_get_u16(&res[PCAP_KEY_IP6_PAYLOADLEN]) + 40;
+	default:
+		return caplen;
+	}
+}
 
 static int interp_pcap(struct ulogd_pluginstance *upi)
 {
 	struct pcap_instance *pi = (struct pcap_instance *) &upi->private;
 	struct ulogd_key *res = upi->input.keys;
 	struct pcap_sf_pkthdr pchdr;
+	struct iovec iov[2];
 
 	pchdr.caplen = ikey_get_u32(&res[1]);
-
-	/* Try to set the len field correctly, if we know the protocol. */
-	switch (ikey_get_u8(&res[5])) {
-	case 2: /* INET */
-		pchdr.len = ikey_get_u16(&res[2]);
-		break;
-	case 10: /* INET6 -- payload length + header length */
-		pchdr.len = ikey_get_u16(&res[6]) + 40;
-		break;
-	default:
-		pchdr.len = pchdr.caplen;
-		break;
-	}
+	pchdr.len = pcap_origlen(res, pchdr.caplen);
 
 	if (GET_FLAGS(res, 3) & ULOGD_RETF_VALID
 	    && GET_FLAGS(res, 4) & ULOGD_RETF_VALID) {
@@ -170,25 +267,21 @@ static int interp_pcap(struct ulogd_pluginstance *upi)
 	} else {
 		/* use current system time */
 		struct timeval tv;
-		gettimeofday(&tv, NULL);
+		ulogd_clock_timeval(&tv);
 
 		pchdr.ts.tv_sec = tv.tv_sec;
 		pchdr.ts.tv_usec = tv.tv_usec;
 	}
 
-	if (fwrite(&pchdr, sizeof(pchdr), 1, pi->of) != 1) {
-		ulogd_log(ULOGD_ERROR, "Error during write: %s\n",
-			  strerror(errno));
-		return ULOGD_IRET_ERR;
-	}
-	if (fwrite(ikey_get_ptr(&res[0]), pchdr.caplen, 1, pi->of) != 1) {
-		ulogd_log(ULOGD_ERROR, "Error during write: %s\n",
-			  strerror(errno));
-		return ULOGD_IRET_ERR;
-	}
+	/* header and packet must not be separated by a dropped record */
+	iov[0].iov_base = &pchdr;
+	iov[0].iov_len = sizeof(pchdr);
+	iov[1].iov_base = ikey_get_ptr(&res[0]);
+	iov[1].iov_len = pchdr.caplen;
+	ulogd_writer_writev(&pi->w, iov, 2);
 
 	if (upi->config_kset->ces[1].u.value)
-		fflush(pi->of);
+		ulogd_writer_flush(&pi->w);
 
 	return ULOGD_IRET_OK;
 }
@@ -197,10 +290,215 @@ static int interp_pcap(struct ulogd_pluginstance *upi)
 #define LINKTYPE_RAW            101
 #define TCPDUMP_MAGIC	0xa1b2c3d4
 
-static int write_pcap_header(struct pcap_instance *pi)
+/* append an option to `buf', returns its length including padding */
+static unsigned int pcapng_opt(char *buf, uint16_t code, const void *data,
+			       uint16_t len)
+{
+	uint16_t hdr[2] = { code, len };
+
+	memcpy(buf, hdr, sizeof(hdr));
+	if (len)
+		memcpy(buf + sizeof(hdr), data, len);
+	memset(buf + sizeof(hdr) + len, 0, PCAPNG_PAD(len) - len);
+
+	return sizeof(hdr) + PCAPNG_PAD(len);
+}
+
+/* store the total length at both ends of the block in `buf' */
+static unsigned int pcapng_block_end(char *buf, unsigned int len)
+{
+	uint32_t total = len + sizeof(total);
+
+	memcpy(buf + sizeof(uint32_t), &total, sizeof(total));
+	memcpy(buf + len, &total, sizeof(total));
+
+	return total;
+}
+
+static unsigned int pcapng_shb(char *buf)
+{
+	struct pcapng_shb shb = {
+		.type = PCAPNG_SHB,
+		.len = sizeof(shb),
+		.magic = PCAPNG_BYTE_ORDER_MAGIC,
+		.major = 1,
+		.minor = 0,
+		.section_len = { 0xffffffff, 0xffffffff },
+		.len2 = sizeof(shb),
+	};
+
+	memcpy(buf, &shb, sizeof(shb));
+	return sizeof(shb);
+}
+
+#define PCAPNG_IDB_MAX	(sizeof(struct pcapng_idb) + 4 + IF_NAMESIZE + \
+			 8 + 4 + 4)
+
+/* interface with nanosecond timestamps, named after `ifindex' if known */
+static unsigned int pcapng_idb(char *buf, uint32_t ifindex)
+{
+	struct pcapng_idb idb = {
+		.type = PCAPNG_IDB,
+		.linktype = LINKTYPE_RAW,
+		.snaplen = 0,
+	};
+	char name[IF_NAMESIZE];
+	uint8_t tsresol = 9;
+	unsigned int len = sizeof(idb);
+
+	memcpy(buf, &idb, sizeof(idb));
+	if (ifindex && if_indextoname(ifindex, name))
+		len += pcapng_opt(buf + len, PCAPNG_IF_NAME, name,
+				  strlen(name));
+	len += pcapng_opt(buf + len, PCAPNG_IF_TSRESOL, &tsresol, 1);
+	len += pcapng_opt(buf + len, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+
+	return pcapng_block_end(buf, len);
+}
+
+/* id of the interface in the current section, -1 if not described yet */
+static int pcapng_iface(struct pcap_instance *pi, uint32_t ifindex)
+{
+	unsigned int i;
+
+	if (pi->last_iface < pi->num_ifaces &&
+	    pi->ifindex[pi->last_iface] == ifindex)
+		return pi->last_iface;
+
+	for (i = 0; i < pi->num_ifaces; i++) {
+		if (pi->ifindex[i] == ifindex) {
+			pi->last_iface = i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int pcapng_add_iface(struct pcap_instance *pi, uint32_t ifindex)
+{
+	if (pi->num_ifaces == pi->max_ifaces) {
+		unsigned int max = pi->max_ifaces ? 2 * pi->max_ifaces : 8;
+		uint32_t *ifindex_tbl;
+
+		ifindex_tbl = realloc(pi->ifindex, max * sizeof(uint32_t));
+		if (!ifindex_tbl)
+			return -1;
+		pi->ifindex = ifindex_tbl;
+		pi->max_ifaces = max;
+	}
+	pi->ifindex[pi->num_ifaces] = ifindex;
+	pi->last_iface = pi->num_ifaces;
+
+	return pi->num_ifaces++;
+}
+
+static int interp_pcapng(struct ulogd_pluginstance *upi)
+{
+	struct pcap_instance *pi = (struct pcap_instance *) &upi->private;
+	struct ulogd_key *res = upi->input.keys;
+	/* section and interface description, when needed */
+	char head[sizeof(struct pcapng_shb) + PCAPNG_IDB_MAX];
+	/* packet padding, comments, end of options and length */
+	char tail[3 + 2 * (4 + PCAPNG_COMMENT_MAX) + 4 + 4];
+	struct pcapng_epb epb = {
+		.type = PCAPNG_EPB,
+	};
+	unsigned int head_len = 0, tail_len, opts, num_ifaces, generation;
+	uint32_t ifindex = 0;
+	uint64_t ts;
+	struct iovec iov[4];
+	int id, n = 0;
+
+	generation = ulogd_writer_begin(&pi->w);
+	num_ifaces = pi->num_ifaces;
+	if (generation != pi->generation) {
+		/* new file, or appending to an old one: start a section */
+		head_len = pcapng_shb(head);
+		pi->num_ifaces = 0;
+	}
+
+	if (pp_is_valid(res, PCAP_KEY_OOB_IFINDEX_IN))
+		ifindex = ikey_get_u32(&res[PCAP_KEY_OOB_IFINDEX_IN]);
+	if (!ifindex && pp_is_valid(res, PCAP_KEY_OOB_IFINDEX_OUT))
+		ifindex = ikey_get_u32(&res[PCAP_KEY_OOB_IFINDEX_OUT]);
+
+	id = pcapng_iface(pi, ifindex);
+	if (id < 0) {
+		id = pcapng_add_iface(pi, ifindex);
+		if (id < 0) {
+			pi->num_ifaces = num_ifaces;
+			return ULOGD_IRET_ERR;
+		}
+		head_len += pcapng_idb(head + head_len, ifindex);
+	}
+
+	if (pp_is_valid(res, PCAP_KEY_OOB_TIME_SEC) &&
+	    pp_is_valid(res, PCAP_KEY_OOB_TIME_USEC)) {
+		ts = ikey_get_u32(&res[PCAP_KEY_OOB_TIME_SEC]) * 1000000000ULL +
+		     ikey_get_u32(&res[PCAP_KEY_OOB_TIME_USEC]) * 1000ULL;
+	} else
+		ts = ulogd_clock_realtime();
+
+	epb.interface = id;
+	epb.ts_high = ts >> 32;
+	epb.ts_low = ts;
+	epb.caplen = ikey_get_u32(&res[PCAP_KEY_RAW_PKTLEN]);
+	epb.origlen = pcap_origlen(res, epb.caplen);
+
+	tail_len = PCAPNG_PAD(epb.caplen) - epb.caplen;
+	memset(tail, 0, tail_len);
+	opts = tail_len;
+	if (pp_is_valid(res, PCAP_KEY_OOB_PREFIX)) {
+		char *prefix = ikey_get_ptr(&res[PCAP_KEY_OOB_PREFIX]);
+		size_t len = strnlen(prefix, PCAPNG_COMMENT_MAX);
+
+		if (len)
+			tail_len += pcapng_opt(tail + tail_len,
+					       PCAPNG_OPT_COMMENT, prefix, len);
+	}
+	if (pp_is_valid(res, PCAP_KEY_OOB_MARK)) {
+		char mark[32];
+		int len = snprintf(mark, sizeof(mark), "mark=%u",
+				   ikey_get_u32(&res[PCAP_KEY_OOB_MARK]));
+
+		tail_len += pcapng_opt(tail + tail_len, PCAPNG_OPT_COMMENT,
+				       mark, len);
+	}
+	if (tail_len > opts)
+		tail_len += pcapng_opt(tail + tail_len, PCAPNG_OPT_ENDOFOPT,
+				       NULL, 0);
+	epb.len = sizeof(epb) + epb.caplen + tail_len + sizeof(epb.len);
+	memcpy(tail + tail_len, &epb.len, sizeof(epb.len));
+	tail_len += sizeof(epb.len);
+
+	/* the blocks the packet depends on must not be dropped alone */
+	if (head_len) {
+		iov[n].iov_base = head;
+		iov[n++].iov_len = head_len;
+	}
+	iov[n].iov_base = &epb;
+	iov[n++].iov_len = sizeof(epb);
+	iov[n].iov_base = ikey_get_ptr(&res[PCAP_KEY_RAW_PKT]);
+	iov[n++].iov_len = epb.caplen;
+	iov[n].iov_base = tail;
+	iov[n++].iov_len = tail_len;
+	if (ulogd_writer_writev(&pi->w, iov, n) < 0) {
+		/* describe the section and interface again next time */
+		pi->num_ifaces = num_ifaces;
+		return ULOGD_IRET_OK;
+	}
+	pi->generation = generation;
+
+	if (sync_ce(upi->config_kset).u.value)
+		ulogd_writer_flush(&pi->w);
+
+	return ULOGD_IRET_OK;
+}
+
+/* the writer puts the header at the start of each new or empty file */
+static int set_pcap_header(struct pcap_instance *pi)
 {
 	struct pcap_file_header pcfh;
-	int ret;
 
 	pcfh.magic = TCPDUMP_MAGIC;
 	pcfh.version_major = PCAP_VERSION_MAJOR;
@@ -210,43 +508,32 @@ static int write_pcap_header(struct pcap_instance *pi)
 	pcfh.snaplen = 64 * 1024; /* we don't know the length in advance */
 	pcfh.linktype = LINKTYPE_RAW;
 
-	ret =  fwrite(&pcfh, sizeof(pcfh), 1, pi->of);
-	fflush(pi->of);
-
-	return ret;
+	return ulogd_writer_set_frame(&pi->w, &pcfh, sizeof(pcfh), NULL, 0);
 }
 
 static int append_create_outfile(struct ulogd_pluginstance *upi)
 {
 	struct pcap_instance *pi = (struct pcap_instance *) &upi->private;
-	char *filename = upi->config_kset->ces[0].u.string;
-	struct stat st_dummy;
-	int exist = 0;
-
-	if (stat(filename, &st_dummy) == 0 && st_dummy.st_size > 0)
-		exist = 1;
-
-	if (!exist) {
-		pi->of = fopen(filename, "w");
-		if (!pi->of) {
-			ulogd_log(ULOGD_ERROR, "can't open pcap file %s: %s\n",
-				  filename,
-				  strerror(errno));
-			return -EPERM;
-		}
-		if (!write_pcap_header(pi)) {
-			ulogd_log(ULOGD_ERROR, "can't write pcap header: %s\n",
-				  strerror(errno));
-			return -ENOSPC;
-		}
-	} else {
-		pi->of = fopen(filename, "a");
-		if (!pi->of) {
-			ulogd_log(ULOGD_ERROR, "can't open pcap file %s: %s\n", 
-				filename,
-				strerror(errno));
-			return -EPERM;
-		}		
+	char *filename = file_ce(upi->config_kset).u.string;
+
+	if (ulogd_writer_open(&pi->w, upi->id, filename, O_CREAT | O_APPEND,
+			      writer_ces(upi->config_kset)) < 0) {
+		ulogd_log(ULOGD_ERROR, "can't open pcap file %s\n",
+			  filename);
+		return -EPERM;
+	}
+	pi->w.stats = &upi->stats;
+
+	/* pcapng starts a section with each file generation instead */
+	if (pi->pcapng) {
+		pi->generation = pi->w.generation - 1;
+		return 0;
+	}
+
+	if (set_pcap_header(pi) < 0) {
+		ulogd_log(ULOGD_ERROR, "can't write pcap header\n");
+		ulogd_writer_close(&pi->w);
+		return -ENOSPC;
 	}
 
 	return 0;
@@ -259,8 +546,7 @@ static void signal_pcap(struct ulogd_pluginstance *upi, int signal)
 	switch (signal) {
 	case SIGHUP:
 		ulogd_log(ULOGD_NOTICE, "reopening capture file\n");
-		fclose(pi->of);
-		append_create_outfile(upi);
+		ulogd_writer_reopen(&pi->w);
 		break;
 	default:
 		break;
@@ -270,7 +556,24 @@ static void signal_pcap(struct ulogd_pluginstance *upi, int signal)
 static int configure_pcap(struct ulogd_pluginstance *upi,
 			  struct ulogd_pluginstance_stack *stack)
 {
-	return config_parse_file(upi->id, upi->config_kset);
+	struct pcap_instance *pi = (struct pcap_instance *) &upi->private;
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (!strcmp(format_ce(upi->config_kset).u.string, "pcap"))
+		pi->pcapng = 0;
+	else if (!strcmp(format_ce(upi->config_kset).u.string, "pcapng"))
+		pi->pcapng = 1;
+	else {
+		ulogd_log(ULOGD_ERROR, "unknown capture format `%s'\n",
+			  format_ce(upi->config_kset).u.string);
+		return -EINVAL;
+	}
+
+	return 0;
 }
 
 static int start_pcap(struct ulogd_pluginstance *upi)
@@ -282,12 +585,23 @@ static int stop_pcap(struct ulogd_pluginstance *upi)
 {
 	struct pcap_instance *pi = (struct pcap_instance *) &upi->private;
 
-	if (pi->of)
-		fclose(pi->of);
+	ulogd_writer_close(&pi->w);
+	free(pi->ifindex);
+	pi->ifindex = NULL;
+	pi->num_ifaces = pi->max_ifaces = 0;
 
 	return 0;
 }
 
+static int interp_capture(struct ulogd_pluginstance *upi)
+{
+	struct pcap_instance *pi = (struct pcap_instance *) &upi->private;
+
+	if (pi->pcapng)
+		return interp_pcapng(upi);
+	return interp_pcap(upi);
+}
+
 static struct ulogd_plugin pcap_plugin = {
 	.name = "PCAP",
 	.input = {
@@ -305,7 +619,7 @@ static struct ulogd_plugin pcap_plugin = {
 	.start		= &start_pcap,
 	.stop		= &stop_pcap,
 	.signal		= &signal_pcap,
-	.interp		= &interp_pcap,
+	.interp		= &interp_capture,
 	.version	= VERSION,
 };
 
@@ -26,23 +26,28 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
+#include <ulogd/clock.h>
+#include <ulogd/writer.h>
 
 #ifndef ULOGD_GPRINT_DEFAULT
 #define ULOGD_GPRINT_DEFAULT	"/var/log/ulogd.gprint"
 #endif
 
 struct gprint_priv {
-	FILE *of;
+	struct ulogd_writer w;
+	struct ulogd_timefmt timefmt;
 };
 
 enum gprint_conf {
 	GPRINT_CONF_FILENAME = 0,
 	GPRINT_CONF_SYNC,
 	GPRINT_CONF_TIMESTAMP,
-	GPRINT_CONF_MAX
+	GPRINT_CONF_WRITER,
+	GPRINT_CONF_MAX = GPRINT_CONF_WRITER + WRITER_CE_NUM
 };
 
 static struct config_keyset gprint_kset = {
@@ -66,6 +71,7 @@ static struct config_keyset gprint_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u = { .value = 0 },
 		},
+		WRITER_CES,
 	},
 };
 
@@ -83,20 +89,15 @@ static int gprint_interp(struct ulogd_pluginstance *upi)
 	int rem = sizeof(buf), size = 0, ret;
 
 	if (upi->config_kset->ces[GPRINT_CONF_TIMESTAMP].u.value != 0) {
-		struct tm tm;
-		time_t now;
+		const char *timestr;
 
-		now = time(NULL);
-		localtime_r(&now, &tm);
-
-		ret = snprintf(buf+size, rem,
-				"timestamp=%.4u/%.2u/%.2u-%.2u:%.2u:%.2u,",
-				1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday,
-				tm.tm_hour, tm.tm_min, tm.tm_sec);
-		if (ret < 0)
+		timestr = ulogd_timefmt(&opi->timefmt, ulogd_clock_sec(),
+					"timestamp=%Y/%m/%d-%H:%M:%S,");
+		if (!timestr)
 			return ULOGD_IRET_OK;
-		rem -= ret;
-		size += ret;
+		memcpy(buf, timestr, opi->timefmt.len);
+		rem -= opi->timefmt.len;
+		size += opi->timefmt.len;
 	}
 
 	for (i = 0; i < upi->input.num_keys; i++) {
@@ -176,10 +177,10 @@ static int gprint_interp(struct ulogd_pluginstance *upi)
 		}
 	}
 	buf[size-1]='\0';
-	fprintf(opi->of, "%s\n", buf);
+	ulogd_writer_printf(&opi->w, "%s\n", buf);
 
 	if (upi->config_kset->ces[GPRINT_CONF_SYNC].u.value != 0)
-		fflush(opi->of);
+		ulogd_writer_flush(&opi->w);
 
 	return ULOGD_IRET_OK;
 }
@@ -187,20 +188,11 @@ static int gprint_interp(struct ulogd_pluginstance *upi)
 static void sighup_handler_print(struct ulogd_pluginstance *upi, int signal)
 {
 	struct gprint_priv *oi = (struct gprint_priv *) &upi->private;
-	FILE *old = oi->of;
 
 	switch (signal) {
 	case SIGHUP:
 		ulogd_log(ULOGD_NOTICE, "GPRINT: reopening logfile\n");
-		oi->of = fopen(upi->config_kset->ces[0].u.string, "a");
-		if (!oi->of) {
-			ulogd_log(ULOGD_ERROR, "can't open GPRINT "
-					       "log file: %s\n",
-				  strerror(errno));
-			oi->of = old;
-		} else {
-			fclose(old);
-		}
+		ulogd_writer_reopen(&oi->w);
 		break;
 	default:
 		break;
@@ -227,12 +219,14 @@ static int gprint_init(struct ulogd_pluginstance *upi)
 {
 	struct gprint_priv *op = (struct gprint_priv *) &upi->private;
 
-	op->of = fopen(upi->config_kset->ces[0].u.string, "a");
-	if (!op->of) {
-		ulogd_log(ULOGD_FATAL, "can't open GPRINT log file: %s\n", 
-			strerror(errno));
+	if (ulogd_writer_open(&op->w, upi->id,
+			      upi->config_kset->ces[GPRINT_CONF_FILENAME].u.string,
+			      O_CREAT | O_APPEND,
+			      &upi->config_kset->ces[GPRINT_CONF_WRITER]) < 0) {
+		ulogd_log(ULOGD_FATAL, "can't open GPRINT log file\n");
 		return -1;
 	}
+	op->w.stats = &upi->stats;
 	return 0;
 }
 
@@ -240,8 +234,7 @@ static int gprint_fini(struct ulogd_pluginstance *pi)
 {
 	struct gprint_priv *op = (struct gprint_priv *) &pi->private;
 
-	if (op->of != stdout)
-		fclose(op->of);
+	ulogd_writer_close(&op->w);
 
 	return 0;
 }
@@ -260,6 +253,7 @@ static struct ulogd_plugin gprint_plugin = {
 	.stop	= &gprint_fini,
 	.signal = &sighup_handler_print,
 	.config_kset = &gprint_kset,
+	.priv_size = sizeof(struct gprint_priv),
 	.version = VERSION,
 };
 
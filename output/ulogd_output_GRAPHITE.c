@@ -27,10 +27,10 @@
 #include <inttypes.h>
 #include <time.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
+#include <ulogd/clock.h>
+#include <ulogd/transport.h>
 
 
 enum {
@@ -62,7 +62,7 @@ static struct ulogd_key graphite_inp[] = {
 
 
 static struct config_keyset graphite_kset = {
-	.num_ces = 3,
+	.num_ces = 4,
 	.ces = {
 		{
 			.key = "host",
@@ -79,114 +79,82 @@ static struct config_keyset graphite_kset = {
 			.type = CONFIG_TYPE_STRING,
 			.options = CONFIG_OPT_NONE,
 		},
+		{
+			.key = "queue_size",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = TRANSPORT_QUEUE_DEFAULT,
+		},
 	},
 };
 
 #define host_ce(x)	(x->ces[0])
 #define port_ce(x)	(x->ces[1])
 #define prefix_ce(x)	(x->ces[2])
+#define queue_size_ce(x)	(x->ces[3])
+
+/* enough for the two lines of a counter with a short prefix, grown for
+ * longer ones */
+#define GRAPHITE_BUF_DEFAULT_SIZE	256
 
 struct graphite_instance {
-	int sck;
+	/* all the counters of one NFACCT polling cycle are queued during the
+	 * same main loop iteration and sent with a single send() */
+	struct ulogd_transport transport;
+	char *buf;
+	unsigned int size;
 };
 
-static int _connect_graphite(struct ulogd_pluginstance *pi)
-{
-	struct graphite_instance *li = (struct graphite_instance *) &pi->private;
-	char *host;
-	char * port;
-	struct addrinfo hints;
-	struct addrinfo *result, *rp;
-	int sfd, s;
-
-	ulogd_log(ULOGD_DEBUG, "connecting to graphite\n");
-
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = 0;
-	hints.ai_protocol = 0;
-
-	host = host_ce(pi->config_kset).u.string;
-	port = port_ce(pi->config_kset).u.string;
-	s = getaddrinfo(host, port, &hints, &result);
-	if (s != 0) {
-		ulogd_log(ULOGD_ERROR, "getaddrinfo: %s\n", gai_strerror(s));
-		return -1;
-	}
-
-	for (rp = result; rp != NULL; rp = rp->ai_next) {
-		int on = 1;
-
-		sfd = socket(rp->ai_family, rp->ai_socktype,
-				rp->ai_protocol);
-		if (sfd == -1)
-			continue;
-
-		setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR,
-			   (char *) &on, sizeof(on));
-
-		if (connect(sfd, rp->ai_addr, rp->ai_addrlen) != -1)
-			break;
-
-		close(sfd);
-	}
-
-	freeaddrinfo(result);
-
-	if (rp == NULL) {
-		ulogd_log(ULOGD_ERROR, "Could not connect\n");
-		return -1;
-	}
-
-	li->sck = sfd;
-
-	return 0;
-}
-
 static int _output_graphite(struct ulogd_pluginstance *upi)
 {
 	struct graphite_instance *li = (struct graphite_instance *) &upi->private;
 	struct ulogd_key *inp = upi->input.keys;
-	static char buf[256];
-	int ret;
-
-	time_t now;
-	int msg_size = 0;
+	char *prefix = prefix_ce(upi->config_kset).u.string;
+	char *name = ikey_get_ptr(&inp[KEY_SUM_NAME]);
+	uint64_t now;
+	int msg_size;
 
 	if (ikey_get_u32(&inp[KEY_OOB_TIME_SEC]))
-		now = (time_t) ikey_get_u32(&inp[KEY_OOB_TIME_SEC]);
+		now = ikey_get_u32(&inp[KEY_OOB_TIME_SEC]);
 	else
-		now = time(NULL);
-
-	msg_size = snprintf(buf, sizeof(buf), "%s.%s.pkts %" PRIu64
-			    " %" PRIu64 "\n%s.%s.bytes %" PRIu64 " %" PRIu64 "\n",
-		 prefix_ce(upi->config_kset).u.string,
-		 (char *)ikey_get_ptr(&inp[KEY_SUM_NAME]),
-		 ikey_get_u64(&inp[KEY_SUM_PKTS]),
-		 (uint64_t) now,
-		 prefix_ce(upi->config_kset).u.string,
-		 (char *)ikey_get_ptr(&inp[KEY_SUM_NAME]),
-		 ikey_get_u64(&inp[KEY_SUM_BYTES]),
-		 (uint64_t) now
-		 );
-	if (msg_size == -1) {
-		ulogd_log(ULOGD_ERROR, "Could not create message\n");
-		return ULOGD_IRET_ERR;
-	}
-	ret = send(li->sck, buf, msg_size, MSG_NOSIGNAL);
-	if (ret != msg_size) {
-		ulogd_log(ULOGD_ERROR, "Failure sending message\n");
-		if (ret == -1) {
-			return _connect_graphite(upi);
+		now = ulogd_clock_sec();
+
+	for (;;) {
+		char *buf;
+
+		msg_size = snprintf(li->buf, li->size, "%s.%s.pkts %" PRIu64
+				    " %" PRIu64 "\n%s.%s.bytes %" PRIu64
+				    " %" PRIu64 "\n",
+				    prefix, name,
+				    ikey_get_u64(&inp[KEY_SUM_PKTS]), now,
+				    prefix, name,
+				    ikey_get_u64(&inp[KEY_SUM_BYTES]), now);
+		if (msg_size < 0) {
+			ulogd_log(ULOGD_ERROR, "Could not create message\n");
+			return ULOGD_IRET_ERR;
+		}
+		if ((unsigned int) msg_size < li->size)
+			break;
+
+		buf = realloc(li->buf, msg_size + 1);
+		if (!buf) {
+			ulogd_log(ULOGD_ERROR, "Could not create message\n");
+			return ULOGD_IRET_ERR;
 		}
+		li->buf = buf;
+		li->size = msg_size + 1;
 	}
 
+	/* the queue drops and accounts for what doesn't fit while the
+	 * server is slow or away, don't stop the stack for that */
+	ulogd_transport_write(&li->transport, li->buf, msg_size);
+
 	return ULOGD_IRET_OK;
 }
 
 static int start_graphite(struct ulogd_pluginstance *pi)
 {
+	struct graphite_instance *li = (struct graphite_instance *) &pi->private;
 	char *host;
 	char *port;
 
@@ -198,14 +166,34 @@ static int start_graphite(struct ulogd_pluginstance *pi)
 	port = port_ce(pi->config_kset).u.string;
 	if (port == NULL)
 		return -1;
-	return _connect_graphite(pi);
+
+	li->size = GRAPHITE_BUF_DEFAULT_SIZE;
+	li->buf = malloc(li->size);
+	if (!li->buf) {
+		ulogd_log(ULOGD_ERROR, "out of memory\n");
+		return -1;
+	}
+
+	/* connecting is done in the background, with an exponential
+	 * backoff while the server can't be reached */
+	if (ulogd_transport_start(&li->transport, pi->id, "tcp", host, port,
+				  NULL,
+				  queue_size_ce(pi->config_kset).u.value) < 0) {
+		free(li->buf);
+		li->buf = NULL;
+		return -1;
+	}
+	li->transport.stats = &pi->stats;
+
+	return 0;
 }
 
 static int fini_graphite(struct ulogd_pluginstance *pi) {
 	struct graphite_instance *li = (struct graphite_instance *) &pi->private;
 
-	close(li->sck);
-	li->sck = 0;
+	ulogd_transport_stop(&li->transport);
+	free(li->buf);
+	li->buf = NULL;
 
 	return 0;
 }
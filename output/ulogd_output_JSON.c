@@ -23,10 +23,13 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
-#include <jansson.h>
+#include <ulogd/clock.h>
+#include <ulogd/transport.h>
+#include <ulogd/writer.h>
 
 #ifndef ULOGD_JSON_DEFAULT
 #define ULOGD_JSON_DEFAULT	"/var/log/ulogd.json"
@@ -36,10 +39,34 @@
 #define ULOGD_JSON_DEFAULT_DEVICE "Netfilter"
 #endif
 
+#define JSON_BUF_DEFAULT_SIZE	4096
+
+/* `"timestamp": "YYYY-MM-DDTHH:MM:SS' without fraction and closing quote */
+#define MAX_TIMESTAMP_MEMBER	64
+
+/* pre-escaped `"name": ' prefix of one input key */
+struct json_field {
+	char *str;
+	unsigned int len;
+};
+
 struct json_priv {
-	FILE *of;
+	struct ulogd_writer writer;
+	/* used instead of `writer' when sending to a collector */
+	int use_transport;
+	struct ulogd_transport transport;
 	int sec_idx;
 	int usec_idx;
+	/* one entry per input key, built once in json_init() */
+	struct json_field *fields;
+	/* `"dvc": "..."' member, NULL if no device is configured */
+	struct json_field dvc;
+	/* reusable output buffer */
+	char *buf;
+	size_t len;
+	size_t size;
+	/* timestamp string cached for the last second we have seen */
+	struct ulogd_timefmt timefmt;
 };
 
 enum json_conf {
@@ -48,7 +75,12 @@ enum json_conf {
 	JSON_CONF_TIMESTAMP,
 	JSON_CONF_DEVICE,
 	JSON_CONF_BOOLEAN_LABEL,
-	JSON_CONF_MAX
+	JSON_CONF_MODE,
+	JSON_CONF_HOST,
+	JSON_CONF_PORT,
+	JSON_CONF_QUEUE_SIZE,
+	JSON_CONF_WRITER,
+	JSON_CONF_MAX = JSON_CONF_WRITER + WRITER_CE_NUM
 };
 
 static struct config_keyset json_kset = {
@@ -84,65 +116,289 @@ static struct config_keyset json_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u = { .value = 0 },
 		},
+		[JSON_CONF_MODE] = {
+			.key = "mode",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u = { .string = "file" },
+		},
+		[JSON_CONF_HOST] = {
+			.key = "host",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+		[JSON_CONF_PORT] = {
+			.key = "port",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+		},
+		[JSON_CONF_QUEUE_SIZE] = {
+			.key = "queue_size",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u = { .value = TRANSPORT_QUEUE_DEFAULT },
+		},
+		WRITER_CES,
 	},
 };
 
-#define MAX_LOCAL_TIME_STRING 32
+/***********************************************************************
+ * streaming encoder
+ ***********************************************************************/
 
-static int json_interp(struct ulogd_pluginstance *upi)
+static const char json_digits[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static const char json_hex[] = "0123456789abcdef";
+
+/* make sure there is room for at least `len' more bytes in the buffer */
+static int json_reserve(struct json_priv *op, size_t len)
 {
-	struct json_priv *opi = (struct json_priv *) &upi->private;
-	unsigned int i;
-	json_t *msg;
+	size_t size = op->size;
+	char *buf;
 
-	msg = json_object();
-	if (!msg) {
-		ulogd_log(ULOGD_ERROR, "Unable to create JSON object\n");
-		return ULOGD_IRET_ERR;
+	if (op->len + len <= op->size)
+		return 0;
+
+	while (op->len + len > size)
+		size *= 2;
+
+	buf = realloc(op->buf, size);
+	if (!buf)
+		return -1;
+
+	op->buf = buf;
+	op->size = size;
+	return 0;
+}
+
+static inline void json_put(struct json_priv *op, const char *str,
+			    unsigned int len)
+{
+	memcpy(op->buf + op->len, str, len);
+	op->len += len;
+}
+
+/* a 64 bit integer has at most 20 digits, plus sign */
+#define JSON_INT_MAXLEN	21
+
+static void json_put_u64(struct json_priv *op, uint64_t v)
+{
+	char tmp[JSON_INT_MAXLEN];
+	char *p = tmp + sizeof(tmp);
+
+	while (v >= 100) {
+		unsigned int i = (v % 100) * 2;
+
+		v /= 100;
+		*--p = json_digits[i + 1];
+		*--p = json_digits[i];
+	}
+	if (v >= 10) {
+		*--p = json_digits[v * 2 + 1];
+		*--p = json_digits[v * 2];
+	} else
+		*--p = '0' + v;
+
+	json_put(op, p, tmp + sizeof(tmp) - p);
+}
+
+static void json_put_i64(struct json_priv *op, int64_t v)
+{
+	if (v < 0) {
+		op->buf[op->len++] = '-';
+		json_put_u64(op, -(uint64_t)v);
+	} else
+		json_put_u64(op, v);
+}
+
+/* length of the valid UTF-8 sequence starting with a byte >= 0x80, 0 if
+ * there is none: no overlong forms, surrogates or code points past
+ * U+10FFFF (RFC 3629) */
+static unsigned int json_utf8_len(const unsigned char *s)
+{
+	unsigned char lo = 0x80, hi = 0xbf;
+	unsigned int len, i;
+
+	if (s[0] >= 0xc2 && s[0] <= 0xdf)
+		len = 2;
+	else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+		len = 3;
+		if (s[0] == 0xe0)
+			lo = 0xa0;
+		else if (s[0] == 0xed)
+			hi = 0x9f;
+	} else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+		len = 4;
+		if (s[0] == 0xf0)
+			lo = 0x90;
+		else if (s[0] == 0xf4)
+			hi = 0x8f;
+	} else
+		return 0;
+
+	if (s[1] < lo || s[1] > hi)
+		return 0;
+	for (i = 2; i < len; i++) {
+		if (s[i] < 0x80 || s[i] > 0xbf)
+			return 0;
 	}
+	return len;
+}
 
-	if (upi->config_kset->ces[JSON_CONF_TIMESTAMP].u.value != 0) {
-		time_t now;
-		char timestr[MAX_LOCAL_TIME_STRING];
-		struct tm *t;
-		struct tm result;
-		struct ulogd_key *inp = upi->input.keys;
-
-
-		if (pp_is_valid(inp, opi->sec_idx))
-			now = (time_t) ikey_get_u64(&inp[opi->sec_idx]);
-		else
-			now = time(NULL);
-		t = localtime_r(&now, &result);
-
-		if (pp_is_valid(inp, opi->usec_idx)) {
-			snprintf(timestr, MAX_LOCAL_TIME_STRING,
-					"%04d-%02d-%02dT%02d:%02d:%02d.%06u",
-					t->tm_year + 1900, t->tm_mon + 1,
-					t->tm_mday, t->tm_hour,
-					t->tm_min, t->tm_sec,
-					ikey_get_u32(&inp[opi->usec_idx]));
-		} else {
-			snprintf(timestr, MAX_LOCAL_TIME_STRING,
-					"%04d-%02d-%02dT%02d:%02d:%02d",
-					t->tm_year + 1900, t->tm_mon + 1,
-					t->tm_mday, t->tm_hour,
-					t->tm_min, t->tm_sec);
+/* quote and escape a string, `dst' must hold 6 * strlen(src) + 2 bytes.
+ * Each byte that isn't part of valid UTF-8 becomes U+FFFD. */
+static unsigned int json_escape(char *dst, const char *src)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	char *p = dst;
+
+	*p++ = '"';
+	for (; *s; s++) {
+		switch (*s) {
+		case '"':
+		case '\\':
+			*p++ = '\\';
+			*p++ = *s;
+			break;
+		case '\n':
+			*p++ = '\\';
+			*p++ = 'n';
+			break;
+		case '\r':
+			*p++ = '\\';
+			*p++ = 'r';
+			break;
+		case '\t':
+			*p++ = '\\';
+			*p++ = 't';
+			break;
+		default:
+			if (*s < 0x20) {
+				*p++ = '\\';
+				*p++ = 'u';
+				*p++ = '0';
+				*p++ = '0';
+				*p++ = json_hex[*s >> 4];
+				*p++ = json_hex[*s & 0xf];
+			} else if (*s < 0x80) {
+				*p++ = *s;
+			} else {
+				unsigned int len = json_utf8_len(s);
+
+				if (len) {
+					memcpy(p, s, len);
+					p += len;
+					s += len - 1;
+				} else {
+					memcpy(p, "\\ufffd", 6);
+					p += 6;
+				}
+			}
+			break;
 		}
+	}
+	*p++ = '"';
 
-		json_object_set_new(msg, "timestamp", json_string(timestr));
+	return p - dst;
+}
+
+static int json_put_string(struct json_priv *op, const char *str)
+{
+	if (json_reserve(op, strlen(str) * 6 + 2) < 0)
+		return -1;
+
+	op->len += json_escape(op->buf + op->len, str);
+	return 0;
+}
+
+/* build the `"name": ' prefix of a member, `value' is appended if set */
+static int json_field_init(struct json_field *f, const char *name,
+			   const char *value)
+{
+	size_t size = strlen(name) * 6 + 2 + 2 + 1;
+
+	if (value)
+		size += strlen(value) * 6 + 2;
+
+	f->str = malloc(size);
+	if (!f->str)
+		return -1;
+
+	f->len = json_escape(f->str, name);
+	f->str[f->len++] = ':';
+	f->str[f->len++] = ' ';
+	if (value)
+		f->len += json_escape(f->str + f->len, value);
+
+	return 0;
+}
+
+static inline void json_put_field(struct json_priv *op, struct json_field *f)
+{
+	if (op->len > 1) {
+		op->buf[op->len++] = ',';
+		op->buf[op->len++] = ' ';
 	}
+	json_put(op, f->str, f->len);
+}
 
-	if (upi->config_kset->ces[JSON_CONF_DEVICE].u.string) {
-		char *dvc = upi->config_kset->ces[JSON_CONF_DEVICE].u.string;
-		json_object_set_new(msg, "dvc", json_string(dvc));
+static void json_put_timestamp(struct json_priv *op, struct ulogd_key *inp)
+{
+	time_t now;
+
+	if (op->sec_idx >= 0 && pp_is_valid(inp, op->sec_idx))
+		now = (time_t) ikey_get_u64(&inp[op->sec_idx]);
+	else
+		now = ulogd_clock_sec();
+
+	/* localtime_r() is expensive, only call it once per second */
+	if (!ulogd_timefmt(&op->timefmt, now,
+			   "\"timestamp\": \"%Y-%m-%dT%H:%M:%S"))
+		return;
+
+	json_put(op, op->timefmt.str, op->timefmt.len);
+	if (op->usec_idx >= 0 && pp_is_valid(inp, op->usec_idx)) {
+		uint32_t usec = ikey_get_u32(&inp[op->usec_idx]);
+		char frac[8];
+		int i;
+
+		frac[0] = '.';
+		for (i = 6; i > 0; i--) {
+			frac[i] = '0' + usec % 10;
+			usec /= 10;
+		}
+		json_put(op, frac, 7);
 	}
+	op->buf[op->len++] = '"';
+}
+
+static int json_interp(struct ulogd_pluginstance *upi)
+{
+	struct json_priv *opi = (struct json_priv *) &upi->private;
+	unsigned int i;
+
+	opi->len = 0;
+
+	/* worst case for everything except string values */
+	if (json_reserve(opi, 1 + MAX_TIMESTAMP_MEMBER + 8 + 2 + opi->dvc.len) < 0)
+		goto err_nomem;
+
+	opi->buf[opi->len++] = '{';
 
+	if (upi->config_kset->ces[JSON_CONF_TIMESTAMP].u.value != 0)
+		json_put_timestamp(opi, upi->input.keys);
 
+	if (opi->dvc.str)
+		json_put_field(opi, &opi->dvc);
 
 	for (i = 0; i < upi->input.num_keys; i++) {
 		struct ulogd_key *key = upi->input.keys[i].u.source;
-		char *field_name;
+		struct json_field *f = &opi->fields[i];
 
 		if (!key)
 			continue;
@@ -150,41 +406,62 @@ static int json_interp(struct ulogd_pluginstance *upi)
 		if (!IS_VALID(*key))
 			continue;
 
-		field_name = key->cim_name ? key->cim_name : key->name;
+		if (json_reserve(opi, 2 + f->len + JSON_INT_MAXLEN + 2) < 0)
+			goto err_nomem;
 
 		switch (key->type) {
 		case ULOGD_RET_STRING:
-			json_object_set_new(msg, field_name, json_string(key->u.value.ptr));
+			json_put_field(opi, f);
+			if (json_put_string(opi, key->u.value.ptr) < 0)
+				goto err_nomem;
 			break;
 		case ULOGD_RET_BOOL:
 		case ULOGD_RET_INT8:
-			json_object_set_new(msg, field_name, json_integer(key->u.value.i8));
+			json_put_field(opi, f);
+			json_put_i64(opi, key->u.value.i8);
 			break;
 		case ULOGD_RET_INT16:
-			json_object_set_new(msg, field_name, json_integer(key->u.value.i16));
+			json_put_field(opi, f);
+			json_put_i64(opi, key->u.value.i16);
 			break;
 		case ULOGD_RET_INT32:
-			json_object_set_new(msg, field_name, json_integer(key->u.value.i32));
+			json_put_field(opi, f);
+			json_put_i64(opi, key->u.value.i32);
 			break;
 		case ULOGD_RET_UINT8:
 			if ((upi->config_kset->ces[JSON_CONF_BOOLEAN_LABEL].u.value != 0)
 					&& (!strcmp(key->name, "raw.label"))) {
+				static const char allowed[] =
+					"\"action\": \"allowed\"";
+				static const char blocked[] =
+					"\"action\": \"blocked\"";
+
+				if (json_reserve(opi, 2 + sizeof(allowed)) < 0)
+					goto err_nomem;
+				if (opi->len > 1)
+					json_put(opi, ", ", 2);
 				if (key->u.value.ui8)
-					json_object_set_new(msg, "action", json_string("allowed"));
+					json_put(opi, allowed,
+						 sizeof(allowed) - 1);
 				else
-					json_object_set_new(msg, "action", json_string("blocked"));
+					json_put(opi, blocked,
+						 sizeof(blocked) - 1);
 				break;
 			}
-			json_object_set_new(msg, field_name, json_integer(key->u.value.ui8));
+			json_put_field(opi, f);
+			json_put_u64(opi, key->u.value.ui8);
 			break;
 		case ULOGD_RET_UINT16:
-			json_object_set_new(msg, field_name, json_integer(key->u.value.ui16));
+			json_put_field(opi, f);
+			json_put_u64(opi, key->u.value.ui16);
 			break;
 		case ULOGD_RET_UINT32:
-			json_object_set_new(msg, field_name, json_integer(key->u.value.ui32));
+			json_put_field(opi, f);
+			json_put_u64(opi, key->u.value.ui32);
 			break;
 		case ULOGD_RET_UINT64:
-			json_object_set_new(msg, field_name, json_integer(key->u.value.ui64));
+			json_put_field(opi, f);
+			json_put_u64(opi, key->u.value.ui64);
 			break;
 		default:
 			/* don't know how to interpret this key. */
@@ -192,34 +469,41 @@ static int json_interp(struct ulogd_pluginstance *upi)
 		}
 	}
 
-	json_dumpf(msg, opi->of, 0);
-	fprintf(opi->of, "\n");
+	if (json_reserve(opi, 2) < 0)
+		goto err_nomem;
+	opi->buf[opi->len++] = '}';
+	opi->buf[opi->len++] = '\n';
 
-	json_decref(msg);
+	if (opi->use_transport) {
+		/* records are dropped and accounted when the queue is full */
+		ulogd_transport_write(&opi->transport, opi->buf, opi->len);
+		return ULOGD_IRET_OK;
+	}
+
+	/* with overflow=drop, records are accounted by the writer */
+	ulogd_writer_write(&opi->writer, opi->buf, opi->len);
 
 	if (upi->config_kset->ces[JSON_CONF_SYNC].u.value != 0)
-		fflush(opi->of);
+		ulogd_writer_flush(&opi->writer);
 
 	return ULOGD_IRET_OK;
+
+err_nomem:
+	ulogd_log(ULOGD_ERROR, "Unable to create JSON message\n");
+	return ULOGD_IRET_ERR;
 }
 
 static void sighup_handler_print(struct ulogd_pluginstance *upi, int signal)
 {
 	struct json_priv *oi = (struct json_priv *) &upi->private;
-	FILE *old = oi->of;
+
+	if (oi->use_transport)
+		return;
 
 	switch (signal) {
 	case SIGHUP:
 		ulogd_log(ULOGD_NOTICE, "JSON: reopening logfile\n");
-		oi->of = fopen(upi->config_kset->ces[0].u.string, "a");
-		if (!oi->of) {
-			ulogd_log(ULOGD_ERROR, "can't open JSON "
-					       "log file: %s\n",
-				  strerror(errno));
-			oi->of = old;
-		} else {
-			fclose(old);
-		}
+		ulogd_writer_reopen(&oi->writer);
 		break;
 	default:
 		break;
@@ -242,19 +526,34 @@ static int json_configure(struct ulogd_pluginstance *upi,
 	return 0;
 }
 
+static void json_free_fields(struct json_priv *op, unsigned int num)
+{
+	unsigned int i;
+
+	if (op->fields) {
+		for (i = 0; i < num; i++)
+			free(op->fields[i].str);
+		free(op->fields);
+		op->fields = NULL;
+	}
+	free(op->dvc.str);
+	op->dvc.str = NULL;
+	free(op->buf);
+	op->buf = NULL;
+}
+
 static int json_init(struct ulogd_pluginstance *upi)
 {
 	struct json_priv *op = (struct json_priv *) &upi->private;
+	char *dvc = upi->config_kset->ces[JSON_CONF_DEVICE].u.string;
+	char *mode = upi->config_kset->ces[JSON_CONF_MODE].u.string;
 	unsigned int i;
 
-	op->of = fopen(upi->config_kset->ces[0].u.string, "a");
-	if (!op->of) {
-		ulogd_log(ULOGD_FATAL, "can't open JSON log file: %s\n",
-			strerror(errno));
-		return -1;
-	}
+	op->fields = calloc(upi->input.num_keys, sizeof(struct json_field));
+	if (!op->fields)
+		goto err_nomem;
 
-	/* search for time */
+	/* search for time and escape the field names once and for all */
 	op->sec_idx = -1;
 	op->usec_idx = -1;
 	for (i = 0; i < upi->input.num_keys; i++) {
@@ -263,17 +562,63 @@ static int json_init(struct ulogd_pluginstance *upi)
 			op->sec_idx = i;
 		else if (!strcmp(key->name, "oob.time.usec"))
 			op->usec_idx = i;
+
+		if (json_field_init(&op->fields[i], key->cim_name ?
+				    key->cim_name : key->name, NULL) < 0)
+			goto err_nomem;
 	}
 
+	if (dvc && json_field_init(&op->dvc, "dvc", dvc) < 0)
+		goto err_nomem;
+
+	op->size = JSON_BUF_DEFAULT_SIZE;
+	op->buf = malloc(op->size);
+	if (!op->buf)
+		goto err_nomem;
+	op->timefmt.len = 0;
+
+	op->use_transport = strcmp(mode, "file") != 0;
+	if (op->use_transport) {
+		if (ulogd_transport_start(&op->transport, upi->id, mode,
+			upi->config_kset->ces[JSON_CONF_HOST].u.string,
+			upi->config_kset->ces[JSON_CONF_PORT].u.string,
+			upi->config_kset->ces[JSON_CONF_FILENAME].u.string,
+			upi->config_kset->ces[JSON_CONF_QUEUE_SIZE].u.value) < 0) {
+			json_free_fields(op, upi->input.num_keys);
+			return -1;
+		}
+		op->transport.stats = &upi->stats;
+		return 0;
+	}
+
+	if (ulogd_writer_open(&op->writer, upi->id,
+			upi->config_kset->ces[JSON_CONF_FILENAME].u.string,
+			O_CREAT | O_APPEND,
+			&upi->config_kset->ces[JSON_CONF_WRITER]) < 0) {
+		ulogd_log(ULOGD_FATAL, "can't open JSON log file\n");
+		json_free_fields(op, upi->input.num_keys);
+		return -1;
+	}
+	op->writer.stats = &upi->stats;
+
 	return 0;
+
+err_nomem:
+	ulogd_log(ULOGD_FATAL, "out of memory\n");
+	json_free_fields(op, upi->input.num_keys);
+	return -1;
 }
 
 static int json_fini(struct ulogd_pluginstance *pi)
 {
 	struct json_priv *op = (struct json_priv *) &pi->private;
 
-	if (op->of != stdout)
-		fclose(op->of);
+	if (op->use_transport)
+		ulogd_transport_stop(&op->transport);
+	else
+		ulogd_writer_close(&op->writer);
+
+	json_free_fields(op, pi->input.num_keys);
 
 	return 0;
 }
@@ -292,6 +637,7 @@ static struct ulogd_plugin json_plugin = {
 	.stop	= &json_fini,
 	.signal = &sighup_handler_print,
 	.config_kset = &json_kset,
+	.priv_size = sizeof(struct json_priv),
 	.version = VERSION,
 };
 
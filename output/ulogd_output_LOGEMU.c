@@ -27,9 +27,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
+#include <ulogd/clock.h>
+#include <ulogd/writer.h>
 
 #ifndef HOST_NAME_MAX
 #warning this libc does not define HOST_NAME_MAX
@@ -59,7 +62,7 @@ static struct ulogd_key logemu_inp[] = {
 };
 
 static struct config_keyset logemu_kset = {
-	.num_ces = 2,
+	.num_ces = 2 + WRITER_CE_NUM,
 	.ces = {
 		{
 			.key 	 = "file",
@@ -73,11 +76,13 @@ static struct config_keyset logemu_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u	 = { .value = ULOGD_LOGEMU_SYNC_DEFAULT },
 		},
+		WRITER_CES,
 	},
 };
 
 struct logemu_instance {
-	FILE *of;
+	struct ulogd_writer w;
+	struct ulogd_timefmt timefmt;
 };
 
 static int _output_logemu(struct ulogd_pluginstance *upi)
@@ -86,24 +91,24 @@ static int _output_logemu(struct ulogd_pluginstance *upi)
 	struct ulogd_key *res = upi->input.keys;
 
 	if (res[0].u.source->flags & ULOGD_RETF_VALID) {
-		char *timestr;
-		char *tmp;
+		const char *timestr;
 		time_t now;
 
 		if (res[1].u.source && (res[1].u.source->flags & ULOGD_RETF_VALID))
 			now = (time_t) res[1].u.source->u.value.ui32;
 		else
-			now = time(NULL);
+			now = ulogd_clock_sec();
 
-		timestr = ctime(&now) + 4;
-		if ((tmp = strchr(timestr, '\n')))
-			*tmp = '\0';
+		/* like ctime(), formatted once per second */
+		timestr = ulogd_timefmt(&li->timefmt, now, "%b %e %H:%M:%S");
+		if (!timestr)
+			timestr = "";
 
-		fprintf(li->of, "%.15s %s %s", timestr, hostname,
-				(char *) res[0].u.source->u.value.ptr);
+		ulogd_writer_printf(&li->w, "%s %s %s", timestr, hostname,
+				    (char *) res[0].u.source->u.value.ptr);
 
 		if (upi->config_kset->ces[1].u.value)
-			fflush(li->of);
+			ulogd_writer_flush(&li->w);
 	}
 
 	return ULOGD_IRET_OK;
@@ -112,19 +117,11 @@ static int _output_logemu(struct ulogd_pluginstance *upi)
 static void signal_handler_logemu(struct ulogd_pluginstance *pi, int signal)
 {
 	struct logemu_instance *li = (struct logemu_instance *) &pi->private;
-	FILE *old = li->of;
 
 	switch (signal) {
 	case SIGHUP:
 		ulogd_log(ULOGD_NOTICE, "syslogemu: reopening logfile\n");
-		li->of = fopen(pi->config_kset->ces[0].u.string, "a");
-		if (!li->of) {
-			ulogd_log(ULOGD_ERROR, "can't reopen syslogemu: %s\n",
-				  strerror(errno));
-			li->of = old;
-		} else {
-			fclose(old);
-		}
+		ulogd_writer_reopen(&li->w);
 		break;
 	default:
 		break;
@@ -135,23 +132,16 @@ static void signal_handler_logemu(struct ulogd_pluginstance *pi, int signal)
 static int start_logemu(struct ulogd_pluginstance *pi)
 {
 	struct logemu_instance *li = (struct logemu_instance *) &pi->private;
+	char *path = pi->config_kset->ces[0].u.string;
 	char *tmp;
 
 	ulogd_log(ULOGD_DEBUG, "starting logemu\n");
 
 #ifdef DEBUG_LOGEMU
-	li->of = stdout;
+	path = NULL;
 #else
-	ulogd_log(ULOGD_DEBUG, "opening file: %s\n",
-		  pi->config_kset->ces[0].u.string);
-	li->of = fopen(pi->config_kset->ces[0].u.string, "a");
-	if (!li->of) {
-		ulogd_log(ULOGD_FATAL, "can't open syslogemu: %s\n", 
-			  strerror(errno));
-		return -errno;
-	}		
+	ulogd_log(ULOGD_DEBUG, "opening file: %s\n", path);
 #endif
-
 	if (gethostname(hostname, sizeof(hostname)) < 0) {
 		ulogd_log(ULOGD_FATAL, "can't gethostname(): %s\n",
 			  strerror(errno));
@@ -162,14 +152,20 @@ static int start_logemu(struct ulogd_pluginstance *pi)
 	if ((tmp = strchr(hostname, '.')))
 		*tmp = '\0';
 
+	if (ulogd_writer_open(&li->w, pi->id, path, O_CREAT | O_APPEND,
+			      &pi->config_kset->ces[2]) < 0) {
+		ulogd_log(ULOGD_FATAL, "can't open syslogemu\n");
+		return -EINVAL;
+	}
+	li->w.stats = &pi->stats;
+
 	return 0;
 }
 
 static int fini_logemu(struct ulogd_pluginstance *pi) {
 	struct logemu_instance *li = (struct logemu_instance *) &pi->private;
 
-	if (li->of != stdout)
-		fclose(li->of);
+	ulogd_writer_close(&li->w);
 
 	return 0;
 }
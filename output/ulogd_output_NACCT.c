@@ -25,15 +25,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
+#include <ulogd/writer.h>
 
 #define NACCT_FILE_DEFAULT	"/var/log/nacctdata.log"
 
 /* config accessors (lazy me...) */
 #define NACCT_CFG_FILE(pi)	((pi)->config_kset->ces[0].u.string)
 #define NACCT_CFG_SYNC(pi)	((pi)->config_kset->ces[1].u.value)
+#define NACCT_CFG_WRITER(pi)	(&(pi)->config_kset->ces[2])
 
 enum input_keys {
 	KEY_IP_SADDR,
@@ -112,7 +115,7 @@ static struct ulogd_key nacct_inp[] = {
 };
 
 struct nacct_priv {
-	FILE *of;
+	struct ulogd_writer w;
 };
 
 
@@ -121,13 +124,12 @@ nacct_interp(struct ulogd_pluginstance *pi)
 {
 	struct nacct_priv *priv = (struct nacct_priv *)&pi->private;
 	struct ulogd_key *inp = pi->input.keys;
-	static char buf[256];
 
 	/* try to be as close to nacct as possible.  Instead of nacct's
 	   'timestamp' value use 'flow.end.sec' */
 	if (ikey_get_u8(&inp[KEY_IP_PROTO]) == IPPROTO_ICMP) {
-		snprintf(buf, sizeof(buf),
-				 "%u\t%u\t%s\t%u\t%s\t%u\t%" PRIu64 "\t%" PRIu64,
+		ulogd_writer_printf(&priv->w,
+				 "%u\t%u\t%s\t%u\t%s\t%u\t%" PRIu64 "\t%" PRIu64 "\n",
 				 ikey_get_u32(&inp[KEY_FLOW_END]),
 				 ikey_get_u8(&inp[KEY_IP_PROTO]),
 				 (char *) ikey_get_ptr(&inp[KEY_IP_SADDR]),
@@ -137,8 +139,8 @@ nacct_interp(struct ulogd_pluginstance *pi)
 				 ikey_get_u64(&inp[KEY_RAW_PKTCNT]),
 				 ikey_get_u64(&inp[KEY_RAW_PKTLEN]));
 	} else {
-		snprintf(buf, sizeof(buf),
-				 "%u\t%u\t%s\t%u\t%s\t%u\t%" PRIu64 "\t%" PRIu64,
+		ulogd_writer_printf(&priv->w,
+				 "%u\t%u\t%s\t%u\t%s\t%u\t%" PRIu64 "\t%" PRIu64 "\n",
 				 ikey_get_u32(&inp[KEY_FLOW_END]),
 				 ikey_get_u8(&inp[KEY_IP_PROTO]),
 				 (char *) ikey_get_ptr(&inp[KEY_IP_SADDR]),
@@ -149,16 +151,14 @@ nacct_interp(struct ulogd_pluginstance *pi)
 				 ikey_get_u64(&inp[KEY_RAW_PKTLEN]));
 	}
 
-	fprintf(priv->of, "%s\n", buf);
-
 	if (NACCT_CFG_SYNC(pi) != 0)
-		fflush(priv->of);
+		ulogd_writer_flush(&priv->w);
 
 	return ULOGD_IRET_OK;
 }
 
 static struct config_keyset nacct_kset = {
-	.num_ces = 2,
+	.num_ces = 2 + WRITER_CE_NUM,
 	.ces = {
 		{
 			.key = "file", 
@@ -172,6 +172,7 @@ static struct config_keyset nacct_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u = { .value = 0 },
 		},
+		WRITER_CES,
 	},
 };
 
@@ -184,11 +185,7 @@ sighup_handler_print(struct ulogd_pluginstance *pi, int signal)
 	case SIGHUP:
 	{
 		ulogd_log(ULOGD_NOTICE, "NACCT: reopening logfile\n");
-		fclose(oi->of);
-		oi->of = fopen(NACCT_CFG_FILE(pi), "a");
-		if (!oi->of)
-			ulogd_log(ULOGD_ERROR, "%s: %s\n", NACCT_CFG_FILE(pi),
-					  strerror(errno));
+		ulogd_writer_reopen(&oi->w);
 		break;
 	}
 
@@ -214,11 +211,12 @@ nacct_init(struct ulogd_pluginstance *pi)
 {
 	struct nacct_priv *op = (struct nacct_priv *)&pi->private;
 
-	if ((op->of = fopen(NACCT_CFG_FILE(pi), "a")) == NULL) {
-		ulogd_log(ULOGD_FATAL, "%s: %s\n", 
-				  NACCT_CFG_FILE(pi), strerror(errno));
+	if (ulogd_writer_open(&op->w, pi->id, NACCT_CFG_FILE(pi),
+			      O_CREAT | O_APPEND, NACCT_CFG_WRITER(pi)) < 0) {
+		ulogd_log(ULOGD_FATAL, "%s: can't open\n", NACCT_CFG_FILE(pi));
 		return -1;
-	}		
+	}
+	op->w.stats = &pi->stats;
 	return 0;
 }
 
@@ -227,8 +225,7 @@ nacct_fini(struct ulogd_pluginstance *pi)
 {
 	struct nacct_priv *op = (struct nacct_priv *)&pi->private;
 
-	if (op->of != stdout)
-		fclose(op->of);
+	ulogd_writer_close(&op->w);
 
 	return 0;
 }
@@ -249,6 +246,7 @@ static struct ulogd_plugin nacct_plugin = {
 	.stop	= &nacct_fini,
 	.signal = &sighup_handler_print,
 	.config_kset = &nacct_kset,
+	.priv_size = sizeof(struct nacct_priv),
 	.version = VERSION,
 };
 
@@ -0,0 +1,179 @@
+/* ulogd_output_NULL.c - sink that only counts events
+ *
+ * Terminates a stack without doing any work, so that the cost of the
+ * other plugins can be measured. When the source sets bench.time (see
+ * GENERATOR), the latency from the source to this sink is measured too.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/conffile.h>
+#include <ulogd/timer.h>
+
+#define NSEC_PER_SEC	1000000000ULL
+
+enum {
+	KEY_BENCH_TIME,
+};
+
+static struct ulogd_key null_inp[] = {
+	[KEY_BENCH_TIME] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "bench.time",
+	},
+};
+
+static struct config_keyset null_kset = {
+	.num_ces = 1,
+	.ces = {
+		{
+			.key	 = "interval",
+			.type	 = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
+	},
+};
+
+#define interval_ce(x)	(x->ces[0])
+
+struct null_counters {
+	uint64_t events;
+	uint64_t timed;
+	uint64_t latency;
+	uint64_t max_latency;
+};
+
+struct null_instance {
+	struct null_counters total;
+	struct null_counters last;	/* since the last periodic report */
+	struct ulogd_timer timer;
+};
+
+static uint64_t null_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void null_account(struct null_counters *c, uint64_t latency, int timed)
+{
+	c->events++;
+	if (!timed)
+		return;
+	c->timed++;
+	c->latency += latency;
+	if (latency > c->max_latency)
+		c->max_latency = latency;
+}
+
+static int null_interp(struct ulogd_pluginstance *upi)
+{
+	struct null_instance *ni = (struct null_instance *)upi->private;
+	struct ulogd_key *inp = upi->input.keys;
+	uint64_t latency = 0;
+	int timed = pp_is_valid(inp, KEY_BENCH_TIME);
+
+	if (timed)
+		latency = null_now() - ikey_get_u64(&inp[KEY_BENCH_TIME]);
+
+	null_account(&ni->total, latency, timed);
+	if (interval_ce(upi->config_kset).u.value > 0)
+		null_account(&ni->last, latency, timed);
+
+	return ULOGD_IRET_OK;
+}
+
+static void null_report(struct ulogd_pluginstance *upi,
+			struct null_counters *c, const char *what)
+{
+	if (c->timed)
+		ulogd_log(ULOGD_NOTICE, "%s: %" PRIu64 " events %s, latency "
+			  "%" PRIu64 " ns avg, %" PRIu64 " ns max\n", upi->id,
+			  c->events, what, c->latency / c->timed,
+			  c->max_latency);
+	else
+		ulogd_log(ULOGD_NOTICE, "%s: %" PRIu64 " events %s\n",
+			  upi->id, c->events, what);
+}
+
+static void null_timer_cb(struct ulogd_timer *t, void *data)
+{
+	struct ulogd_pluginstance *upi = data;
+	struct null_instance *ni = (struct null_instance *)upi->private;
+
+	null_report(upi, &ni->last, "in the last interval");
+	memset(&ni->last, 0, sizeof(ni->last));
+	ulogd_add_timer(&ni->timer, interval_ce(upi->config_kset).u.value);
+}
+
+static int null_configure(struct ulogd_pluginstance *upi,
+			  struct ulogd_pluginstance_stack *stack)
+{
+	return config_parse_file(upi->id, upi->config_kset);
+}
+
+static int null_start(struct ulogd_pluginstance *upi)
+{
+	struct null_instance *ni = (struct null_instance *)upi->private;
+
+	memset(&ni->total, 0, sizeof(ni->total));
+	memset(&ni->last, 0, sizeof(ni->last));
+	if (interval_ce(upi->config_kset).u.value > 0) {
+		ulogd_init_timer(&ni->timer, upi, null_timer_cb);
+		ulogd_add_timer(&ni->timer,
+				interval_ce(upi->config_kset).u.value);
+	}
+
+	return 0;
+}
+
+static int null_stop(struct ulogd_pluginstance *upi)
+{
+	struct null_instance *ni = (struct null_instance *)upi->private;
+
+	if (interval_ce(upi->config_kset).u.value > 0)
+		ulogd_del_timer(&ni->timer);
+	null_report(upi, &ni->total, "in total");
+
+	return 0;
+}
+
+static struct ulogd_plugin null_plugin = {
+	.name = "NULL",
+	.input = {
+		.keys = null_inp,
+		.num_keys = ARRAY_SIZE(null_inp),
+		.type = ULOGD_DTYPE_RAW | ULOGD_DTYPE_PACKET |
+			ULOGD_DTYPE_FLOW | ULOGD_DTYPE_SUM,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_SINK,
+	},
+	.config_kset	= &null_kset,
+	.priv_size	= sizeof(struct null_instance),
+
+	.configure	= &null_configure,
+	.start		= &null_start,
+	.stop		= &null_stop,
+	.interp		= &null_interp,
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&null_plugin);
+}
@@ -21,11 +21,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
+#include <ulogd/writer.h>
 
 #ifndef ULOGD_OPRINT_DEFAULT
 #define ULOGD_OPRINT_DEFAULT	"/var/log/ulogd.pktlog"
@@ -43,16 +46,55 @@
         ((unsigned char *)&addr)[1], \
         ((unsigned char *)&addr)[0]
 
+#define OPRINT_BUF_DEFAULT_SIZE	4096
+
 struct oprint_priv {
-	FILE *of;
+	struct ulogd_writer w;
+	/* the record is built there and queued with one write */
+	char *buf;
+	size_t size;
+	size_t len;
 };
 
+static void oprint_put(struct oprint_priv *op, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+
+static void oprint_put(struct oprint_priv *op, const char *fmt, ...)
+{
+	va_list ap;
+	size_t size;
+	char *buf;
+	int ret;
+
+	while (1) {
+		va_start(ap, fmt);
+		ret = vsnprintf(op->buf + op->len, op->size - op->len, fmt, ap);
+		va_end(ap);
+		if (ret < 0)
+			return;
+		if ((size_t)ret < op->size - op->len) {
+			op->len += ret;
+			return;
+		}
+		for (size = op->size; (size_t)ret >= size - op->len; )
+			size *= 2;
+		buf = realloc(op->buf, size);
+		if (!buf) {
+			ulogd_log(ULOGD_ERROR, "OPRINT: out of memory\n");
+			return;
+		}
+		op->buf = buf;
+		op->size = size;
+	}
+}
+
 static int oprint_interp(struct ulogd_pluginstance *upi)
 {
 	struct oprint_priv *opi = (struct oprint_priv *) &upi->private;
 	unsigned int i;
-	
-	fprintf(opi->of, "===>PACKET BOUNDARY\n");
+
+	opi->len = 0;
+	oprint_put(opi, "===>PACKET BOUNDARY\n");
 	for (i = 0; i < upi->input.num_keys; i++) {
 		struct ulogd_key *ret = upi->input.keys[i].u.source;
 
@@ -63,44 +105,45 @@ static int oprint_interp(struct ulogd_pluginstance *upi)
 		if (!IS_VALID(*ret))
 			continue;
 
-		fprintf(opi->of,"%s=", ret->name);
+		oprint_put(opi, "%s=", ret->name);
 		switch (ret->type) {
 			case ULOGD_RET_STRING:
-				fprintf(opi->of, "%s\n",
+				oprint_put(opi, "%s\n",
 					(char *) ret->u.value.ptr);
 				break;
 			case ULOGD_RET_BOOL:
 			case ULOGD_RET_INT8:
 			case ULOGD_RET_INT16:
 			case ULOGD_RET_INT32:
-				fprintf(opi->of, "%d\n", ret->u.value.i32);
+				oprint_put(opi, "%d\n", ret->u.value.i32);
 				break;
 			case ULOGD_RET_UINT8:
 			case ULOGD_RET_UINT16:
 			case ULOGD_RET_UINT32:
-				fprintf(opi->of, "%u\n", ret->u.value.ui32);
+				oprint_put(opi, "%u\n", ret->u.value.ui32);
 				break;
 			case ULOGD_RET_UINT64:
-				fprintf(opi->of, "%" PRIu64 "\n", ret->u.value.ui64);
+				oprint_put(opi, "%" PRIu64 "\n", ret->u.value.ui64);
 				break;
 			case ULOGD_RET_IPADDR:
-				fprintf(opi->of, "%u.%u.%u.%u\n", 
+				oprint_put(opi, "%u.%u.%u.%u\n", 
 					HIPQUAD(ret->u.value.ui32));
 				break;
 			case ULOGD_RET_NONE:
-				fprintf(opi->of, "<none>\n");
+				oprint_put(opi, "<none>\n");
 				break;
-			default: fprintf(opi->of, "default\n");
+			default: oprint_put(opi, "default\n");
 		}
 	}
+	ulogd_writer_write(&opi->w, opi->buf, opi->len);
 	if (upi->config_kset->ces[1].u.value != 0)
-		fflush(opi->of);
+		ulogd_writer_flush(&opi->w);
 
 	return ULOGD_IRET_OK;
 }
 
 static struct config_keyset oprint_kset = {
-	.num_ces = 2,
+	.num_ces = 2 + WRITER_CE_NUM,
 	.ces = {
 		{
 			.key = "file", 
@@ -114,25 +157,18 @@ static struct config_keyset oprint_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u = { .value = 0 },
 		},
+		WRITER_CES,
 	},
 };
 
 static void sighup_handler_print(struct ulogd_pluginstance *upi, int signal)
 {
 	struct oprint_priv *oi = (struct oprint_priv *) &upi->private;
-	FILE *old = oi->of;
 
 	switch (signal) {
 	case SIGHUP:
 		ulogd_log(ULOGD_NOTICE, "OPRINT: reopening logfile\n");
-		oi->of = fopen(upi->config_kset->ces[0].u.string, "a");
-		if (!oi->of) {
-			ulogd_log(ULOGD_ERROR, "can't open PKTLOG: %s\n",
-				strerror(errno));
-			oi->of = old;
-		} else {
-			fclose(old);
-		}
+		ulogd_writer_reopen(&oi->w);
 		break;
 	default:
 		break;
@@ -159,12 +195,23 @@ static int oprint_init(struct ulogd_pluginstance *upi)
 {
 	struct oprint_priv *op = (struct oprint_priv *) &upi->private;
 
-	op->of = fopen(upi->config_kset->ces[0].u.string, "a");
-	if (!op->of) {
-		ulogd_log(ULOGD_FATAL, "can't open PKTLOG: %s\n", 
-			strerror(errno));
+	op->size = OPRINT_BUF_DEFAULT_SIZE;
+	op->buf = malloc(op->size);
+	if (!op->buf) {
+		ulogd_log(ULOGD_FATAL, "out of memory\n");
 		return -1;
-	}		
+	}
+
+	if (ulogd_writer_open(&op->w, upi->id,
+			      upi->config_kset->ces[0].u.string,
+			      O_CREAT | O_APPEND,
+			      &upi->config_kset->ces[2]) < 0) {
+		ulogd_log(ULOGD_FATAL, "can't open PKTLOG\n");
+		free(op->buf);
+		op->buf = NULL;
+		return -1;
+	}
+	op->w.stats = &upi->stats;
 	return 0;
 }
 
@@ -172,8 +219,9 @@ static int oprint_fini(struct ulogd_pluginstance *pi)
 {
 	struct oprint_priv *op = (struct oprint_priv *) &pi->private;
 
-	if (op->of != stdout)
-		fclose(op->of);
+	ulogd_writer_close(&op->w);
+	free(op->buf);
+	op->buf = NULL;
 
 	return 0;
 }
@@ -192,6 +240,7 @@ static struct ulogd_plugin oprint_plugin = {
 	.stop	= &oprint_fini,
 	.signal = &sighup_handler_print,
 	.config_kset = &oprint_kset,
+	.priv_size = sizeof(struct oprint_priv),
 	.version = VERSION,
 };
 
@@ -0,0 +1,866 @@
+/* ulogd_output_PROMETHEUS.c
+ *
+ * ulogd output target keeping the latest counters in memory and serving
+ * them in the Prometheus text exposition format over HTTP.
+ *
+ * NFACCT objects are exported as they are. Packets (NFLOG) are counted
+ * per oob.prefix and flows (NFCT) are summed up, so that the same sink
+ * can be put at the end of any stack. The HTTP server runs from the
+ * ulogd main loop and never blocks: a scrape renders the table into a
+ * per connection buffer which is only grown when the table grew.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/conffile.h>
+#include <ulogd/clock.h>
+#include <ulogd/timer.h>
+#include <ulogd/linuxlist.h>
+#include <ulogd/jhash.h>
+#include <ulogd/hash.h>
+
+/* concurrent scrapes, more connections are answered with a 503 */
+#define PROM_CLIENTS_MAX	8
+/* seconds without progress before a connection is closed */
+#define PROM_CLIENT_IDLE	10
+#define PROM_REQUEST_MAX	1024
+/* room reserved in front of the body for the HTTP response header */
+#define PROM_HEADER_MAX		128
+/* counter names longer than this are truncated */
+#define PROM_NAME_MAX		64
+
+enum {
+	KEY_SUM_NAME,
+	KEY_SUM_PKTS,
+	KEY_SUM_BYTES,
+	KEY_OOB_PREFIX,
+	KEY_RAW_PKTLEN,
+	KEY_ORIG_RAW_PKTLEN,
+	KEY_ORIG_RAW_PKTCOUNT,
+	KEY_REPLY_RAW_PKTLEN,
+	KEY_REPLY_RAW_PKTCOUNT,
+};
+
+static struct ulogd_key prom_inp[] = {
+	[KEY_SUM_NAME] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "sum.name",
+	},
+	[KEY_SUM_PKTS] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "sum.pkts",
+	},
+	[KEY_SUM_BYTES] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "sum.bytes",
+	},
+	[KEY_OOB_PREFIX] = {
+		.type	= ULOGD_RET_STRING,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "oob.prefix",
+	},
+	[KEY_RAW_PKTLEN] = {
+		.type	= ULOGD_RET_UINT32,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "raw.pktlen",
+	},
+	[KEY_ORIG_RAW_PKTLEN] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.raw.pktlen",
+	},
+	[KEY_ORIG_RAW_PKTCOUNT] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "orig.raw.pktcount",
+	},
+	[KEY_REPLY_RAW_PKTLEN] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "reply.raw.pktlen",
+	},
+	[KEY_REPLY_RAW_PKTCOUNT] = {
+		.type	= ULOGD_RET_UINT64,
+		.flags	= ULOGD_KEYF_OPTIONAL,
+		.name	= "reply.raw.pktcount",
+	},
+};
+
+static struct config_keyset prom_kset = {
+	.num_ces = 4,
+	.ces = {
+		{
+			.key = "host",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "127.0.0.1",
+		},
+		{
+			.key = "port",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "9480",
+		},
+		{
+			.key = "prefix",
+			.type = CONFIG_TYPE_STRING,
+			.options = CONFIG_OPT_NONE,
+			.u.string = "ulogd",
+		},
+		{
+			.key = "max_counters",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 4096,
+		},
+	},
+};
+
+#define host_ce(x)	(x->ces[0])
+#define port_ce(x)	(x->ces[1])
+#define prefix_ce(x)	(x->ces[2])
+#define max_counters_ce(x)	(x->ces[3])
+
+enum {
+	PROM_NFACCT,
+	PROM_PACKET,
+	PROM_KIND_MAX,
+};
+
+struct prom_counter {
+	struct hashtable_node hashnode;	/* must be first, freed by flush */
+	struct llist_head list;
+	int kind;
+	uint64_t pkts;
+	uint64_t bytes;
+	unsigned int name_len;
+	char name[PROM_NAME_MAX];
+	/* label value escaped once, when the counter is created */
+	unsigned int label_len;
+	char label[2 * PROM_NAME_MAX];
+};
+
+struct prom_lookup {
+	int kind;
+	const char *name;
+	unsigned int name_len;
+};
+
+struct prom_client {
+	struct ulogd_fd ufd;
+	struct ulogd_pluginstance *upi;
+	int active;
+	time_t last;
+	char req[PROM_REQUEST_MAX];
+	unsigned int req_len;
+	char *resp;
+	unsigned int resp_size;
+	unsigned int resp_off;
+	unsigned int resp_end;
+};
+
+struct prom_instance {
+	struct ulogd_fd listen_fd;
+	struct hashtable *table;
+	struct llist_head counters[PROM_KIND_MAX];
+	uint64_t flows;
+	uint64_t flow_pkts;
+	uint64_t flow_bytes;
+	uint64_t dropped;
+	uint64_t scrapes;
+	/* upper bound of the size of the rendered body */
+	unsigned int body_max;
+	struct prom_client clients[PROM_CLIENTS_MAX];
+	struct ulogd_timer idle_timer;
+};
+
+static const struct {
+	const char *label;
+	const char *name[2];
+	const char *help[2];
+} prom_families[PROM_KIND_MAX] = {
+	[PROM_NFACCT] = {
+		.label = "name",
+		.name = { "nfacct_packets_total", "nfacct_bytes_total" },
+		.help = { "Packets counted by the nfacct object.",
+			  "Bytes counted by the nfacct object." },
+	},
+	[PROM_PACKET] = {
+		.label = "prefix",
+		.name = { "log_packets_total", "log_bytes_total" },
+		.help = { "Packets logged, by log prefix.",
+			  "Bytes of the packets logged, by log prefix." },
+	},
+};
+
+/* worst case length of the two lines of one counter */
+static unsigned int prom_line_max(struct ulogd_pluginstance *upi,
+				  unsigned int label_len)
+{
+	unsigned int prefix_len = strlen(prefix_ce(upi->config_kset).u.string);
+
+	/* prefix_<family>{<label>="<value>"} <u64>\n */
+	return 2 * (prefix_len + 1 + 32 + 1 + 8 + 2 + label_len + 3 + 20 + 1);
+}
+
+static uint32_t prom_hash(const void *data, const struct hashtable *table)
+{
+	const struct prom_lookup *l = data;
+
+	return ((uint64_t)jhash(l->name, l->name_len, l->kind) *
+		table->hashsize) >> 32;
+}
+
+static int prom_compare(const void *data1, const void *data2)
+{
+	const struct prom_counter *c = data1;
+	const struct prom_lookup *l = data2;
+
+	return c->kind == l->kind && c->name_len == l->name_len &&
+	       !memcmp(c->name, l->name, l->name_len);
+}
+
+static unsigned int prom_escape(char *dst, const char *src, unsigned int len)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		switch (src[i]) {
+		case '\\':
+		case '"':
+			dst[n++] = '\\';
+			dst[n++] = src[i];
+			break;
+		case '\n':
+			dst[n++] = '\\';
+			dst[n++] = 'n';
+			break;
+		default:
+			dst[n++] = src[i];
+		}
+	}
+	return n;
+}
+
+static struct prom_counter *prom_get(struct ulogd_pluginstance *upi,
+				     int kind, const char *name)
+{
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+	struct prom_lookup l = {
+		.kind = kind,
+		.name = name,
+		.name_len = strnlen(name, PROM_NAME_MAX),
+	};
+	struct prom_counter *c;
+	int id = hashtable_hash(pi->table, &l);
+
+	c = (struct prom_counter *) hashtable_find(pi->table, &l, id);
+	if (c)
+		return c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	c->kind = kind;
+	c->name_len = l.name_len;
+	memcpy(c->name, name, l.name_len);
+	c->label_len = prom_escape(c->label, name, l.name_len);
+
+	if (hashtable_add(pi->table, &c->hashnode, id) < 0) {
+		free(c);
+		return NULL;
+	}
+	llist_add_tail(&c->list, &pi->counters[kind]);
+	pi->body_max += prom_line_max(upi, c->label_len);
+
+	return c;
+}
+
+static int prom_interp(struct ulogd_pluginstance *upi)
+{
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+	struct ulogd_key *inp = upi->input.keys;
+	struct prom_counter *c;
+
+	if (pp_is_valid(inp, KEY_SUM_NAME)) {
+		c = prom_get(upi, PROM_NFACCT,
+			     ikey_get_ptr(&inp[KEY_SUM_NAME]));
+		if (!c) {
+			pi->dropped++;
+			return ULOGD_IRET_OK;
+		}
+		if (pp_is_valid(inp, KEY_SUM_PKTS))
+			c->pkts = ikey_get_u64(&inp[KEY_SUM_PKTS]);
+		if (pp_is_valid(inp, KEY_SUM_BYTES))
+			c->bytes = ikey_get_u64(&inp[KEY_SUM_BYTES]);
+	} else if (pp_is_valid(inp, KEY_ORIG_RAW_PKTCOUNT)) {
+		pi->flows++;
+		pi->flow_pkts += ikey_get_u64(&inp[KEY_ORIG_RAW_PKTCOUNT]);
+		if (pp_is_valid(inp, KEY_REPLY_RAW_PKTCOUNT))
+			pi->flow_pkts +=
+				ikey_get_u64(&inp[KEY_REPLY_RAW_PKTCOUNT]);
+		if (pp_is_valid(inp, KEY_ORIG_RAW_PKTLEN))
+			pi->flow_bytes +=
+				ikey_get_u64(&inp[KEY_ORIG_RAW_PKTLEN]);
+		if (pp_is_valid(inp, KEY_REPLY_RAW_PKTLEN))
+			pi->flow_bytes +=
+				ikey_get_u64(&inp[KEY_REPLY_RAW_PKTLEN]);
+	} else if (pp_is_valid(inp, KEY_RAW_PKTLEN)) {
+		c = prom_get(upi, PROM_PACKET,
+			     pp_is_valid(inp, KEY_OOB_PREFIX) ?
+			     ikey_get_ptr(&inp[KEY_OOB_PREFIX]) : "");
+		if (!c) {
+			pi->dropped++;
+			return ULOGD_IRET_OK;
+		}
+		c->pkts++;
+		c->bytes += ikey_get_u32(&inp[KEY_RAW_PKTLEN]);
+	}
+
+	return ULOGD_IRET_OK;
+}
+
+/***********************************************************************
+ * rendering, nothing is allocated here
+ ***********************************************************************/
+
+static char *prom_put(char *p, const char *s, unsigned int len)
+{
+	memcpy(p, s, len);
+	return p + len;
+}
+
+static char *prom_put_str(char *p, const char *s)
+{
+	return prom_put(p, s, strlen(s));
+}
+
+static char *prom_put_u64(char *p, uint64_t v)
+{
+	char tmp[20];
+	unsigned int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static char *prom_put_header(char *p, const char *prefix, const char *name,
+			     const char *help, const char *type)
+{
+	p = prom_put_str(p, "# HELP ");
+	p = prom_put_str(p, prefix);
+	*p++ = '_';
+	p = prom_put_str(p, name);
+	*p++ = ' ';
+	p = prom_put_str(p, help);
+	p = prom_put_str(p, "\n# TYPE ");
+	p = prom_put_str(p, prefix);
+	*p++ = '_';
+	p = prom_put_str(p, name);
+	*p++ = ' ';
+	p = prom_put_str(p, type);
+	*p++ = '\n';
+	return p;
+}
+
+static char *prom_put_sample(char *p, const char *prefix, const char *name,
+			     uint64_t value)
+{
+	p = prom_put_str(p, prefix);
+	*p++ = '_';
+	p = prom_put_str(p, name);
+	*p++ = ' ';
+	p = prom_put_u64(p, value);
+	*p++ = '\n';
+	return p;
+}
+
+/* the fixed part: 10 family headers, with names shorter than 32 and help
+ * texts shorter than 128, and 6 unlabeled samples */
+static unsigned int prom_fixed_max(struct ulogd_pluginstance *upi)
+{
+	unsigned int prefix_len = strlen(prefix_ce(upi->config_kset).u.string);
+
+	return 10 * (2 * prefix_len + 2 * 32 + 128 + 32) +
+	       6 * (prefix_len + 1 + 32 + 1 + 20 + 1);
+}
+
+static char *prom_render(struct ulogd_pluginstance *upi, char *p)
+{
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+	const char *prefix = prefix_ce(upi->config_kset).u.string;
+	struct prom_counter *c;
+	int kind, i;
+
+	for (kind = 0; kind < PROM_KIND_MAX; kind++) {
+		if (llist_empty(&pi->counters[kind]))
+			continue;
+		for (i = 0; i < 2; i++) {
+			p = prom_put_header(p, prefix,
+					    prom_families[kind].name[i],
+					    prom_families[kind].help[i],
+					    "counter");
+			llist_for_each_entry(c, &pi->counters[kind], list) {
+				p = prom_put_str(p, prefix);
+				*p++ = '_';
+				p = prom_put_str(p,
+						 prom_families[kind].name[i]);
+				*p++ = '{';
+				p = prom_put_str(p, prom_families[kind].label);
+				p = prom_put(p, "=\"", 2);
+				p = prom_put(p, c->label, c->label_len);
+				p = prom_put(p, "\"} ", 3);
+				p = prom_put_u64(p, i ? c->bytes : c->pkts);
+				*p++ = '\n';
+			}
+		}
+	}
+
+	if (pi->flows) {
+		p = prom_put_header(p, prefix, "ct_flows_total",
+				    "Flows seen by conntrack.", "counter");
+		p = prom_put_sample(p, prefix, "ct_flows_total", pi->flows);
+		p = prom_put_header(p, prefix, "ct_packets_total",
+				    "Packets of the flows, both directions.",
+				    "counter");
+		p = prom_put_sample(p, prefix, "ct_packets_total",
+				    pi->flow_pkts);
+		p = prom_put_header(p, prefix, "ct_bytes_total",
+				    "Bytes of the flows, both directions.",
+				    "counter");
+		p = prom_put_sample(p, prefix, "ct_bytes_total",
+				    pi->flow_bytes);
+	}
+
+	p = prom_put_header(p, prefix, "counters",
+			    "Counters in the table.", "gauge");
+	p = prom_put_sample(p, prefix, "counters", pi->table->count);
+	p = prom_put_header(p, prefix, "counters_dropped_total",
+			    "Events dropped because the table was full.",
+			    "counter");
+	p = prom_put_sample(p, prefix, "counters_dropped_total", pi->dropped);
+	p = prom_put_header(p, prefix, "scrapes_total",
+			    "Scrapes served.", "counter");
+	p = prom_put_sample(p, prefix, "scrapes_total", pi->scrapes);
+
+	return p;
+}
+
+/***********************************************************************
+ * HTTP server
+ ***********************************************************************/
+
+static void prom_client_close(struct prom_client *cl)
+{
+	ulogd_unregister_fd(&cl->ufd);
+	close(cl->ufd.fd);
+	cl->ufd.fd = -1;
+	cl->active = 0;
+}
+
+static int prom_client_send(struct prom_client *cl)
+{
+	while (cl->resp_off < cl->resp_end) {
+		ssize_t ret = send(cl->ufd.fd, cl->resp + cl->resp_off,
+				   cl->resp_end - cl->resp_off,
+				   MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ulogd_update_fd(&cl->ufd, ULOGD_FD_WRITE);
+				return 0;
+			}
+			break;
+		}
+		cl->resp_off += ret;
+		cl->last = ulogd_clock_sec();
+	}
+
+	prom_client_close(cl);
+	return 0;
+}
+
+static int prom_client_reserve(struct prom_client *cl, unsigned int size)
+{
+	char *resp;
+
+	if (cl->resp_size >= size)
+		return 0;
+
+	/* only happens when the table grew since the last scrape */
+	resp = realloc(cl->resp, size);
+	if (!resp)
+		return -1;
+	cl->resp = resp;
+	cl->resp_size = size;
+	return 0;
+}
+
+static void prom_client_reply(struct prom_client *cl, const char *status,
+			      int with_body, int head_only)
+{
+	struct ulogd_pluginstance *upi = cl->upi;
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+	char header[PROM_HEADER_MAX], *end;
+	int len;
+
+	if (with_body) {
+		if (prom_client_reserve(cl, PROM_HEADER_MAX +
+					prom_fixed_max(upi) +
+					pi->body_max) < 0) {
+			ulogd_log(ULOGD_ERROR, "%s: out of memory\n", upi->id);
+			prom_client_close(cl);
+			return;
+		}
+		pi->scrapes++;
+		end = prom_render(upi, cl->resp + PROM_HEADER_MAX);
+	} else {
+		if (prom_client_reserve(cl, PROM_HEADER_MAX) < 0) {
+			prom_client_close(cl);
+			return;
+		}
+		end = cl->resp + PROM_HEADER_MAX;
+	}
+
+	len = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\n"
+		       "Content-Type: text/plain; version=0.0.4\r\n"
+		       "Content-Length: %u\r\n"
+		       "Connection: close\r\n\r\n", status,
+		       (unsigned int)(end - cl->resp - PROM_HEADER_MAX));
+
+	/* the header goes right in front of the body */
+	cl->resp_off = PROM_HEADER_MAX - len;
+	memcpy(cl->resp + cl->resp_off, header, len);
+	cl->resp_end = head_only ? PROM_HEADER_MAX : end - cl->resp;
+
+	prom_client_send(cl);
+}
+
+static void prom_client_request(struct prom_client *cl)
+{
+	char *line_end, *path, *path_end;
+	int head_only = 0;
+
+	line_end = memchr(cl->req, '\n', cl->req_len);
+	if (!strncmp(cl->req, "GET ", 4))
+		path = cl->req + 4;
+	else if (!strncmp(cl->req, "HEAD ", 5)) {
+		path = cl->req + 5;
+		head_only = 1;
+	} else {
+		prom_client_reply(cl, "405 Method Not Allowed", 0, 0);
+		return;
+	}
+
+	for (path_end = path; path_end < line_end; path_end++)
+		if (*path_end == ' ' || *path_end == '?' || *path_end == '\r')
+			break;
+
+	if (path_end - path == 8 && !memcmp(path, "/metrics", 8))
+		prom_client_reply(cl, "200 OK", 1, head_only);
+	else
+		prom_client_reply(cl, "404 Not Found", 0, head_only);
+}
+
+static int prom_client_cb(int fd, unsigned int what, void *data)
+{
+	struct prom_client *cl = data;
+	ssize_t ret;
+
+	if (what & ULOGD_FD_WRITE)
+		return prom_client_send(cl);
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	ret = recv(fd, cl->req + cl->req_len,
+		   sizeof(cl->req) - 1 - cl->req_len, 0);
+	if (ret <= 0) {
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			return 0;
+		prom_client_close(cl);
+		return 0;
+	}
+	cl->req_len += ret;
+	cl->req[cl->req_len] = '\0';
+	cl->last = ulogd_clock_sec();
+
+	/* answer once the whole request header is there */
+	if (strstr(cl->req, "\r\n\r\n") || strstr(cl->req, "\n\n"))
+		prom_client_request(cl);
+	else if (cl->req_len == sizeof(cl->req) - 1)
+		prom_client_reply(cl, "400 Bad Request", 0, 0);
+
+	return 0;
+}
+
+static struct prom_client *prom_client_slot(struct prom_instance *pi)
+{
+	int i;
+
+	for (i = 0; i < PROM_CLIENTS_MAX; i++) {
+		if (!pi->clients[i].active)
+			return &pi->clients[i];
+	}
+	return NULL;
+}
+
+/* no slot left: only the callback of a client may unregister its fd, so
+ * the connections in progress are left alone */
+static void prom_refuse(int fd)
+{
+	static const char resp[] = "HTTP/1.0 503 Service Unavailable\r\n"
+				   "Content-Length: 0\r\n"
+				   "Connection: close\r\n\r\n";
+
+	if (send(fd, resp, sizeof(resp) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+		/* it's closed anyway */
+	}
+	close(fd);
+}
+
+/* slow or stuck scrapers don't hold their slot forever, this runs from
+ * the timer list, outside of the pass over the fds */
+static void prom_idle_cb(struct ulogd_timer *t, void *data)
+{
+	struct prom_instance *pi = data;
+	time_t now = ulogd_clock_sec();
+	int i, active = 0;
+
+	for (i = 0; i < PROM_CLIENTS_MAX; i++) {
+		struct prom_client *cl = &pi->clients[i];
+
+		if (!cl->active)
+			continue;
+		if (now - cl->last >= PROM_CLIENT_IDLE)
+			prom_client_close(cl);
+		else
+			active = 1;
+	}
+
+	if (active)
+		ulogd_add_timer(&pi->idle_timer, 1);
+}
+
+static int prom_listen_cb(int fd, unsigned int what, void *data)
+{
+	struct ulogd_pluginstance *upi = data;
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+
+	if (!(what & ULOGD_FD_READ))
+		return 0;
+
+	for (;;) {
+		struct prom_client *cl;
+		int cfd;
+
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				ulogd_log(ULOGD_ERROR, "%s: accept: %s\n",
+					  upi->id, strerror(errno));
+			return 0;
+		}
+		if (fcntl(cfd, F_SETFL, O_NONBLOCK) < 0) {
+			close(cfd);
+			continue;
+		}
+		fcntl(cfd, F_SETFD, FD_CLOEXEC);
+
+		cl = prom_client_slot(pi);
+		if (!cl) {
+			prom_refuse(cfd);
+			continue;
+		}
+		cl->ufd.fd = cfd;
+		cl->ufd.when = ULOGD_FD_READ;
+		cl->ufd.cb = &prom_client_cb;
+		cl->ufd.data = cl;
+		cl->upi = upi;
+		cl->req_len = 0;
+		cl->last = ulogd_clock_sec();
+		if (ulogd_register_fd(&cl->ufd) < 0) {
+			close(cfd);
+			continue;
+		}
+		cl->active = 1;
+		if (!ulogd_timer_pending(&pi->idle_timer))
+			ulogd_add_timer(&pi->idle_timer, 1);
+	}
+}
+
+static int prom_listen(struct ulogd_pluginstance *upi)
+{
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+	struct addrinfo hints, *result, *rp;
+	int fd = -1, ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	ret = getaddrinfo(host_ce(upi->config_kset).u.string,
+			  port_ce(upi->config_kset).u.string, &hints, &result);
+	if (ret != 0) {
+		ulogd_log(ULOGD_ERROR, "%s: getaddrinfo: %s\n", upi->id,
+			  gai_strerror(ret));
+		return -1;
+	}
+
+	for (rp = result; rp != NULL; rp = rp->ai_next) {
+		int on = 1;
+
+		fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if (fd < 0)
+			continue;
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0 &&
+		    listen(fd, PROM_CLIENTS_MAX) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't listen on %s:%s\n", upi->id,
+			  host_ce(upi->config_kset).u.string,
+			  port_ce(upi->config_kset).u.string);
+		return -1;
+	}
+
+	pi->listen_fd.fd = fd;
+	pi->listen_fd.when = ULOGD_FD_READ;
+	pi->listen_fd.cb = &prom_listen_cb;
+	pi->listen_fd.data = upi;
+	if (ulogd_register_fd(&pi->listen_fd) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int prom_configure(struct ulogd_pluginstance *upi,
+			  struct ulogd_pluginstance_stack *stack)
+{
+	int ret;
+
+	ret = config_parse_file(upi->id, upi->config_kset);
+	if (ret < 0)
+		return ret;
+
+	if (max_counters_ce(upi->config_kset).u.value <= 0) {
+		ulogd_log(ULOGD_ERROR, "%s: max_counters must be positive\n",
+			  upi->id);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int prom_start(struct ulogd_pluginstance *upi)
+{
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+	int max = max_counters_ce(upi->config_kset).u.value;
+	int kind;
+
+	for (kind = 0; kind < PROM_KIND_MAX; kind++)
+		INIT_LLIST_HEAD(&pi->counters[kind]);
+	pi->body_max = 0;
+	ulogd_init_timer(&pi->idle_timer, pi, prom_idle_cb);
+
+	pi->table = hashtable_create(max, max, prom_hash, prom_compare);
+	if (!pi->table) {
+		ulogd_log(ULOGD_ERROR, "%s: out of memory\n", upi->id);
+		return -1;
+	}
+
+	if (prom_listen(upi) < 0) {
+		hashtable_destroy(pi->table);
+		pi->table = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int prom_stop(struct ulogd_pluginstance *upi)
+{
+	struct prom_instance *pi = (struct prom_instance *) &upi->private;
+	int i;
+
+	ulogd_del_timer(&pi->idle_timer);
+	for (i = 0; i < PROM_CLIENTS_MAX; i++) {
+		if (pi->clients[i].active)
+			prom_client_close(&pi->clients[i]);
+		free(pi->clients[i].resp);
+		pi->clients[i].resp = NULL;
+		pi->clients[i].resp_size = 0;
+	}
+
+	ulogd_unregister_fd(&pi->listen_fd);
+	close(pi->listen_fd.fd);
+
+	hashtable_flush(pi->table);
+	hashtable_destroy(pi->table);
+	pi->table = NULL;
+
+	return 0;
+}
+
+static struct ulogd_plugin prom_plugin = {
+	.name = "PROMETHEUS",
+	.input = {
+		.keys = prom_inp,
+		.num_keys = ARRAY_SIZE(prom_inp),
+		.type = ULOGD_DTYPE_SUM | ULOGD_DTYPE_PACKET |
+			ULOGD_DTYPE_FLOW,
+	},
+	.output = {
+		.type = ULOGD_DTYPE_SINK,
+	},
+	.config_kset	= &prom_kset,
+	.priv_size	= sizeof(struct prom_instance),
+
+	.configure	= &prom_configure,
+	.start		= &prom_start,
+	.stop		= &prom_stop,
+	.interp		= &prom_interp,
+	.version	= VERSION,
+};
+
+void __attribute__ ((constructor)) init(void);
+
+void init(void)
+{
+	ulogd_register_plugin(&prom_plugin);
+}
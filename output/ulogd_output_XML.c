@@ -31,9 +31,11 @@
 #include <libnetfilter_acct/libnetfilter_acct.h>
 #endif
 #include <ulogd/ulogd.h>
+#include <ulogd/writer.h>
 #include <sys/param.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #ifndef ULOGD_XML_DEFAULT_DIR
 #define ULOGD_XML_DEFAULT_DIR "/var/log/"
@@ -67,10 +69,12 @@ enum {
 	CFG_XML_DIR,
 	CFG_XML_SYNC,
 	CFG_XML_STDOUT,
+	CFG_XML_WRITER,
+	CFG_XML_MAX = CFG_XML_WRITER + WRITER_CE_NUM
 };
 
 static struct config_keyset xml_kset = {
-	.num_ces = 3,
+	.num_ces = CFG_XML_MAX,
 	.ces = {
 		[CFG_XML_DIR] = {
 			.key = "directory", 
@@ -90,11 +94,13 @@ static struct config_keyset xml_kset = {
 			.options = CONFIG_OPT_NONE,
 			.u = { .value = 0 },
 		},
+		WRITER_CES,
 	},
 };
 
 struct xml_priv {
-        FILE *of;
+	struct ulogd_writer w;
+	char buf[4096];
 };
 
 static int
@@ -154,22 +160,21 @@ static int xml_output(struct ulogd_pluginstance *upi)
 {
 	struct ulogd_key *inp = upi->input.keys;
 	struct xml_priv *opi = (struct xml_priv *) &upi->private;
-	static char buf[4096];
 	int ret = -1;
 
 	if (pp_is_valid(inp, KEY_CT))
-		ret = xml_output_flow(inp, buf, sizeof(buf));
+		ret = xml_output_flow(inp, opi->buf, sizeof(opi->buf));
 	else if (pp_is_valid(inp, KEY_PCKT))
-		ret = xml_output_packet(inp, buf, sizeof(buf));
+		ret = xml_output_packet(inp, opi->buf, sizeof(opi->buf));
 	else if (pp_is_valid(inp, KEY_SUM))
-		ret = xml_output_sum(inp, buf, sizeof(buf));
+		ret = xml_output_sum(inp, opi->buf, sizeof(opi->buf));
 
 	if (ret < 0)
 		return ULOGD_IRET_ERR;
 
-	fprintf(opi->of, "%s\n", buf);
+	ulogd_writer_printf(&opi->w, "%s\n", opi->buf);
 	if (upi->config_kset->ces[CFG_XML_SYNC].u.value != 0)
-		fflush(opi->of);
+		ulogd_writer_flush(&opi->w);
 
 	return ULOGD_IRET_OK;
 }
@@ -186,34 +191,39 @@ static int xml_configure(struct ulogd_pluginstance *upi,
 	return 0;
 }
 
-static int xml_fini(struct ulogd_pluginstance *pi)
+/* the root element depends on the source. */
+static const char *xml_root_tag(struct ulogd_pluginstance *upi)
 {
-	struct xml_priv *op = (struct xml_priv *) &pi->private;
 	/* XXX: provide generic function to get the input plugin. */
 	struct ulogd_pluginstance *input_plugin =
-		llist_entry(pi->stack->list.next,
+		llist_entry(upi->stack->list.next,
 			    struct ulogd_pluginstance, list);
 
-	/* the initial tag depends on the source. */
 	if (input_plugin->plugin->output.type & ULOGD_DTYPE_FLOW)
-		fprintf(op->of, "</conntrack>\n");
+		return "conntrack";
 	else if (input_plugin->plugin->output.type & ULOGD_DTYPE_RAW)
-		fprintf(op->of, "</packet>\n");
+		return "packet";
 	else if (input_plugin->plugin->output.type & ULOGD_DTYPE_SUM)
-		fprintf(op->of, "</sum>\n");
+		return "sum";
+	return NULL;
+}
+
+static int xml_fini(struct ulogd_pluginstance *pi)
+{
+	struct xml_priv *op = (struct xml_priv *) &pi->private;
 
-	if (op->of != stdout)
-		fclose(op->of);
+	/* the writer closes the root element */
+	ulogd_writer_close(&op->w);
 
 	return 0;
 }
 
-static int xml_open_file(struct ulogd_pluginstance *upi)
+static int xml_file_name(struct ulogd_pluginstance *upi, char *buf,
+			 size_t size)
 {
 	time_t now;
 	struct tm *tm;
-	char buf[PATH_MAX], filename[FILENAME_MAX];
-	struct xml_priv *op = (struct xml_priv *) &upi->private;
+	char filename[FILENAME_MAX];
 	int ret;
 
 	struct ulogd_pluginstance *input_plugin =
@@ -239,70 +249,78 @@ static int xml_open_file(struct ulogd_pluginstance *upi)
 	if (ret == -1 || ret >= (int)sizeof(filename))
 		return -1;
 
-	ret = snprintf(buf, sizeof(buf), "%s/%s",
+	ret = snprintf(buf, size, "%s/%s",
 		       upi->config_kset->ces[CFG_XML_DIR].u.string,
 		       filename);
-	if (ret == -1 || ret >= (int)sizeof(buf))
-		return -1;
-
-	op->of = fopen(buf, "a");
-	if (!op->of)
+	if (ret == -1 || ret >= (int)size)
 		return -1;
 
 	return 0;
 }
 
-static void xml_print_header(struct ulogd_pluginstance *upi)
+/* written at the start and the end of each file by the writer, also
+ * after a SIGHUP or a rotation */
+static int xml_set_frame(struct ulogd_pluginstance *upi)
 {
 	struct xml_priv *op = (struct xml_priv *) &upi->private;
+	const char *tag = xml_root_tag(upi);
+	char header[128], footer[32];
+	int hlen, flen = 0;
+
+	hlen = snprintf(header, sizeof(header),
+			"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+	if (tag) {
+		hlen += snprintf(header + hlen, sizeof(header) - hlen,
+				 "<%s>\n", tag);
+		flen = snprintf(footer, sizeof(footer), "</%s>\n", tag);
+	}
 
-	fprintf(op->of, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
-
-	struct ulogd_pluginstance *input_plugin =
-		llist_entry(upi->stack->list.next,
-			    struct ulogd_pluginstance, list);
-
-	if (input_plugin->plugin->output.type & ULOGD_DTYPE_FLOW)
-		fprintf(op->of, "<conntrack>\n");
-	else if (input_plugin->plugin->output.type & ULOGD_DTYPE_RAW)
-		fprintf(op->of, "<packet>\n");
-	else if (input_plugin->plugin->output.type & ULOGD_DTYPE_SUM)
-		fprintf(op->of, "<sum>\n");
-
-	if (upi->config_kset->ces[CFG_XML_SYNC].u.value != 0)
-		fflush(op->of);
+	return ulogd_writer_set_frame(&op->w, header, hlen, footer, flen);
 }
 
 static int xml_start(struct ulogd_pluginstance *upi)
 {
 	struct xml_priv *op = (struct xml_priv *) &upi->private;
+	char buf[PATH_MAX], *path = NULL;
 
-	if (upi->config_kset->ces[CFG_XML_STDOUT].u.value != 0) {
-		op->of = stdout;
-	} else {
-		if (xml_open_file(upi) < 0) {
-			ulogd_log(ULOGD_FATAL, "can't open XML file: %s\n", 
-				  strerror(errno));
+	if (upi->config_kset->ces[CFG_XML_STDOUT].u.value == 0) {
+		if (xml_file_name(upi, buf, sizeof(buf)) < 0) {
+			ulogd_log(ULOGD_FATAL, "XML file name too long\n");
 			return -1;
 		}
+		path = buf;
 	}
-	xml_print_header(upi);
+	if (ulogd_writer_open(&op->w, upi->id, path, O_CREAT | O_APPEND,
+			      &upi->config_kset->ces[CFG_XML_WRITER]) < 0) {
+		ulogd_log(ULOGD_FATAL, "can't open XML file\n");
+		return -1;
+	}
+	op->w.stats = &upi->stats;
+	if (xml_set_frame(upi) < 0) {
+		ulogd_writer_close(&op->w);
+		return -1;
+	}
+	if (upi->config_kset->ces[CFG_XML_SYNC].u.value != 0)
+		ulogd_writer_flush(&op->w);
 	return 0;
 }
 
 static void
 xml_signal_handler(struct ulogd_pluginstance *upi, int signal)
 {
+	struct xml_priv *op = (struct xml_priv *) &upi->private;
+	char buf[PATH_MAX];
+
 	switch (signal) {
 	case SIGHUP:
+		if (upi->config_kset->ces[CFG_XML_STDOUT].u.value != 0)
+			break;
 		ulogd_log(ULOGD_NOTICE, "XML: reopening logfile\n");
-		xml_fini(upi);
-		if (xml_open_file(upi) < 0) {
-			ulogd_log(ULOGD_FATAL, "can't open XML file: %s\n", 
-				  strerror(errno));
-			return;
-		}
-		xml_print_header(upi);
+		if (xml_file_name(upi, buf, sizeof(buf)) < 0)
+			break;
+		if (ulogd_writer_switch(&op->w, buf) < 0)
+			ulogd_log(ULOGD_ERROR, "can't open XML file %s\n",
+				  buf);
 		break;
 	default:
 		break;
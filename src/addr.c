@@ -43,7 +43,8 @@ void ulogd_ipv6_cidr2mask_host(uint8_t cidr, uint32_t *res)
 		res[i] = 0xFFFFFFFF;
 		cidr -= 32;
 	}
-	res[i] = 0xFFFFFFFF << (32 - cidr);
+	if (cidr)
+		res[i] = 0xFFFFFFFF << (32 - cidr);
 	for (j = i+1; j < 4; j++) {
 		res[j] = 0;
 	}
@@ -61,50 +62,75 @@ void ulogd_ipv6_addr2addr_host(uint32_t *addr, uint32_t *res)
 	}
 }
 
+/* parse "address/bits" from the len first bytes of string, which need not
+ * be NUL terminated, ignoring blanks around the address and after the
+ * bits. Returns the family, or -1 if the text is invalid. */
 int ulogd_parse_addr(char *string, size_t len, struct ulogd_addr *addr)
 {
-	char filter_addr[128];
-	char *slash;
-	char *ddash;
-	if ((ddash = strchr(string, ':')) && (ddash < string + len)) {
-		struct in6_addr raddr;
-		int i;
-		slash = strchr(string, '/');
-		if (slash == NULL) {
-			ulogd_log(ULOGD_FATAL,
-					"No network specified\n");
-			return -1;
-		}
-
-		strncpy(filter_addr, string,
-				slash - string);
-		filter_addr[slash - string] = 0;
-		if (inet_pton(AF_INET6, filter_addr, (void *)&raddr)
-				!= 1) {
-			ulogd_log(ULOGD_FATAL,
-					"error reading address\n");
-			return -1;
-		}
-		for(i = 0; i < 4; i++)
-			addr->in.ipv6[i] = raddr.s6_addr32[i];
-		addr->netmask = atoi(slash + 1);
+	char filter_addr[INET6_ADDRSTRLEN];
+	struct in6_addr raddr;
+	const char *slash, *p, *end = string + len;
+	unsigned int bits = 0, maxbits;
+	size_t addrlen;
+	int family, i;
+
+	/* lists are often written "a, b" */
+	while (string < end && (*string == ' ' || *string == '\t'))
+		string++;
+	len = end - string;
+
+	slash = memchr(string, '/', len);
+	if (slash == NULL) {
+		ulogd_log(ULOGD_FATAL,
+				"No network specified\n");
+		return -1;
+	}
+	for (addrlen = slash - string; addrlen > 0 &&
+	     (string[addrlen - 1] == ' ' || string[addrlen - 1] == '\t');
+	     addrlen--)
+		;
+
+	if (memchr(string, ':', addrlen)) {
+		family = AF_INET6;
+		maxbits = 128;
+	} else if (memchr(string, '.', addrlen)) {
+		family = AF_INET;
+		maxbits = 32;
+	} else
+		return -1;
 
-		return AF_INET6;
+	if (addrlen >= sizeof(filter_addr)) {
+		ulogd_log(ULOGD_FATAL,
+				"error reading address\n");
+		return -1;
 	}
-	if ((ddash = strchr(string, '.')) && (ddash < string + len)) {
-		slash = strchr(string, '/');
-		if (slash == NULL) {
-			ulogd_log(ULOGD_FATAL,
-					"No network specified\n");
-			return -1;
-		}
-		strncpy(filter_addr, string,
-				slash - string);
-		filter_addr[slash - string] = 0;
-		addr->in.ipv4 = inet_addr(filter_addr);
-		addr->netmask = atoi(slash + 1);
-
-		return AF_INET;
+	memcpy(filter_addr, string, addrlen);
+	filter_addr[addrlen] = 0;
+	if (inet_pton(family, filter_addr, (void *)&raddr) != 1) {
+		ulogd_log(ULOGD_FATAL,
+				"error reading address\n");
+		return -1;
 	}
-	return -1;
+
+	for (p = slash + 1; p < end && *p >= '0' && *p <= '9'; p++) {
+		bits = bits * 10 + *p - '0';
+		if (bits > maxbits)
+			break;
+	}
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	if (p == slash + 1 || p != end || bits > maxbits) {
+		ulogd_log(ULOGD_FATAL,
+				"error reading netmask\n");
+		return -1;
+	}
+	addr->netmask = bits;
+
+	if (family == AF_INET6) {
+		for (i = 0; i < 4; i++)
+			addr->in.ipv6[i] = raddr.s6_addr32[i];
+	} else
+		memcpy(&addr->in.ipv4, &raddr, sizeof(addr->in.ipv4));
+
+	return family;
 }
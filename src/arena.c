@@ -0,0 +1,87 @@
+/* Bump pointer allocator for the values of one event
+ *
+ * When an allocation doesn't fit, a chunk twice as large as the current
+ * one is added. On reset, only the last and largest chunk is kept, so
+ * that an arena settles on a single chunk big enough for the events it
+ * sees.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ulogd/arena.h>
+
+struct ulogd_arena_chunk {
+	struct ulogd_arena_chunk *next;
+	size_t size;
+	char data[] __attribute__((aligned(ULOGD_ARENA_ALIGN)));
+};
+
+void ulogd_arena_init(struct ulogd_arena *a)
+{
+	a->cur = a->end = NULL;
+	a->chunks = NULL;
+}
+
+void *__ulogd_arena_alloc(struct ulogd_arena *a, size_t size)
+{
+	struct ulogd_arena_chunk *c;
+	size_t csize = ULOGD_ARENA_MIN_SIZE;
+
+	if (a->chunks)
+		csize = a->chunks->size * 2;
+	while (csize < size + ULOGD_ARENA_ALIGN) {
+		if (csize * 2 < csize)
+			return NULL;
+		csize *= 2;
+	}
+
+	c = malloc(sizeof(*c) + csize);
+	if (!c)
+		return NULL;
+	c->size = csize;
+	c->next = a->chunks;
+	a->chunks = c;
+	a->cur = c->data;
+	a->end = c->data + csize;
+
+	return ulogd_arena_alloc(a, size);
+}
+
+void ulogd_arena_reset(struct ulogd_arena *a)
+{
+	struct ulogd_arena_chunk *c = a->chunks, *next;
+
+	if (!c)
+		return;
+
+	for (next = c->next; next; ) {
+		struct ulogd_arena_chunk *old = next;
+
+		next = next->next;
+		free(old);
+	}
+	c->next = NULL;
+	a->cur = c->data;
+	a->end = c->data + c->size;
+}
+
+void ulogd_arena_fini(struct ulogd_arena *a)
+{
+	ulogd_arena_reset(a);
+	free(a->chunks);
+	ulogd_arena_init(a);
+}
+
+char *ulogd_arena_strndup(struct ulogd_arena *a, const char *s, size_t len)
+{
+	char *p = ulogd_arena_alloc(a, len + 1);
+
+	if (!p)
+		return NULL;
+	memcpy(p, s, len);
+	p[len] = 0;
+
+	return p;
+}
@@ -0,0 +1,53 @@
+/* Clock sampled once per main loop iteration
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#include <ulogd/clock.h>
+
+static struct timespec clock_real;
+static struct timespec clock_mono;
+
+void ulogd_clock_update(void)
+{
+	clock_gettime(CLOCK_REALTIME, &clock_real);
+	clock_gettime(CLOCK_MONOTONIC, &clock_mono);
+}
+
+time_t ulogd_clock_sec(void)
+{
+	return clock_real.tv_sec;
+}
+
+void ulogd_clock_timeval(struct timeval *tv)
+{
+	tv->tv_sec = clock_real.tv_sec;
+	tv->tv_usec = clock_real.tv_nsec / 1000;
+}
+
+uint64_t ulogd_clock_realtime(void)
+{
+	return clock_real.tv_sec * 1000000000ULL + clock_real.tv_nsec;
+}
+
+uint64_t ulogd_clock_monotonic(void)
+{
+	return clock_mono.tv_sec * 1000000000ULL + clock_mono.tv_nsec;
+}
+
+const char *ulogd_timefmt(struct ulogd_timefmt *tf, time_t sec,
+			  const char *fmt)
+{
+	struct tm tm;
+
+	if (tf->len && tf->sec == sec)
+		return tf->str;
+
+	if (!localtime_r(&sec, &tm))
+		return NULL;
+	tf->len = strftime(tf->str, sizeof(tf->str), fmt, &tm);
+	if (!tf->len)
+		return NULL;
+	tf->sec = sec;
+
+	return tf->str;
+}
@@ -0,0 +1,81 @@
+/* Log-linear latency histograms
+ *
+ * The histograms count ulogd_cycles() differences, which are only
+ * converted to nanoseconds when they are read. The rate of the counter
+ * is measured against CLOCK_MONOTONIC since ulogd_cycles_calibrate()
+ * was called, which avoids spending time on calibration at startup.
+ *
+ * This code is distributed under the terms of GNU GPL version 2 */
+
+#include <ulogd/histogram.h>
+
+static uint64_t calib_cycles;
+static uint64_t calib_ns;
+
+static uint64_t hist_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* highest value counted in bucket `idx' */
+static uint64_t hist_bucket_max(unsigned int idx)
+{
+	unsigned int group = idx >> ULOGD_HIST_SUB_BITS;
+	uint64_t sub = idx & (ULOGD_HIST_SUB - 1);
+
+	if (group == 0)
+		return sub;
+
+	return ((ULOGD_HIST_SUB + sub + 1) << (group - 1)) - 1;
+}
+
+uint64_t ulogd_hist_percentile(const struct ulogd_histogram *h, double p)
+{
+	uint64_t rank, seen = 0;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = h->count * p / 100;
+	if (rank >= h->count)
+		rank = h->count - 1;
+
+	for (i = 0; i < ULOGD_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank) {
+			uint64_t v = hist_bucket_max(i);
+
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+void ulogd_cycles_calibrate(void)
+{
+	if (calib_ns)
+		return;
+
+	calib_ns = hist_now();
+	calib_cycles = ulogd_cycles();
+}
+
+uint64_t ulogd_cycles_to_ns(uint64_t cycles)
+{
+	uint64_t ns, elapsed;
+
+	if (!calib_ns)
+		ulogd_cycles_calibrate();
+
+	ns = hist_now() - calib_ns;
+	elapsed = ulogd_cycles() - calib_cycles;
+	/* too early to tell, assume one cycle per nanosecond */
+	if (ns < 1000000 || elapsed == 0)
+		return cycles;
+
+	return (double)cycles * ns / elapsed;
+}
@@ -18,6 +18,7 @@
 
 #include <fcntl.h>
 #include <ulogd/ulogd.h>
+#include <ulogd/clock.h>
 #include <ulogd/linuxlist.h>
 
 static int maxfd = 0;
@@ -76,9 +77,31 @@ void ulogd_unregister_fd(struct ulogd_fd *fd)
 	}
 }
 
+/* change the set of events we are waiting for on an already registered fd,
+ * this can be safely called from fd callbacks */
+void ulogd_update_fd(struct ulogd_fd *fd, unsigned int when)
+{
+	if (when & ULOGD_FD_READ)
+		FD_SET(fd->fd, &readset);
+	else
+		FD_CLR(fd->fd, &readset);
+
+	if (when & ULOGD_FD_WRITE)
+		FD_SET(fd->fd, &writeset);
+	else
+		FD_CLR(fd->fd, &writeset);
+
+	if (when & ULOGD_FD_EXCEPT)
+		FD_SET(fd->fd, &exceptset);
+	else
+		FD_CLR(fd->fd, &exceptset);
+
+	fd->when = when;
+}
+
 int ulogd_select_main(struct timeval *tv)
 {
-	struct ulogd_fd *ufd;
+	struct ulogd_fd *ufd, *nufd;
 	fd_set rds_tmp, wrs_tmp, exs_tmp;
 	int i;
 
@@ -87,9 +110,11 @@ int ulogd_select_main(struct timeval *tv)
 	exs_tmp = exceptset;
 
 	i = select(maxfd+1, &rds_tmp, &wrs_tmp, &exs_tmp, tv);
+	ulogd_clock_update();
 	if (i > 0) {
-		/* call registered callback functions */
-		llist_for_each_entry(ufd, &ulogd_fds, list) {
+		/* call registered callback functions, callbacks are allowed
+		 * to unregister their own fd */
+		llist_for_each_entry_safe(ufd, nufd, &ulogd_fds, list) {
 			int flags = 0;
 
 			if (FD_ISSET(ufd->fd, &rds_tmp))
@@ -35,6 +35,7 @@
  */
 
 #include <ulogd/timer.h>
+#include <ulogd/clock.h>
 #include <stdlib.h>
 #include <limits.h>
 
@@ -79,7 +80,9 @@ void ulogd_add_timer(struct ulogd_timer *alarm, unsigned long sc)
 	ulogd_del_timer(alarm);
 	alarm->tv.tv_sec = sc;
 	alarm->tv.tv_usec = 0;
-	gettimeofday(&tv, NULL);
+	/* the cached clock is as old as the callbacks run since select */
+	ulogd_clock_update();
+	ulogd_clock_timeval(&tv);
 	timeradd(&alarm->tv, &tv, &alarm->tv);
 	__add_timer(alarm);
 }
@@ -124,7 +127,9 @@ struct timeval *ulogd_get_next_timer_run(struct timeval *next_run)
 	struct rb_node *node;
 	struct timeval tv;
 
-	gettimeofday(&tv, NULL);
+	/* the time left until select, not since the last one returned */
+	ulogd_clock_update();
+	ulogd_clock_timeval(&tv);
 
 	node = rb_first(&alarm_root);
 	if (node) {
@@ -142,7 +147,7 @@ struct timeval *ulogd_do_timer_run(struct timeval *next_run)
 	struct ulogd_timer *this;
 	struct timeval tv;
 
-	gettimeofday(&tv, NULL);
+	ulogd_clock_timeval(&tv);
 
 	INIT_LLIST_HEAD(&alarm_run_queue);
 	for (node = rb_first(&alarm_root); node; node = rb_next(node)) {
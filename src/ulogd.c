@@ -50,6 +50,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <poll.h>
 #include <errno.h>
 #include <time.h>
 #include <ctype.h>
@@ -66,6 +70,11 @@
 #include <sys/stat.h>
 #include <ulogd/conffile.h>
 #include <ulogd/ulogd.h>
+#include <ulogd/histogram.h>
+#include <ulogd/clock.h>
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
 #ifdef DEBUG
 #define DEBUGP(format, args...) fprintf(stderr, format, ## args)
 #else
@@ -95,6 +104,16 @@ static LLIST_HEAD(ulogd_plugins);
 /* linked list for all plugins handle */
 static LLIST_HEAD(ulogd_plugins_handle);
 static LLIST_HEAD(ulogd_pi_stacks);
+static int stats_timing;
+
+/* USDT probes, no-ops unless traced (e.g. perf probe sdt_ulogd:*) */
+#ifdef HAVE_SYS_SDT_H
+#define ULOGD_PROBE1(name, a)		DTRACE_PROBE1(ulogd, name, a)
+#define ULOGD_PROBE2(name, a, b)	DTRACE_PROBE2(ulogd, name, a, b)
+#else
+#define ULOGD_PROBE1(name, a)		do { } while (0)
+#define ULOGD_PROBE2(name, a, b)	do { } while (0)
+#endif
 
 
 static int load_plugin(const char *file);
@@ -103,7 +122,7 @@ static int logfile_open(const char *name);
 static void cleanup_pidfile();
 
 static struct config_keyset ulogd_kset = {
-	.num_ces = 4,
+	.num_ces = 5,
 	.ces = {
 		{
 			.key = "logfile",
@@ -129,6 +148,12 @@ static struct config_keyset ulogd_kset = {
 			.options = CONFIG_OPT_MULTI,
 			.u.parser = &create_stack,
 		},
+		{
+			.key = "timing",
+			.type = CONFIG_TYPE_INT,
+			.options = CONFIG_OPT_NONE,
+			.u.value = 0,
+		},
 	},
 };
 
@@ -136,6 +161,7 @@ static struct config_keyset ulogd_kset = {
 #define plugin_ce	ulogd_kset.ces[1]
 #define loglevel_ce	ulogd_kset.ces[2]
 #define stack_ce	ulogd_kset.ces[3]
+#define timing_ce	ulogd_kset.ces[4]
 
 /***********************************************************************
  * UTILITY FUNCTIONS FOR PLUGINS
@@ -213,15 +239,24 @@ int ulogd_wildcard_inputkeys(struct ulogd_pluginstance *upi)
 	if (!upi->input.keys)
 		return -ENOMEM;
 
-	/* second pass: copy key names */
+	/* second pass: copy key names. A key with the name of an upstream
+	 * one replaces it, both would be resolved to the last anyway. */
 	llist_for_each_entry(pi_cur, &stack->list, list) {
-		unsigned int i;
+		unsigned int i, j;
+
+		for (i = 0; i < pi_cur->plugin->output.num_keys; i++) {
+			struct ulogd_key *key = &pi_cur->output.keys[i];
 
-		for (i = 0; i < pi_cur->plugin->output.num_keys; i++)
-			upi->input.keys[index++] = pi_cur->output.keys[i];
+			for (j = 0; j < index; j++)
+				if (!strcmp(upi->input.keys[j].name, key->name))
+					break;
+			if (j == index)
+				index++;
+			upi->input.keys[j] = *key;
+		}
 	}
 
-	upi->input.num_keys = num_keys;
+	upi->input.num_keys = index;
 
 	return 0;
 }
@@ -415,51 +450,389 @@ static inline int ulogd2syslog_level(int level)
 	return syslog_level;
 }
 
+/* Daemon log messages are queued by __ulogd_log() into a bounded
+ * lock-free ring and written by a background thread once the main loop
+ * runs, so that a slow logfile or syslog never stalls event processing.
+ * Once the main loop runs, each call site may log at most LOG_RATE_BURST
+ * messages per second, the others are counted and reported later on.
+ * Fatal messages and those of the startup are never dropped. Before the thread is
+ * started and after it has been stopped, messages are written directly. */
+#define LOG_QUEUE_SLOTS		256	/* must be a power of two */
+#define LOG_MSG_MAX		512
+#define LOG_RATE_BURST		10
+#define LOG_SITES		256
+#define LOG_SITE_PROBES		8
+
+struct log_slot {
+	unsigned int seq;		/* slot is ready when seq == pos + 1 */
+	int level;
+	const char *file;
+	int line;
+	time_t tm;
+	char msg[LOG_MSG_MAX];
+};
+
+/* shared by all threads logging, so only accessed with __atomic ops */
+struct log_site {
+	const char *file;
+	int line;
+	int level;
+	time_t window;
+	unsigned int count;
+	unsigned int suppressed;
+};
+
+static struct log_slot log_queue[LOG_QUEUE_SLOTS];
+static unsigned int log_head;		/* next slot to fill */
+static unsigned int log_tail;		/* next slot to write */
+static unsigned int log_lost;		/* queue was full */
+static struct log_site log_sites[LOG_SITES];
+static pthread_t log_thread;
+static int log_threaded;
+static int log_limited;			/* the main loop runs */
+static int log_pipe[2] = { -1, -1 };	/* wakes up the log thread */
+static int log_sleeping;
+static int log_stop;
+static int log_reopen;
+
+static void log_write(int level, const char *file, int line, time_t tm,
+		      const char *msg)
+{
+	char timestr[32];
+	FILE *outfd;
+
+	if (logfile == &syslog_dummy) {
+		/* FIXME: this omits the 'file' string */
+		syslog(ulogd2syslog_level(level), "%s", msg);
+		return;
+	}
+
+	if (logfile)
+		outfd = logfile;
+	else
+		outfd = stderr;
+
+	ctime_r(&tm, timestr);
+	timestr[strlen(timestr)-1] = '\0';
+	fprintf(outfd, "%s <%1.1d> %s:%d %s", timestr, level, file, line, msg);
+	/* flush glibc's buffer */
+	fflush(outfd);
+
+	if (verbose && outfd != stderr) {
+		fprintf(stderr, "%s <%1.1d> %s:%d %s", timestr, level, file,
+			line, msg);
+		fflush(stderr);
+	}
+}
+
+static void log_wakeup(void)
+{
+	/* write() can be used from signal handlers, unlike a condition */
+	if (__atomic_load_n(&log_sleeping, __ATOMIC_SEQ_CST) &&
+	    write(log_pipe[1], "", 1) < 0) {
+		/* the pipe is full, so the thread is woken up anyway */
+	}
+}
+
+static void log_enqueue(int level, const char *file, int line, time_t tm,
+			const char *fmt, va_list ap)
+{
+	unsigned int pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	struct log_slot *slot;
+	int len;
+
+	while (1) {
+		int diff;
+
+		slot = &log_queue[pos & (LOG_QUEUE_SLOTS - 1)];
+		diff = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1,
+							1, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			__atomic_add_fetch(&log_lost, 1, __ATOMIC_RELAXED);
+			return;
+		} else
+			pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	}
+
+	slot->level = level;
+	slot->file = file;
+	slot->line = line;
+	slot->tm = tm;
+	len = vsnprintf(slot->msg, LOG_MSG_MAX, fmt, ap);
+	if (len >= LOG_MSG_MAX)
+		slot->msg[LOG_MSG_MAX - 2] = '\n';
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	log_wakeup();
+}
+
+static void log_vmessage(int level, const char *file, int line, time_t tm,
+			 const char *fmt, va_list ap)
+{
+	char msg[LOG_MSG_MAX];
+	int len;
+
+	if (log_threaded) {
+		log_enqueue(level, file, line, tm, fmt, ap);
+		return;
+	}
+
+	len = vsnprintf(msg, sizeof(msg), fmt, ap);
+	if (len >= LOG_MSG_MAX)
+		msg[LOG_MSG_MAX - 2] = '\n';
+	log_write(level, file, line, tm, msg);
+}
+
+static void log_message(int level, const char *file, int line, time_t tm,
+			const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	log_vmessage(level, file, line, tm, fmt, ap);
+	va_end(ap);
+}
+
+static void log_report_suppressed(struct log_site *site, time_t tm)
+{
+	unsigned int num = __atomic_exchange_n(&site->suppressed, 0,
+					       __ATOMIC_RELAXED);
+
+	if (num)
+		log_message(__atomic_load_n(&site->level, __ATOMIC_RELAXED),
+			    __atomic_load_n(&site->file, __ATOMIC_ACQUIRE),
+			    __atomic_load_n(&site->line, __ATOMIC_ACQUIRE), tm,
+			    "%u similar messages suppressed\n", num);
+}
+
+static struct log_site *log_site_get(const char *file, int line)
+{
+	unsigned int h = ((uintptr_t)file ^ (line * 2654435761U)) % LOG_SITES;
+	unsigned int i;
+
+	for (i = 0; i < LOG_SITE_PROBES; i++) {
+		struct log_site *site = &log_sites[(h + i) % LOG_SITES];
+		const char *cur = __atomic_load_n(&site->file,
+						  __ATOMIC_ACQUIRE);
+
+		if (!cur && __atomic_compare_exchange_n(&site->file, &cur,
+							file, 0,
+							__ATOMIC_ACQ_REL,
+							__ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&site->line, line, __ATOMIC_RELEASE);
+			return site;
+		}
+		if (cur == file &&
+		    __atomic_load_n(&site->line, __ATOMIC_ACQUIRE) == line)
+			return site;
+	}
+	/* too many call sites, don't limit this one */
+	return NULL;
+}
+
+/* returns 1 if the message should be dropped */
+static int log_ratelimit(int level, const char *file, int line, time_t tm)
+{
+	struct log_site *site = log_site_get(file, line);
+	time_t window;
+
+	if (!site)
+		return 0;
+
+	__atomic_store_n(&site->level, level, __ATOMIC_RELAXED);
+	/* only the thread moving the window on resets it */
+	window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+	if (window != tm &&
+	    __atomic_compare_exchange_n(&site->window, &window, tm, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+		log_report_suppressed(site, tm);
+	}
+	if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) <=
+	    LOG_RATE_BURST)
+		return 0;
+
+	__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
 /* log message to the logfile */
 void __ulogd_log(int level, char *file, int line, const char *format, ...)
 {
-	char *timestr;
 	va_list ap;
 	time_t tm;
-	FILE *outfd;
 
 	/* log only messages which have level at least as high as loglevel */
 	if (level < loglevel_ce.u.value)
 		return;
 
-	if (logfile == &syslog_dummy) {
-		/* FIXME: this omits the 'file' string */
-		va_start(ap, format);
-		vsyslog(ulogd2syslog_level(level), format, ap);
-		va_end(ap);
-	} else {
-		if (logfile)
-			outfd = logfile;
-		else
-			outfd = stderr;
-
-		tm = time(NULL);
-		timestr = ctime(&tm);
-		timestr[strlen(timestr)-1] = '\0';
-		fprintf(outfd, "%s <%1.1d> %s:%d ", timestr, level, file, line);
-		if (verbose && outfd != stderr)
-			fprintf(stderr, "%s <%1.1d> %s:%d ", timestr, level, file, line);
-
-
-		va_start(ap, format);
-		vfprintf(outfd, format, ap);
-		va_end(ap);
-		/* flush glibc's buffer */
-		fflush(outfd);
-
-		if (verbose && outfd != stderr) {
-			va_start(ap, format);
-			vfprintf(stderr, format, ap);
-			va_end(ap);
-			fflush(stderr);
+	tm = time(NULL);
+	if (level != ULOGD_FATAL &&
+	    __atomic_load_n(&log_limited, __ATOMIC_RELAXED) &&
+	    log_ratelimit(level, file, line, tm))
+		return;
+
+	va_start(ap, format);
+	log_vmessage(level, file, line, tm, format, ap);
+	va_end(ap);
+}
+
+/* write out the queued messages, returns the number written */
+static unsigned int log_drain(void)
+{
+	unsigned int num = 0, lost;
+
+	while (1) {
+		struct log_slot *slot;
+
+		slot = &log_queue[log_tail & (LOG_QUEUE_SLOTS - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) !=
+		    log_tail + 1)
+			break;
+		log_write(slot->level, slot->file, slot->line, slot->tm,
+			  slot->msg);
+		__atomic_store_n(&slot->seq, log_tail + LOG_QUEUE_SLOTS,
+				 __ATOMIC_RELEASE);
+		log_tail++;
+		num++;
+	}
+
+	lost = __atomic_exchange_n(&log_lost, 0, __ATOMIC_RELAXED);
+	if (lost) {
+		char msg[64];
+
+		snprintf(msg, sizeof(msg), "%u log messages lost, queue "
+			 "full\n", lost);
+		log_write(ULOGD_ERROR, __FILE__, __LINE__, time(NULL), msg);
+	}
+	return num;
+}
+
+/* report the suppressed messages of the sites which did not log during
+ * second `now', all of them with now == 0 */
+static void log_report_quiet(time_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < LOG_SITES; i++) {
+		struct log_site *site = &log_sites[i];
+
+		if (__atomic_load_n(&site->suppressed, __ATOMIC_RELAXED) &&
+		    __atomic_load_n(&site->window, __ATOMIC_RELAXED) != now)
+			log_report_suppressed(site, time(NULL));
+	}
+}
+
+static void log_reopen_file(void)
+{
+	if (!logfile || logfile == stdout || logfile == &syslog_dummy)
+		return;
+
+	fclose(logfile);
+	logfile = fopen(ulogd_logfile, "a");
+	if (!logfile) {
+		fprintf(stderr, "ERROR: can't open logfile %s: %s\n",
+			ulogd_logfile, strerror(errno));
+		/* let the main thread shut down like it did on SIGHUP */
+		kill(getpid(), SIGTERM);
+	}
+}
+
+static void *log_thread_main(void *arg)
+{
+	struct pollfd pfd = {
+		.fd = log_pipe[0],
+		.events = POLLIN,
+	};
+	time_t last_scan = 0;
+
+	while (1) {
+		char buf[64];
+		time_t now;
+
+		if (__atomic_exchange_n(&log_reopen, 0, __ATOMIC_SEQ_CST))
+			log_reopen_file();
+
+		log_drain();
+
+		/* report the sites which stopped logging after a storm */
+		now = time(NULL);
+		if (now != last_scan) {
+			log_report_quiet(now);
+			last_scan = now;
 		}
 
+		if (__atomic_load_n(&log_stop, __ATOMIC_SEQ_CST))
+			break;
+
+		__atomic_store_n(&log_sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!log_drain() && !__atomic_load_n(&log_stop,
+						     __ATOMIC_SEQ_CST) &&
+		    !__atomic_load_n(&log_reopen, __ATOMIC_SEQ_CST))
+			poll(&pfd, 1, 1000);
+		__atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+		while (read(log_pipe[0], buf, sizeof(buf)) > 0)
+			;
+	}
+	return NULL;
+}
+
+static void log_thread_stop(void);
+
+static void log_thread_start(void)
+{
+	sigset_t all, old;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < LOG_QUEUE_SLOTS; i++)
+		log_queue[i].seq = i;
+
+	if (pipe(log_pipe) < 0) {
+		ulogd_log(ULOGD_ERROR, "can't create log pipe: %s\n",
+			  strerror(errno));
+		return;
+	}
+	fcntl(log_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(log_pipe[1], F_SETFL, O_NONBLOCK);
+
+	/* signals have to be handled by the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	log_threaded = 1;
+	ret = pthread_create(&log_thread, NULL, log_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		log_threaded = 0;
+		ulogd_log(ULOGD_ERROR, "can't start log thread, logging "
+			  "synchronously\n");
+		close(log_pipe[0]);
+		close(log_pipe[1]);
+		return;
 	}
+	/* plugins may exit() on fatal errors, don't lose their last words */
+	atexit(log_thread_stop);
+}
+
+static void log_thread_stop(void)
+{
+	if (!log_threaded)
+		return;
+
+	__atomic_store_n(&log_stop, 1, __ATOMIC_SEQ_CST);
+	if (write(log_pipe[1], "", 1) < 0) {
+		/* the thread is awake already */
+	}
+	pthread_join(log_thread, NULL);
+	log_threaded = 0;
+	log_drain();
+	log_report_quiet(0);
+	close(log_pipe[0]);
+	close(log_pipe[1]);
 }
 
 static void warn_and_exit(int daemonize)
@@ -506,18 +879,68 @@ static void ulogd_clean_results(struct ulogd_pluginstance *pi)
 	}
 }
 
+void ulogd_stats_timing(void)
+{
+	ulogd_cycles_calibrate();
+	stats_timing = 1;
+}
+
+int ulogd_pluginstance_iterate(int (*cb)(struct ulogd_pluginstance *pi,
+					 void *data), void *data)
+{
+	struct ulogd_pluginstance_stack *stack;
+	struct ulogd_pluginstance *pi;
+	int ret;
+
+	/* stacks are added at the head, walk them in configuration order */
+	llist_for_each_entry_reverse(stack, &ulogd_pi_stacks, stack_list) {
+		llist_for_each_entry(pi, &stack->list, list) {
+			ret = cb(pi, data);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+static void ulogd_interp_account(struct ulogd_pluginstance *pi,
+				 uint64_t cycles)
+{
+	pi->stats.interp_cycles += cycles;
+	if (!pi->stats.latency) {
+		pi->stats.latency = calloc(1, sizeof(struct ulogd_histogram));
+		if (!pi->stats.latency)
+			return;
+	}
+	ulogd_hist_add(pi->stats.latency, cycles);
+}
+
 /* propagate results to all downstream plugins in the stack */
 void ulogd_propagate_results(struct ulogd_pluginstance *pi)
 {
 	struct ulogd_pluginstance *cur = pi;
 	int abort_stack = 0;
+
+	pi->stats.events++;
+	ULOGD_PROBE2(event__start, pi->id, pi->plugin->name);
+
 	/* iterate over remaining plugin stack */
 	llist_for_each_entry_continue(cur, &pi->stack->list, list) {
 		int ret;
-		
-		ret = cur->plugin->interp(cur);
+
+		cur->stats.events++;
+		ULOGD_PROBE2(interp__start, cur->id, cur->plugin->name);
+		if (stats_timing) {
+			uint64_t start = ulogd_cycles();
+
+			ret = cur->plugin->interp(cur);
+			ulogd_interp_account(cur, ulogd_cycles() - start);
+		} else
+			ret = cur->plugin->interp(cur);
+		ULOGD_PROBE2(interp__done, cur->id, ret);
 		switch (ret) {
 		case ULOGD_IRET_ERR:
+			cur->stats.errors++;
 			ulogd_log(ULOGD_NOTICE,
 				  "error during propagate_results\n");
 			/* fallthrough */
@@ -541,6 +964,8 @@ void ulogd_propagate_results(struct ulogd_pluginstance *pi)
 	}
 
 	ulogd_clean_results(pi);
+	ulogd_arena_reset(&pi->stack->arena);
+	ULOGD_PROBE1(event__done, pi->id);
 }
 
 static struct ulogd_pluginstance *
@@ -838,6 +1263,7 @@ static int create_stack(const char *option)
 		goto out_stack;
 	}
 	INIT_LLIST_HEAD(&stack->list);
+	ulogd_arena_init(&stack->arena);
 
 	ulogd_log(ULOGD_NOTICE, "building new pluginstance stack: '%s'\n",
 		  option);
@@ -1199,6 +1625,7 @@ static void stop_pluginstances()
 				(*pi->plugin->stop)(pi);
 				pi->private[0] = 0;
 			}
+			free(pi->stats.latency);
 			free(pi);
 		}
 	}
@@ -1220,6 +1647,7 @@ static void stop_stack()
 	struct ulogd_pluginstance_stack *stack, *nstack;
 
 	llist_for_each_entry_safe(stack, nstack, &ulogd_pi_stacks, stack_list) {
+		ulogd_arena_fini(&stack->arena);
 		free(stack);
 	}
 }
@@ -1236,6 +1664,9 @@ static void sigterm_handler(int signal)
 
 	stop_stack();
 
+	/* queued messages point to file names in the plugins */
+	log_thread_stop();
+
 #ifndef DEBUG_VALGRIND
 	unload_plugins();
 #endif
@@ -1255,14 +1686,42 @@ static void sigterm_handler(int signal)
 	exit(0);
 }
 
+static void dump_latency(void)
+{
+	struct ulogd_pluginstance_stack *stack;
+	struct ulogd_pluginstance *pi;
+
+	llist_for_each_entry_reverse(stack, &ulogd_pi_stacks, stack_list) {
+		llist_for_each_entry(pi, &stack->list, list) {
+			struct ulogd_histogram *h = pi->stats.latency;
+
+			if (!h || !h->count)
+				continue;
+			ulogd_log(ULOGD_NOTICE, "%s(%s): %" PRIu64 " calls, "
+				  "interp p50 %" PRIu64 " ns, p90 %" PRIu64
+				  " ns, p99 %" PRIu64 " ns, p99.9 %" PRIu64
+				  " ns, max %" PRIu64 " ns\n", pi->id,
+				  pi->plugin->name, h->count,
+				  ulogd_cycles_to_ns(ulogd_hist_percentile(h, 50)),
+				  ulogd_cycles_to_ns(ulogd_hist_percentile(h, 90)),
+				  ulogd_cycles_to_ns(ulogd_hist_percentile(h, 99)),
+				  ulogd_cycles_to_ns(ulogd_hist_percentile(h, 99.9)),
+				  ulogd_cycles_to_ns(h->max));
+		}
+	}
+}
+
 static void signal_handler(int signal)
 {
 	ulogd_log(ULOGD_NOTICE, "signal received, calling pluginstances\n");
 	
 	switch (signal) {
 	case SIGHUP:
-		/* reopen logfile */
-		if (logfile != stdout && logfile != &syslog_dummy) {
+		/* reopen logfile, by the log thread if it writes to it */
+		if (log_threaded) {
+			__atomic_store_n(&log_reopen, 1, __ATOMIC_SEQ_CST);
+			log_wakeup();
+		} else if (logfile != stdout && logfile != &syslog_dummy) {
 			fclose(logfile);
 			logfile = fopen(ulogd_logfile, "a");
  			if (!logfile) {
@@ -1274,6 +1733,10 @@ static void signal_handler(int signal)
 	
 		}
 		break;
+	case SIGUSR1:
+		if (stats_timing)
+			dump_latency();
+		break;
 	default:
 		break;
 	}
@@ -1281,6 +1744,64 @@ static void signal_handler(int signal)
 	deliver_signal_pluginstances(signal);
 }
 
+/* Signals are only queued by the handler and dispatched from the main
+ * loop: the plugins' signal callbacks and the shutdown take locks (e.g.
+ * the writer's) which the interrupted main thread may be holding. */
+static int signal_pipe[2] = { -1, -1 };
+static struct ulogd_fd signal_fd;
+
+static void signal_enqueue(int signal)
+{
+	unsigned char c = signal;
+	int saved_errno = errno;
+
+	if (write(signal_pipe[1], &c, 1) < 0) {
+		/* the pipe is full, the main loop is busy with signals */
+	}
+	errno = saved_errno;
+}
+
+static int signal_pipe_cb(int fd, unsigned int what, void *param)
+{
+	unsigned char sigs[64];
+	ssize_t len, i;
+
+	while ((len = read(fd, sigs, sizeof(sigs))) > 0) {
+		for (i = 0; i < len; i++) {
+			if (sigs[i] == SIGTERM || sigs[i] == SIGINT)
+				sigterm_handler(sigs[i]);
+			else
+				signal_handler(sigs[i]);
+		}
+	}
+	return 0;
+}
+
+static int signal_init(void)
+{
+	if (pipe(signal_pipe) < 0)
+		return -1;
+	fcntl(signal_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+	fcntl(signal_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(signal_pipe[1], F_SETFD, FD_CLOEXEC);
+
+	signal_fd.fd = signal_pipe[0];
+	signal_fd.when = ULOGD_FD_READ;
+	signal_fd.cb = &signal_pipe_cb;
+	if (ulogd_register_fd(&signal_fd) < 0)
+		return -1;
+
+	signal(SIGTERM, &signal_enqueue);
+	signal(SIGINT, &signal_enqueue);
+	signal(SIGHUP, &signal_enqueue);
+	signal(SIGALRM, &signal_enqueue);
+	signal(SIGUSR1, &signal_enqueue);
+	signal(SIGUSR2, &signal_enqueue);
+
+	return 0;
+}
+
 static void print_usage(void)
 {
 	printf("ulogd Version %s\n", VERSION);
@@ -1413,6 +1934,9 @@ int main(int argc, char* argv[])
 			warn_and_exit(0);
 	}
 
+	/* plugins may use the clock as soon as they are started */
+	ulogd_clock_update();
+
 	if (config_register_file(ulogd_configfile)) {
 		ulogd_log(ULOGD_FATAL, "error registering configfile \"%s\"\n",
 			  ulogd_configfile);
@@ -1431,6 +1955,9 @@ int main(int argc, char* argv[])
 		warn_and_exit(daemonize);
 	}
 
+	if (timing_ce.u.value)
+		ulogd_stats_timing();
+
 	errno = 0;
 	if (nice(-1) == -1) {
 		if (errno != 0)
@@ -1464,16 +1991,18 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	signal(SIGTERM, &sigterm_handler);
-	signal(SIGINT, &sigterm_handler);
-	signal(SIGHUP, &signal_handler);
-	signal(SIGALRM, &signal_handler);
-	signal(SIGUSR1, &signal_handler);
-	signal(SIGUSR2, &signal_handler);
+	if (signal_init() < 0) {
+		ulogd_log(ULOGD_FATAL, "can't set up signal handling: %s\n",
+			  strerror(errno));
+		warn_and_exit(daemonize);
+	}
 
 	ulogd_log(ULOGD_INFO, 
 		  "initialization finished, entering main loop\n");
 
+	log_thread_start();
+	__atomic_store_n(&log_limited, 1, __ATOMIC_RELAXED);
+
 	ulogd_main_loop();
 
 	/* hackish, but result is the same */
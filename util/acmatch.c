@@ -0,0 +1,312 @@
+/* acmatch.c
+ *
+ * ulogd helper functions to look for many patterns at once
+ *
+ * The patterns are compiled into a deterministic Aho-Corasick
+ * automaton: every state has a transition for each input symbol, so the
+ * search does one table lookup per byte whatever the number of
+ * patterns. To keep the table small, bytes are first mapped to classes:
+ * one per distinct (case folded) byte of the patterns and one for all
+ * the others. Transitions hold the offset of the next row and a flag
+ * set if a pattern ends in that state.
+ *
+ * While in the initial state, bytes which can't start a pattern are
+ * skipped without walking the automaton, 16 at a time with SSE2 when
+ * there are few distinct first bytes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ulogd/acmatch.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ACM_MATCH	0x80000000U
+#define ACM_PREFILTER	4
+
+struct acm_pattern {
+	unsigned int id;
+	size_t len;
+	uint8_t *data;
+};
+
+struct ulogd_acm {
+	int nocase;
+	int compiled;
+
+	struct acm_pattern *patterns;
+	unsigned int num_patterns;
+	size_t total_len;
+
+	uint8_t cls[256];
+	unsigned int num_cls;
+	/* num_states rows of num_cls transitions */
+	uint32_t *delta;
+	unsigned int num_states;
+	/* pattern reported for each state, -1 if none */
+	int *out;
+
+	/* bytes leaving the initial state */
+	uint8_t start[256];
+	uint8_t start_bytes[ACM_PREFILTER];
+	unsigned int num_start;
+};
+
+static inline uint8_t acm_fold(const struct ulogd_acm *acm, uint8_t c)
+{
+	if (acm->nocase && c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+	return c;
+}
+
+struct ulogd_acm *ulogd_acm_alloc(int nocase)
+{
+	struct ulogd_acm *acm = calloc(1, sizeof(*acm));
+
+	if (acm)
+		acm->nocase = nocase;
+	return acm;
+}
+
+void ulogd_acm_free(struct ulogd_acm *acm)
+{
+	unsigned int i;
+
+	if (!acm)
+		return;
+
+	for (i = 0; i < acm->num_patterns; i++)
+		free(acm->patterns[i].data);
+	free(acm->patterns);
+	free(acm->delta);
+	free(acm->out);
+	free(acm);
+}
+
+int ulogd_acm_add(struct ulogd_acm *acm, const void *pattern, size_t len,
+		  unsigned int id)
+{
+	struct acm_pattern *p;
+
+	if (acm->compiled || len == 0)
+		return -1;
+
+	p = realloc(acm->patterns, (acm->num_patterns + 1) * sizeof(*p));
+	if (!p)
+		return -1;
+	acm->patterns = p;
+
+	p = &acm->patterns[acm->num_patterns];
+	p->data = malloc(len);
+	if (!p->data)
+		return -1;
+	memcpy(p->data, pattern, len);
+	p->len = len;
+	p->id = id;
+
+	acm->num_patterns++;
+	acm->total_len += len;
+
+	return 0;
+}
+
+static void acm_classes(struct ulogd_acm *acm)
+{
+	unsigned int i, c;
+	size_t j;
+
+	memset(acm->cls, 0, sizeof(acm->cls));
+	acm->num_cls = 1;
+
+	for (i = 0; i < acm->num_patterns; i++) {
+		for (j = 0; j < acm->patterns[i].len; j++) {
+			uint8_t b = acm_fold(acm, acm->patterns[i].data[j]);
+
+			if (acm->cls[b] == 0)
+				acm->cls[b] = acm->num_cls++;
+		}
+	}
+	if (acm->nocase)
+		for (c = 'A'; c <= 'Z'; c++)
+			acm->cls[c] = acm->cls[c - 'A' + 'a'];
+}
+
+int ulogd_acm_compile(struct ulogd_acm *acm)
+{
+	unsigned int max_states, ncls, s, c, i, head = 0, tail = 0;
+	unsigned int *fail = NULL, *queue = NULL;
+	uint32_t *go;
+
+	if (acm->compiled)
+		return -1;
+
+	acm_classes(acm);
+	ncls = acm->num_cls;
+	max_states = acm->total_len + 1;
+	if ((uint64_t)max_states * ncls >= ACM_MATCH)
+		return -1;
+
+	go = malloc(sizeof(*go) * max_states * ncls);
+	acm->out = malloc(sizeof(*acm->out) * max_states);
+	fail = malloc(sizeof(*fail) * max_states);
+	queue = malloc(sizeof(*queue) * max_states);
+	if (!go || !acm->out || !fail || !queue)
+		goto err;
+
+	/* trie of the patterns, UINT32_MAX for missing transitions */
+	memset(go, 0xff, sizeof(*go) * ncls);
+	acm->out[0] = -1;
+	acm->num_states = 1;
+	for (i = 0; i < acm->num_patterns; i++) {
+		struct acm_pattern *p = &acm->patterns[i];
+		size_t j;
+
+		for (s = 0, j = 0; j < p->len; j++) {
+			uint32_t *t = &go[s * ncls + acm->cls[p->data[j]]];
+
+			if (*t == UINT32_MAX) {
+				unsigned int n = acm->num_states++;
+
+				memset(&go[n * ncls], 0xff, sizeof(*go) * ncls);
+				acm->out[n] = -1;
+				*t = n;
+			}
+			s = *t;
+		}
+		if (acm->out[s] < 0)
+			acm->out[s] = i;
+	}
+
+	/* breadth first: fill the missing transitions from the failure
+	 * state, which is closer to the root and so already complete */
+	for (c = 0; c < ncls; c++) {
+		uint32_t n = go[c];
+
+		if (n == UINT32_MAX) {
+			go[c] = 0;
+			continue;
+		}
+		fail[n] = 0;
+		queue[tail++] = n;
+	}
+	while (head < tail) {
+		s = queue[head++];
+		if (acm->out[s] < 0)
+			acm->out[s] = acm->out[fail[s]];
+
+		for (c = 0; c < ncls; c++) {
+			uint32_t n = go[s * ncls + c];
+
+			if (n == UINT32_MAX) {
+				go[s * ncls + c] = go[fail[s] * ncls + c];
+				continue;
+			}
+			fail[n] = go[fail[s] * ncls + c];
+			queue[tail++] = n;
+		}
+	}
+
+	/* rows are addressed by offset, with the match flag */
+	for (i = 0; i < acm->num_states * ncls; i++) {
+		uint32_t n = go[i];
+
+		go[i] = n * ncls | (acm->out[n] >= 0 ? ACM_MATCH : 0);
+	}
+	acm->delta = realloc(go, sizeof(*go) * acm->num_states * ncls);
+	if (!acm->delta)
+		acm->delta = go;
+
+	/* the states store pattern indexes, keep their length around */
+	for (i = 0; i < acm->num_patterns; i++) {
+		free(acm->patterns[i].data);
+		acm->patterns[i].data = NULL;
+	}
+
+	acm->num_start = 0;
+	for (c = 0; c < 256; c++) {
+		acm->start[c] = acm->delta[acm->cls[c]] != 0;
+		if (acm->start[c] && acm->num_start++ < ACM_PREFILTER)
+			acm->start_bytes[acm->num_start - 1] = c;
+	}
+
+	free(fail);
+	free(queue);
+	acm->compiled = 1;
+	return 0;
+
+err:
+	free(go);
+	free(acm->out);
+	acm->out = NULL;
+	free(fail);
+	free(queue);
+	return -1;
+}
+
+/* first byte from p which may start a pattern, or end */
+static const uint8_t *acm_skip(const struct ulogd_acm *acm,
+			       const uint8_t *p, const uint8_t *end)
+{
+#ifdef __SSE2__
+	if (acm->num_start <= ACM_PREFILTER) {
+		__m128i b[ACM_PREFILTER];
+		unsigned int i;
+
+		for (i = 0; i < acm->num_start; i++)
+			b[i] = _mm_set1_epi8(acm->start_bytes[i]);
+
+		while (end - p >= 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			__m128i m = _mm_cmpeq_epi8(v, b[0]);
+			int mask;
+
+			for (i = 1; i < acm->num_start; i++)
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(v, b[i]));
+			mask = _mm_movemask_epi8(m);
+			if (mask)
+				return p + __builtin_ctz(mask);
+			p += 16;
+		}
+	}
+#endif
+	while (p < end && !acm->start[*p])
+		p++;
+	return p;
+}
+
+int ulogd_acm_search(const struct ulogd_acm *acm, const void *buf,
+		     size_t len, size_t *offset)
+{
+	const uint8_t *start = buf, *p = buf, *end = p + len;
+	uint32_t s = 0;
+	int i;
+
+	if (!acm->compiled || acm->num_patterns == 0)
+		return -1;
+
+	while (p < end) {
+		uint32_t t;
+
+		if (s == 0) {
+			p = acm_skip(acm, p, end);
+			if (p == end)
+				break;
+		}
+		t = acm->delta[s + acm->cls[*p++]];
+		s = t & ~ACM_MATCH;
+		if (t & ACM_MATCH) {
+			i = acm->out[s / acm->num_cls];
+			if (offset)
+				*offset = p - start - acm->patterns[i].len;
+			return acm->patterns[i].id;
+		}
+	}
+	return -1;
+}
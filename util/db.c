@@ -36,6 +36,7 @@
 
 #include <ulogd/ulogd.h>
 #include <ulogd/db.h>
+#include <ulogd/clock.h>
 
 
 /* generic db layer */
@@ -298,9 +299,9 @@ static int _init_reconnect(struct ulogd_pluginstance *upi)
 	struct db_instance *di = (struct db_instance *) upi->private;
 
 	if (reconnect_ce(upi->config_kset).u.value) {
-		if (time(NULL) < di->reconnect)
+		if (ulogd_clock_sec() < di->reconnect)
 			return -1;
-		di->reconnect = time(NULL);
+		di->reconnect = ulogd_clock_sec();
 		if (di->reconnect != TIME_ERR) {
 			ulogd_log(ULOGD_ERROR, "no connection to database, "
 				  "attempting to reconnect after %u seconds\n",
@@ -414,6 +415,7 @@ static int __add_to_backlog(struct ulogd_pluginstance *upi, const char *stmt, un
 			ulogd_log(ULOGD_ERROR,
 				  "Backlog is full starting to reject events.\n");
 		di->backlog_full = 1;
+		upi->stats.drops++;
 		return -1;
 	}
 
@@ -430,6 +432,7 @@ static int __add_to_backlog(struct ulogd_pluginstance *upi, const char *stmt, un
 	}
 
 	di->backlog_memusage += len + sizeof(struct db_stmt);
+	upi->stats.backlog = di->backlog_memusage;
 	di->backlog_full = 0;
 
 	llist_add_tail(&query->list, &di->backlog);
@@ -441,13 +444,14 @@ static int _init_db(struct ulogd_pluginstance *upi)
 {
 	struct db_instance *di = (struct db_instance *) upi->private;
 
-	if (di->reconnect && di->reconnect > time(NULL)) {
+	if (di->reconnect && di->reconnect > ulogd_clock_sec()) {
 		/* store entry to backlog if it is active */
 		if (di->backlog_memcap && !di->backlog_full) {
 			__format_query_db(upi, di->stmt);
 			__add_to_backlog(upi, di->stmt,
 						strlen(di->stmt));
-		}
+		} else if (di->backlog_memcap)
+			upi->stats.drops++;
 		return 0;
 	}
 
@@ -456,7 +460,8 @@ static int _init_db(struct ulogd_pluginstance *upi)
 		if (di->backlog_memcap && !di->backlog_full) {
 			__format_query_db(upi, di->stmt);
 			__add_to_backlog(upi, di->stmt, strlen(di->stmt));
-		}
+		} else if (di->backlog_memcap)
+			upi->stats.drops++;
 		return _init_reconnect(upi);
 	}
 
@@ -478,7 +483,7 @@ static int __treat_backlog(struct ulogd_pluginstance *upi)
 	struct db_stmt *nquery;
 
 	/* Don't try reconnect before timeout */
-	if (di->reconnect && di->reconnect > time(NULL))
+	if (di->reconnect && di->reconnect > ulogd_clock_sec())
 		return 0;
 
 	llist_for_each_entry_safe(query, nquery, &di->backlog, list) {
@@ -488,6 +493,7 @@ static int __treat_backlog(struct ulogd_pluginstance *upi)
 			return _init_reconnect(upi);
 		} else {
 			di->backlog_memusage -= query->len + sizeof(struct db_stmt);
+			upi->stats.backlog = di->backlog_memusage;
 			llist_del(&query->list);
 			free(query->stmt);
 			free(query);
@@ -505,6 +511,8 @@ static int __add_to_ring(struct ulogd_pluginstance *upi, struct db_instance *di)
 			ulogd_log(ULOGD_ERROR, "No place left in ring\n");
 			di->ring.full = 1;
 		}
+		upi->stats.drops++;
+		upi->stats.backlog = (uint64_t)di->ring.size * di->ring.length;
 		return ULOGD_IRET_OK;
 	} else if (di->ring.full) {
 		ulogd_log(ULOGD_NOTICE, "Recovered some place in ring\n");
@@ -519,6 +527,10 @@ static int __add_to_ring(struct ulogd_pluginstance *upi, struct db_instance *di)
 		di->ring.wr_item = 0;
 		di->ring.wr_place = di->ring.ring;
 	}
+	/* rd_item is moved by the db thread, a stale value is good enough */
+	upi->stats.backlog = (uint64_t)((di->ring.wr_item + di->ring.size -
+					 di->ring.rd_item) % di->ring.size) *
+			     di->ring.length;
 	return ULOGD_IRET_OK;
 }
 
@@ -0,0 +1,211 @@
+/* format.c
+ *
+ * ulogd helper functions to format addresses and binary data as text
+ *
+ * Hex digits come from a table of the 256 byte values, 16 bytes at a
+ * time with SSE2 where available. Dotted quads and IPv6 groups copy a
+ * fixed number of bytes and only advance the output by the length of
+ * the number, so that the loops don't depend on the digits.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <string.h>
+
+#include <ulogd/format.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char hex_pairs[2 * 256 + 1] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/* each entry is NUL padded, so that 3 bytes can always be copied */
+static const char dec_str[256][4] = {
+	"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11",
+	"12", "13", "14", "15", "16", "17", "18", "19", "20", "21", "22", "23",
+	"24", "25", "26", "27", "28", "29", "30", "31", "32", "33", "34", "35",
+	"36", "37", "38", "39", "40", "41", "42", "43", "44", "45", "46", "47",
+	"48", "49", "50", "51", "52", "53", "54", "55", "56", "57", "58", "59",
+	"60", "61", "62", "63", "64", "65", "66", "67", "68", "69", "70", "71",
+	"72", "73", "74", "75", "76", "77", "78", "79", "80", "81", "82", "83",
+	"84", "85", "86", "87", "88", "89", "90", "91", "92", "93", "94", "95",
+	"96", "97", "98", "99", "100", "101", "102", "103", "104", "105", "106", "107",
+	"108", "109", "110", "111", "112", "113", "114", "115", "116", "117", "118", "119",
+	"120", "121", "122", "123", "124", "125", "126", "127", "128", "129", "130", "131",
+	"132", "133", "134", "135", "136", "137", "138", "139", "140", "141", "142", "143",
+	"144", "145", "146", "147", "148", "149", "150", "151", "152", "153", "154", "155",
+	"156", "157", "158", "159", "160", "161", "162", "163", "164", "165", "166", "167",
+	"168", "169", "170", "171", "172", "173", "174", "175", "176", "177", "178", "179",
+	"180", "181", "182", "183", "184", "185", "186", "187", "188", "189", "190", "191",
+	"192", "193", "194", "195", "196", "197", "198", "199", "200", "201", "202", "203",
+	"204", "205", "206", "207", "208", "209", "210", "211", "212", "213", "214", "215",
+	"216", "217", "218", "219", "220", "221", "222", "223", "224", "225", "226", "227",
+	"228", "229", "230", "231", "232", "233", "234", "235", "236", "237", "238", "239",
+	"240", "241", "242", "243", "244", "245", "246", "247", "248", "249", "250", "251",
+	"252", "253", "254", "255",
+};
+
+static inline char *hex_byte(char *dst, uint8_t v)
+{
+	memcpy(dst, &hex_pairs[2 * v], 2);
+	return dst + 2;
+}
+
+#ifdef __SSE2__
+/* 16 bytes to 32 hex digits */
+static inline void hex_16(char *dst, const void *src)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+	__m128i v = _mm_loadu_si128(src);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+	__m128i lo = _mm_and_si128(v, mask);
+
+	/* nibbles above 9 get the offset to 'a' on top of '0' */
+	hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+			  _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+	lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+			  _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+	_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+}
+#endif
+
+char *ulogd_format_hex(char *dst, const void *src, size_t len)
+{
+	const uint8_t *s = src;
+
+#ifdef __SSE2__
+	for (; len >= 16; len -= 16, s += 16, dst += 32)
+		hex_16(dst, s);
+#endif
+	for (; len > 0; len--)
+		dst = hex_byte(dst, *s++);
+	*dst = 0;
+
+	return dst;
+}
+
+static inline char *dec_byte(char *dst, uint8_t v)
+{
+	memcpy(dst, dec_str[v], 3);
+	return dst + 1 + (v >= 10) + (v >= 100);
+}
+
+char *ulogd_format_ipv4(char *dst, uint32_t addr)
+{
+	const uint8_t *b = (const uint8_t *)&addr;
+
+	dst = dec_byte(dst, b[0]);
+	*dst++ = '.';
+	dst = dec_byte(dst, b[1]);
+	*dst++ = '.';
+	dst = dec_byte(dst, b[2]);
+	*dst++ = '.';
+	dst = dec_byte(dst, b[3]);
+	*dst = 0;
+
+	return dst;
+}
+
+/* a 16 bit group without leading zeros */
+static inline char *hex_group(char *dst, uint16_t v)
+{
+	char tmp[8] = { 0 };
+	int n = 1 + (v > 0xf) + (v > 0xff) + (v > 0xfff);
+
+	hex_byte(tmp, v >> 8);
+	hex_byte(tmp + 2, v & 0xff);
+	memcpy(dst, tmp + 4 - n, 4);
+
+	return dst + n;
+}
+
+char *ulogd_format_ipv6(char *dst, const void *addr)
+{
+	const uint8_t *b = addr;
+	uint16_t w[8];
+	int i, best = -1, best_len = 0, cur = -1, cur_len = 0;
+
+	for (i = 0; i < 8; i++) {
+		w[i] = b[2 * i] << 8 | b[2 * i + 1];
+		if (w[i] == 0) {
+			if (cur < 0)
+				cur = i;
+			if (++cur_len > best_len) {
+				best = cur;
+				best_len = cur_len;
+			}
+		} else {
+			cur = -1;
+			cur_len = 0;
+		}
+	}
+	/* a single zero group is not compressed */
+	if (best_len < 2)
+		best = -1;
+
+	for (i = 0; i < 8; i++) {
+		if (i == best) {
+			*dst++ = ':';
+			i += best_len - 1;
+			if (i == 7)
+				*dst++ = ':';
+			continue;
+		}
+		if (i)
+			*dst++ = ':';
+		/* IPv4 compatible (::a.b.c.d) and mapped (::ffff:a.b.c.d) */
+		if (i == 6 && best == 0 &&
+		    (best_len == 6 || (best_len == 5 && w[5] == 0xffff))) {
+			uint32_t ip;
+
+			memcpy(&ip, b + 12, sizeof(ip));
+			return ulogd_format_ipv4(dst, ip);
+		}
+		dst = hex_group(dst, w[i]);
+	}
+	*dst = 0;
+
+	return dst;
+}
+
+char *ulogd_format_mac(char *dst, const void *mac, size_t len, char sep)
+{
+	const uint8_t *s = mac;
+
+	if (len == 0) {
+		*dst = 0;
+		return dst;
+	}
+
+	for (; len > 0; len--) {
+		dst = hex_byte(dst, *s++);
+		*dst++ = sep;
+	}
+	*--dst = 0;
+
+	return dst;
+}
@@ -0,0 +1,760 @@
+/* lpm.c
+ *
+ * ulogd helper functions for longest prefix match
+ *
+ * The prefixes are compiled into a multibit trie in the way of poptrie:
+ * the first 16 bits of the address index a direct table, the following
+ * bits are consumed 6 at a time by nodes of 64 slots. A node does not
+ * store its slots, only a bitmap of the slots holding a child and a
+ * bitmap of the slots where a run of equal leaves starts. Children and
+ * leaves of a node are stored contiguously, so that the index of the
+ * one to follow is found by counting the bits set below the slot.
+ *
+ * The trie is built uncompressed first, inserting the prefixes from the
+ * shortest to the longest so that a prefix only ever overwrites slots
+ * of shorter ones (leaf pushing). The compiled image only holds
+ * indexes and offsets, it can be written to a file and mapped as is.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <ulogd/jhash.h>
+#include <ulogd/lpm.h>
+
+#define LPM_ROOT_BITS	16
+#define LPM_ROOT_SIZE	(1 << LPM_ROOT_BITS)
+#define LPM_STRIDE	6
+#define LPM_SLOTS	(1 << LPM_STRIDE)
+#define LPM_NODE	0x80000000U
+
+#define LPM_MAGIC	"ulogdlpm"
+#define LPM_VERSION	1
+#define LPM_BYTEORDER	0x01020304U
+
+struct lpm_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint64_t source[2];
+	uint32_t num_prefixes;
+	uint32_t num_nodes;
+	uint32_t num_leaves;
+	uint32_t tags_len;
+	/* followed by the IPv4 and IPv6 roots, the nodes, the leaves
+	 * and the NUL terminated tags */
+};
+
+struct lpm_node {
+	uint64_t vector;	/* slots holding a child */
+	uint64_t leafvec;	/* slots starting a run of leaves */
+	uint32_t base0;		/* first leaf */
+	uint32_t base1;		/* first child */
+};
+
+struct ulogd_lpm {
+	void *image;
+	size_t size;
+	int mapped;
+
+	const struct lpm_header *hdr;
+	const uint32_t *root;
+	const struct lpm_node *nodes;
+	const uint32_t *leaves;
+	const char *tags;
+};
+
+struct lpm_prefix {
+	uint64_t key[2];
+	uint32_t tag;
+	uint32_t seq;
+	uint8_t v6;
+	uint8_t bits;
+};
+
+/* a slot holds a tag offset, 0 for no tag, or LPM_NODE | node index */
+struct lpm_bnode {
+	uint32_t slot[LPM_SLOTS];
+};
+
+struct ulogd_lpm_builder {
+	struct lpm_prefix *prefixes;
+	unsigned int num_prefixes;
+	unsigned int max_prefixes;
+
+	/* tags are stored once, offset 0 is the empty tag */
+	char *tags;
+	size_t tags_len;
+	size_t tags_size;
+	uint32_t *tag_hash;
+	unsigned int tag_hash_size;
+	unsigned int num_tags;
+
+	uint32_t *root;
+	struct lpm_bnode *nodes;
+	unsigned int num_nodes;
+	unsigned int max_nodes;
+
+	uint32_t *leaves;
+	unsigned int num_leaves;
+	unsigned int max_leaves;
+};
+
+/* address as 64 bit words, most significant bit first, padded with a
+ * zero word so that a stride crossing the end can be read */
+static inline void lpm_key(uint64_t k[3], int v6, const void *addr)
+{
+	if (v6) {
+		memcpy(k, addr, 16);
+		k[0] = be64toh(k[0]);
+		k[1] = be64toh(k[1]);
+	} else {
+		uint32_t a;
+
+		memcpy(&a, addr, sizeof(a));
+		k[0] = (uint64_t)ntohl(a) << 32;
+		k[1] = 0;
+	}
+	k[2] = 0;
+}
+
+static inline unsigned int lpm_bits(const uint64_t k[3], unsigned int off)
+{
+	unsigned int s = off & 63;
+	uint64_t v = k[off >> 6] << s;
+
+	if (s > 64 - LPM_STRIDE)
+		v |= k[(off >> 6) + 1] >> (64 - s);
+	return v >> (64 - LPM_STRIDE);
+}
+
+struct ulogd_lpm_builder *ulogd_lpm_builder_alloc(void)
+{
+	struct ulogd_lpm_builder *b = calloc(1, sizeof(*b));
+
+	if (!b)
+		return NULL;
+
+	b->tags_size = 4096;
+	b->tags = malloc(b->tags_size);
+	b->tag_hash_size = 1024;
+	b->tag_hash = calloc(b->tag_hash_size, sizeof(*b->tag_hash));
+	if (!b->tags || !b->tag_hash) {
+		ulogd_lpm_builder_free(b);
+		return NULL;
+	}
+	b->tags[0] = '\0';
+	b->tags_len = 1;
+
+	return b;
+}
+
+void ulogd_lpm_builder_free(struct ulogd_lpm_builder *b)
+{
+	if (!b)
+		return;
+
+	free(b->prefixes);
+	free(b->tags);
+	free(b->tag_hash);
+	free(b->root);
+	free(b->nodes);
+	free(b->leaves);
+	free(b);
+}
+
+static int lpm_tag_rehash(struct ulogd_lpm_builder *b)
+{
+	unsigned int size = b->tag_hash_size * 2, i;
+	uint32_t *h = calloc(size, sizeof(*h));
+
+	if (!h)
+		return -1;
+
+	for (i = 0; i < b->tag_hash_size; i++) {
+		const char *tag = b->tags + b->tag_hash[i];
+		uint32_t j;
+
+		if (b->tag_hash[i] == 0)
+			continue;
+		j = jhash(tag, strlen(tag), 0) & (size - 1);
+		while (h[j])
+			j = (j + 1) & (size - 1);
+		h[j] = b->tag_hash[i];
+	}
+	free(b->tag_hash);
+	b->tag_hash = h;
+	b->tag_hash_size = size;
+	return 0;
+}
+
+/* offset of tag in b->tags, adding it if new, 0 if out of memory */
+static uint32_t lpm_tag(struct ulogd_lpm_builder *b, const char *tag)
+{
+	size_t len = strlen(tag);
+	uint32_t j;
+
+	if (len == 0)
+		return 0;
+
+	if (2 * (b->num_tags + 1) > b->tag_hash_size &&
+	    lpm_tag_rehash(b) < 0)
+		return 0;
+
+	j = jhash(tag, len, 0) & (b->tag_hash_size - 1);
+	while (b->tag_hash[j]) {
+		if (strcmp(b->tags + b->tag_hash[j], tag) == 0)
+			return b->tag_hash[j];
+		j = (j + 1) & (b->tag_hash_size - 1);
+	}
+
+	if (b->tags_len + len + 1 >= LPM_NODE)
+		return 0;
+	if (b->tags_len + len + 1 > b->tags_size) {
+		size_t size = b->tags_size * 2;
+		char *tags;
+
+		while (size < b->tags_len + len + 1)
+			size *= 2;
+		tags = realloc(b->tags, size);
+		if (!tags)
+			return 0;
+		b->tags = tags;
+		b->tags_size = size;
+	}
+	memcpy(b->tags + b->tags_len, tag, len + 1);
+	b->tag_hash[j] = b->tags_len;
+	b->tags_len += len + 1;
+	b->num_tags++;
+
+	return b->tag_hash[j];
+}
+
+int ulogd_lpm_add(struct ulogd_lpm_builder *b, int family, const void *addr,
+		  unsigned int bits, const char *tag)
+{
+	struct lpm_prefix *p;
+	uint64_t k[3];
+	int v6;
+
+	switch (family) {
+	case AF_INET:
+		v6 = 0;
+		break;
+	case AF_INET6:
+		v6 = 1;
+		break;
+	default:
+		return -1;
+	}
+	if (bits > (v6 ? 128 : 32))
+		return -1;
+
+	if (b->num_prefixes == b->max_prefixes) {
+		unsigned int max = b->max_prefixes ? b->max_prefixes * 2 : 1024;
+
+		p = realloc(b->prefixes, max * sizeof(*p));
+		if (!p)
+			return -1;
+		b->prefixes = p;
+		b->max_prefixes = max;
+	}
+
+	p = &b->prefixes[b->num_prefixes];
+	p->tag = lpm_tag(b, tag);
+	if (p->tag == 0 && tag[0] != '\0')
+		return -1;
+
+	lpm_key(k, v6, addr);
+	/* clear the host bits */
+	if (bits <= 64) {
+		k[0] &= bits ? ~0ULL << (64 - bits) : 0;
+		k[1] = 0;
+	} else if (bits < 128)
+		k[1] &= ~0ULL << (128 - bits);
+	p->key[0] = k[0];
+	p->key[1] = k[1];
+	p->v6 = v6;
+	p->bits = bits;
+	p->seq = b->num_prefixes++;
+
+	return 0;
+}
+
+static int lpm_prefix_cmp(const void *a, const void *b)
+{
+	const struct lpm_prefix *pa = a, *pb = b;
+
+	if (pa->bits != pb->bits)
+		return pa->bits < pb->bits ? -1 : 1;
+	if (pa->seq != pb->seq)
+		return pa->seq < pb->seq ? -1 : 1;
+	return 0;
+}
+
+static int lpm_bnode_new(struct ulogd_lpm_builder *b, uint32_t fill)
+{
+	unsigned int i;
+
+	if (b->num_nodes == b->max_nodes) {
+		unsigned int max = b->max_nodes ? b->max_nodes * 2 : 1024;
+		struct lpm_bnode *n;
+
+		if (max >= LPM_NODE)
+			return -1;
+		n = realloc(b->nodes, max * sizeof(*n));
+		if (!n)
+			return -1;
+		b->nodes = n;
+		b->max_nodes = max;
+	}
+	for (i = 0; i < LPM_SLOTS; i++)
+		b->nodes[b->num_nodes].slot[i] = fill;
+
+	return b->num_nodes++;
+}
+
+/* set the slots covered by p to its tag, expanding it to the stride.
+ * Longer prefixes are inserted later, so no child is overwritten. */
+static int lpm_insert(struct ulogd_lpm_builder *b, const struct lpm_prefix *p)
+{
+	uint32_t *root = b->root + (p->v6 ? LPM_ROOT_SIZE : 0);
+	uint64_t k[3] = { p->key[0], p->key[1], 0 };
+	unsigned int off = LPM_ROOT_BITS, slot, count, i;
+	int parent = -1;
+
+	slot = k[0] >> (64 - LPM_ROOT_BITS);
+	if (p->bits <= LPM_ROOT_BITS) {
+		count = 1 << (LPM_ROOT_BITS - p->bits);
+		for (i = 0; i < count; i++)
+			root[slot + i] = p->tag;
+		return 0;
+	}
+
+	for (;;) {
+		uint32_t *s = parent < 0 ? &root[slot] :
+					   &b->nodes[parent].slot[slot];
+		int n;
+
+		if (*s & LPM_NODE)
+			n = *s & ~LPM_NODE;
+		else {
+			n = lpm_bnode_new(b, *s);
+			if (n < 0)
+				return -1;
+			/* the nodes may have moved */
+			s = parent < 0 ? &root[slot] :
+					 &b->nodes[parent].slot[slot];
+			*s = LPM_NODE | n;
+		}
+
+		parent = n;
+		slot = lpm_bits(k, off);
+		if (p->bits <= off + LPM_STRIDE) {
+			count = 1 << (off + LPM_STRIDE - p->bits);
+			for (i = 0; i < count; i++)
+				b->nodes[n].slot[slot + i] = p->tag;
+			return 0;
+		}
+		off += LPM_STRIDE;
+	}
+}
+
+static int lpm_leaf(struct ulogd_lpm_builder *b, uint32_t tag)
+{
+	if (b->num_leaves == b->max_leaves) {
+		unsigned int max = b->max_leaves ? b->max_leaves * 2 : 4096;
+		uint32_t *l;
+
+		if (max >= LPM_NODE)
+			return -1;
+		l = realloc(b->leaves, max * sizeof(*l));
+		if (!l)
+			return -1;
+		b->leaves = l;
+		b->max_leaves = max;
+	}
+	b->leaves[b->num_leaves++] = tag;
+	return 0;
+}
+
+/* compile builder node bn into nodes[cn], the children of a node are
+ * given consecutive indexes before compiling them */
+static int lpm_compile_node(struct ulogd_lpm_builder *b,
+			    struct lpm_node *nodes, unsigned int *next,
+			    unsigned int bn, unsigned int cn)
+{
+	const uint32_t *slot = b->nodes[bn].slot;
+	struct lpm_node *n = &nodes[cn];
+	unsigned int i, child;
+	int last = -1;
+
+	n->vector = 0;
+	n->leafvec = 0;
+	n->base0 = b->num_leaves;
+	n->base1 = *next;
+
+	for (i = 0; i < LPM_SLOTS; i++) {
+		if (slot[i] & LPM_NODE) {
+			n->vector |= 1ULL << i;
+			continue;
+		}
+		if (last >= 0 && slot[i] == (uint32_t)last)
+			continue;
+		n->leafvec |= 1ULL << i;
+		if (lpm_leaf(b, slot[i]) < 0)
+			return -1;
+		last = slot[i];
+	}
+
+	*next += __builtin_popcountll(n->vector);
+	for (i = 0, child = n->base1; i < LPM_SLOTS; i++) {
+		if (!(slot[i] & LPM_NODE))
+			continue;
+		if (lpm_compile_node(b, nodes, next, slot[i] & ~LPM_NODE,
+				     child++) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void lpm_init(struct ulogd_lpm *lpm)
+{
+	const char *p = lpm->image;
+
+	lpm->hdr = lpm->image;
+	p += sizeof(struct lpm_header);
+	lpm->root = (const uint32_t *)p;
+	p += 2 * LPM_ROOT_SIZE * sizeof(uint32_t);
+	lpm->nodes = (const struct lpm_node *)p;
+	p += lpm->hdr->num_nodes * sizeof(struct lpm_node);
+	lpm->leaves = (const uint32_t *)p;
+	p += lpm->hdr->num_leaves * sizeof(uint32_t);
+	lpm->tags = p;
+}
+
+static size_t lpm_image_size(const struct lpm_header *hdr)
+{
+	return sizeof(*hdr) + 2 * LPM_ROOT_SIZE * sizeof(uint32_t) +
+	       (size_t)hdr->num_nodes * sizeof(struct lpm_node) +
+	       (size_t)hdr->num_leaves * sizeof(uint32_t) + hdr->tags_len;
+}
+
+void *ulogd_lpm_compile(struct ulogd_lpm_builder *b, const uint64_t source[2],
+			size_t *size)
+{
+	struct lpm_header hdr;
+	struct lpm_node *nodes = NULL;
+	unsigned int i, next;
+	uint32_t *root;
+	char *image;
+
+	free(b->root);
+	b->root = calloc(2 * LPM_ROOT_SIZE, sizeof(*b->root));
+	if (!b->root)
+		return NULL;
+	b->num_nodes = 0;
+	b->num_leaves = 0;
+
+	/* shortest first, duplicates in the order they were added */
+	qsort(b->prefixes, b->num_prefixes, sizeof(*b->prefixes),
+	      lpm_prefix_cmp);
+	for (i = 0; i < b->num_prefixes; i++)
+		if (lpm_insert(b, &b->prefixes[i]) < 0)
+			return NULL;
+
+	if (b->num_nodes) {
+		nodes = malloc(b->num_nodes * sizeof(*nodes));
+		if (!nodes)
+			return NULL;
+	}
+	for (i = 0, next = 0; i < 2 * LPM_ROOT_SIZE; i++) {
+		unsigned int cn;
+
+		if (!(b->root[i] & LPM_NODE))
+			continue;
+		cn = next++;
+		if (lpm_compile_node(b, nodes, &next, b->root[i] & ~LPM_NODE,
+				     cn) < 0) {
+			free(nodes);
+			return NULL;
+		}
+		b->root[i] = LPM_NODE | cn;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, LPM_MAGIC, sizeof(hdr.magic));
+	hdr.version = LPM_VERSION;
+	hdr.byteorder = LPM_BYTEORDER;
+	if (source) {
+		hdr.source[0] = source[0];
+		hdr.source[1] = source[1];
+	}
+	hdr.num_prefixes = b->num_prefixes;
+	hdr.num_nodes = b->num_nodes;
+	hdr.num_leaves = b->num_leaves;
+	hdr.tags_len = b->tags_len;
+
+	*size = lpm_image_size(&hdr);
+	image = malloc(*size);
+	if (!image) {
+		free(nodes);
+		return NULL;
+	}
+
+	memcpy(image, &hdr, sizeof(hdr));
+	root = (uint32_t *)(image + sizeof(hdr));
+	memcpy(root, b->root, 2 * LPM_ROOT_SIZE * sizeof(*root));
+	memcpy(root + 2 * LPM_ROOT_SIZE, nodes,
+	       b->num_nodes * sizeof(*nodes));
+	memcpy((char *)(root + 2 * LPM_ROOT_SIZE) +
+	       b->num_nodes * sizeof(*nodes), b->leaves,
+	       b->num_leaves * sizeof(*b->leaves));
+	memcpy(image + *size - b->tags_len, b->tags, b->tags_len);
+
+	free(nodes);
+	return image;
+}
+
+/* check that a lookup in the image can't go astray: children come after
+ * their parent so the trie has no loop, and every index is in range */
+static int lpm_check(const struct ulogd_lpm *lpm, size_t size)
+{
+	const struct lpm_header *hdr = lpm->hdr;
+	unsigned int i;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, LPM_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != LPM_VERSION || hdr->byteorder != LPM_BYTEORDER ||
+	    hdr->num_nodes >= LPM_NODE || hdr->num_leaves >= LPM_NODE ||
+	    hdr->tags_len == 0 || hdr->tags_len >= LPM_NODE ||
+	    lpm_image_size(hdr) != size ||
+	    lpm->tags[hdr->tags_len - 1] != '\0')
+		return -1;
+
+	for (i = 0; i < 2 * LPM_ROOT_SIZE; i++) {
+		uint32_t e = lpm->root[i];
+
+		if (e & LPM_NODE ? (e & ~LPM_NODE) >= hdr->num_nodes :
+				   e >= hdr->tags_len)
+			return -1;
+	}
+
+	for (i = 0; i < hdr->num_nodes; i++) {
+		const struct lpm_node *n = &lpm->nodes[i];
+		uint64_t leaves = ~n->vector;
+
+		if (n->leafvec & n->vector)
+			return -1;
+		/* the first leaf slot starts a run */
+		if (leaves && !(n->leafvec & leaves & -leaves))
+			return -1;
+		if (n->vector && (n->base1 <= i ||
+		    (uint64_t)n->base1 + __builtin_popcountll(n->vector) >
+		    hdr->num_nodes))
+			return -1;
+		if ((uint64_t)n->base0 + __builtin_popcountll(n->leafvec) >
+		    hdr->num_leaves)
+			return -1;
+	}
+
+	for (i = 0; i < hdr->num_leaves; i++)
+		if (lpm->leaves[i] >= hdr->tags_len)
+			return -1;
+
+	return 0;
+}
+
+struct ulogd_lpm *ulogd_lpm_load(void *image, size_t size)
+{
+	struct ulogd_lpm *lpm = calloc(1, sizeof(*lpm));
+
+	if (!lpm)
+		return NULL;
+
+	lpm->image = image;
+	lpm->size = size;
+	lpm_init(lpm);
+	return lpm;
+}
+
+struct ulogd_lpm *ulogd_lpm_open(const char *path, const uint64_t source[2])
+{
+	struct ulogd_lpm *lpm;
+	struct stat st;
+	void *image;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(struct lpm_header)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	err = errno;
+	close(fd);
+	if (image == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+
+	lpm = calloc(1, sizeof(*lpm));
+	if (!lpm) {
+		munmap(image, st.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	lpm->image = image;
+	lpm->size = st.st_size;
+	lpm->mapped = 1;
+
+	lpm_init(lpm);
+	if (lpm_check(lpm, st.st_size) < 0) {
+		ulogd_lpm_close(lpm);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (source && (lpm->hdr->source[0] != source[0] ||
+		       lpm->hdr->source[1] != source[1])) {
+		ulogd_lpm_close(lpm);
+		errno = ESTALE;
+		return NULL;
+	}
+
+	return lpm;
+}
+
+void ulogd_lpm_close(struct ulogd_lpm *lpm)
+{
+	if (!lpm)
+		return;
+
+	if (lpm->mapped)
+		munmap(lpm->image, lpm->size);
+	else
+		free(lpm->image);
+	free(lpm);
+}
+
+int ulogd_lpm_save(const struct ulogd_lpm *lpm, const char *path)
+{
+	size_t len = strlen(path), done = 0;
+	char *tmp = malloc(len + sizeof(".XXXXXX"));
+	int fd, err;
+
+	if (!tmp)
+		return -1;
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		err = errno;
+		free(tmp);
+		errno = err;
+		return -1;
+	}
+
+	while (done < lpm->size) {
+		ssize_t ret = write(fd, (const char *)lpm->image + done,
+				    lpm->size - done);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			goto err;
+		}
+		done += ret;
+	}
+	if (fchmod(fd, 0644) < 0 || fsync(fd) < 0)
+		goto err;
+	if (close(fd) < 0) {
+		fd = -1;
+		goto err;
+	}
+	fd = -1;
+	if (rename(tmp, path) < 0)
+		goto err;
+
+	free(tmp);
+	return 0;
+
+err:
+	err = errno;
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	free(tmp);
+	errno = err;
+	return -1;
+}
+
+unsigned int ulogd_lpm_count(const struct ulogd_lpm *lpm)
+{
+	return lpm->hdr->num_prefixes;
+}
+
+const char *ulogd_lpm_lookup(const struct ulogd_lpm *lpm, int family,
+			     const void *addr)
+{
+	const uint32_t *root = lpm->root;
+	unsigned int off = LPM_ROOT_BITS, maxbits = 32;
+	uint64_t k[3];
+	uint32_t e;
+
+	switch (family) {
+	case AF_INET:
+		lpm_key(k, 0, addr);
+		break;
+	case AF_INET6:
+		lpm_key(k, 1, addr);
+		root += LPM_ROOT_SIZE;
+		maxbits = 128;
+		break;
+	default:
+		return NULL;
+	}
+
+	e = root[k[0] >> (64 - LPM_ROOT_BITS)];
+	while (e & LPM_NODE) {
+		const struct lpm_node *n = &lpm->nodes[e & ~LPM_NODE];
+		unsigned int slot = lpm_bits(k, off);
+		uint64_t upto = (2ULL << slot) - 1;
+
+		if (!(n->vector & (1ULL << slot))) {
+			e = lpm->leaves[n->base0 - 1 +
+					__builtin_popcountll(n->leafvec & upto)];
+			break;
+		}
+		e = LPM_NODE | (n->base1 - 1 +
+				__builtin_popcountll(n->vector & upto));
+		off += LPM_STRIDE;
+		/* only a damaged image has nodes below the last bit */
+		if (off >= maxbits)
+			return NULL;
+	}
+
+	return e ? lpm->tags + e : NULL;
+}
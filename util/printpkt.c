@@ -34,6 +34,7 @@
 #include <ulogd/ulogd.h>
 #include <ulogd/conffile.h>
 #include <ulogd/printpkt.h>
+#include <ulogd/format.h>
 #include <netinet/if_ether.h>
 
 struct ulogd_key printpkt_keys[] = {
@@ -265,10 +266,8 @@ static int printpkt_ipv4(struct ulogd_key *res, char *buf)
 			break;
 		case ICMP_REDIRECT:
 			paddr = ikey_get_u32(&res[KEY_ICMP_GATEWAY]),
-			buf_cur += sprintf(buf_cur, "GATEWAY=%s ",
-					   inet_ntop(AF_INET,
-						     &paddr,
-						     tmp, sizeof(tmp)));
+			ulogd_format_ipv4(tmp, paddr);
+			buf_cur += sprintf(buf_cur, "GATEWAY=%s ", tmp);
 			break;
 		case ICMP_DEST_UNREACH:
 			if (ikey_get_u8(&res[KEY_ICMP_CODE]) == ICMP_FRAG_NEEDED)
@@ -394,10 +393,9 @@ int printpkt_arp(struct ulogd_key *res, char *buf)
 
 		if (pp_is_valid(res, KEY_ARP_SHA) && (code == ARPOP_REPLY)) {
 			mac = ikey_get_ptr(&res[KEY_ARP_SHA]);
-			buf_cur += sprintf(buf_cur, "REPLY_MAC="
-					   "%02x:%02x:%02x:%02x:%02x:%02x ",
-					   mac[0], mac[1], mac[2],
-					   mac[3], mac[4], mac[5]);
+			buf_cur += sprintf(buf_cur, "REPLY_MAC=");
+			buf_cur = ulogd_format_mac(buf_cur, mac, ETH_ALEN, ':');
+			*buf_cur++ = ' ';
 		}
 	}
 
@@ -443,12 +441,13 @@ int printpkt_print(struct ulogd_key *res, char *buf)
 	/* FIXME: configurable */
 	if (pp_is_valid(res, KEY_RAW_MAC)) {
 		unsigned char *mac = (unsigned char *) ikey_get_ptr(&res[KEY_RAW_MAC]);
-		int i, len = ikey_get_u16(&res[KEY_RAW_MACLEN]);
+		int len = ikey_get_u16(&res[KEY_RAW_MACLEN]);
 
 		buf_cur += sprintf(buf_cur, "MAC=");
-		for (i = 0; i < len; i++)
-			buf_cur += sprintf(buf_cur, "%02x%c", mac[i],
-					   i == len - 1 ? ' ' : ':');
+		if (len > 0) {
+			buf_cur = ulogd_format_mac(buf_cur, mac, len, ':');
+			*buf_cur++ = ' ';
+		}
 	} else
 		buf_cur += sprintf(buf_cur, "MAC= ");
 
@@ -0,0 +1,413 @@
+/* sketch.c
+ *
+ * ulogd helper functions to summarize streams in fixed memory
+ *
+ * Space-Saving uses the stream summary of Metwally et al.: counters
+ * with the same count share a bucket, and buckets are kept sorted in a
+ * doubly linked list. Counting one more occurrence moves the counter
+ * to the next bucket, or creates it right after its own, so that the
+ * counter with the lowest count, which is replaced by a new key, is
+ * always at hand. Counters and buckets are preallocated and linked by
+ * index.
+ *
+ * Count-Min takes the rows from two halves of a 64 bit hash, as in
+ * Kirsch and Mitzenmacher, and only increments the rows holding the
+ * minimum (conservative update).
+ *
+ * HyperLogLog follows Flajolet et al., with linear counting for small
+ * cardinalities.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <ulogd/sketch.h>
+
+#define NONE	ULOGD_TOPK_NONE
+
+struct topk_counter {
+	uint32_t hnext;
+	uint32_t prev;		/* in the bucket */
+	uint32_t next;
+	uint32_t bucket;
+	uint32_t hash;
+	uint32_t pad;
+	uint64_t error;
+	unsigned char key[];
+};
+
+struct topk_bucket {
+	uint64_t count;
+	uint32_t prev;		/* lower count */
+	uint32_t next;		/* higher count, or next free */
+	uint32_t head;		/* counters */
+	uint32_t pad;
+};
+
+struct ulogd_topk {
+	unsigned int num_counters;
+	unsigned int used;
+	size_t key_len;
+	size_t stride;
+	uint32_t hash_mask;
+	uint32_t *hash;
+	uint32_t min;		/* bucket with the lowest count */
+	uint32_t max;
+	uint32_t free;
+	struct topk_bucket *buckets;
+	unsigned char *counters;
+};
+
+static inline struct topk_counter *counter(const struct ulogd_topk *tk,
+					   uint32_t i)
+{
+	return (struct topk_counter *)(tk->counters + i * tk->stride);
+}
+
+struct ulogd_topk *ulogd_topk_alloc(unsigned int counters, size_t key_len)
+{
+	struct ulogd_topk *tk;
+	uint32_t size = 1;
+
+	if (counters == 0 || counters >= NONE / 2)
+		return NULL;
+	while (size < 2 * counters)
+		size <<= 1;
+
+	tk = calloc(1, sizeof(*tk));
+	if (!tk)
+		return NULL;
+	tk->num_counters = counters;
+	tk->key_len = key_len;
+	tk->stride = (sizeof(struct topk_counter) + key_len + 7) & ~(size_t)7;
+	tk->hash_mask = size - 1;
+	tk->hash = malloc(size * sizeof(uint32_t));
+	/* one more, as a bucket is created before one is emptied */
+	tk->buckets = malloc((counters + 1) * sizeof(struct topk_bucket));
+	tk->counters = malloc(counters * tk->stride);
+	if (!tk->hash || !tk->buckets || !tk->counters) {
+		ulogd_topk_free(tk);
+		return NULL;
+	}
+	ulogd_topk_reset(tk);
+
+	return tk;
+}
+
+void ulogd_topk_free(struct ulogd_topk *tk)
+{
+	if (!tk)
+		return;
+	free(tk->hash);
+	free(tk->buckets);
+	free(tk->counters);
+	free(tk);
+}
+
+void ulogd_topk_reset(struct ulogd_topk *tk)
+{
+	unsigned int i;
+
+	memset(tk->hash, 0xff, (tk->hash_mask + 1) * sizeof(uint32_t));
+	for (i = 0; i <= tk->num_counters; i++)
+		tk->buckets[i].next = i + 1 <= tk->num_counters ? i + 1 : NONE;
+	tk->free = 0;
+	tk->min = tk->max = NONE;
+	tk->used = 0;
+}
+
+static uint32_t bucket_new(struct ulogd_topk *tk, uint64_t count,
+			   uint32_t after)
+{
+	uint32_t b = tk->free;
+	struct topk_bucket *nb = &tk->buckets[b];
+
+	tk->free = nb->next;
+	nb->count = count;
+	nb->head = NONE;
+	nb->prev = after;
+	if (after == NONE) {
+		nb->next = tk->min;
+		tk->min = b;
+	} else {
+		nb->next = tk->buckets[after].next;
+		tk->buckets[after].next = b;
+	}
+	if (nb->next == NONE)
+		tk->max = b;
+	else
+		tk->buckets[nb->next].prev = b;
+
+	return b;
+}
+
+static void bucket_drop(struct ulogd_topk *tk, uint32_t b)
+{
+	struct topk_bucket *ob = &tk->buckets[b];
+
+	if (ob->prev == NONE)
+		tk->min = ob->next;
+	else
+		tk->buckets[ob->prev].next = ob->next;
+	if (ob->next == NONE)
+		tk->max = ob->prev;
+	else
+		tk->buckets[ob->next].prev = ob->prev;
+
+	ob->next = tk->free;
+	tk->free = b;
+}
+
+static void counter_attach(struct ulogd_topk *tk, uint32_t i, uint32_t b)
+{
+	struct topk_counter *c = counter(tk, i);
+
+	c->bucket = b;
+	c->prev = NONE;
+	c->next = tk->buckets[b].head;
+	if (c->next != NONE)
+		counter(tk, c->next)->prev = i;
+	tk->buckets[b].head = i;
+}
+
+static void counter_detach(struct ulogd_topk *tk, uint32_t i)
+{
+	struct topk_counter *c = counter(tk, i);
+
+	if (c->prev == NONE)
+		tk->buckets[c->bucket].head = c->next;
+	else
+		counter(tk, c->prev)->next = c->next;
+	if (c->next != NONE)
+		counter(tk, c->next)->prev = c->prev;
+
+	if (tk->buckets[c->bucket].head == NONE)
+		bucket_drop(tk, c->bucket);
+}
+
+static void counter_increment(struct ulogd_topk *tk, uint32_t i)
+{
+	struct topk_counter *c = counter(tk, i);
+	uint32_t b = c->bucket;
+	uint32_t nb = tk->buckets[b].next;
+	uint64_t count = tk->buckets[b].count + 1;
+	int alone = c->prev == NONE && c->next == NONE;
+
+	if (nb != NONE && tk->buckets[nb].count == count) {
+		counter_detach(tk, i);
+		counter_attach(tk, i, nb);
+	} else if (alone) {
+		tk->buckets[b].count = count;
+	} else {
+		nb = bucket_new(tk, count, b);
+		counter_detach(tk, i);
+		counter_attach(tk, i, nb);
+	}
+}
+
+static void hash_remove(struct ulogd_topk *tk, uint32_t i)
+{
+	struct topk_counter *c = counter(tk, i);
+	uint32_t *p = &tk->hash[c->hash & tk->hash_mask];
+
+	while (*p != i)
+		p = &counter(tk, *p)->hnext;
+	*p = c->hnext;
+}
+
+uint32_t ulogd_topk_add(struct ulogd_topk *tk, const void *key,
+			uint32_t hash, int *fresh)
+{
+	uint32_t *head = &tk->hash[hash & tk->hash_mask];
+	struct topk_counter *c;
+	uint64_t count;
+	uint32_t i;
+
+	for (i = *head; i != NONE; i = c->hnext) {
+		c = counter(tk, i);
+		if (c->hash == hash && memcmp(c->key, key, tk->key_len) == 0) {
+			counter_increment(tk, i);
+			*fresh = 0;
+			return i;
+		}
+	}
+
+	/* a key which isn't counted occurred at most min times */
+	if (tk->used < tk->num_counters) {
+		i = tk->used++;
+		c = counter(tk, i);
+		c->error = 0;
+		count = 1;
+	} else {
+		i = tk->buckets[tk->min].head;
+		c = counter(tk, i);
+		c->error = tk->buckets[tk->min].count;
+		count = c->error + 1;
+		hash_remove(tk, i);
+		counter_detach(tk, i);
+	}
+
+	c->hash = hash;
+	memcpy(c->key, key, tk->key_len);
+	c->hnext = *head;
+	*head = i;
+
+	/* the lowest count, or one more than the lowest */
+	if (tk->min != NONE && tk->buckets[tk->min].count == count) {
+		counter_attach(tk, i, tk->min);
+	} else if (tk->min != NONE && tk->buckets[tk->min].count < count) {
+		uint32_t nb = tk->buckets[tk->min].next;
+
+		if (nb == NONE || tk->buckets[nb].count != count)
+			nb = bucket_new(tk, count, tk->min);
+		counter_attach(tk, i, nb);
+	} else {
+		counter_attach(tk, i, bucket_new(tk, count, NONE));
+	}
+
+	*fresh = 1;
+	return i;
+}
+
+uint32_t ulogd_topk_first(const struct ulogd_topk *tk)
+{
+	return tk->max == NONE ? NONE : tk->buckets[tk->max].head;
+}
+
+uint32_t ulogd_topk_next(const struct ulogd_topk *tk, uint32_t i)
+{
+	const struct topk_counter *c = counter(tk, i);
+	uint32_t b;
+
+	if (c->next != NONE)
+		return c->next;
+	b = tk->buckets[c->bucket].prev;
+	return b == NONE ? NONE : tk->buckets[b].head;
+}
+
+uint64_t ulogd_topk_count(const struct ulogd_topk *tk, uint32_t i)
+{
+	return tk->buckets[counter(tk, i)->bucket].count;
+}
+
+uint64_t ulogd_topk_error(const struct ulogd_topk *tk, uint32_t i)
+{
+	return counter(tk, i)->error;
+}
+
+const void *ulogd_topk_key(const struct ulogd_topk *tk, uint32_t i)
+{
+	return counter(tk, i)->key;
+}
+
+uint32_t ulogd_topk_hash(const struct ulogd_topk *tk, uint32_t i)
+{
+	return counter(tk, i)->hash;
+}
+
+int ulogd_cms_init(struct ulogd_cms *cms, unsigned int width)
+{
+	uint32_t size = 1;
+
+	if (width == 0 || width > (1U << 28))
+		return -1;
+	while (size < width)
+		size <<= 1;
+
+	cms->mask = size - 1;
+	cms->rows = calloc(ULOGD_CMS_DEPTH * size, sizeof(uint32_t));
+	return cms->rows ? 0 : -1;
+}
+
+void ulogd_cms_free(struct ulogd_cms *cms)
+{
+	free(cms->rows);
+	cms->rows = NULL;
+}
+
+void ulogd_cms_reset(struct ulogd_cms *cms)
+{
+	memset(cms->rows, 0,
+	       ULOGD_CMS_DEPTH * (cms->mask + 1) * sizeof(uint32_t));
+}
+
+static inline void cms_cells(const struct ulogd_cms *cms, uint64_t hash,
+			     uint32_t **cell)
+{
+	uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+	unsigned int i;
+
+	for (i = 0; i < ULOGD_CMS_DEPTH; i++)
+		cell[i] = &cms->rows[(i * (cms->mask + 1)) +
+				     ((h1 + i * h2) & cms->mask)];
+}
+
+uint32_t ulogd_cms_add(struct ulogd_cms *cms, uint64_t hash)
+{
+	uint32_t *cell[ULOGD_CMS_DEPTH];
+	uint32_t min = UINT32_MAX;
+	unsigned int i;
+
+	cms_cells(cms, hash, cell);
+	for (i = 0; i < ULOGD_CMS_DEPTH; i++)
+		if (*cell[i] < min)
+			min = *cell[i];
+	if (min == UINT32_MAX)
+		return min;
+	min++;
+	for (i = 0; i < ULOGD_CMS_DEPTH; i++)
+		if (*cell[i] < min)
+			*cell[i] = min;
+
+	return min;
+}
+
+uint32_t ulogd_cms_estimate(const struct ulogd_cms *cms, uint64_t hash)
+{
+	uint32_t *cell[ULOGD_CMS_DEPTH];
+	uint32_t min = UINT32_MAX;
+	unsigned int i;
+
+	cms_cells(cms, hash, cell);
+	for (i = 0; i < ULOGD_CMS_DEPTH; i++)
+		if (*cell[i] < min)
+			min = *cell[i];
+
+	return min;
+}
+
+uint64_t ulogd_hll_count(const uint8_t *reg, unsigned int bits)
+{
+	unsigned int m = 1U << bits, zeros = 0, i;
+	double sum = 0, alpha, e;
+
+	for (i = 0; i < m; i++) {
+		sum += 1.0 / (double)(1ULL << reg[i]);
+		zeros += reg[i] == 0;
+	}
+
+	switch (m) {
+	case 16:
+		alpha = 0.673;
+		break;
+	case 32:
+		alpha = 0.697;
+		break;
+	case 64:
+		alpha = 0.709;
+		break;
+	default:
+		alpha = 0.7213 / (1 + 1.079 / m);
+		break;
+	}
+	e = alpha * m * m / sum;
+	if (e <= 2.5 * m && zeros)
+		e = m * log((double)m / zeros);
+
+	return e + 0.5;
+}
@@ -0,0 +1,453 @@
+/* transport.c
+ *
+ * ulogd helper functions to ship newline terminated records to a
+ * remote collector over tcp, udp or unix sockets without blocking
+ * the main loop.
+ *
+ * Records are appended to a bounded in-memory queue.  The queue is
+ * flushed from the ulogd select loop as soon as the socket is writable,
+ * so all records produced during one loop iteration end up in a single
+ * send().  If the collector goes away we reconnect with an exponential
+ * backoff, and records which do not fit in the queue are dropped and
+ * accounted for.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/transport.h>
+
+static void transport_connect(struct ulogd_transport *t);
+
+static unsigned int transport_when(struct ulogd_transport *t)
+{
+	unsigned int when = 0;
+
+	switch (t->state) {
+	case TRANSPORT_CONNECTING:
+		when = ULOGD_FD_WRITE;
+		break;
+	case TRANSPORT_CONNECTED:
+		/* stream peers closing the connection make us readable */
+		if (t->socktype == SOCK_STREAM)
+			when |= ULOGD_FD_READ;
+		if (t->head != t->tail)
+			when |= ULOGD_FD_WRITE;
+		break;
+	}
+	return when;
+}
+
+static void transport_report_drops(struct ulogd_transport *t)
+{
+	if (t->dropped == 0)
+		return;
+
+	ulogd_log(ULOGD_NOTICE, "%s: %" PRIu64 " records dropped\n",
+		  t->name, t->dropped);
+	t->dropped_total += t->dropped;
+	t->dropped = 0;
+}
+
+static void transport_account(struct ulogd_transport *t)
+{
+	if (!t->stats)
+		return;
+
+	t->stats->drops = t->dropped_total + t->dropped;
+	t->stats->backlog = t->tail - t->head;
+}
+
+static unsigned int count_records(const char *buf, unsigned int len)
+{
+	unsigned int num = 0;
+	const char *p = buf, *end = buf + len;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		num++;
+		p++;
+	}
+	return num;
+}
+
+static void transport_reconnect_cb(struct ulogd_timer *timer, void *data)
+{
+	transport_connect(data);
+}
+
+static void transport_schedule_reconnect(struct ulogd_transport *t)
+{
+	ulogd_log(ULOGD_NOTICE, "%s: reconnecting in %u seconds\n",
+		  t->name, t->backoff);
+	ulogd_add_timer(&t->timer, t->backoff);
+
+	t->backoff *= 2;
+	if (t->backoff > TRANSPORT_BACKOFF_MAX)
+		t->backoff = TRANSPORT_BACKOFF_MAX;
+}
+
+static void transport_close(struct ulogd_transport *t)
+{
+	if (t->state != TRANSPORT_DISCONNECTED) {
+		ulogd_unregister_fd(&t->ufd);
+		close(t->ufd.fd);
+		t->ufd.fd = -1;
+		t->state = TRANSPORT_DISCONNECTED;
+	}
+
+	/* never send the tail of a record to the next connection */
+	if (t->partial) {
+		char *p = memchr(t->queue + t->head, '\n', t->tail - t->head);
+
+		t->head = p - t->queue + 1;
+		t->dropped++;
+		t->partial = 0;
+	}
+	if (t->head == t->tail)
+		t->head = t->tail = 0;
+	transport_account(t);
+}
+
+static void transport_lost(struct ulogd_transport *t, int err)
+{
+	ulogd_log(ULOGD_ERROR, "%s: connection lost: %s\n", t->name,
+		  err ? strerror(err) : "closed by peer");
+	transport_close(t);
+	transport_schedule_reconnect(t);
+}
+
+static void transport_connected(struct ulogd_transport *t)
+{
+	ulogd_log(ULOGD_INFO, "%s: connected\n", t->name);
+	t->state = TRANSPORT_CONNECTED;
+	t->backoff = 1;
+	transport_report_drops(t);
+}
+
+static void transport_connect(struct ulogd_transport *t)
+{
+	int fd, flags;
+
+	fd = socket(t->addr.ss_family, t->socktype, 0);
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't create socket: %s\n",
+			  t->name, strerror(errno));
+		transport_schedule_reconnect(t);
+		return;
+	}
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't set nonblocking mode: %s\n",
+			  t->name, strerror(errno));
+		close(fd);
+		transport_schedule_reconnect(t);
+		return;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (connect(fd, (struct sockaddr *) &t->addr, t->addrlen) < 0) {
+		if (errno != EINPROGRESS) {
+			ulogd_log(ULOGD_ERROR, "%s: can't connect: %s\n",
+				  t->name, strerror(errno));
+			close(fd);
+			transport_schedule_reconnect(t);
+			return;
+		}
+		t->state = TRANSPORT_CONNECTING;
+	} else
+		transport_connected(t);
+
+	t->ufd.fd = fd;
+	t->ufd.when = transport_when(t);
+	if (ulogd_register_fd(&t->ufd) < 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't register fd\n", t->name);
+		close(fd);
+		t->ufd.fd = -1;
+		t->state = TRANSPORT_DISCONNECTED;
+		transport_schedule_reconnect(t);
+	}
+}
+
+/* find the largest run of complete records which fits in one datagram */
+static unsigned int dgram_chunk(struct ulogd_transport *t)
+{
+	unsigned int len = t->tail - t->head;
+	const char *p;
+
+	if (len > t->dgram_max)
+		len = t->dgram_max;
+
+	for (p = t->queue + t->head + len - 1; p >= t->queue + t->head; p--) {
+		if (*p == '\n')
+			return p - (t->queue + t->head) + 1;
+	}
+
+	/* a single record bigger than a datagram, send it alone */
+	p = memchr(t->queue + t->head, '\n', t->tail - t->head);
+	return p - (t->queue + t->head) + 1;
+}
+
+static void transport_flush(struct ulogd_transport *t)
+{
+	while (t->head != t->tail) {
+		unsigned int len = t->tail - t->head;
+		ssize_t ret;
+
+		if (t->socktype == SOCK_DGRAM)
+			len = dgram_chunk(t);
+
+		ret = send(t->ufd.fd, t->queue + t->head, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (t->socktype == SOCK_DGRAM && errno == EMSGSIZE) {
+				/* the socket has a lower limit than ours, learn
+				 * it and drop records which can never fit */
+				if (count_records(t->queue + t->head, len) > 1) {
+					t->dgram_max = len - 1;
+					continue;
+				}
+				ulogd_log(ULOGD_NOTICE, "%s: dropping a %u bytes "
+					  "record, too large for a datagram\n",
+					  t->name, len);
+				t->dropped++;
+				t->head += len;
+				continue;
+			}
+			if (t->socktype == SOCK_DGRAM &&
+			    t->addr.ss_family != AF_UNIX) {
+				/* nobody listening, udp is lossy anyway */
+				t->dropped += count_records(t->queue + t->head,
+							    len);
+				t->head += len;
+				continue;
+			}
+			transport_lost(t, errno);
+			return;
+		}
+		t->head += ret;
+		t->partial = t->queue[t->head - 1] != '\n';
+	}
+
+	if (t->head == t->tail) {
+		t->head = t->tail = 0;
+		transport_report_drops(t);
+	}
+	transport_account(t);
+	ulogd_update_fd(&t->ufd, transport_when(t));
+}
+
+static int transport_fd_cb(int fd, unsigned int what, void *data)
+{
+	struct ulogd_transport *t = data;
+
+	if (t->state == TRANSPORT_CONNECTING) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+		if (err) {
+			ulogd_log(ULOGD_ERROR, "%s: can't connect: %s\n",
+				  t->name, strerror(err));
+			transport_close(t);
+			transport_schedule_reconnect(t);
+			return 0;
+		}
+		transport_connected(t);
+		ulogd_update_fd(&t->ufd, transport_when(t));
+		return 0;
+	}
+
+	if (what & ULOGD_FD_READ) {
+		char buf[256];
+		ssize_t ret;
+
+		/* we don't expect anything from the peer, just drain it */
+		ret = recv(fd, buf, sizeof(buf), 0);
+		if (ret == 0) {
+			transport_lost(t, 0);
+			return 0;
+		}
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+		    errno != EINTR) {
+			transport_lost(t, errno);
+			return 0;
+		}
+	}
+
+	if (what & ULOGD_FD_WRITE)
+		transport_flush(t);
+
+	return 0;
+}
+
+int ulogd_transport_write(struct ulogd_transport *t,
+			  const char *buf, unsigned int len)
+{
+	int was_empty = t->head == t->tail;
+
+	if (t->tail + len > t->size && t->head > 0) {
+		memmove(t->queue, t->queue + t->head, t->tail - t->head);
+		t->tail -= t->head;
+		t->head = 0;
+	}
+
+	if (t->tail + len > t->size) {
+		if (t->dropped == 0)
+			ulogd_log(ULOGD_NOTICE, "%s: queue full, dropping "
+				  "records\n", t->name);
+		t->dropped += count_records(buf, len);
+		transport_account(t);
+		return -1;
+	}
+
+	memcpy(t->queue + t->tail, buf, len);
+	t->tail += len;
+	transport_account(t);
+
+	/* the data is sent once the select loop tells us we can write */
+	if (was_empty && t->state == TRANSPORT_CONNECTED)
+		ulogd_update_fd(&t->ufd, transport_when(t));
+
+	return 0;
+}
+
+static int transport_resolve(struct ulogd_transport *t, const char *host,
+			     const char *port)
+{
+	struct addrinfo hints;
+	struct addrinfo *result;
+	int ret;
+
+	if (!host || !port) {
+		ulogd_log(ULOGD_ERROR, "%s: host and port are required\n",
+			  t->name);
+		return -1;
+	}
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = t->socktype;
+
+	ret = getaddrinfo(host, port, &hints, &result);
+	if (ret != 0) {
+		ulogd_log(ULOGD_ERROR, "%s: getaddrinfo: %s\n", t->name,
+			  gai_strerror(ret));
+		return -1;
+	}
+
+	/* resolve once, we don't want DNS lookups while reconnecting */
+	memcpy(&t->addr, result->ai_addr, result->ai_addrlen);
+	t->addrlen = result->ai_addrlen;
+	freeaddrinfo(result);
+
+	return 0;
+}
+
+static int transport_unix_addr(struct ulogd_transport *t, const char *path)
+{
+	struct sockaddr_un *sun = (struct sockaddr_un *) &t->addr;
+
+	if (!path || strlen(path) >= sizeof(sun->sun_path)) {
+		ulogd_log(ULOGD_ERROR, "%s: invalid unix socket path\n",
+			  t->name);
+		return -1;
+	}
+
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	strcpy(sun->sun_path, path);
+	t->addrlen = sizeof(*sun);
+
+	return 0;
+}
+
+int ulogd_transport_start(struct ulogd_transport *t, const char *name,
+			  const char *mode, const char *host,
+			  const char *port, const char *path,
+			  unsigned int queue_size)
+{
+	int ret;
+
+	memset(t, 0, sizeof(*t));
+	t->name = name;
+	t->ufd.fd = -1;
+	t->ufd.cb = &transport_fd_cb;
+	t->ufd.data = t;
+	t->backoff = 1;
+	t->dgram_max = TRANSPORT_DGRAM_MAX;
+	ulogd_init_timer(&t->timer, t, transport_reconnect_cb);
+
+	if (!strcmp(mode, "tcp")) {
+		t->socktype = SOCK_STREAM;
+		ret = transport_resolve(t, host, port);
+	} else if (!strcmp(mode, "udp")) {
+		t->socktype = SOCK_DGRAM;
+		ret = transport_resolve(t, host, port);
+	} else if (!strcmp(mode, "unix")) {
+		t->socktype = SOCK_STREAM;
+		ret = transport_unix_addr(t, path);
+	} else if (!strcmp(mode, "unixgram")) {
+		t->socktype = SOCK_DGRAM;
+		ret = transport_unix_addr(t, path);
+	} else {
+		ulogd_log(ULOGD_ERROR, "%s: unknown mode `%s'\n", name, mode);
+		return -1;
+	}
+	if (ret < 0)
+		return ret;
+
+	t->size = queue_size ? queue_size : TRANSPORT_QUEUE_DEFAULT;
+	t->queue = malloc(t->size);
+	if (!t->queue) {
+		ulogd_log(ULOGD_ERROR, "%s: can't allocate queue\n", name);
+		return -1;
+	}
+
+	/* the collector may not be up yet, this is not fatal */
+	transport_connect(t);
+
+	return 0;
+}
+
+void ulogd_transport_stop(struct ulogd_transport *t)
+{
+	/* last chance to get the pending records out */
+	if (t->state == TRANSPORT_CONNECTED && t->head != t->tail)
+		transport_flush(t);
+	if (t->state != TRANSPORT_DISCONNECTED)
+		transport_close(t);
+	ulogd_del_timer(&t->timer);
+
+	t->dropped += count_records(t->queue + t->head, t->tail - t->head);
+	transport_report_drops(t);
+
+	free(t->queue);
+	t->queue = NULL;
+}
@@ -0,0 +1,335 @@
+/* tuple.c
+ *
+ * ulogd helper functions to pack the values of a list of keys
+ *
+ * The layout is computed once the stack is resolved: each key gets the
+ * size of its type, numbers in host byte order, addresses on 16 bytes
+ * with the unused bytes of IPv4 ones zeroed, strings truncated and NUL
+ * padded. As the buffer is cleared before packing, two packed tuples
+ * of the same keys are equal if and only if their bytes are.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/format.h>
+#include <ulogd/jhash.h>
+#include <ulogd/tuple.h>
+
+static int tuple_add(struct ulogd_tuple *t, const char *name, size_t len,
+		     const char *plugin)
+{
+	unsigned int i;
+
+	if (len == 0)
+		return 0;
+	if (len > ULOGD_MAX_KEYLEN) {
+		ulogd_log(ULOGD_FATAL, "%s: key name `%.*s' too long\n",
+			  plugin, (int)len, name);
+		return -1;
+	}
+	for (i = 0; i < t->num_keys; i++)
+		if (strncmp(t->field[i].name, name, len) == 0 &&
+		    t->field[i].name[len] == '\0')
+			return 0;
+	if (t->num_keys == ULOGD_TUPLE_MAX_KEYS) {
+		ulogd_log(ULOGD_FATAL, "%s: more than %u keys\n", plugin,
+			  ULOGD_TUPLE_MAX_KEYS);
+		return -1;
+	}
+
+	memset(&t->field[i], 0, sizeof(t->field[i]));
+	memcpy(t->field[i].name, name, len);
+	t->num_keys++;
+
+	return 0;
+}
+
+int ulogd_tuple_parse(struct ulogd_tuple *t, const char *list,
+		      unsigned int base, const char *plugin)
+{
+	const char *p = list;
+	unsigned int i;
+
+	memset(t, 0, sizeof(*t));
+	t->base = base;
+
+	while (*p) {
+		size_t len;
+
+		p += strspn(p, " \t,");
+		len = strcspn(p, " \t,");
+		if (tuple_add(t, p, len, plugin) < 0)
+			return -1;
+		p += len;
+	}
+	if (t->num_keys == 0) {
+		ulogd_log(ULOGD_FATAL, "%s: no keys configured\n", plugin);
+		return -1;
+	}
+
+	for (i = 0; i < t->num_keys; i++)
+		if (strcmp(t->field[i].name, "oob.family") == 0)
+			break;
+	if (i == t->num_keys) {
+		if (tuple_add(t, "oob.family", strlen("oob.family"),
+			      plugin) < 0)
+			return -1;
+		t->field[i].hidden = 1;
+	}
+	t->family = i;
+
+	return 0;
+}
+
+void ulogd_tuple_init_keys(const struct ulogd_tuple *t, struct ulogd_key *inp)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->num_keys; i++) {
+		memset(&inp[t->base + i], 0, sizeof(struct ulogd_key));
+		strcpy(inp[t->base + i].name, t->field[i].name);
+		inp[t->base + i].flags = ULOGD_KEYF_OPTIONAL;
+	}
+}
+
+static int tuple_size(uint16_t type)
+{
+	switch (type) {
+	case ULOGD_RET_INT8:
+	case ULOGD_RET_UINT8:
+	case ULOGD_RET_BOOL:
+		return 1;
+	case ULOGD_RET_INT16:
+	case ULOGD_RET_UINT16:
+		return 2;
+	case ULOGD_RET_INT32:
+	case ULOGD_RET_UINT32:
+		return 4;
+	case ULOGD_RET_INT64:
+	case ULOGD_RET_UINT64:
+		return 8;
+	case ULOGD_RET_IPADDR:
+	case ULOGD_RET_IP6ADDR:
+		return 16;
+	case ULOGD_RET_STRING:
+		return ULOGD_TUPLE_STRLEN;
+	}
+	return -1;
+}
+
+int ulogd_tuple_start(struct ulogd_tuple *t, struct ulogd_key *inp,
+		      const char *plugin)
+{
+	unsigned int i, offset = 0;
+
+	for (i = 0; i < t->num_keys; i++) {
+		struct ulogd_tuple_field *f = &t->field[i];
+		struct ulogd_key *src = inp[t->base + i].u.source;
+		int size;
+
+		/* never valid, takes no room */
+		if (!src) {
+			f->type = ULOGD_RET_NONE;
+			f->offset = offset;
+			f->size = 0;
+			continue;
+		}
+		size = tuple_size(src->type);
+		if (size < 0) {
+			ulogd_log(ULOGD_ERROR, "%s: key `%s' can't be part "
+				  "of a tuple\n", plugin, f->name);
+			return -1;
+		}
+		f->type = src->type;
+		f->offset = offset;
+		f->size = size;
+		offset += size;
+	}
+	t->len = (offset + 3) & ~3U;
+	if (t->len == 0)
+		t->len = 4;
+
+	return 0;
+}
+
+uint32_t ulogd_tuple_pack(const struct ulogd_tuple *t, struct ulogd_key *inp,
+			  void *buf)
+{
+	const struct ulogd_key *fam = inp[t->base + t->family].u.source;
+	uint8_t *p = buf;
+	uint32_t valid = 0;
+	int ipv4 = 0;
+	unsigned int i;
+
+	if (fam && (fam->flags & ULOGD_RETF_VALID))
+		ipv4 = fam->u.value.ui8 == AF_INET;
+
+	memset(buf, 0, t->len);
+	for (i = 0; i < t->num_keys; i++) {
+		const struct ulogd_tuple_field *f = &t->field[i];
+		const struct ulogd_key *src = inp[t->base + i].u.source;
+
+		if (!src || !(src->flags & ULOGD_RETF_VALID))
+			continue;
+
+		switch (f->type) {
+		case ULOGD_RET_STRING:
+			if (!src->u.value.ptr)
+				continue;
+			memcpy(p + f->offset, src->u.value.ptr,
+			       strnlen(src->u.value.ptr, f->size - 1));
+			break;
+		case ULOGD_RET_IPADDR:
+			/* only the first word is set for IPv4 */
+			memcpy(p + f->offset, &src->u.value,
+			       ipv4 ? sizeof(uint32_t) : f->size);
+			break;
+		default:
+			memcpy(p + f->offset, &src->u.value, f->size);
+			break;
+		}
+		valid |= 1U << i;
+	}
+
+	return valid;
+}
+
+uint32_t ulogd_tuple_hash(const struct ulogd_tuple *t, const void *buf,
+			  uint32_t valid, uint32_t seed)
+{
+	return jhash2((u32 *)buf, t->len / 4, seed ^ valid);
+}
+
+static char *tuple_format_value(const struct ulogd_tuple_field *f,
+				const uint8_t *v, int ipv4, char *dst)
+{
+	int64_t i = 0;
+	uint64_t u = 0;
+
+	switch (f->type) {
+	case ULOGD_RET_STRING:
+		return dst + sprintf(dst, "%s", (const char *)v);
+	case ULOGD_RET_IPADDR:
+		if (ipv4) {
+			uint32_t addr;
+
+			memcpy(&addr, v, sizeof(addr));
+			return ulogd_format_ipv4(dst, addr);
+		}
+		/* fallthrough */
+	case ULOGD_RET_IP6ADDR:
+		return ulogd_format_ipv6(dst, v);
+	case ULOGD_RET_INT8:
+		i = *(const int8_t *)v;
+		break;
+	case ULOGD_RET_INT16: {
+		int16_t x;
+
+		memcpy(&x, v, sizeof(x));
+		i = x;
+		break;
+	}
+	case ULOGD_RET_INT32: {
+		int32_t x;
+
+		memcpy(&x, v, sizeof(x));
+		i = x;
+		break;
+	}
+	case ULOGD_RET_INT64:
+		memcpy(&i, v, sizeof(i));
+		break;
+	case ULOGD_RET_UINT8:
+	case ULOGD_RET_BOOL:
+		u = *v;
+		return dst + sprintf(dst, "%" PRIu64, u);
+	case ULOGD_RET_UINT16: {
+		uint16_t x;
+
+		memcpy(&x, v, sizeof(x));
+		u = x;
+		return dst + sprintf(dst, "%" PRIu64, u);
+	}
+	case ULOGD_RET_UINT32: {
+		uint32_t x;
+
+		memcpy(&x, v, sizeof(x));
+		u = x;
+		return dst + sprintf(dst, "%" PRIu64, u);
+	}
+	case ULOGD_RET_UINT64:
+		memcpy(&u, v, sizeof(u));
+		return dst + sprintf(dst, "%" PRIu64, u);
+	default:
+		*dst = '\0';
+		return dst;
+	}
+
+	return dst + sprintf(dst, "%" PRId64, i);
+}
+
+char *ulogd_tuple_format(const struct ulogd_tuple *t, const void *buf,
+			 uint32_t valid, char *dst, size_t size)
+{
+	const uint8_t *p = buf;
+	char *end = dst;
+	int ipv4;
+	unsigned int i;
+
+	if (size == 0)
+		return dst;
+	*end = '\0';
+
+	/* without oob.family, or for bridged packets, IPADDR keys with 96
+	 * zero bits at the end are taken for IPv4 addresses */
+	ipv4 = -1;
+	if (valid & (1U << t->family)) {
+		switch (p[t->field[t->family].offset]) {
+		case AF_INET:
+			ipv4 = 1;
+			break;
+		case AF_INET6:
+			ipv4 = 0;
+			break;
+		}
+	}
+
+	for (i = 0; i < t->num_keys; i++) {
+		const struct ulogd_tuple_field *f = &t->field[i];
+		char tmp[ULOGD_MAX_KEYLEN + ULOGD_TUPLE_STRLEN + 8], *e;
+		static const uint8_t zero[12];
+		int v4 = ipv4;
+		size_t len;
+
+		if (f->hidden || !(valid & (1U << i)))
+			continue;
+		if (v4 < 0 && f->type == ULOGD_RET_IPADDR)
+			v4 = !memcmp(p + f->offset + 4, zero, sizeof(zero));
+
+		e = tmp;
+		if (end != dst)
+			*e++ = ' ';
+		len = strlen(f->name);
+		memcpy(e, f->name, len);
+		e += len;
+		*e++ = '=';
+		e = tuple_format_value(f, p + f->offset, v4, e);
+
+		len = e - tmp;
+		if (len >= size - (end - dst))
+			len = size - (end - dst) - 1;
+		memcpy(end, tmp, len);
+		end += len;
+		*end = '\0';
+	}
+
+	return end;
+}
@@ -0,0 +1,1122 @@
+/* writer.c
+ *
+ * ulogd helper functions to write log files without blocking the main
+ * loop on disk I/O.
+ *
+ * Output plugins append their records to a set of large in-memory
+ * buffers.  A dedicated thread writes the filled buffers to the file
+ * with a single writev() call, either when a buffer is full, when the
+ * plugin asks for it (sync option) or at the latest after
+ * flush_interval milliseconds.  If the disk can't keep up and all
+ * buffers are waiting to be written, the overflow option decides if we
+ * wait for the thread (block) or if the record is lost (drop).
+ *
+ * Files can also be rotated once they reach rotate_size bytes or every
+ * rotate_interval seconds.  The thread opens the next file in advance
+ * (<file>.next), so the main loop only has to swap file descriptors.
+ * Once the old file has been written out, the thread renames <file>.N
+ * to <file>.N+1, <file> to <file>.1 and <file>.next to <file>.  With
+ * rotate_compress, <file>.1 is then gzipped by a helper thread.
+ *
+ * With the compress option, the flush thread compresses the data itself
+ * as a gzip or zstd stream. Each batch of buffers ends on a block
+ * boundary, so a file cut by a crash can still be read by zcat/zstdcat.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include <ulogd/ulogd.h>
+#include <ulogd/writer.h>
+#include <ulogd/clock.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define WRITER_BUFFER_SIZE_MIN	4096
+
+/* state of <file>.next, failures are only logged once */
+enum {
+	WRITER_NEXT_OK,
+	WRITER_NEXT_FAILED,	/* wait for the flush timer to retry */
+	WRITER_NEXT_RETRY,
+};
+
+/* hand the active buffer over to the flush thread, called with the mutex
+ * held. Returns -1 if there is no free buffer to continue with. */
+static int writer_seal(struct ulogd_writer *w)
+{
+	struct writer_buf *buf = &w->bufs[w->active];
+	unsigned int next = (w->active + 1) % WRITER_BUFFERS;
+
+	if (buf->len == 0)
+		return 0;
+
+	if (w->bufs[next].filled)
+		return -1;
+
+	buf->fd = w->fd;
+	buf->filled = 1;
+	w->active = next;
+	w->bufs[next].len = 0;
+	pthread_cond_signal(&w->cond);
+
+	return 0;
+}
+
+/* switch to a fresh buffer, waiting for the flush thread if needed */
+static int writer_get_space(struct ulogd_writer *w, int policy)
+{
+	while (writer_seal(w) < 0) {
+		if (policy == WRITER_OVERFLOW_DROP) {
+			w->dropped++;
+			if (w->stats)
+				w->stats->drops++;
+			return -1;
+		}
+		pthread_cond_wait(&w->space, &w->mutex);
+	}
+	return 0;
+}
+
+/* queue a file header or footer, these are never dropped */
+static void writer_put(struct ulogd_writer *w, const char *data,
+		       unsigned int len)
+{
+	struct writer_buf *buf = &w->bufs[w->active];
+
+	if (len == 0)
+		return;
+
+	if (buf->len + len > w->size) {
+		writer_get_space(w, WRITER_OVERFLOW_BLOCK);
+		buf = &w->bufs[w->active];
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	w->written += len;
+}
+
+static int writer_fd_pending(struct ulogd_writer *w, int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < WRITER_BUFFERS; i++) {
+		if (w->bufs[i].filled && w->bufs[i].fd == fd)
+			return 1;
+	}
+	return 0;
+}
+
+static int writer_rotates(struct ulogd_writer *w)
+{
+	return w->path && (w->rotate_size || w->rotate_interval);
+}
+
+static time_t writer_next_rotation(struct ulogd_writer *w, time_t now)
+{
+	return (now / w->rotate_interval + 1) * w->rotate_interval;
+}
+
+/* with overflow=drop, a rotation would wait for the disk if the footer
+ * and the last buffer of the old file can't be handed over right away */
+static int writer_rotate_would_block(struct ulogd_writer *w)
+{
+	unsigned int next = (w->active + 1) % WRITER_BUFFERS;
+
+	if (w->overflow != WRITER_OVERFLOW_DROP)
+		return 0;
+	if (w->bufs[next].filled)
+		return 1;
+	/* the footer doesn't fit, it is sealed into a buffer of its own */
+	return w->bufs[w->active].len + w->footer_len > w->size &&
+	       w->bufs[(next + 1) % WRITER_BUFFERS].filled;
+}
+
+/* swap to the pre-opened file, called from the main loop with the mutex
+ * held. The flush thread renames the files once the old one is written. */
+static int writer_rotate(struct ulogd_writer *w)
+{
+	char *path;
+
+	/* the next file isn't ready yet, a previous change of file is
+	 * still in progress or the disk is behind, try again with the next
+	 * record */
+	if (w->next_fd < 0 || w->retired_fd >= 0 || w->rotated_path ||
+	    writer_rotate_would_block(w))
+		return -1;
+
+	path = strdup(w->path);
+	if (!path)
+		return -1;
+
+	writer_put(w, w->footer, w->footer_len);
+	writer_get_space(w, WRITER_OVERFLOW_BLOCK);
+
+	w->retired_fd = w->fd;
+	w->fd = w->next_fd;
+	w->next_fd = -1;
+	w->rotated_path = path;
+	w->rotated_next = w->next_path;
+	w->next_path = NULL;
+	w->written = 0;
+	w->generation++;
+	writer_put(w, w->header, w->header_len);
+	pthread_cond_signal(&w->cond);
+
+	return 0;
+}
+
+static void writer_check_rotation(struct ulogd_writer *w)
+{
+	time_t now;
+
+	if (w->rotation_checked) {
+		w->rotation_checked = 0;
+		return;
+	}
+
+	if (!writer_rotates(w))
+		return;
+
+	if (w->rotate_size && w->written >= w->rotate_size) {
+		writer_rotate(w);
+		return;
+	}
+
+	if (!w->rotate_interval)
+		return;
+
+	now = ulogd_clock_sec();
+	if (now < w->rotate_at)
+		return;
+	/* don't create empty files */
+	if (w->written > w->header_len && writer_rotate(w) < 0)
+		return;
+	w->rotate_at = writer_next_rotation(w, now);
+}
+
+#ifdef HAVE_ZLIB
+struct writer_gzip {
+	struct ulogd_writer *w;
+	char path[];
+};
+
+static void *writer_compress(void *data)
+{
+	struct writer_gzip *job = data;
+	char gzpath[PATH_MAX], buf[65536];
+	gzFile out;
+	ssize_t len;
+	int fd, err = 0;
+
+	if (snprintf(gzpath, sizeof(gzpath), "%s.gz", job->path)
+	    >= (int)sizeof(gzpath))
+		goto out;
+
+	fd = open(job->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+
+	out = gzopen(gzpath, "wb");
+	if (!out) {
+		ulogd_log(ULOGD_ERROR, "%s: can't create %s\n", job->w->name,
+			  gzpath);
+		close(fd);
+		goto out;
+	}
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		if (gzwrite(out, buf, len) != len) {
+			err = 1;
+			break;
+		}
+	}
+	if (len < 0)
+		err = 1;
+	if (gzclose(out) != Z_OK)
+		err = 1;
+	close(fd);
+
+	if (err) {
+		ulogd_log(ULOGD_ERROR, "%s: can't compress %s\n",
+			  job->w->name, job->path);
+		unlink(gzpath);
+	} else {
+		unlink(job->path);
+	}
+out:
+	free(job);
+	return NULL;
+}
+
+static void writer_start_compress(struct ulogd_writer *w, const char *path)
+{
+	struct writer_gzip *job;
+
+	job = malloc(sizeof(*job) + strlen(path) + 1);
+	if (!job)
+		return;
+	job->w = w;
+	strcpy(job->path, path);
+
+	/* runs with the signal mask of the flush thread */
+	if (pthread_create(&w->compressor, NULL, writer_compress, job) != 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't create compression thread\n",
+			  w->name);
+		free(job);
+		return;
+	}
+	w->compressing = 1;
+}
+#endif
+
+static void writer_join_compress(struct ulogd_writer *w)
+{
+	if (w->compressing) {
+		pthread_join(w->compressor, NULL);
+		w->compressing = 0;
+	}
+}
+
+static void writer_rename(struct ulogd_writer *w, const char *path,
+			  unsigned int from, unsigned int to,
+			  const char *suffix)
+{
+	char src[PATH_MAX], dst[PATH_MAX];
+
+	snprintf(src, sizeof(src), "%s.%u%s", path, from, suffix);
+	snprintf(dst, sizeof(dst), "%s.%u%s", path, to, suffix);
+	if (rename(src, dst) < 0 && errno != ENOENT)
+		ulogd_log(ULOGD_ERROR, "%s: can't rename %s: %s\n", w->name,
+			  src, strerror(errno));
+}
+
+/* called by the flush thread without the mutex, once the rotated file
+ * has been closed */
+static void writer_shift(struct ulogd_writer *w, const char *path,
+			 const char *next)
+{
+	char old[PATH_MAX];
+	unsigned int i;
+
+	/* <file>.1 has to be compressed before it becomes <file>.2 */
+	writer_join_compress(w);
+
+	for (i = w->rotate_count; i > 1; i--) {
+		writer_rename(w, path, i - 1, i, "");
+		writer_rename(w, path, i - 1, i, ".gz");
+	}
+
+	snprintf(old, sizeof(old), "%s.1", path);
+	if (rename(path, old) < 0)
+		ulogd_log(ULOGD_ERROR, "%s: can't rename %s: %s\n", w->name,
+			  path, strerror(errno));
+	if (rename(next, path) < 0)
+		ulogd_log(ULOGD_ERROR, "%s: can't rename %s: %s\n", w->name,
+			  next, strerror(errno));
+
+#ifdef HAVE_ZLIB
+	if (w->rotate_compress)
+		writer_start_compress(w, old);
+#endif
+}
+
+/* open <file>.next, called by the flush thread with the mutex held */
+static void writer_prepare_next(struct ulogd_writer *w)
+{
+	char *path, *next;
+	int fd = -1;
+
+	path = strdup(w->path);
+	next = malloc(strlen(w->path) + sizeof(".next"));
+	if (!path || !next) {
+		free(path);
+		free(next);
+		w->next_failed = WRITER_NEXT_FAILED;
+		return;
+	}
+	sprintf(next, "%s.next", path);
+
+	w->busy = 1;
+	pthread_mutex_unlock(&w->mutex);
+	fd = open(next, w->flags | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 && w->next_failed == WRITER_NEXT_OK)
+		ulogd_log(ULOGD_ERROR, "%s: can't open %s: %s\n", w->name,
+			  next, strerror(errno));
+	pthread_mutex_lock(&w->mutex);
+	w->busy = 0;
+	pthread_cond_broadcast(&w->space);
+
+	if (fd < 0) {
+		w->next_failed = WRITER_NEXT_FAILED;
+		free(next);
+	} else if (!w->path || strcmp(path, w->path)) {
+		/* switched to another file meanwhile */
+		close(fd);
+		unlink(next);
+		free(next);
+	} else {
+		w->next_failed = WRITER_NEXT_OK;
+		w->next_fd = fd;
+		w->next_path = next;
+	}
+	free(path);
+}
+
+static void writer_stream_end(struct ulogd_writer *w, int fd);
+
+/* close a file the main loop is done with, and rename the files after a
+ * rotation. Called by the flush thread with the mutex held. */
+static void writer_retire(struct ulogd_writer *w)
+{
+	char *path = w->rotated_path, *next = w->rotated_next;
+	int fd = w->retired_fd;
+
+	w->busy = 1;
+	pthread_mutex_unlock(&w->mutex);
+	writer_stream_end(w, fd);
+	close(fd);
+	if (path)
+		writer_shift(w, path, next);
+	pthread_mutex_lock(&w->mutex);
+
+	free(path);
+	free(next);
+	w->rotated_path = NULL;
+	w->rotated_next = NULL;
+	w->retired_fd = -1;
+	w->busy = 0;
+	pthread_cond_broadcast(&w->space);
+}
+
+static void writer_writev(struct ulogd_writer *w, int fd,
+			  struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t ret = writev(fd, iov, iovcnt);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ulogd_log(ULOGD_ERROR, "%s: error during write: %s\n",
+				  w->name, strerror(errno));
+			return;
+		}
+
+		/* skip what has been written, handles short writes */
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+/***********************************************************************
+ * streaming compression, only used by the flush thread
+ ***********************************************************************/
+
+#define WRITER_ZBUF_SIZE	(128 * 1024)
+
+enum {
+	WRITER_STREAM_CONTINUE,
+	WRITER_STREAM_FLUSH,	/* up to a block boundary */
+	WRITER_STREAM_END,	/* end of file, the stream is reset */
+};
+
+static int writer_stream_init(struct ulogd_writer *w)
+{
+	switch (w->compress) {
+#ifdef HAVE_ZLIB
+	case WRITER_COMPRESS_GZIP: {
+		z_stream *strm = calloc(1, sizeof(*strm));
+
+		if (!strm)
+			return -1;
+		/* 16 + MAX_WBITS selects the gzip format */
+		if (deflateInit2(strm, w->compress_level ? w->compress_level :
+				 Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				 16 + MAX_WBITS, 8,
+				 Z_DEFAULT_STRATEGY) != Z_OK) {
+			free(strm);
+			return -1;
+		}
+		w->stream = strm;
+		break;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case WRITER_COMPRESS_ZSTD: {
+		ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+		if (!cctx)
+			return -1;
+		if (w->compress_level)
+			ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+					       w->compress_level);
+		w->stream = cctx;
+		break;
+	}
+#endif
+	default:
+		return 0;
+	}
+
+	w->zbuf = malloc(WRITER_ZBUF_SIZE);
+	if (!w->zbuf)
+		return -1;
+	return 0;
+}
+
+static void writer_stream_free(struct ulogd_writer *w)
+{
+	if (!w->stream)
+		return;
+
+	switch (w->compress) {
+#ifdef HAVE_ZLIB
+	case WRITER_COMPRESS_GZIP:
+		deflateEnd(w->stream);
+		free(w->stream);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case WRITER_COMPRESS_ZSTD:
+		ZSTD_freeCCtx(w->stream);
+		break;
+#endif
+	}
+	w->stream = NULL;
+	free(w->zbuf);
+	w->zbuf = NULL;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+static void writer_zbuf_out(struct ulogd_writer *w, int fd, size_t len)
+{
+	struct iovec out = {
+		.iov_base = w->zbuf,
+		.iov_len = len,
+	};
+
+	if (len)
+		writer_writev(w, fd, &out, 1);
+}
+#endif
+
+static void writer_stream(struct ulogd_writer *w, int fd, void *data,
+			  size_t len, int mode)
+{
+	switch (w->compress) {
+#ifdef HAVE_ZLIB
+	case WRITER_COMPRESS_GZIP: {
+		z_stream *strm = w->stream;
+		int flush = mode == WRITER_STREAM_END ? Z_FINISH :
+			    mode == WRITER_STREAM_FLUSH ? Z_SYNC_FLUSH :
+			    Z_NO_FLUSH;
+
+		strm->next_in = data;
+		strm->avail_in = len;
+		do {
+			strm->next_out = (Bytef *)w->zbuf;
+			strm->avail_out = WRITER_ZBUF_SIZE;
+			if (deflate(strm, flush) == Z_STREAM_ERROR) {
+				ulogd_log(ULOGD_ERROR, "%s: gzip error\n",
+					  w->name);
+				return;
+			}
+			writer_zbuf_out(w, fd, WRITER_ZBUF_SIZE -
+					       strm->avail_out);
+		} while (strm->avail_out == 0);
+
+		if (mode == WRITER_STREAM_END)
+			deflateReset(strm);
+		break;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case WRITER_COMPRESS_ZSTD: {
+		ZSTD_EndDirective op = mode == WRITER_STREAM_END ? ZSTD_e_end :
+				       mode == WRITER_STREAM_FLUSH ?
+				       ZSTD_e_flush : ZSTD_e_continue;
+		ZSTD_inBuffer in = { data, len, 0 };
+		size_t remaining;
+
+		do {
+			ZSTD_outBuffer out = { w->zbuf, WRITER_ZBUF_SIZE, 0 };
+
+			remaining = ZSTD_compressStream2(w->stream, &out,
+							 &in, op);
+			if (ZSTD_isError(remaining)) {
+				ulogd_log(ULOGD_ERROR, "%s: zstd error: %s\n",
+					  w->name,
+					  ZSTD_getErrorName(remaining));
+				return;
+			}
+			writer_zbuf_out(w, fd, out.pos);
+		} while (op == ZSTD_e_continue ? in.pos < in.size :
+						 remaining != 0);
+		break;
+	}
+#endif
+	}
+}
+
+/* terminate the stream before the file is closed */
+static void writer_stream_end(struct ulogd_writer *w, int fd)
+{
+	if (w->stream && w->stream_fd == fd) {
+		writer_stream(w, fd, NULL, 0, WRITER_STREAM_END);
+		w->stream_fd = -1;
+	}
+}
+
+static void writer_output(struct ulogd_writer *w, int fd,
+			  struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	if (!w->stream) {
+		writer_writev(w, fd, iov, iovcnt);
+		return;
+	}
+
+	w->stream_fd = fd;
+	for (i = 0; i < iovcnt; i++)
+		writer_stream(w, fd, iov[i].iov_base, iov[i].iov_len,
+			      i == iovcnt - 1 ? WRITER_STREAM_FLUSH :
+						WRITER_STREAM_CONTINUE);
+}
+
+static void writer_deadline(struct ulogd_writer *w, struct timespec *ts)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	ts->tv_sec = tv.tv_sec + w->flush_interval / 1000;
+	ts->tv_nsec = tv.tv_usec * 1000 +
+		      (w->flush_interval % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void *writer_thread(void *data)
+{
+	struct ulogd_writer *w = data;
+	struct iovec iov[WRITER_BUFFERS];
+	struct timespec deadline;
+
+	pthread_mutex_lock(&w->mutex);
+	if (w->flush_interval)
+		writer_deadline(w, &deadline);
+
+	while (1) {
+		unsigned int i, n = 0;
+		uint64_t dropped;
+		int fd;
+
+		if (w->retired_fd >= 0 && !writer_fd_pending(w, w->retired_fd)) {
+			writer_retire(w);
+			continue;
+		}
+
+		if (writer_rotates(w) && w->next_fd < 0 && !w->rotated_path &&
+		    w->next_failed != WRITER_NEXT_FAILED && !w->stop) {
+			writer_prepare_next(w);
+			continue;
+		}
+
+		if (!w->bufs[w->next_flush].filled) {
+			int ret = 0;
+
+			if (w->flush_requested || w->stop) {
+				w->flush_requested = 0;
+				if (w->bufs[w->active].len) {
+					writer_seal(w);
+					continue;
+				}
+				if (w->stop)
+					break;
+			}
+
+			if (w->flush_interval)
+				ret = pthread_cond_timedwait(&w->cond,
+							     &w->mutex,
+							     &deadline);
+			else
+				pthread_cond_wait(&w->cond, &w->mutex);
+
+			if (ret == ETIMEDOUT) {
+				writer_deadline(w, &deadline);
+				writer_seal(w);
+				/* retry to open <file>.next, quietly */
+				if (w->next_failed == WRITER_NEXT_FAILED)
+					w->next_failed = WRITER_NEXT_RETRY;
+			}
+			continue;
+		}
+
+		/* write all consecutive filled buffers of the same file */
+		fd = w->bufs[w->next_flush].fd;
+		for (i = w->next_flush; n < WRITER_BUFFERS; i = (i + 1) % WRITER_BUFFERS) {
+			if (!w->bufs[i].filled || w->bufs[i].fd != fd)
+				break;
+			iov[n].iov_base = w->bufs[i].data;
+			iov[n].iov_len = w->bufs[i].len;
+			n++;
+		}
+		dropped = w->dropped;
+		w->dropped = 0;
+		pthread_mutex_unlock(&w->mutex);
+
+		if (dropped)
+			ulogd_log(ULOGD_NOTICE, "%s: %" PRIu64 " records "
+				  "dropped, disk too slow\n", w->name, dropped);
+		writer_output(w, fd, iov, n);
+
+		pthread_mutex_lock(&w->mutex);
+		for (i = 0; i < n; i++) {
+			w->bufs[w->next_flush].filled = 0;
+			w->next_flush = (w->next_flush + 1) % WRITER_BUFFERS;
+		}
+		pthread_cond_broadcast(&w->space);
+	}
+	writer_stream_end(w, w->fd);
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+/* bytes not written out yet, called with the mutex held */
+static void writer_account(struct ulogd_writer *w)
+{
+	uint64_t backlog = 0;
+	unsigned int i;
+
+	if (!w->stats)
+		return;
+
+	for (i = 0; i < WRITER_BUFFERS; i++) {
+		if (w->bufs[i].filled || i == w->active)
+			backlog += w->bufs[i].len;
+	}
+	w->stats->backlog = backlog;
+}
+
+int ulogd_writer_writev(struct ulogd_writer *w, const struct iovec *iov,
+			int iovcnt)
+{
+	struct writer_buf *buf;
+	unsigned int len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len > w->size) {
+		ulogd_log(ULOGD_ERROR, "%s: record of %u bytes is larger than "
+			  "buffer_size\n", w->name, len);
+		return -1;
+	}
+
+	pthread_mutex_lock(&w->mutex);
+	writer_check_rotation(w);
+	if (w->bufs[w->active].len + len > w->size &&
+	    writer_get_space(w, w->overflow) < 0) {
+		pthread_mutex_unlock(&w->mutex);
+		return -1;
+	}
+	buf = &w->bufs[w->active];
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(buf->data + buf->len, iov[i].iov_base, iov[i].iov_len);
+		buf->len += iov[i].iov_len;
+	}
+	w->written += len;
+	writer_account(w);
+	pthread_mutex_unlock(&w->mutex);
+
+	return 0;
+}
+
+int ulogd_writer_write(struct ulogd_writer *w, const void *data,
+		       unsigned int len)
+{
+	struct iovec iov = {
+		.iov_base = (void *)data,
+		.iov_len = len,
+	};
+
+	return ulogd_writer_writev(w, &iov, 1);
+}
+
+int ulogd_writer_printf(struct ulogd_writer *w, const char *fmt, ...)
+{
+	struct writer_buf *buf;
+	unsigned int room;
+	va_list ap;
+	int ret;
+
+	pthread_mutex_lock(&w->mutex);
+	writer_check_rotation(w);
+	while (1) {
+		buf = &w->bufs[w->active];
+		room = w->size - buf->len;
+
+		va_start(ap, fmt);
+		ret = vsnprintf(buf->data + buf->len, room, fmt, ap);
+		va_end(ap);
+		if (ret < 0)
+			break;
+
+		if ((unsigned int)ret < room) {
+			buf->len += ret;
+			w->written += ret;
+			break;
+		}
+
+		if ((unsigned int)ret >= w->size) {
+			ulogd_log(ULOGD_ERROR, "%s: record of %d bytes is "
+				  "larger than buffer_size\n", w->name, ret);
+			ret = -1;
+			break;
+		}
+
+		if (writer_get_space(w, w->overflow) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	writer_account(w);
+	pthread_mutex_unlock(&w->mutex);
+
+	return ret;
+}
+
+unsigned int ulogd_writer_begin(struct ulogd_writer *w)
+{
+	unsigned int generation;
+
+	pthread_mutex_lock(&w->mutex);
+	writer_check_rotation(w);
+	w->rotation_checked = 1;
+	generation = w->generation;
+	pthread_mutex_unlock(&w->mutex);
+
+	return generation;
+}
+
+void ulogd_writer_flush(struct ulogd_writer *w)
+{
+	pthread_mutex_lock(&w->mutex);
+	w->flush_requested = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static int writer_open_file(struct ulogd_writer *w, const char *path,
+			    uint64_t *size)
+{
+	struct stat st;
+	int fd;
+
+	if (!path) {
+		*size = 0;
+		return STDOUT_FILENO;
+	}
+
+	fd = open(path, w->flags | O_WRONLY | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't open %s: %s\n", w->name,
+			  path, strerror(errno));
+		return -1;
+	}
+
+	*size = fstat(fd, &st) == 0 ? st.st_size : 0;
+	return fd;
+}
+
+int ulogd_writer_switch(struct ulogd_writer *w, const char *path)
+{
+	char *new_path = NULL;
+	uint64_t size;
+	int fd;
+
+	if (!w->path)
+		return 0;
+
+	if (path != w->path) {
+		new_path = strdup(path);
+		if (!new_path)
+			return -1;
+	}
+
+	/* wait until the flush thread is done with the previous change of
+	 * file, it could still be renaming the one we are about to open */
+	pthread_mutex_lock(&w->mutex);
+	while (w->retired_fd >= 0 || w->rotated_path || w->busy)
+		pthread_cond_wait(&w->space, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
+
+	fd = writer_open_file(w, path, &size);
+	if (fd < 0) {
+		free(new_path);
+		return -1;
+	}
+
+	pthread_mutex_lock(&w->mutex);
+	/* what we have got so far belongs to the old file */
+	writer_put(w, w->footer, w->footer_len);
+	writer_get_space(w, WRITER_OVERFLOW_BLOCK);
+	w->retired_fd = w->fd;
+	w->fd = fd;
+	w->written = size;
+	w->generation++;
+	if (size == 0)
+		writer_put(w, w->header, w->header_len);
+
+	if (new_path) {
+		free(w->path);
+		w->path = new_path;
+		/* <file>.next was prepared for the old name */
+		if (w->next_fd >= 0) {
+			close(w->next_fd);
+			unlink(w->next_path);
+			free(w->next_path);
+			w->next_fd = -1;
+			w->next_path = NULL;
+		}
+	}
+	w->next_failed = WRITER_NEXT_OK;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	return 0;
+}
+
+int ulogd_writer_reopen(struct ulogd_writer *w)
+{
+	return ulogd_writer_switch(w, w->path);
+}
+
+int ulogd_writer_set_frame(struct ulogd_writer *w,
+			   const void *header, unsigned int header_len,
+			   const void *footer, unsigned int footer_len)
+{
+	if (header_len + footer_len > w->size)
+		return -1;
+
+	w->header = malloc(header_len + 1);
+	w->footer = malloc(footer_len + 1);
+	if (!w->header || !w->footer) {
+		free(w->header);
+		free(w->footer);
+		w->header = w->footer = NULL;
+		return -1;
+	}
+	if (header_len)
+		memcpy(w->header, header, header_len);
+	if (footer_len)
+		memcpy(w->footer, footer, footer_len);
+
+	pthread_mutex_lock(&w->mutex);
+	w->header_len = header_len;
+	w->footer_len = footer_len;
+	if (w->written == 0)
+		writer_put(w, w->header, w->header_len);
+	pthread_mutex_unlock(&w->mutex);
+
+	return 0;
+}
+
+int ulogd_writer_open(struct ulogd_writer *w, const char *name,
+		      const char *path, int flags, struct config_entry *ces)
+{
+	sigset_t all, old;
+	unsigned int i;
+
+	memset(w, 0, sizeof(*w));
+	w->name = name;
+	w->flags = flags;
+	w->retired_fd = -1;
+	w->next_fd = -1;
+
+	w->size = writer_bufsize_ce(ces).u.value;
+	if (w->size < WRITER_BUFFER_SIZE_MIN)
+		w->size = WRITER_BUFFER_SIZE_MIN;
+	w->flush_interval = writer_interval_ce(ces).u.value;
+
+	if (!strcmp(writer_overflow_ce(ces).u.string, "block"))
+		w->overflow = WRITER_OVERFLOW_BLOCK;
+	else if (!strcmp(writer_overflow_ce(ces).u.string, "drop"))
+		w->overflow = WRITER_OVERFLOW_DROP;
+	else {
+		ulogd_log(ULOGD_ERROR, "%s: unknown overflow policy `%s'\n",
+			  name, writer_overflow_ce(ces).u.string);
+		return -1;
+	}
+
+	w->rotate_size = writer_rsize_ce(ces).u.value;
+	w->rotate_interval = writer_rinterval_ce(ces).u.value;
+	w->rotate_count = writer_rcount_ce(ces).u.value;
+	if (w->rotate_count < 1)
+		w->rotate_count = 1;
+	w->rotate_compress = writer_rcompress_ce(ces).u.value;
+#ifndef HAVE_ZLIB
+	if (w->rotate_compress) {
+		ulogd_log(ULOGD_ERROR, "%s: rotate_compress needs ulogd to be "
+			  "built with zlib\n", name);
+		return -1;
+	}
+#endif
+
+	if (!strcmp(writer_compress_ce(ces).u.string, "none"))
+		w->compress = WRITER_COMPRESS_NONE;
+#ifdef HAVE_ZLIB
+	else if (!strcmp(writer_compress_ce(ces).u.string, "gzip"))
+		w->compress = WRITER_COMPRESS_GZIP;
+#endif
+#ifdef HAVE_ZSTD
+	else if (!strcmp(writer_compress_ce(ces).u.string, "zstd"))
+		w->compress = WRITER_COMPRESS_ZSTD;
+#endif
+	else {
+		ulogd_log(ULOGD_ERROR, "%s: compression `%s' is unknown or not "
+			  "built in\n", name, writer_compress_ce(ces).u.string);
+		return -1;
+	}
+	w->compress_level = writer_clevel_ce(ces).u.value;
+	w->stream_fd = -1;
+	if (w->compress != WRITER_COMPRESS_NONE && w->rotate_compress) {
+		ulogd_log(ULOGD_NOTICE, "%s: files are already compressed, "
+			  "ignoring rotate_compress\n", name);
+		w->rotate_compress = 0;
+	}
+
+	if (w->rotate_interval)
+		w->rotate_at = writer_next_rotation(w, time(NULL));
+
+	if (path) {
+		w->path = strdup(path);
+		if (!w->path)
+			return -1;
+	}
+
+	w->fd = writer_open_file(w, w->path, &w->written);
+	if (w->fd < 0)
+		goto err_path;
+
+	for (i = 0; i < WRITER_BUFFERS; i++) {
+		w->bufs[i].data = malloc(w->size);
+		if (!w->bufs[i].data)
+			goto err_bufs;
+	}
+	if (writer_stream_init(w) < 0) {
+		ulogd_log(ULOGD_ERROR, "%s: can't set up compression\n", name);
+		goto err_bufs;
+	}
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	pthread_cond_init(&w->space, NULL);
+
+	/* signals have to be handled by the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		ulogd_log(ULOGD_ERROR, "%s: can't create writer thread\n",
+			  name);
+		goto err_thread;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return 0;
+
+err_thread:
+	pthread_cond_destroy(&w->space);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+err_bufs:
+	writer_stream_free(w);
+	for (i = 0; i < WRITER_BUFFERS; i++)
+		free(w->bufs[i].data);
+	if (w->path)
+		close(w->fd);
+err_path:
+	free(w->path);
+	w->path = NULL;
+	return -1;
+}
+
+void ulogd_writer_close(struct ulogd_writer *w)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&w->mutex);
+	writer_put(w, w->footer, w->footer_len);
+	w->stop = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	/* the thread exits once everything has been written */
+	pthread_join(w->thread, NULL);
+	writer_join_compress(w);
+
+	if (w->retired_fd >= 0)
+		close(w->retired_fd);
+	if (w->path)
+		close(w->fd);
+	if (w->next_fd >= 0) {
+		close(w->next_fd);
+		unlink(w->next_path);
+	}
+
+	pthread_cond_destroy(&w->space);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+	writer_stream_free(w);
+	for (i = 0; i < WRITER_BUFFERS; i++)
+		free(w->bufs[i].data);
+	free(w->next_path);
+	free(w->header);
+	free(w->footer);
+	free(w->path);
+	w->path = NULL;
+}